@@ -38,10 +38,20 @@
 #define XDL_UNUSED
 #endif
 
-#define xdl_malloc(x) malloc(x)
-#define xdl_calloc(n, sz) calloc(n, sz)
-#define xdl_free(ptr) free(ptr)
-#define xdl_realloc(ptr, x) realloc(ptr, x)
+/*
+ * Allocations go to the allocator of the xdl_diff() or xdl_merge() call
+ * in progress on the calling thread, if it was given one, and to the C
+ * library otherwise. Callbacks always run with the C library.
+ */
+void *xdl_alloc_malloc(size_t size);
+void *xdl_alloc_calloc(size_t nmemb, size_t size);
+void *xdl_alloc_realloc(void *ptr, size_t size);
+void xdl_alloc_free(void *ptr);
+
+#define xdl_malloc(x) xdl_alloc_malloc(x)
+#define xdl_calloc(n, sz) xdl_alloc_calloc(n, sz)
+#define xdl_free(ptr) xdl_alloc_free(ptr)
+#define xdl_realloc(ptr, x) xdl_alloc_realloc(ptr, x)
 
 #define XDL_BUG(msg)                         \
     do {                                     \
@@ -0,0 +1,1006 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "xdiff.h"
+
+namespace {
+
+// Allocator that counts what goes through it
+struct CountingAlloc {
+    xdlalloc_t alloc;
+    long live = 0;
+    long calls = 0;
+};
+
+void *countingMalloc(void *priv, size_t size)
+{
+    CountingAlloc *ca = static_cast<CountingAlloc *>(priv);
+    ca->live++;
+    ca->calls++;
+    return malloc(size);
+}
+
+void *countingRealloc(void *priv, void *ptr, size_t size)
+{
+    CountingAlloc *ca = static_cast<CountingAlloc *>(priv);
+    if (!ptr)
+        ca->live++;
+    ca->calls++;
+    return realloc(ptr, size);
+}
+
+void countingFree(void *priv, void *ptr)
+{
+    CountingAlloc *ca = static_cast<CountingAlloc *>(priv);
+    ca->live--;
+    free(ptr);
+}
+
+// Collects the diff lines; allocates with xdl_malloc() as callers may
+struct Output {
+    std::string text;
+};
+
+int outLine(void *priv, mmbuffer_t *mb, int nbuf)
+{
+    Output *out = static_cast<Output *>(priv);
+    char *copy;
+
+    for (int i = 0; i < nbuf; i++) {
+        copy = static_cast<char *>(xdl_malloc(mb[i].size));
+        if (!copy)
+            return -1;
+        memcpy(copy, mb[i].ptr, mb[i].size);
+        out->text.append(copy, mb[i].size);
+        xdl_free(copy);
+    }
+    return 0;
+}
+
+mmfile_t makeFile(std::string &content)
+{
+    mmfile_t mf;
+    mf.ptr = &content[0];
+    mf.size = (long)content.size();
+    return mf;
+}
+
+std::string runDiff(std::string a, std::string b, unsigned long flags, const xdlalloc_t *alloc)
+{
+    mmfile_t mf1 = makeFile(a), mf2 = makeFile(b);
+    xpparam_t xpp;
+    xdemitconf_t xecfg;
+    xdemitcb_t ecb;
+    Output out;
+
+    memset(&xpp, 0, sizeof(xpp));
+    xpp.flags = flags;
+    xpp.alloc = alloc;
+    memset(&xecfg, 0, sizeof(xecfg));
+    xecfg.ctxlen = 3;
+    memset(&ecb, 0, sizeof(ecb));
+    ecb.priv = &out;
+    ecb.out_line = outLine;
+    EXPECT_EQ(0, xdl_diff(&mf1, &mf2, &xpp, &xecfg, &ecb));
+    return out.text;
+}
+
+int runDiffWith(std::string a, std::string b, xpparam_t const &xpp, std::string &text)
+{
+    mmfile_t mf1 = makeFile(a), mf2 = makeFile(b);
+    xdemitconf_t xecfg;
+    xdemitcb_t ecb;
+    Output out;
+
+    memset(&xecfg, 0, sizeof(xecfg));
+    xecfg.ctxlen = 3;
+    memset(&ecb, 0, sizeof(ecb));
+    ecb.priv = &out;
+    ecb.out_line = outLine;
+    int ret = xdl_diff(&mf1, &mf2, &xpp, &xecfg, &ecb);
+    text = out.text;
+    return ret;
+}
+
+long countLines(const std::string &text, char first)
+{
+    long n = 0;
+    for (size_t i = 0; i < text.size(); i = text.find('\n', i) + 1) {
+        if (text[i] == first)
+            n++;
+        if (text.find('\n', i) == std::string::npos)
+            break;
+    }
+    return n;
+}
+
+std::string numberedLines(int n, int changed)
+{
+    std::string s;
+    for (int i = 0; i < n; i++)
+        s += (i % changed ? "line " : "changed ") + std::to_string(i) + "\n";
+    return s;
+}
+
+} // namespace
+
+// Test that a diff allocates only through its allocator, and that callbacks do not
+TEST(XDiffApiTest, DiffUsesGivenAllocator)
+{
+    std::string a = numberedLines(500, 7), b = numberedLines(500, 11);
+    CountingAlloc ca;
+    ca.alloc.malloc = countingMalloc;
+    ca.alloc.realloc = countingRealloc;
+    ca.alloc.free = countingFree;
+    ca.alloc.priv = &ca;
+
+    for (unsigned long flags : { 0UL, (unsigned long)XDF_PATIENCE_DIFF,
+                                 (unsigned long)XDF_HISTOGRAM_DIFF }) {
+        std::string expected = runDiff(a, b, flags, nullptr);
+
+        ca.calls = 0;
+        EXPECT_EQ(expected, runDiff(a, b, flags, &ca.alloc)) << flags;
+        EXPECT_GT(ca.calls, 0) << flags;
+        EXPECT_EQ(0, ca.live) << "Every block must be freed through the allocator";
+    }
+}
+
+// Test that an arena reused across diffs gives the same output
+TEST(XDiffApiTest, ArenaReset)
+{
+    xdlarena_t arena;
+    xdl_arena_init(&arena, 4096);
+
+    for (int round = 0; round < 20; round++) {
+        std::string a = numberedLines(50 + round * 40, 5), b = numberedLines(60 + round * 30, 3);
+        std::string expected = runDiff(a, b, XDF_HISTOGRAM_DIFF, nullptr);
+
+        EXPECT_EQ(expected, runDiff(a, b, XDF_HISTOGRAM_DIFF, &arena.alloc)) << round;
+        xdl_arena_reset(&arena);
+        EXPECT_EQ(nullptr, arena.chunks);
+    }
+    xdl_arena_free(&arena);
+    EXPECT_EQ(nullptr, arena.spare);
+}
+
+// Test that the result of a merge under an arena outlives the arena
+TEST(XDiffApiTest, MergeResultWithArena)
+{
+    std::string base = "a\nb\nc\nd\ne\n", ours = "a\nB\nc\nd\ne\n", theirs = "a\nb\nc\nD\ne\n";
+    mmfile_t orig = makeFile(base), mf1 = makeFile(ours), mf2 = makeFile(theirs);
+    xdlarena_t arena;
+    xmparam_t xmp;
+    mmbuffer_t result;
+
+    xdl_arena_init(&arena, 0);
+    memset(&xmp, 0, sizeof(xmp));
+    xmp.xpp.alloc = &arena.alloc;
+    xmp.level = XDL_MERGE_ZEALOUS;
+    xmp.marker_size = DEFAULT_CONFLICT_MARKER_SIZE;
+
+    ASSERT_EQ(0, xdl_merge(&orig, &mf1, &mf2, &xmp, &result));
+    xdl_arena_free(&arena);
+    EXPECT_EQ("a\nB\nc\nD\ne\n", std::string(result.ptr, result.size));
+    xdl_free(result.ptr);
+}
+
+// Test that the memory report accounts every phase and the peak
+TEST(XDiffApiTest, MemStats)
+{
+    std::string a = numberedLines(2000, 7), b = numberedLines(2000, 11), text;
+    xdlmemstats_t stats;
+    xpparam_t xpp;
+
+    memset(&xpp, 0, sizeof(xpp));
+    xpp.memstats = &stats;
+    ASSERT_EQ(0, runDiffWith(a, b, xpp, text));
+    EXPECT_EQ(runDiff(a, b, 0, nullptr), text);
+
+    long total = 0;
+    for (int i = 0; i < XDL_MEM_PHASES; i++)
+        total += stats.allocated[i];
+    EXPECT_GT(stats.allocated[XDL_MEM_PREPARE], 0);
+    EXPECT_GT(stats.allocated[XDL_MEM_ALGORITHM], 0);
+    EXPECT_GT(stats.allocated[XDL_MEM_SCRIPT], 0);
+    EXPECT_GT(stats.peak, 0);
+    EXPECT_LE(stats.peak, total);
+    EXPECT_EQ(0, stats.degraded);
+}
+
+// Test that a budget too small for the algorithm yields a coarser diff, and
+// one too small to read the files an error
+TEST(XDiffApiTest, MemoryBudget)
+{
+    std::string a, b, text;
+    xdlmemstats_t stats;
+    xpparam_t xpp;
+
+    // Lines this repetitive make the histogram index fall back to Myers
+    for (int i = 0; i < 2000; i++) {
+        a += i % 7 ? "same\n" : "a " + std::to_string(i) + "\n";
+        b += i % 11 ? "same\n" : "b " + std::to_string(i) + "\n";
+    }
+    for (unsigned long flags : { (unsigned long)XDF_PATIENCE_DIFF,
+                                 (unsigned long)XDF_HISTOGRAM_DIFF }) {
+        memset(&xpp, 0, sizeof(xpp));
+        xpp.flags = flags;
+        xpp.memstats = &stats;
+        ASSERT_EQ(0, runDiffWith(a, b, xpp, text));
+        long full = countLines(text, '-');
+
+        xpp.max_memory = stats.peak - 4096;
+        ASSERT_EQ(0, runDiffWith(a, b, xpp, text)) << flags;
+        EXPECT_EQ(1, stats.degraded) << flags;
+        EXPECT_LE(stats.peak, xpp.max_memory);
+        EXPECT_GT(countLines(text, '-'), full);
+        EXPECT_EQ(countLines(text, '-'), countLines(text, '+'));
+
+        xpp.max_memory = 1024;
+        EXPECT_EQ(-1, runDiffWith(a, b, xpp, text)) << flags;
+    }
+}
+
+// Test that a merge reports the sum of its two diffs
+TEST(XDiffApiTest, MergeStats)
+{
+    std::string base = numberedLines(300, 7), ours = numberedLines(300, 5), theirs = base;
+    theirs.replace(0, 6, "first ");
+    mmfile_t orig = makeFile(base), mf1 = makeFile(ours), mf2 = makeFile(theirs);
+    xdlstats_t stats;
+    xmparam_t xmp;
+    mmbuffer_t result;
+
+    memset(&xmp, 0, sizeof(xmp));
+    xmp.xpp.stats = &stats;
+    xmp.level = XDL_MERGE_ZEALOUS;
+    xmp.marker_size = DEFAULT_CONFLICT_MARKER_SIZE;
+
+    ASSERT_EQ(0, xdl_merge(&orig, &mf1, &mf2, &xmp, &result));
+    xdl_free(result.ptr);
+    EXPECT_EQ(600, stats.records1);
+    EXPECT_EQ(600, stats.records2);
+    EXPECT_GT(stats.classes, 0);
+    EXPECT_GT(stats.buckets, 0);
+    EXPECT_GE(stats.chain_max, 1);
+    for (int i = 0; i < XDL_PHASES; i++)
+        EXPECT_GE(stats.time[i], 0.0) << i;
+}
+
+// Test that every instruction set gives the output of the portable kernels
+TEST(XDiffApiTest, CpuFeatures)
+{
+    unsigned int all = xdl_set_cpu_features(~0U);
+    std::string a, b;
+
+    // Long and short lines, whitespace runs, CRs, high bytes and a missing final newline
+    for (int i = 0; i < 3000; i++) {
+        std::string line = std::string(i % 4, '\t') + "word" + std::to_string(i * 7919 % 1000);
+        line += i % 5 ? " \t x" : "\xc3\xa9\xc2\xa0 y";
+        line += std::string(i % 70, i % 3 ? 'z' : ' ');
+        a += line + (i % 9 ? "\n" : "\r\n");
+        if (i % 13 == 0)
+            line = "  " + line + " ";
+        if (i % 17 == 0)
+            line += "changed";
+        if (i % 101 != 0)
+            b += line + (i % 11 ? "\n" : "\r\n");
+    }
+    b += "no newline";
+
+    std::string binary = a;
+    binary[binary.size() - 5] = '\0';
+    mmfile_t text = makeFile(a), bin = makeFile(binary);
+    std::vector<std::string> expected;
+
+    const unsigned long flagSets[] = {
+        0,
+        XDF_IGNORE_WHITESPACE,
+        XDF_IGNORE_WHITESPACE_CHANGE,
+        XDF_IGNORE_WHITESPACE_AT_EOL,
+        XDF_IGNORE_CR_AT_EOL,
+        XDF_HISTOGRAM_DIFF | XDF_IGNORE_WHITESPACE_CHANGE,
+        XDF_PATIENCE_DIFF,
+        XDF_NEED_MINIMAL,
+    };
+
+    EXPECT_EQ(0U, xdl_set_cpu_features(0));
+    EXPECT_EQ(0U, xdl_cpu_features());
+    for (unsigned long flags : flagSets)
+        expected.push_back(runDiff(a, b, flags, nullptr));
+    EXPECT_EQ(0, xdl_mmfile_is_binary(&text, 0));
+    EXPECT_EQ(1, xdl_mmfile_is_binary(&bin, 0));
+
+    for (unsigned int mask : { (unsigned int)XDL_CPU_SSE2, (unsigned int)(XDL_CPU_SSE2 | XDL_CPU_AVX2),
+                               ~0U }) {
+        EXPECT_EQ(all & mask, xdl_set_cpu_features(mask));
+        for (size_t i = 0; i < expected.size(); i++)
+            EXPECT_EQ(expected[i], runDiff(a, b, flagSets[i], nullptr)) << mask << " " << flagSets[i];
+        EXPECT_EQ(0, xdl_mmfile_is_binary(&text, 0)) << mask;
+        EXPECT_EQ(1, xdl_mmfile_is_binary(&bin, 0)) << mask;
+    }
+    EXPECT_EQ(all, xdl_cpu_features());
+}
+
+// Test that skipping the identical ends of the files leaves the output
+// unchanged, also where compaction slides a hunk far into them
+TEST(XDiffApiTest, TrimCommonEnds)
+{
+    const unsigned long flagSets[] = {
+        0,
+        XDF_NEED_MINIMAL,
+        XDF_INDENT_HEURISTIC,
+        XDF_IGNORE_WHITESPACE,
+        XDF_PATIENCE_DIFF,
+        XDF_HISTOGRAM_DIFF,
+    };
+    unsigned long long seed = 2024;
+
+    auto next = [&seed](unsigned long n) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        return (unsigned long)(seed >> 33) % n;
+    };
+    // Long runs of closing braces, blank lines, and lines repeated a
+    // few times or only once, so that the counts of the classes matter
+    auto block = [&next](std::vector<std::string> &lines, size_t at) {
+        std::vector<std::string> add;
+        switch (next(4)) {
+        case 0:
+            add.assign(1 + next(150), "}\n");
+            break;
+        case 1:
+            add.assign(1 + next(3), "\n");
+            break;
+        case 2:
+            for (unsigned long i = 0, n = 1 + next(10); i < n; i++)
+                add.push_back("  v" + std::to_string(next(60)) + ";\n");
+            break;
+        default:
+            add.push_back("once " + std::to_string(next(1000000)) + "\n");
+        }
+        lines.insert(lines.begin() + at, add.begin(), add.end());
+    };
+
+    for (int round = 0; round < 200; round++) {
+        std::vector<std::string> lines;
+        std::string a, b;
+
+        for (unsigned long i = 0, n = 20 + next(60); i < n; i++)
+            block(lines, lines.size());
+        for (const std::string &line : lines)
+            a += line;
+        for (unsigned long i = 0, n = 1 + next(3); i < n; i++) {
+            size_t at = lines.size() / 3 + next((unsigned long)lines.size() / 3);
+            if (next(2))
+                lines.erase(lines.begin() + at, lines.begin() + at + 1 + next(6));
+            else
+                block(lines, at);
+        }
+        for (const std::string &line : lines)
+            b += line;
+        if (round % 2)
+            b.pop_back();
+
+        for (unsigned long flags : flagSets)
+            EXPECT_EQ(runDiff(a, b, flags | XDF_NO_TRIM_COMMON, nullptr),
+                      runDiff(a, b, flags, nullptr))
+                << round << " " << flags;
+    }
+}
+
+namespace {
+
+struct Hunk {
+    long i1, chg1, i2, chg2;
+};
+
+int collectHunk(long i1, long chg1, long i2, long chg2, void *priv)
+{
+    static_cast<std::vector<Hunk> *>(priv)->push_back({ i1, chg1, i2, chg2 });
+    return 0;
+}
+
+std::vector<std::string> splitLines(const std::string &text)
+{
+    std::vector<std::string> lines;
+    for (size_t i = 0, e; i < text.size(); i = e) {
+        e = text.find('\n', i);
+        e = e == std::string::npos ? text.size() : e + 1;
+        lines.push_back(text.substr(i, e - i));
+    }
+    return lines;
+}
+
+std::string incrText(xdlincr_t *inc)
+{
+    std::string text(xdl_incr_size(inc), '\0');
+    EXPECT_EQ((long)text.size(), xdl_incr_read(inc, 0, &text[0], (long)text.size()));
+    return text;
+}
+
+// Checks a script is sorted, keeps only equal lines and turns 'a' into 'b'
+void checkHunks(const std::vector<Hunk> &hunks, const std::string &a, const std::string &b)
+{
+    std::vector<std::string> la = splitLines(a), lb = splitLines(b);
+    long i1 = 0, i2 = 0;
+
+    for (const Hunk &h : hunks) {
+        ASSERT_TRUE(h.chg1 || h.chg2);
+        ASSERT_EQ(h.i1 - i1, h.i2 - i2);
+        ASSERT_GE(h.i1 - i1, i1 ? 1 : 0);
+        for (; i1 < h.i1; i1++, i2++)
+            ASSERT_EQ(la[i1], lb[i2]) << i1 << " " << i2;
+        i1 += h.chg1;
+        i2 += h.chg2;
+    }
+    ASSERT_EQ((long)la.size() - i1, (long)lb.size() - i2);
+    for (; i1 < (long)la.size(); i1++, i2++)
+        ASSERT_EQ(la[i1], lb[i2]) << i1 << " " << i2;
+}
+
+// Checks the script of 'inc' is valid for 'a' and its text is 'b'
+void checkIncr(xdlincr_t *inc, const std::string &a, const std::string &b)
+{
+    std::vector<Hunk> hunks;
+
+    ASSERT_EQ(b, incrText(inc));
+    ASSERT_EQ(0, xdl_incr_hunks(inc, collectHunk, &hunks));
+    checkHunks(hunks, a, b);
+}
+
+} // namespace
+
+// Test that edits of the second file keep a valid script, and that
+// an edit far from other changes gives the same diff as a full run
+TEST(XDiffApiTest, IncrementalEdits)
+{
+    std::string a = numberedLines(600, 37), b = a;
+    mmfile_t mf1 = makeFile(a), mf2 = makeFile(b);
+    xpparam_t xpp;
+    unsigned long long seed = 12345;
+
+    memset(&xpp, 0, sizeof(xpp));
+    xdlincr_t *inc = xdl_incr_new(&mf1, &mf2, &xpp);
+    ASSERT_NE(nullptr, inc);
+    checkIncr(inc, a, b);
+
+    // Type a word into a line, one key at a time, then newlines in it
+    size_t at = b.find("line 300\n") + 4;
+    for (char c : std::string(" typed\n\nx")) {
+        ASSERT_EQ(0, xdl_incr_edit(inc, (long)at, 0, &c, 1));
+        b.insert(at++, 1, c);
+        checkIncr(inc, a, b);
+    }
+
+    xdemitconf_t xecfg;
+    xdemitcb_t ecb;
+    Output out;
+    memset(&xecfg, 0, sizeof(xecfg));
+    xecfg.ctxlen = 3;
+    memset(&ecb, 0, sizeof(ecb));
+    ecb.priv = &out;
+    ecb.out_line = outLine;
+    ASSERT_EQ(0, xdl_incr_emit(inc, &xecfg, &ecb));
+    EXPECT_EQ(runDiff(a, b, 0, nullptr), out.text);
+
+    // Random replacements, with and without newlines, at the ends too
+    const char *pieces[] = { "", "x", "\n", "line 12\n", "new\nlines\n", "changed 5", "\n\n\n" };
+    for (int i = 0; i < 500; i++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        size_t size = b.size(), offset = (seed >> 33) % (size + 1);
+        if (i % 50 == 0)
+            offset = i % 100 ? size : 0;
+        size_t len = std::min<size_t>((seed >> 20) % 12, size - offset);
+        std::string text = pieces[(seed >> 8) % 7];
+        ASSERT_EQ(0, xdl_incr_edit(inc, (long)offset, (long)len, text.data(), (long)text.size()));
+        b.replace(offset, len, text);
+        checkIncr(inc, a, b);
+    }
+
+    // Emitting a valid script gives as many removed and added lines
+    std::vector<Hunk> hunks;
+    long removed = 0, added = 0;
+    ASSERT_EQ(0, xdl_incr_hunks(inc, collectHunk, &hunks));
+    for (const Hunk &h : hunks) {
+        removed += h.chg1;
+        added += h.chg2;
+    }
+    out.text.clear();
+    ASSERT_EQ(0, xdl_incr_emit(inc, &xecfg, &ecb));
+    EXPECT_EQ(removed, countLines(out.text, '-'));
+    EXPECT_EQ(added, countLines(out.text, '+'));
+
+    EXPECT_EQ(-1, xdl_incr_edit(inc, (long)b.size() + 1, 0, "x", 1));
+    EXPECT_EQ(-1, xdl_incr_edit(inc, 0, (long)b.size() + 1, "", 0));
+    xdl_incr_free(inc);
+}
+
+// Test that extending an index over appended bytes, cut anywhere, gives
+// the index of the whole buffer, and that diffs from it are unchanged
+TEST(XDiffApiTest, IndexAppend)
+{
+    std::string full = numberedLines(300, 7) + "  tail  without newline";
+    const unsigned long flagSets[] = { 0, XDF_IGNORE_WHITESPACE, XDF_IGNORE_WHITESPACE_CHANGE };
+
+    for (unsigned long flags : flagSets) {
+        std::string grown;
+        mmfile_t mf = makeFile(grown), whole = makeFile(full);
+        xdlindex_t index, expected;
+
+        ASSERT_EQ(0, xdl_index_build(&mf, flags, &index));
+        for (size_t at = 0; at < full.size(); at += 1 + at % 97) {
+            grown = full.substr(0, std::min(full.size(), at + 1 + at % 97));
+            mf = makeFile(grown);
+            ASSERT_EQ(0, xdl_index_append(&mf, &index));
+        }
+        ASSERT_EQ(0, xdl_index_build(&whole, flags, &expected));
+        ASSERT_EQ(expected.nrec, index.nrec);
+        EXPECT_EQ(mf.ptr, index.ptr);
+        EXPECT_EQ(mf.size, index.size);
+        for (long i = 0; i < index.nrec; i++) {
+            ASSERT_EQ(expected.ends[i], index.ends[i]) << i;
+            ASSERT_EQ(expected.ha[i], index.ha[i]) << i;
+        }
+
+        // The index only applies to its own buffer, so diff it in place
+        std::string other = numberedLines(320, 11);
+        mmfile_t mf1 = makeFile(other);
+        xpparam_t xpp;
+        xdemitconf_t xecfg;
+        xdemitcb_t ecb;
+        Output out;
+        memset(&xpp, 0, sizeof(xpp));
+        xpp.flags = flags;
+        xpp.index2 = &index;
+        memset(&xecfg, 0, sizeof(xecfg));
+        xecfg.ctxlen = 3;
+        memset(&ecb, 0, sizeof(ecb));
+        ecb.priv = &out;
+        ecb.out_line = outLine;
+        ASSERT_EQ(0, xdl_diff(&mf1, &mf, &xpp, &xecfg, &ecb));
+        EXPECT_EQ(runDiff(other, grown, flags, nullptr), out.text);
+
+        std::string shorter = full.substr(0, 10);
+        mf = makeFile(shorter);
+        EXPECT_EQ(-1, xdl_index_append(&mf, &index));
+        xdl_index_free(&index);
+        xdl_index_free(&expected);
+    }
+}
+
+// Test that appending to either file keeps a valid script
+TEST(XDiffApiTest, IncrementalAppend)
+{
+    std::string a = numberedLines(200, 13), b = numberedLines(190, 17);
+    mmfile_t mf1 = makeFile(a), mf2 = makeFile(b);
+    xpparam_t xpp;
+    unsigned long long seed = 777;
+
+    memset(&xpp, 0, sizeof(xpp));
+    xdlincr_t *inc = xdl_incr_new(&mf1, &mf2, &xpp);
+    ASSERT_NE(nullptr, inc);
+
+    const char *pieces[] = { "", "line 5", "\n", "line 201\nline 202\n", "changed 7\n", "x" };
+    for (int i = 0; i < 300; i++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        std::string t1 = pieces[(seed >> 33) % 6], t2 = pieces[(seed >> 40) % 6];
+        if (i % 3 == 0)
+            t2 = t1;
+        std::string grown = a + t1;
+        mmfile_t mf = makeFile(grown);
+        ASSERT_EQ(0, xdl_incr_append(inc, i % 4 ? &mf : nullptr, t2.data(), (long)t2.size()));
+        if (i % 4)
+            a.swap(grown);
+        b += t2;
+        checkIncr(inc, a, b);
+    }
+    EXPECT_EQ(-1, xdl_incr_append(inc, &mf1, "", 0));
+    xdl_incr_free(inc);
+}
+
+// Test that a saved index loads back only for the same content and flags
+TEST(XDiffApiTest, IndexImage)
+{
+    std::string content = numberedLines(500, 9) + "last", copy = content;
+    mmfile_t mf = makeFile(content), same = makeFile(copy);
+    xdlindex_t index, loaded;
+    mmbuffer_t image;
+
+    ASSERT_EQ(0, xdl_index_build(&mf, XDF_IGNORE_WHITESPACE_CHANGE, &index));
+    ASSERT_EQ(0, xdl_index_save(&index, &image));
+
+    // Mapped images are page aligned; keep the copy aligned for the arrays
+    std::vector<long> aligned(image.size / sizeof(long) + 1);
+    memcpy(aligned.data(), image.ptr, image.size);
+    const char *data = reinterpret_cast<const char *>(aligned.data());
+
+    ASSERT_EQ(0, xdl_index_load(&same, XDF_IGNORE_WHITESPACE_CHANGE | XDF_HISTOGRAM_DIFF, data,
+                                image.size, &loaded));
+    EXPECT_EQ(same.ptr, loaded.ptr);
+    ASSERT_EQ(index.nrec, loaded.nrec);
+    for (long i = 0; i < index.nrec; i++) {
+        ASSERT_EQ(index.ends[i], loaded.ends[i]);
+        ASSERT_EQ(index.ha[i], loaded.ha[i]);
+    }
+    EXPECT_EQ(-1, xdl_index_append(&same, &loaded));
+    xdl_index_free(&loaded);
+
+    EXPECT_EQ(-1, xdl_index_load(&same, 0, data, image.size, &loaded));
+    EXPECT_EQ(-1, xdl_index_load(&same, XDF_IGNORE_WHITESPACE_CHANGE, data, image.size - 1,
+                                 &loaded));
+    copy[10] = 'X';
+    EXPECT_EQ(-1, xdl_index_load(&same, XDF_IGNORE_WHITESPACE_CHANGE, data, image.size, &loaded));
+    copy[10] = content[10];
+    // The checksum also covers the ends and the hashes
+    long *words = reinterpret_cast<long *>(aligned.data());
+    long header = 48 / sizeof(long);
+    words[header + 1] += 1;
+    EXPECT_EQ(-1, xdl_index_load(&same, XDF_IGNORE_WHITESPACE_CHANGE, data, image.size, &loaded));
+    words[header + 1] -= 1;
+    words[header + index.nrec + 3] ^= 1;
+    EXPECT_EQ(-1, xdl_index_load(&same, XDF_IGNORE_WHITESPACE_CHANGE, data, image.size, &loaded));
+    words[header + index.nrec + 3] ^= 1;
+    ASSERT_EQ(0, xdl_index_load(&same, XDF_IGNORE_WHITESPACE_CHANGE, data, image.size, &loaded));
+    xdl_index_free(&loaded);
+
+    xdl_free(image.ptr);
+    xdl_index_free(&index);
+}
+
+// Test that each step of a chain of versions, diffed in any order,
+// matches a diff of the two versions on their own
+TEST(XDiffApiTest, ChainedVersions)
+{
+    std::vector<std::string> versions;
+    std::vector<std::string> lines = splitLines(numberedLines(400, 23));
+    unsigned long long seed = 777;
+
+    for (int v = 0; v < 8; v++) {
+        std::string text;
+        for (const std::string &line : lines)
+            text += line;
+        versions.push_back(text);
+        for (int i = 0; i < 6; i++) {
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            size_t at = (seed >> 33) % (lines.size() + 1);
+            if ((seed >> 8) % 3 == 0 && at < lines.size())
+                lines.erase(lines.begin() + at, lines.begin() + std::min(lines.size(), at + 3));
+            else
+                lines.insert(lines.begin() + at, "  version " + std::to_string(v) + "\n");
+        }
+    }
+    versions.push_back("");
+    versions.push_back("no newline");
+    versions.push_back(versions[3]);
+
+    const unsigned long flags[] = { 0, XDF_NEED_MINIMAL, XDF_PATIENCE_DIFF, XDF_HISTOGRAM_DIFF,
+                                    XDF_IGNORE_WHITESPACE };
+    for (unsigned long f : flags) {
+        std::vector<mmfile_t> mfs;
+        for (std::string &text : versions)
+            mfs.push_back(makeFile(text));
+        xpparam_t xpp;
+        memset(&xpp, 0, sizeof(xpp));
+        xpp.flags = f;
+        xdlchain_t *chain = xdl_chain_new(mfs.data(), (long)mfs.size(), &xpp);
+        ASSERT_NE(nullptr, chain);
+        ASSERT_EQ((long)versions.size() - 1, xdl_chain_steps(chain));
+
+        for (long step = xdl_chain_steps(chain) - 1; step >= 0; step--) {
+            xdemitconf_t xecfg;
+            xdemitcb_t ecb;
+            Output out;
+            memset(&xecfg, 0, sizeof(xecfg));
+            xecfg.ctxlen = 3;
+            memset(&ecb, 0, sizeof(ecb));
+            ecb.priv = &out;
+            ecb.out_line = outLine;
+            ASSERT_EQ(0, xdl_chain_diff(chain, step, &xecfg, &ecb));
+            EXPECT_EQ(runDiff(versions[step], versions[step + 1], f, nullptr), out.text)
+                << "flags " << f << " step " << step;
+        }
+
+        xdemitconf_t xecfg;
+        xdemitcb_t ecb;
+        memset(&xecfg, 0, sizeof(xecfg));
+        memset(&ecb, 0, sizeof(ecb));
+        EXPECT_EQ(-1, xdl_chain_diff(chain, -1, &xecfg, &ecb));
+        EXPECT_EQ(-1, xdl_chain_diff(chain, xdl_chain_steps(chain), &xecfg, &ecb));
+        xdl_chain_free(chain);
+    }
+}
+
+// Test that a long identical interior is pinned before the algorithm,
+// ahead of a shorter block moved across it, and the script stays valid
+TEST(XDiffApiTest, PinnedInteriorRuns)
+{
+    std::vector<std::string> lines = splitLines(numberedLines(20000, 7));
+    std::vector<std::string> moved;
+    std::string a, b;
+
+    for (const std::string &line : lines)
+        a += line;
+    for (int i = 0; i < 400; i += 20)
+        std::swap(lines[i], lines[i + 10]);
+    for (int i = 19600; i < 20000; i += 15)
+        lines[i] = "}\n";
+    moved.assign(lines.begin() + 1000, lines.begin() + 1300);
+    lines.erase(lines.begin() + 1000, lines.begin() + 1300);
+    lines.insert(lines.begin() + 18000, moved.begin(), moved.end());
+    for (const std::string &line : lines)
+        b += line;
+
+    mmfile_t mf1 = makeFile(a), mf2 = makeFile(b);
+    xpparam_t xpp;
+    xdemitconf_t xecfg;
+    xdemitcb_t ecb;
+    xdlstats_t stats;
+    std::vector<Hunk> hunks;
+
+    memset(&xpp, 0, sizeof(xpp));
+    xpp.stats = &stats;
+    memset(&xecfg, 0, sizeof(xecfg));
+    xecfg.hunk_func = collectHunk;
+    memset(&ecb, 0, sizeof(ecb));
+    ecb.priv = &hunks;
+    ASSERT_EQ(0, xdl_diff(&mf1, &mf2, &xpp, &xecfg, &ecb));
+    checkHunks(hunks, a, b);
+    // Lines 400-1000 and 1300-18300; the rest is a common suffix once
+    // the replaced lines are discarded
+    EXPECT_EQ(2, stats.pinned_runs);
+    EXPECT_GT(stats.pinned, 17000);
+    long removed = 0;
+    for (const Hunk &h : hunks)
+        removed += h.chg1;
+    EXPECT_LT(removed, 700) << "The moved block must not displace the long runs";
+
+    // A minimal diff is never pinned
+    hunks.clear();
+    xpp.flags = XDF_NEED_MINIMAL;
+    ASSERT_EQ(0, xdl_diff(&mf1, &mf2, &xpp, &xecfg, &ecb));
+    checkHunks(hunks, a, b);
+    EXPECT_EQ(0, stats.pinned_runs);
+}
+
+// Test that the line map agrees with the hunks of the same diff, in
+// both directions and for a chain step
+TEST(XDiffApiTest, LineMap)
+{
+    std::vector<std::string> lines = splitLines(numberedLines(3000, 11));
+    std::string a, b;
+
+    for (const std::string &line : lines)
+        a += line;
+    for (int i = 100; i < 2900; i += 250) {
+        lines[i] = "  changed\n";
+        lines.insert(lines.begin() + i + 7, 3, "  added\n");
+        lines.erase(lines.begin() + i + 40, lines.begin() + i + 45);
+    }
+    for (const std::string &line : lines)
+        b += line;
+
+    const unsigned long flags[] = { 0, XDF_NEED_MINIMAL, XDF_PATIENCE_DIFF, XDF_HISTOGRAM_DIFF };
+    for (unsigned long f : flags) {
+        mmfile_t mfs[2] = { makeFile(a), makeFile(b) };
+        xpparam_t xpp;
+        xdemitconf_t xecfg;
+        xdemitcb_t ecb;
+        std::vector<Hunk> hunks;
+
+        memset(&xpp, 0, sizeof(xpp));
+        xpp.flags = f;
+        memset(&xecfg, 0, sizeof(xecfg));
+        xecfg.hunk_func = collectHunk;
+        memset(&ecb, 0, sizeof(ecb));
+        ecb.priv = &hunks;
+        ASSERT_EQ(0, xdl_diff(&mfs[0], &mfs[1], &xpp, &xecfg, &ecb));
+
+        // Expected mapping of every line, -1 for the changed ones
+        long n1 = (long)splitLines(a).size(), n2 = (long)splitLines(b).size();
+        std::vector<long> old2new(n1, -1), new2old(n2, -1);
+        long i1 = 0, i2 = 0;
+        for (size_t k = 0; k <= hunks.size(); k++) {
+            long end1 = k < hunks.size() ? hunks[k].i1 : n1;
+            for (; i1 < end1; i1++, i2++) {
+                old2new[i1] = i2;
+                new2old[i2] = i1;
+            }
+            if (k < hunks.size()) {
+                i1 += hunks[k].chg1;
+                i2 += hunks[k].chg2;
+            }
+        }
+
+        xdllinemap_t maps[2];
+        ASSERT_EQ(0, xdl_line_map(&mfs[0], &mfs[1], &xpp, &maps[0]));
+        xdlchain_t *chain = xdl_chain_new(mfs, 2, &xpp);
+        ASSERT_NE(nullptr, chain);
+        ASSERT_EQ(0, xdl_chain_line_map(chain, 0, &maps[1]));
+        xdllinemap_t none;
+        EXPECT_EQ(-1, xdl_chain_line_map(chain, 1, &none));
+        EXPECT_EQ(nullptr, none.start1);
+        xdl_chain_free(chain);
+
+        for (xdllinemap_t &map : maps) {
+            EXPECT_EQ(n1, map.nrec1);
+            EXPECT_EQ(n2, map.nrec2);
+            EXPECT_EQ((long)hunks.size() + 1, map.nr) << "flags " << f;
+            for (long i = 0; i < n1; i++)
+                ASSERT_EQ(old2new[i], xdl_line_map_new(&map, i)) << "flags " << f << " " << i;
+            for (long i = 0; i < n2; i++)
+                ASSERT_EQ(new2old[i], xdl_line_map_old(&map, i)) << "flags " << f << " " << i;
+            EXPECT_EQ(-1, xdl_line_map_new(&map, -1));
+            EXPECT_EQ(-1, xdl_line_map_new(&map, n1));
+            EXPECT_EQ(-1, xdl_line_map_old(&map, n2));
+            xdl_line_map_free(&map);
+            EXPECT_EQ(0, map.nr);
+        }
+    }
+
+    // Nothing in common
+    std::string empty;
+    mmfile_t mf1 = makeFile(a), mf2 = makeFile(empty);
+    xpparam_t xpp;
+    xdllinemap_t map;
+    memset(&xpp, 0, sizeof(xpp));
+    ASSERT_EQ(0, xdl_line_map(&mf1, &mf2, &xpp, &map));
+    EXPECT_EQ(0, map.nr);
+    EXPECT_EQ(0, map.nrec2);
+    EXPECT_EQ(-1, xdl_line_map_new(&map, 0));
+    xdl_line_map_free(&map);
+}
+
+// Test that a line map honours the allocator, reports and ignore options of a diff
+TEST(XDiffApiTest, LineMapOptions)
+{
+    std::string a = numberedLines(2000, 7), b = numberedLines(2000, 11);
+    mmfile_t mf1 = makeFile(a), mf2 = makeFile(b);
+    CountingAlloc ca;
+    xdlmemstats_t stats;
+    xpparam_t xpp;
+    xdllinemap_t map;
+
+    ca.alloc.malloc = countingMalloc;
+    ca.alloc.realloc = countingRealloc;
+    ca.alloc.free = countingFree;
+    ca.alloc.priv = &ca;
+    memset(&xpp, 0, sizeof(xpp));
+    xpp.alloc = &ca.alloc;
+    xpp.memstats = &stats;
+    ASSERT_EQ(0, xdl_line_map(&mf1, &mf2, &xpp, &map));
+    EXPECT_GT(ca.calls, 0);
+    EXPECT_EQ(0, ca.live) << "the map comes from xdl_malloc()";
+    EXPECT_GT(stats.allocated[XDL_MEM_PREPARE], 0);
+    EXPECT_GT(stats.peak, 0);
+    xdl_line_map_free(&map);
+
+    // Hidden changes pair up when both sides have as many lines
+    std::string c = "a\nold 1\nb\n\nc\nold 2\n", d = "a\nnew 1\nb\nc\nnew 2\nnew 3\n";
+    mmfile_t mf3 = makeFile(c), mf4 = makeFile(d);
+    regex_t re;
+    xdl_regex_t *res[] = { &re };
+    ASSERT_EQ(0, regcomp(&re, "^(old|new) ", REG_EXTENDED));
+    memset(&xpp, 0, sizeof(xpp));
+    xpp.flags = XDF_IGNORE_BLANK_LINES;
+    xpp.ignore_regex = res;
+    xpp.ignore_regex_nr = 1;
+    ASSERT_EQ(0, xdl_line_map(&mf3, &mf4, &xpp, &map));
+    EXPECT_EQ(1, xdl_line_map_new(&map, 1));
+    EXPECT_EQ(2, xdl_line_map_new(&map, 2));
+    EXPECT_EQ(-1, xdl_line_map_new(&map, 3));
+    EXPECT_EQ(3, xdl_line_map_new(&map, 4));
+    EXPECT_EQ(-1, xdl_line_map_new(&map, 5));
+    EXPECT_EQ(-1, xdl_line_map_old(&map, 5));
+    xdl_line_map_free(&map);
+    xpp.ignore_regex_nr = 0;
+    xpp.ignore_regex = nullptr;
+    ASSERT_EQ(0, xdl_line_map(&mf3, &mf4, &xpp, &map));
+    EXPECT_EQ(-1, xdl_line_map_new(&map, 1));
+    xdl_line_map_free(&map);
+    regfree(&re);
+}
+
+// Test that the shared line count matches a count of the lines of both
+// files, and that sketches estimate it
+TEST(XDiffApiTest, Similarity)
+{
+    std::vector<std::string> lines = splitLines(numberedLines(4000, 13));
+    std::string a, b;
+
+    for (const std::string &line : lines)
+        a += line;
+    for (int i = 200; i < 3800; i += 7)
+        lines[i] = i % 3 ? "  moved " + std::to_string(i % 50) + "\n" : "\n";
+    std::rotate(lines.begin() + 1000, lines.begin() + 2500, lines.begin() + 3000);
+    for (size_t i = 0; i < lines.size(); i++)
+        b += i % 2 ? lines[i] : lines[i].substr(0, lines[i].size() - 1) + "  \n";
+
+    const unsigned long flags[] = { 0, XDF_IGNORE_WHITESPACE, XDF_IGNORE_WHITESPACE_CHANGE };
+    for (unsigned long f : flags) {
+        mmfile_t mf1 = makeFile(a), mf2 = makeFile(b);
+        xdlsimilarity_t sim;
+
+        // Count the lines of 'a' that pair with a line of 'b' under the flags
+        std::map<std::string, long> count;
+        for (std::string line : splitLines(b)) {
+            if (f && line.size() > 2 && line.compare(line.size() - 3, 3, "  \n") == 0)
+                line.erase(line.size() - 3, 2);
+            count[line]++;
+        }
+        long shared = 0;
+        for (const std::string &line : splitLines(a))
+            if (count[line]-- > 0)
+                shared++;
+
+        ASSERT_EQ(0, xdl_similarity(&mf1, &mf2, f, &sim));
+        EXPECT_EQ(4000, sim.nrec1);
+        EXPECT_EQ(4000, sim.nrec2);
+        EXPECT_EQ(shared, sim.shared) << "flags " << f;
+
+        xdlsketch_t sk1, sk2;
+        xdl_sketch(&mf1, f, &sk1);
+        xdl_sketch(&mf2, f, &sk2);
+        EXPECT_EQ(XDL_SKETCH_SIZE, sk1.nr);
+        EXPECT_TRUE(std::is_sorted(sk1.min, sk1.min + sk1.nr));
+        xdl_sketch_similarity(&sk1, &sk2, &sim);
+        EXPECT_EQ(4000, sim.nrec1);
+        EXPECT_NEAR(shared, sim.shared, 400) << "flags " << f;
+        xdl_sketch_similarity(&sk1, &sk1, &sim);
+        EXPECT_EQ(4000, sim.shared);
+    }
+
+    // Files made mostly of repeated lines: the sketch counts the copies too
+    std::string r1, r2, r3, r4;
+    for (int i = 0; i < 3000; i++) {
+        std::string line = "\tx" + std::to_string(i) + "();\n";
+        if (i % 4 == 0)
+            line = "}\n";
+        else if (i % 4 == 2)
+            line = "\n";
+        else if (i % 8 == 1)
+            line = "\tbreak;\n";
+        r1 += line;
+        r2 += i % 5 == 3 ? "\ty" + std::to_string(i) + "();\n" : line;
+        if (i % 3 == 0)
+            r2 += "}\n";
+        // Only the repeated line in common, three lines in four
+        r3 += i % 4 ? "}\n" : "\tx" + std::to_string(i) + "();\n";
+        r4 += i % 4 ? "}\n" : "\ty" + std::to_string(i) + "();\n";
+    }
+    const std::pair<std::string *, std::string *> pairs[] = { { &r1, &r1 }, { &r1, &r2 },
+                                                              { &r3, &r4 } };
+    for (const auto &pair : pairs) {
+        mmfile_t mfs[2] = { makeFile(*pair.first), makeFile(*pair.second) };
+        xdlsimilarity_t exact, sketched;
+        xdlsketch_t sk1, sk2;
+
+        ASSERT_EQ(0, xdl_similarity(&mfs[0], &mfs[1], 0, &exact));
+        ASSERT_EQ(0, xdl_sketch(&mfs[0], 0, &sk1));
+        ASSERT_EQ(0, xdl_sketch(&mfs[1], 0, &sk2));
+        xdl_sketch_similarity(&sk1, &sk2, &sketched);
+        EXPECT_EQ(exact.nrec2, sketched.nrec2);
+        double most = std::max(exact.nrec1, exact.nrec2);
+        EXPECT_NEAR(exact.shared / most, sketched.shared / most, 0.08)
+            << exact.shared << " vs " << sketched.shared;
+    }
+
+    // Identical ends are counted without being classified
+    mmfile_t mf1 = makeFile(a), mf2 = makeFile(a);
+    xdlsimilarity_t sim;
+    ASSERT_EQ(0, xdl_similarity(&mf1, &mf2, 0, &sim));
+    EXPECT_EQ(4000, sim.shared);
+    std::string c = a + "tail without newline", empty;
+    mf2 = makeFile(c);
+    ASSERT_EQ(0, xdl_similarity(&mf1, &mf2, 0, &sim));
+    EXPECT_EQ(4001, sim.nrec2);
+    EXPECT_EQ(4000, sim.shared);
+    mf2 = makeFile(empty);
+    ASSERT_EQ(0, xdl_similarity(&mf1, &mf2, 0, &sim));
+    EXPECT_EQ(0, sim.nrec2);
+    EXPECT_EQ(0, sim.shared);
+}
@@ -1,7 +1,9 @@
 #include <gtest/gtest.h>
+#include <signal.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <filesystem>
@@ -403,3 +405,737 @@ TEST_F(XDiffCliTest, MovedBlocksNoChanges)
     EXPECT_TRUE(output.empty() || output.find("<") == std::string::npos || output.find(">") == std::string::npos)
         << "Output should not contain moved markers for identical files";
 }
+
+// Test recursive directory comparison
+TEST_F(XDiffCliTest, RecursiveDirectories)
+{
+    fs::create_directories(test_dir / "dir1" / "sub");
+    fs::create_directories(test_dir / "dir2" / "sub");
+    createTestFile("dir1/common.txt", "line1\nline2\n");
+    createTestFile("dir2/common.txt", "line1\nmodified\n");
+    createTestFile("dir1/sub/same.txt", "same\n");
+    createTestFile("dir2/sub/same.txt", "same\n");
+    createTestFile("dir1/only1.txt", "only\n");
+    createTestFile("dir2/only2.txt", "only\n");
+
+    std::string output, error;
+    fs::path dir1 = test_dir / "dir1";
+    fs::path dir2 = test_dir / "dir2";
+
+    int status = runXDiffCli({ "-r", dir1.string(), dir2.string() }, output, error);
+
+    EXPECT_EQ(0, status) << "Recursive diff should succeed";
+    EXPECT_NE(std::string::npos, output.find("+modified")) << output;
+    EXPECT_NE(std::string::npos, output.find("Only in " + dir1.string() + ": only1.txt"))
+        << output;
+    EXPECT_NE(std::string::npos, output.find("Only in " + dir2.string() + ": only2.txt"))
+        << output;
+    EXPECT_EQ(std::string::npos, output.find("same.txt")) << "Identical files should be silent";
+
+    // Entries are reported in sorted order
+    EXPECT_LT(output.find("common.txt"), output.find("only1.txt"));
+    EXPECT_LT(output.find("only1.txt"), output.find("only2.txt"));
+}
+
+// Test that a symbolic link back into the tree is reported and skipped
+TEST_F(XDiffCliTest, RecursiveSymlinkLoop)
+{
+    fs::create_directories(test_dir / "a");
+    fs::create_directories(test_dir / "b");
+    createTestFile("a/f", "one\n");
+    createTestFile("b/f", "two\n");
+    fs::create_directory_symlink("..", test_dir / "a" / "loop");
+    fs::create_directory_symlink("..", test_dir / "b" / "loop");
+
+    std::string output, error;
+    std::string a = (test_dir / "a").string(), b = (test_dir / "b").string();
+
+    EXPECT_NE(0, runXDiffCli({ "-r", a, b }, output, error));
+    EXPECT_NE(std::string::npos, output.find("recursive directory loop")) << output;
+    EXPECT_NE(std::string::npos, output.find("-one")) << output;
+    EXPECT_NE(std::string::npos, output.find("+two")) << output;
+}
+
+// Test that similar added and deleted files are paired as renames and copies
+TEST_F(XDiffCliTest, RecursiveRenames)
+{
+    std::string body, edited, kept;
+    for (int i = 0; i < 200; i++) {
+        body += "line " + std::to_string(i) + "\n";
+        edited += (i == 17 ? "changed " : "line ") + std::to_string(i) + "\n";
+    }
+    for (int i = 0; i < 50; i++)
+        kept += "kept " + std::to_string(i) + "\n";
+    fs::create_directories(test_dir / "dir1" / "sub");
+    fs::create_directories(test_dir / "dir2" / "moved");
+    createTestFile("dir1/old.txt", body);
+    createTestFile("dir2/new.txt", edited);
+    createTestFile("dir1/sub/f.txt", kept + "sub\n");
+    createTestFile("dir2/moved/f.txt", kept + "sub\n");
+    createTestFile("dir1/keep.txt", kept);
+    createTestFile("dir2/keep.txt", kept);
+    createTestFile("dir2/copy.txt", kept + "extra\n");
+    createTestFile("dir1/gone.txt", "nothing alike\n");
+    createTestFile("dir2/fresh.txt", "brand new\n");
+
+    std::string d1 = (test_dir / "dir1").string(), d2 = (test_dir / "dir2").string();
+    std::string output, error;
+    EXPECT_EQ(0, runXDiffCli({ "-r", "-M", d1, d2 }, output, error));
+    EXPECT_NE(std::string::npos, output.find("File " + d1 + "/old.txt renamed to " + d2 +
+                                             "/new.txt (99% similar)\ndiff -r " + d1 +
+                                             "/old.txt " + d2 + "/new.txt\n"))
+        << output;
+    EXPECT_NE(std::string::npos, output.find("-line 17\n+changed 17\n")) << output;
+    EXPECT_NE(std::string::npos, output.find("File " + d1 + "/sub/f.txt renamed to " + d2 +
+                                             "/moved/f.txt (100% similar)\n"))
+        << output;
+    EXPECT_EQ(std::string::npos, output.find("Only in " + d1 + ": old.txt")) << output;
+    EXPECT_EQ(std::string::npos, output.find("Only in " + d2 + ": new.txt")) << output;
+    EXPECT_NE(std::string::npos, output.find("Only in " + d1 + ": gone.txt")) << output;
+    EXPECT_NE(std::string::npos, output.find("Only in " + d2 + ": fresh.txt")) << output;
+    EXPECT_NE(std::string::npos, output.find("Only in " + d2 + ": copy.txt")) << output;
+
+    // Kept files are copy sources with -C; a higher threshold drops the edited rename
+    output.clear();
+    EXPECT_EQ(0, runXDiffCli({ "-r", "--find-copies=98", d1, d2 }, output, error));
+    EXPECT_NE(std::string::npos, output.find("File " + d1 + "/keep.txt copied to " + d2 +
+                                             "/copy.txt (98% similar)\n"))
+        << output;
+    EXPECT_NE(std::string::npos, output.find("renamed to " + d2 + "/new.txt")) << output;
+    output.clear();
+    EXPECT_EQ(0, runXDiffCli({ "-r", "-M100%", d1, d2 }, output, error));
+    EXPECT_NE(std::string::npos, output.find("Only in " + d2 + ": new.txt")) << output;
+    EXPECT_NE(std::string::npos, output.find("renamed to " + d2 + "/moved/f.txt")) << output;
+
+    // The same output with any number of jobs
+    std::string serial, parallel;
+    runXDiffCli({ "-r", "-C", "-j1", d1, d2 }, serial, error);
+    runXDiffCli({ "-r", "-C", "-j4", d1, d2 }, parallel, error);
+    EXPECT_EQ(serial, parallel);
+
+    output.clear();
+    EXPECT_NE(0, runXDiffCli({ "-M", d1, d2 }, output, error));
+    EXPECT_NE(std::string::npos, output.find("need -r")) << output;
+    output.clear();
+    EXPECT_NE(0, runXDiffCli({ "-r", "-M101", d1, d2 }, output, error));
+    EXPECT_NE(std::string::npos, output.find("invalid similarity threshold")) << output;
+}
+
+// Test that renames are scored by the exact shared lines, not the sketch estimate
+TEST_F(XDiffCliTest, RecursiveRenameExactScore)
+{
+    std::string before, after;
+    for (int i = 0; i < 2000; i++) {
+        before += "line " + std::to_string(i) + " of the old file\n";
+        after += i % 3 ? "line " + std::to_string(i) + " of the old file\n"
+                       : "edited " + std::to_string(i) + "\n";
+    }
+    fs::create_directories(test_dir / "a");
+    fs::create_directories(test_dir / "b");
+    createTestFile("a/old.txt", before);
+    createTestFile("b/new.txt", after);
+
+    std::string a = (test_dir / "a").string(), b = (test_dir / "b").string();
+    std::string exact, output, error;
+    EXPECT_EQ(0, runXDiffCli({ "--similarity", a + "/old.txt", b + "/new.txt" }, exact, error));
+    ASSERT_EQ(0u, exact.find("66% similar")) << exact;
+    EXPECT_EQ(0, runXDiffCli({ "-r", "-M66", a, b }, output, error));
+    EXPECT_NE(std::string::npos, output.find("renamed to " + b + "/new.txt (66% similar)"))
+        << output;
+    output.clear();
+    EXPECT_EQ(0, runXDiffCli({ "-r", "-M67", a, b }, output, error));
+    EXPECT_NE(std::string::npos, output.find("Only in " + b + ": new.txt")) << output;
+}
+
+// Test that parallel recursive comparison produces the same output as serial
+TEST_F(XDiffCliTest, RecursiveJobsDeterministic)
+{
+    for (int d = 0; d < 4; d++) {
+        std::string sub = "/d" + std::to_string(d);
+        fs::create_directories(test_dir.string() + "/dir1" + sub);
+        fs::create_directories(test_dir.string() + "/dir2" + sub);
+        for (int i = 0; i < 10; i++) {
+            std::string name = sub + "/file" + std::to_string(i) + ".txt";
+            createTestFile("dir1" + name, "a\nb\nc\n" + std::to_string(i) + "\n");
+            createTestFile("dir2" + name, "a\nB\nc\n" + std::to_string(i * (i % 2)) + "\n");
+        }
+    }
+
+    std::string serial, parallel, error;
+    fs::path dir1 = test_dir / "dir1";
+    fs::path dir2 = test_dir / "dir2";
+
+    int status1 = runXDiffCli({ "-r", "--jobs=1", dir1.string(), dir2.string() }, serial, error);
+    int status2 = runXDiffCli({ "-r", "-j", "4", dir1.string(), dir2.string() }, parallel, error);
+
+    EXPECT_EQ(0, status1);
+    EXPECT_EQ(0, status2);
+    EXPECT_FALSE(serial.empty());
+    EXPECT_EQ(serial, parallel) << "Output must not depend on the number of jobs";
+}
+
+// Test that files loaded ahead through io_uring and through I/O threads diff the same
+TEST_F(XDiffCliTest, RecursiveReadAhead)
+{
+    fs::create_directories(test_dir / "dir1");
+    fs::create_directories(test_dir / "dir2");
+    for (int i = 0; i < 30; i++) {
+        std::string name = "/file" + std::to_string(i) + ".txt", text;
+        for (int j = 0; j < (i % 5) * i * 200; j++)
+            text += "line " + std::to_string(j) + "\n";
+        createTestFile("dir1" + name, text);
+        createTestFile("dir2" + name, i % 3 ? text : text + "tail\n");
+    }
+
+    std::string uring, threads, error;
+    fs::path dir1 = test_dir / "dir1";
+    fs::path dir2 = test_dir / "dir2";
+
+    int status1 = runXDiffCli({ "-r", "-j", "2", dir1.string(), dir2.string() }, uring, error);
+    setenv("XDIFF_NO_IO_URING", "1", 1);
+    int status2 = runXDiffCli({ "-r", "-j", "2", dir1.string(), dir2.string() }, threads, error);
+    unsetenv("XDIFF_NO_IO_URING");
+
+    EXPECT_EQ(0, status1);
+    EXPECT_EQ(0, status2);
+    EXPECT_NE(std::string::npos, uring.find("+tail"));
+    EXPECT_EQ(uring, threads);
+}
+
+// Test batch mode framing, per-pair options and per-pair errors
+TEST_F(XDiffCliTest, BatchManifest)
+{
+    createTestFile("file1.txt", "line1\nline2\nline3\n");
+    createTestFile("file2.txt", "line1\nmodified\nline3\n");
+    createTestFile("space1.txt", "a  b\n");
+    createTestFile("space2.txt", "a b\n");
+
+    fs::path file1 = test_dir / "file1.txt";
+    fs::path file2 = test_dir / "file2.txt";
+    fs::path space1 = test_dir / "space1.txt";
+    fs::path space2 = test_dir / "space2.txt";
+    fs::path missing = test_dir / "missing.txt";
+    createTestFile("manifest", "# comment\n"
+                               "one\t" + file1.string() + "\t" + file2.string() + "\t-u 0\n"
+                               "\n"
+                               "two\t" + space1.string() + "\t" + space2.string() + "\t-b\n"
+                               "three\t" + file1.string() + "\t" + missing.string() + "\n");
+
+    std::string output, error;
+    fs::path manifest = test_dir / "manifest";
+    int status = runXDiffCli({ "--batch=" + manifest.string(), "-j", "2" }, output, error);
+
+    std::string diff = "--- " + file1.string() + "\n+++ " + file2.string() +
+                       "\n@@ -2,1 +2,1 @@\n-line2\n+modified\n";
+    std::string expected = "=== one 1 " + std::to_string(diff.size()) + "\n" + diff +
+                           "=== two 0 0\n"
+                           "=== three 2 ";
+    EXPECT_EQ(1, status) << "A failed pair should fail the batch";
+    EXPECT_EQ(0u, output.find(expected)) << output;
+    EXPECT_NE(std::string::npos, output.find("cannot read file")) << output;
+}
+
+// Test that batch output does not depend on the number of jobs
+TEST_F(XDiffCliTest, BatchJobsDeterministic)
+{
+    std::string manifest;
+    for (int i = 0; i < 40; i++) {
+        std::string a = "a" + std::to_string(i) + ".txt", b = "b" + std::to_string(i) + ".txt";
+        createTestFile(a, "x\ny\nz\n" + std::to_string(i) + "\n");
+        createTestFile(b, "x\nY\nz\n" + std::to_string(i * (i % 3)) + "\n");
+        manifest += "pair" + std::to_string(i) + "\t" + (test_dir / a).string() + "\t" +
+                    (test_dir / b).string() + (i % 2 ? "\t--patience" : "") + "\n";
+    }
+    createTestFile("manifest", manifest);
+
+    std::string serial, parallel, error;
+    fs::path path = test_dir / "manifest";
+
+    int status1 = runXDiffCli({ "--batch", "-j", "1", "<", path.string() }, serial, error);
+    int status2 = runXDiffCli({ "--batch=" + path.string(), "--jobs=4" }, parallel, error);
+
+    EXPECT_EQ(0, status1);
+    EXPECT_EQ(0, status2);
+    EXPECT_NE(std::string::npos, serial.find("=== pair39 1 "));
+    EXPECT_EQ(serial, parallel) << "Output must not depend on the number of jobs";
+}
+
+// Test that diffs answered by xdiff --serve match local ones, also from the cache
+TEST_F(XDiffCliTest, ServeClient)
+{
+    createTestFile("file1.txt", "line1\nline2\nline3\nline4\n");
+    createTestFile("file2.txt", "line1\nline2 \nline3\nline5\n");
+
+    fs::path file1 = test_dir / "file1.txt";
+    fs::path file2 = test_dir / "file2.txt";
+    fs::path missing = test_dir / "missing.txt";
+    std::string socket = (test_dir / "xdiff.sock").string();
+    std::string serve = "--serve=" + socket;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        execl(xdiff_cli_path.c_str(), "xdiff", serve.c_str(), (char *)nullptr);
+        _exit(127);
+    }
+    for (int i = 0; i < 300 && !fs::exists(socket); i++)
+        usleep(10000);
+    bool started = fs::exists(socket);
+
+    std::string local, first, second, ignored, error;
+    int status = runXDiffCli({ file1.string(), file2.string() }, local, error);
+    int status1 =
+        runXDiffCli({ "--client=" + socket, file1.string(), file2.string() }, first, error);
+    int status2 =
+        runXDiffCli({ "--client", socket, file1.string(), file2.string() }, second, error);
+    int status3 = runXDiffCli({ "--client=" + socket, "-b", "-q", file1.string(), file2.string() },
+                              ignored, error);
+    std::string failed;
+    int status4 =
+        runXDiffCli({ "--client=" + socket, file1.string(), missing.string() }, failed, error);
+    std::string failed_first;
+    int status5 = runXDiffCli({ "--client=" + socket, missing.string(), file1.string() },
+                              failed_first, error);
+
+    kill(pid, SIGTERM);
+    waitpid(pid, nullptr, 0);
+
+    ASSERT_TRUE(started) << "server did not create " << socket;
+    EXPECT_EQ(0, status);
+    EXPECT_EQ(0, status1);
+    EXPECT_EQ(0, status2);
+    EXPECT_EQ(local, first);
+    EXPECT_EQ(local, second) << "A cached file must give the same diff";
+    EXPECT_EQ(1, status3);
+    EXPECT_EQ("Files " + file1.string() + " and " + file2.string() + " differ\n", ignored);
+    EXPECT_EQ(1, status4);
+    EXPECT_NE(std::string::npos, failed.find("cannot read file")) << failed;
+    EXPECT_EQ(1, status5);
+    EXPECT_NE(std::string::npos, failed_first.find("cannot read file '" + missing.string() +
+                                                   "': No such file or directory"))
+        << failed_first;
+    EXPECT_FALSE(fs::exists(socket)) << "The socket must be removed on shutdown";
+}
+
+// Test that the server gives fresh diffs of files that grow or are rewritten larger
+TEST_F(XDiffCliTest, ServeAppendedFile)
+{
+    std::string log1, log2;
+    for (int i = 0; i < 2000; i++) {
+        log1 += "event " + std::to_string(i) + "\n";
+        log2 += "event " + std::to_string(i % 300 ? i : -i) + "\n";
+    }
+    createTestFile("file1.txt", log1);
+    createTestFile("file2.txt", log2 + "partial");
+    // Same length edit in the middle, then an append: the cached copy is stale
+    std::string middle = log2;
+    middle.replace(middle.find("event 1501\n"), 10, "EVENT 1501");
+
+    fs::path file1 = test_dir / "file1.txt";
+    fs::path file2 = test_dir / "file2.txt";
+    std::string socket = (test_dir / "xdiff.sock").string();
+    std::string serve = "--serve=" + socket;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        execl(xdiff_cli_path.c_str(), "xdiff", serve.c_str(), (char *)nullptr);
+        _exit(127);
+    }
+    for (int i = 0; i < 300 && !fs::exists(socket); i++)
+        usleep(10000);
+    bool started = fs::exists(socket);
+
+    std::vector<std::string> expected, served;
+    std::string out, error;
+    std::vector<std::string> versions = { log2 + "partial", log2 + "partial line\nevent 2000\n",
+                                          log2 + "partial line\nevent 2000\nevent -2001\n",
+                                          middle + "partial line\nevent 2000\nevent -2001\nmore\n",
+                                          "event 0\n" + log2 + "partial line\nevent 2000\n\n" };
+    for (const std::string &content : versions) {
+        {
+            std::ofstream file(file2, std::ios::binary | std::ios::in | std::ios::out);
+            file << content;
+        }
+        out.clear();
+        runXDiffCli({ file1.string(), file2.string() }, out, error);
+        expected.push_back(out);
+        out.clear();
+        runXDiffCli({ "--client=" + socket, file1.string(), file2.string() }, out, error);
+        served.push_back(out);
+    }
+
+    kill(pid, SIGTERM);
+    waitpid(pid, nullptr, 0);
+
+    ASSERT_TRUE(started) << "server did not create " << socket;
+    for (size_t i = 0; i < versions.size(); i++)
+        EXPECT_EQ(expected[i], served[i]) << "version " << i;
+}
+
+// Test that sidecar indexes are written, used, and ignored once stale or damaged
+TEST_F(XDiffCliTest, SidecarIndex)
+{
+    std::string content1, content2;
+    for (int i = 0; i < 500; i++) {
+        content1 += "line  " + std::to_string(i) + "\n";
+        content2 += (i % 40 ? "line " : "changed ") + std::to_string(i) + "\n";
+    }
+    createTestFile("file1.txt", content1);
+    createTestFile("file2.txt", content2);
+
+    std::string file1 = (test_dir / "file1.txt").string();
+    std::string file2 = (test_dir / "file2.txt").string();
+    fs::path side1 = test_dir / "file1.txt.xdi", side2 = test_dir / "file2.txt.xdi";
+    auto run = [&](std::vector<std::string> args) {
+        std::string output, error;
+        args.push_back(file1);
+        args.push_back(file2);
+        runXDiffCli(args, output, error);
+        return output;
+    };
+
+    std::string plain = run({}), ignored = run({ "-b" });
+    EXPECT_EQ(plain, run({ "--use-index" }));
+    EXPECT_FALSE(fs::exists(side1)) << "--use-index alone must not write sidecars";
+    EXPECT_EQ(plain, run({ "--write-index" }));
+    ASSERT_TRUE(fs::exists(side1));
+    ASSERT_TRUE(fs::exists(side2));
+    EXPECT_EQ(plain, run({ "--use-index" }));
+    EXPECT_EQ(ignored, run({ "-b", "--use-index" })) << "Sidecars of other flags are not used";
+
+    // Same size, other content: the checksum rules the sidecar out
+    content2[content2.find("line 7")] = 'L';
+    createTestFile("file2.txt", content2);
+    plain = run({});
+    EXPECT_EQ(plain, run({ "--use-index" }));
+
+    fs::resize_file(side1, fs::file_size(side1) / 2);
+    EXPECT_EQ(plain, run({ "--use-index" }));
+    auto damaged = fs::file_size(side1);
+    EXPECT_EQ(plain, run({ "--use-index", "--write-index" }));
+    EXPECT_NE(damaged, fs::file_size(side1)) << "A stale sidecar is rewritten";
+
+    std::string output, error;
+    EXPECT_NE(0, runXDiffCli({ "-r", "--use-index", test_dir.string(), test_dir.string() },
+                             output, error));
+    EXPECT_NE(std::string::npos, output.find("only apply to the comparison of two files"));
+}
+
+// Test that --history prints the diff of each version against the next, in order
+TEST_F(XDiffCliTest, HistoryMode)
+{
+    std::vector<std::string> files;
+    std::string content;
+    for (int i = 0; i < 300; i++)
+        content += "line " + std::to_string(i) + "\n";
+    for (int v = 0; v < 5; v++) {
+        std::string name = "v" + std::to_string(v) + ".txt";
+        createTestFile(name, content);
+        files.push_back((test_dir / name).string());
+        content.insert(content.find("line " + std::to_string(50 * v + 7) + "\n"),
+                       "version " + std::to_string(v) + "\n");
+        std::string gone = "line " + std::to_string(50 * v + 30) + "\n";
+        content.erase(content.find(gone), gone.size());
+    }
+    createTestFile("same.txt", content);
+    files.push_back(files.back());
+
+    std::string expected, output, error;
+    for (size_t i = 0; i + 1 < files.size(); i++)
+        runXDiffCli({ "--moved=zebra", files[i], files[i + 1] }, expected, error);
+    ASSERT_NE(std::string::npos, expected.find("+version 3"));
+
+    std::vector<std::string> args = { "--history", "--moved=zebra" };
+    args.insert(args.end(), files.begin(), files.end());
+    EXPECT_EQ(0, runXDiffCli(args, output, error));
+    EXPECT_EQ(expected, output);
+    output.clear();
+    args.insert(args.begin(), "-j3");
+    EXPECT_EQ(0, runXDiffCli(args, output, error));
+    EXPECT_EQ(expected, output);
+
+    output.clear();
+    args[0] = "-q";
+    EXPECT_EQ(1, runXDiffCli(args, output, error));
+    EXPECT_EQ(4, std::count(output.begin(), output.end(), '\n')) << output;
+
+    output.clear();
+    EXPECT_NE(0, runXDiffCli({ "--history", files[0] }, output, error));
+    EXPECT_NE(std::string::npos, output.find("at least two file arguments required"));
+    output.clear();
+    EXPECT_NE(0, runXDiffCli({ "--history", files[0], (test_dir / "missing").string() }, output,
+                             error));
+    EXPECT_NE(std::string::npos, output.find("cannot read file"));
+}
+
+// Test the exact and sketched line similarity of two files
+TEST_F(XDiffCliTest, SimilarityOption)
+{
+    std::string content1, content2;
+    for (int i = 0; i < 1000; i++) {
+        content1 += "line " + std::to_string(i) + "\n";
+        content2 += (i % 4 ? "line " : "other ") + std::to_string(i) + "\n";
+    }
+    createTestFile("sim1.txt", content1);
+    createTestFile("sim2.txt", content2);
+    std::string file1 = (test_dir / "sim1.txt").string();
+    std::string file2 = (test_dir / "sim2.txt").string();
+
+    std::string output, error;
+    EXPECT_EQ(0, runXDiffCli({ "--similarity", file1, file2 }, output, error));
+    EXPECT_EQ("75% similar: 750 of 1000 and 1000 lines shared\n", output);
+
+    output.clear();
+    EXPECT_EQ(0, runXDiffCli({ "--similarity=sketch", file1, file2 }, output, error));
+    long percent = atol(output.c_str());
+    EXPECT_GE(percent, 60) << output;
+    EXPECT_LE(percent, 90) << output;
+
+    output.clear();
+    EXPECT_EQ(0, runXDiffCli({ "--similarity=sketch", file1, file1 }, output, error));
+    EXPECT_EQ("100% similar: 1000 of 1000 and 1000 lines shared\n", output);
+
+    output.clear();
+    EXPECT_NE(0, runXDiffCli({ "--similarity=fuzzy", file1, file2 }, output, error));
+    EXPECT_NE(std::string::npos, output.find("invalid similarity mode"));
+    output.clear();
+    EXPECT_NE(0, runXDiffCli({ "--similarity", "-r", file1, file2 }, output, error));
+    EXPECT_NE(std::string::npos, output.find("cannot be combined"));
+}
+
+// Test hunk line numbers when most of the file is a common prefix and suffix
+TEST_F(XDiffCliTest, LargeCommonPrefixSuffix)
+{
+    std::string content1, content2;
+    for (int i = 1; i <= 1000; i++) {
+        content1 += "line" + std::to_string(i) + "\n";
+        content2 += (i == 500 ? std::string("modified") : "line" + std::to_string(i)) + "\n";
+    }
+    createTestFile("file1.txt", content1);
+    createTestFile("file2.txt", content2);
+
+    std::string output, error;
+    fs::path file1 = test_dir / "file1.txt";
+    fs::path file2 = test_dir / "file2.txt";
+
+    for (const char *algorithm : { "--minimal", "--patience", "--histogram" }) {
+        output.clear();
+        int status = runXDiffCli({ algorithm, file1.string(), file2.string() }, output, error);
+
+        EXPECT_EQ(0, status) << algorithm;
+        EXPECT_NE(std::string::npos, output.find("@@ -497,7 +497,7 @@")) << algorithm << output;
+        EXPECT_NE(std::string::npos, output.find("-line500\n+modified\n")) << algorithm;
+    }
+}
+
+// Test that files compared in windows under --max-memory give the in-memory diff
+TEST_F(XDiffCliTest, StreamMaxMemory)
+{
+    std::string content1, content2;
+    for (int i = 1; i <= 60000; i++) {
+        std::string line = "line" + std::to_string(i) + "\n";
+        content1 += line;
+        if (i % 7919 == 0)
+            content2 += "modified" + std::to_string(i) + "\n";
+        else if (i == 30000)
+            for (int j = 0; j < 5000; j++)
+                content2 += "inserted" + std::to_string(j) + "\n";
+        else if (i < 45000 || i > 47000)
+            content2 += line;
+    }
+    createTestFile("file1.txt", content1);
+    createTestFile("file2.txt", content2 + "end");
+
+    std::string memory, stream, brief, error;
+    fs::path file1 = test_dir / "file1.txt";
+    fs::path file2 = test_dir / "file2.txt";
+
+    int status1 = runXDiffCli({ "--moved=no", file1.string(), file2.string() }, memory, error);
+    int status2 = runXDiffCli({ "--max-memory=1", file1.string(), file2.string() }, stream, error);
+    int status3 = runXDiffCli({ "-q", "--max-memory=1", file1.string(), file2.string() }, brief,
+                              error);
+    std::string failed;
+    int status4 = runXDiffCli({ "-B", "--max-memory=1", file1.string(), file2.string() }, failed,
+                              error);
+
+    EXPECT_EQ(0, status1);
+    EXPECT_EQ(0, status2);
+    EXPECT_NE(std::string::npos, stream.find("\\ No newline at end of file"));
+    EXPECT_EQ(memory, stream);
+    EXPECT_EQ(1, status3);
+    EXPECT_EQ("Files " + file1.string() + " and " + file2.string() + " differ\n", brief);
+    EXPECT_EQ(1, status4);
+    EXPECT_NE(std::string::npos, failed.find("cannot be combined")) << failed;
+}
+
+// Test that files held in one window each give the in-memory diff, and
+// that --moved and --stats are refused for them
+TEST_F(XDiffCliTest, StreamOneWindow)
+{
+    // Over 1MB / STREAM_BYTES_FACTOR together, under the 64KB window each
+    std::string content1, content2;
+    for (int i = 1; i <= 5400; i++) {
+        std::string line = "row " + std::to_string(i) + (i % 3 ? " a\n" : "  a\n");
+        content1 += line;
+        if (i % 400 == 0)
+            content2 += "changed " + std::to_string(i) + "\n";
+        else if (i % 900 == 0)
+            content2 += line + "added " + std::to_string(i) + "\n";
+        else if (i < 2000 || i > 2010)
+            content2 += i % 5 ? line : "row " + std::to_string(i) + " a\n";
+    }
+    createTestFile("file1.txt", content1);
+    createTestFile("file2.txt", content2 + "end");
+    ASSERT_GT(content1.size() + content2.size(), (1u << 20) / 9);
+    ASSERT_LT(content1.size(), 64u * 1024);
+    ASSERT_LT(content2.size(), 64u * 1024);
+
+    fs::path file1 = test_dir / "file1.txt";
+    fs::path file2 = test_dir / "file2.txt";
+    for (const char *opt : { "--unified=3", "--unified=0", "--unified=10", "-w" }) {
+        std::string memory, stream, error;
+        int status1 = runXDiffCli({ "--moved=no", opt, file1.string(), file2.string() }, memory,
+                                  error);
+        int status2 = runXDiffCli({ "--max-memory=1", opt, file1.string(), file2.string() },
+                                  stream, error);
+
+        EXPECT_EQ(0, status1) << opt;
+        EXPECT_EQ(0, status2) << opt;
+        EXPECT_NE(std::string::npos, memory.find("@@")) << opt;
+        EXPECT_EQ(memory, stream) << opt;
+    }
+
+    std::string moved, stats, plain, error;
+    int status1 = runXDiffCli({ "--max-memory=1", "--moved=plain", file1.string(), file2.string() },
+                              moved, error);
+    int status2 = runXDiffCli({ "--max-memory=1", "--stats", file1.string(), file2.string() },
+                              stats, error);
+    int status3 = runXDiffCli({ "--max-memory=1", "--moved=no", file1.string(), file2.string() },
+                              plain, error);
+
+    EXPECT_NE(0, status1);
+    EXPECT_NE(std::string::npos, moved.find("--moved and --stats cannot be used")) << moved;
+    EXPECT_NE(0, status2);
+    EXPECT_NE(std::string::npos, stats.find("--moved and --stats cannot be used")) << stats;
+    EXPECT_EQ(0, status3);
+    EXPECT_NE(std::string::npos, plain.find("@@")) << plain;
+}
+
+// Test that a binary delta written by --bdiff rebuilds the new file with --bpatch
+TEST_F(XDiffCliTest, BinaryDeltaRoundTrip)
+{
+    std::string content1, content2;
+    unsigned int seed = 1;
+    for (int i = 0; i < 200000; i++) {
+        seed = seed * 1103515245 + 12345;
+        content1 += (char)(seed >> 16);
+    }
+    content2 = content1.substr(0, 50000) + std::string(300, '\0') + content1.substr(50000, 90000) +
+               content1.substr(150000) + content1.substr(1000, 2000);
+    createTestFile("old.bin", content1);
+    createTestFile("new.bin", content2);
+    createTestFile("other.bin", content2);
+
+    std::string output, error;
+    fs::path old_file = test_dir / "old.bin";
+    fs::path new_file = test_dir / "new.bin";
+    fs::path other = test_dir / "other.bin";
+    fs::path delta = test_dir / "delta";
+    fs::path rebuilt = test_dir / "rebuilt.bin";
+
+    int status1 = runXDiffCli({ "--bdiff", old_file.string(), new_file.string(), ">",
+                                delta.string() }, output, error);
+    int status2 = runXDiffCli({ "--bpatch", old_file.string(), delta.string(), ">",
+                                rebuilt.string() }, output, error);
+    std::string failed;
+    int status3 = runXDiffCli({ "--bpatch", other.string(), delta.string() }, failed, error);
+
+    std::ifstream in(rebuilt, std::ios::binary);
+    std::string result((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    EXPECT_EQ(0, status1);
+    EXPECT_EQ(0, status2);
+    EXPECT_LT(fs::file_size(delta), 1000u) << "Copied regions must not be stored literally";
+    EXPECT_EQ(content2, result);
+    EXPECT_EQ(1, status3);
+    EXPECT_NE(std::string::npos, failed.find("is not a delta against")) << failed;
+}
+
+// Test that binary files are reported without a line diff unless -a is given
+TEST_F(XDiffCliTest, BinaryFiles)
+{
+    std::string late_nul = std::string(20000, 'x') + '\n' + std::string(1, '\0') + "\n";
+    createTestFile("file1.bin", std::string("line1\n\x01\x02\x03\0line2\n", 14));
+    createTestFile("file2.bin", std::string("line1\n\x01\x02\x04\0line2\n", 14));
+    createTestFile("copy.bin", std::string("line1\n\x01\x02\x03\0line2\n", 14));
+    createTestFile("late1.txt", late_nul);
+    createTestFile("late2.txt", late_nul + "tail\n");
+    createTestFile("large1.bin", std::string(1, '\0') + std::string(1 << 20, 'x') + "1");
+    createTestFile("large2.bin", std::string(1, '\0') + std::string(1 << 20, 'x') + "2");
+
+    std::string output, brief, same, text, late, scan, large, error;
+    fs::path file1 = test_dir / "file1.bin";
+    fs::path file2 = test_dir / "file2.bin";
+    fs::path copy = test_dir / "copy.bin";
+    fs::path late1 = test_dir / "late1.txt";
+    fs::path late2 = test_dir / "late2.txt";
+    fs::path large1 = test_dir / "large1.bin";
+    fs::path large2 = test_dir / "large2.bin";
+
+    int status1 = runXDiffCli({ file1.string(), file2.string() }, output, error);
+    int status2 = runXDiffCli({ "-q", file1.string(), file2.string() }, brief, error);
+    int status3 = runXDiffCli({ "-q", file1.string(), copy.string() }, same, error);
+    int status4 = runXDiffCli({ "-a", file1.string(), file2.string() }, text, error);
+    runXDiffCli({ late1.string(), late2.string() }, late, error);
+    runXDiffCli({ "--binary-scan=0", late1.string(), late2.string() }, scan, error);
+    int status5 = runXDiffCli({ "--max-memory=1", large1.string(), large2.string() }, large, error);
+
+    EXPECT_EQ(0, status1);
+    EXPECT_EQ("Binary files " + file1.string() + " and " + file2.string() + " differ\n", output);
+    EXPECT_EQ(1, status2);
+    EXPECT_EQ("Files " + file1.string() + " and " + file2.string() + " differ\n", brief);
+    EXPECT_EQ(0, status3);
+    EXPECT_EQ("", same);
+    EXPECT_EQ(0, status4);
+    EXPECT_NE(std::string::npos, text.find("@@")) << text;
+    EXPECT_NE(std::string::npos, late.find("+tail")) << "Only the first 8KB are checked by default";
+    EXPECT_EQ("Binary files " + late1.string() + " and " + late2.string() + " differ\n", scan);
+    EXPECT_EQ(0, status5);
+    EXPECT_EQ("Binary files " + large1.string() + " and " + large2.string() + " differ\n", large);
+}
+
+// Test that --stats reports the phases and counters of each diff
+TEST_F(XDiffCliTest, StatsOption)
+{
+    std::string content1, content2, content3;
+    for (int i = 0; i < 1000; i++) {
+        content1 += "line " + std::to_string(i) + "\n";
+        content2 += (i % 50 ? "line " : "changed ") + std::to_string(i) + "\n";
+        // Every 50th line moves down by one, so no line is unique to a file
+        content3 += "line " + std::to_string(i % 50 == 0 ? i + 1 : i % 50 == 1 ? i - 1 : i) + "\n";
+    }
+    createTestFile("file1.txt", content1);
+    createTestFile("file2.txt", content2);
+    createTestFile("file3.txt", content3);
+
+    std::string plain, output, moved, histogram, error;
+    fs::path file1 = test_dir / "file1.txt";
+    fs::path file2 = test_dir / "file2.txt";
+    fs::path file3 = test_dir / "file3.txt";
+
+    runXDiffCli({ file1.string(), file2.string() }, plain, error);
+    int status = runXDiffCli({ "--stats", file1.string(), file2.string() }, output, error);
+    runXDiffCli({ "--stats", file1.string(), file3.string() }, moved, error);
+    runXDiffCli({ "--stats", "--histogram", file1.string(), file3.string() }, histogram, error);
+
+    EXPECT_EQ(0, status);
+    EXPECT_EQ(0u, output.find(plain)) << "The diff itself is unchanged";
+    EXPECT_NE(std::string::npos, output.find("stats for " + file1.string()));
+    for (const char *field : { "prepare", "cleanup", "algorithm", "compact", "script", "emit" })
+        EXPECT_NE(std::string::npos, output.find(std::string("  ") + field + " ")) << field;
+    EXPECT_NE(std::string::npos, output.find("records      1000 / 1000, ")) << output;
+    EXPECT_NE(std::string::npos, output.find(", 40 discarded")) << "Changed lines match nothing";
+    EXPECT_NE(std::string::npos, output.find("memory       peak ")) << output;
+    EXPECT_EQ(std::string::npos, moved.find("splits       0,")) << moved;
+    EXPECT_NE(std::string::npos, moved.find(", 0 discarded")) << moved;
+    EXPECT_NE(std::string::npos, histogram.find("splits       0,")) << histogram;
+}
@@ -0,0 +1,486 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "xdiff.h"
+
+namespace {
+
+// Engines whose output is checked against each other; add new ones here
+struct Engine {
+    const char *name;
+    unsigned long flags;
+};
+
+const Engine engines[] = {
+    { "myers", 0 },
+    { "minimal", XDF_NEED_MINIMAL },
+    { "indent", XDF_INDENT_HEURISTIC },
+    { "patience", XDF_PATIENCE_DIFF },
+    { "histogram", XDF_HISTOGRAM_DIFF },
+};
+
+// xorshift64*, so that the corpora are the same everywhere
+struct Rng {
+    unsigned long long state;
+
+    explicit Rng(unsigned long long seed) : state(seed * 2654435761ULL + 1) {}
+
+    unsigned long next()
+    {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return (unsigned long)((state * 0x2545F4914F6CDD1DULL) >> 32);
+    }
+
+    long range(long lo, long hi) { return lo + (long)(next() % (unsigned long)(hi - lo + 1)); }
+};
+
+const char *const commonLines[] = { "}", "{", "", "\treturn 0;", "\t}", "\t\tbreak;", "#endif" };
+
+std::string genLine(Rng &rng, int dupPercent)
+{
+    if (rng.range(0, 99) < dupPercent)
+        return std::string(commonLines[rng.next() % 7]) + "\n";
+
+    std::string line(rng.range(0, 2), '\t');
+    for (long len = rng.range(1, 40); len > 0; len--)
+        line += len % 6 ? (char)('a' + rng.next() % 26) : ' ';
+    return line + "\n";
+}
+
+std::vector<std::string> splitLines(const std::string &s)
+{
+    std::vector<std::string> lines;
+    size_t start = 0;
+
+    while (start < s.size()) {
+        size_t end = s.find('\n', start);
+        end = end == std::string::npos ? s.size() : end + 1;
+        lines.push_back(s.substr(start, end - start));
+        start = end;
+    }
+    return lines;
+}
+
+std::string genFile(Rng &rng, long lines, int dupPercent)
+{
+    std::string s;
+    for (long i = 0; i < lines; i++)
+        s += genLine(rng, dupPercent);
+    return s;
+}
+
+// Replace, delete and insert lines at 'editPercent', and move 'moves' blocks
+std::string editFile(Rng &rng, const std::string &base, int editPercent, int moves, int dupPercent)
+{
+    std::vector<std::string> lines = splitLines(base), out;
+
+    for (int m = 0; m < moves && lines.size() > 40; m++) {
+        long len = rng.range(3, 15), from = rng.range(0, (long)lines.size() - len);
+        std::vector<std::string> block(lines.begin() + from, lines.begin() + from + len);
+        lines.erase(lines.begin() + from, lines.begin() + from + len);
+        long to = rng.range(0, (long)lines.size());
+        lines.insert(lines.begin() + to, block.begin(), block.end());
+    }
+    for (const std::string &line : lines) {
+        if (rng.range(0, 999) >= editPercent * 10) {
+            out.push_back(line);
+            continue;
+        }
+        switch (rng.next() % 3) {
+        case 0:
+            out.push_back(genLine(rng, dupPercent));
+            break;
+        case 1:
+            break;
+        default:
+            out.push_back(genLine(rng, dupPercent));
+            out.push_back(line);
+            break;
+        }
+    }
+    std::string s;
+    for (const std::string &line : out)
+        s += line;
+    return s;
+}
+
+mmfile_t makeFile(std::string &content)
+{
+    mmfile_t mf;
+    mf.ptr = content.empty() ? nullptr : &content[0];
+    mf.size = (long)content.size();
+    return mf;
+}
+
+// Applies the unified diff as xdl_diff() emits it to the lines of the first file
+struct Patch {
+    const std::vector<std::string> *a;
+    size_t pos = 0;
+    std::string out;
+    std::string error;
+};
+
+int patchHunk(void *priv, long old_begin, long old_nr, long, long, const char *, long)
+{
+    Patch *p = static_cast<Patch *>(priv);
+    // An empty old range starts after the given line
+    size_t start = old_nr ? old_begin - 1 : old_begin;
+
+    if (start < p->pos || start > p->a->size()) {
+        p->error = "hunk out of order at line " + std::to_string(old_begin);
+        return -1;
+    }
+    for (; p->pos < start; p->pos++)
+        p->out += (*p->a)[p->pos];
+    return 0;
+}
+
+int patchLine(void *priv, mmbuffer_t *mb, int nbuf)
+{
+    Patch *p = static_cast<Patch *>(priv);
+    std::string line(mb[1].ptr, mb[1].size);
+    char op = nbuf > 1 && mb[0].size ? mb[0].ptr[0] : '?';
+
+    if (op == '+') {
+        p->out += line;
+        return 0;
+    }
+    if (op != ' ' && op != '-') {
+        p->error = "unexpected line prefix";
+        return -1;
+    }
+    if (p->pos >= p->a->size() || (*p->a)[p->pos] != line) {
+        p->error = std::string(op == ' ' ? "context" : "deleted") + " line " +
+                   std::to_string(p->pos + 1) + " does not match the first file";
+        return -1;
+    }
+    if (op == ' ')
+        p->out += line;
+    p->pos++;
+    return 0;
+}
+
+// Diff 'a' against 'b' and check that the emitted script turns one into the other
+::testing::AssertionResult scriptTransforms(std::string a, std::string b, unsigned long flags,
+                                            long ctxlen)
+{
+    std::vector<std::string> aLines = splitLines(a);
+    mmfile_t mf1 = makeFile(a), mf2 = makeFile(b);
+    xpparam_t xpp;
+    xdemitconf_t xecfg;
+    xdemitcb_t ecb;
+    Patch patch;
+
+    patch.a = &aLines;
+    memset(&xpp, 0, sizeof(xpp));
+    xpp.flags = flags;
+    memset(&xecfg, 0, sizeof(xecfg));
+    xecfg.ctxlen = ctxlen;
+    memset(&ecb, 0, sizeof(ecb));
+    ecb.priv = &patch;
+    ecb.out_hunk = patchHunk;
+    ecb.out_line = patchLine;
+
+    if (xdl_diff(&mf1, &mf2, &xpp, &xecfg, &ecb) < 0)
+        return ::testing::AssertionFailure() << "xdl_diff() failed: " << patch.error;
+    for (; patch.pos < aLines.size(); patch.pos++)
+        patch.out += aLines[patch.pos];
+    if (patch.out != b)
+        return ::testing::AssertionFailure() << "the script does not produce the second file";
+    return ::testing::AssertionSuccess();
+}
+
+// Allocator counting its calls, for the allocation budgets
+struct CountingAlloc {
+    xdlalloc_t alloc;
+    long calls = 0;
+};
+
+void *countMalloc(void *priv, size_t size)
+{
+    static_cast<CountingAlloc *>(priv)->calls++;
+    return malloc(size);
+}
+
+void *countRealloc(void *priv, void *ptr, size_t size)
+{
+    static_cast<CountingAlloc *>(priv)->calls++;
+    return realloc(ptr, size);
+}
+
+void countFree(void *, void *ptr)
+{
+    free(ptr);
+}
+
+int discardLine(void *, mmbuffer_t *, int)
+{
+    return 0;
+}
+
+int runDiff(std::string &a, std::string &b, unsigned long flags, xdlmemstats_t *memstats,
+            const xdlalloc_t *alloc)
+{
+    mmfile_t mf1 = makeFile(a), mf2 = makeFile(b);
+    xpparam_t xpp;
+    xdemitconf_t xecfg;
+    xdemitcb_t ecb;
+
+    memset(&xpp, 0, sizeof(xpp));
+    xpp.flags = flags;
+    xpp.memstats = memstats;
+    xpp.alloc = alloc;
+    memset(&xecfg, 0, sizeof(xecfg));
+    xecfg.ctxlen = 3;
+    memset(&ecb, 0, sizeof(ecb));
+    ecb.out_line = discardLine;
+    return xdl_diff(&mf1, &mf2, &xpp, &xecfg, &ecb);
+}
+
+double bestOf(int runs, const std::function<void()> &fn)
+{
+    double best = 1e30;
+
+    for (int i = 0; i < runs; i++) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+/*
+ * Reference work the budgets are relative to, so that they hold on slow
+ * and fast machines and in optimized and debug builds alike: hash every
+ * line of both files into an open-addressing table, as the classifier
+ * does. Written out by hand so that it is compiled like the library.
+ */
+long calibrationWork(const std::string &a, const std::string &b)
+{
+    size_t size = 1;
+    while (size < (a.size() + b.size()) / 8)
+        size <<= 1;
+    std::vector<unsigned long> table(size);
+    long distinct = 0;
+
+    for (const std::string *s : { &a, &b }) {
+        unsigned long h = 5381;
+        for (size_t i = 0; i < s->size(); i++) {
+            h = h * 33 + (unsigned char)(*s)[i];
+            if ((*s)[i] != '\n')
+                continue;
+            size_t slot = h & (size - 1);
+            while (table[slot] && table[slot] != h)
+                slot = (slot + 1) & (size - 1);
+            if (!table[slot]) {
+                table[slot] = h;
+                distinct++;
+            }
+            h = 5381;
+        }
+    }
+    return distinct;
+}
+
+// Fixed corpora of the budgets
+struct Corpus {
+    const char *name;
+    std::string a, b;
+};
+
+std::vector<Corpus> &perfCorpora()
+{
+    static std::vector<Corpus> corpora;
+
+    if (corpora.empty()) {
+        Rng rng(42);
+        std::string base = genFile(rng, 40000, 10);
+        corpora.push_back({ "sparse", base, editFile(rng, base, 1, 10, 10) });
+        corpora.push_back({ "dense", base, editFile(rng, base, 30, 0, 10) });
+        std::string dups = genFile(rng, 40000, 70);
+        corpora.push_back({ "duplicates", dups, editFile(rng, dups, 2, 20, 70) });
+        corpora.push_back({ "unrelated", base, genFile(rng, 40000, 10) });
+    }
+    return corpora;
+}
+
+/*
+ * Time budgets as multiples of the calibration work on the same corpus,
+ * at about three times the ratios of an optimized build. The library
+ * gains less from optimization than the calibration loop does, so debug
+ * builds run further below them.
+ */
+struct TimeBudget {
+    const char *corpus;
+    const char *engine;
+    double ratio;
+};
+
+const TimeBudget timeBudgets[] = {
+    { "sparse", "myers", 10 },          { "sparse", "minimal", 10 },
+    { "sparse", "indent", 10 },         { "sparse", "patience", 12 },
+    { "sparse", "histogram", 10 },      { "dense", "myers", 12 },
+    { "dense", "minimal", 16 },         { "dense", "indent", 15 },
+    { "dense", "patience", 15 },        { "dense", "histogram", 25 },
+    { "duplicates", "myers", 13 },      { "duplicates", "minimal", 13 },
+    { "duplicates", "indent", 12 },     { "duplicates", "patience", 10 },
+    { "duplicates", "histogram", 16 },  { "unrelated", "myers", 16 },
+    { "unrelated", "minimal", 25 },     { "unrelated", "indent", 16 },
+    { "unrelated", "patience", 23 },    { "unrelated", "histogram", 16 },
+};
+
+/*
+ * Allocation budgets: peak bytes in use per input byte and allocator
+ * calls per input line. Both are deterministic, so they sit only a
+ * quarter above what the library needs.
+ */
+struct AllocBudget {
+    const char *corpus;
+    const char *engine;
+    double peakPerByte;
+    double callsPerLine;
+};
+
+const AllocBudget allocBudgets[] = {
+    { "sparse", "myers", 7.5, 0.007 },       { "sparse", "minimal", 7.5, 0.007 },
+    { "sparse", "indent", 7.5, 0.007 },      { "sparse", "patience", 6.5, 0.009 },
+    { "sparse", "histogram", 7.2, 0.032 },   { "dense", "myers", 8.3, 0.15 },
+    { "dense", "minimal", 8.3, 0.15 },       { "dense", "indent", 8.3, 0.15 },
+    { "dense", "patience", 7.3, 0.23 },      { "dense", "histogram", 8.0, 0.78 },
+    { "duplicates", "myers", 13.2, 0.014 },  { "duplicates", "minimal", 13.2, 0.014 },
+    { "duplicates", "indent", 13.2, 0.014 }, { "duplicates", "patience", 12.8, 0.02 },
+    { "duplicates", "histogram", 12.3, 0.064 }, { "unrelated", "myers", 9.8, 0.006 },
+    { "unrelated", "minimal", 9.8, 0.006 },  { "unrelated", "indent", 9.8, 0.006 },
+    { "unrelated", "patience", 8.7, 0.058 }, { "unrelated", "histogram", 8.9, 0.012 },
+};
+
+const Engine &engine(const char *name)
+{
+    for (const Engine &e : engines)
+        if (!strcmp(e.name, name))
+            return e;
+    abort();
+}
+
+} // namespace
+
+// Test that every engine emits a script that turns the first file into the second
+TEST(XDiffCrossEngineTest, ScriptsTransformFile1IntoFile2)
+{
+    for (unsigned long seed = 1; seed <= 60; seed++) {
+        Rng rng(seed);
+        int dup = (int)rng.range(0, 80), edit = (int)rng.range(1, 40);
+        std::string a = genFile(rng, rng.range(0, 400), dup);
+        std::string b = editFile(rng, a, edit, (int)rng.range(0, 5), dup);
+
+        for (const Engine &e : engines)
+            for (long ctxlen : { 0L, 3L })
+                EXPECT_TRUE(scriptTransforms(a, b, e.flags, ctxlen))
+                    << e.name << " seed " << seed << " context " << ctxlen;
+    }
+}
+
+// Test the scripts of the corner cases: empty files, missing final newlines, no common lines
+TEST(XDiffCrossEngineTest, EdgeCases)
+{
+    const std::pair<std::string, std::string> cases[] = {
+        { "", "" },
+        { "", "a\nb\n" },
+        { "a\nb\n", "" },
+        { "a\nb", "a\nb\n" },
+        { "a\nb\n", "a\nc" },
+        { "x\ny\nz\n", "p\nq\n" },
+        { "a\na\na\na\n", "a\na\n" },
+        { "a\nb\na\nb\n", "b\na\nb\na\n" },
+    };
+
+    for (const auto &c : cases)
+        for (const Engine &e : engines)
+            EXPECT_TRUE(scriptTransforms(c.first, c.second, e.flags, 3))
+                << e.name << ": '" << c.first << "' -> '" << c.second << "'";
+    for (const Corpus &c : perfCorpora())
+        for (const Engine &e : engines)
+            EXPECT_TRUE(scriptTransforms(c.a, c.b, e.flags, 3)) << e.name << " on " << c.name;
+}
+
+// Test that a merge with one unchanged side gives the other side, with every engine
+TEST(XDiffCrossEngineTest, MergeWithOneSideUnchanged)
+{
+    Rng rng(7);
+    std::string base = genFile(rng, 300, 20), ours = editFile(rng, base, 10, 2, 20);
+
+    for (const Engine &e : engines) {
+        mmfile_t orig = makeFile(base), mf1 = makeFile(ours), mf2 = makeFile(base);
+        xmparam_t xmp;
+        mmbuffer_t result;
+
+        memset(&xmp, 0, sizeof(xmp));
+        xmp.xpp.flags = e.flags;
+        xmp.level = XDL_MERGE_ZEALOUS;
+        xmp.marker_size = DEFAULT_CONFLICT_MARKER_SIZE;
+        ASSERT_EQ(0, xdl_merge(&orig, &mf1, &mf2, &xmp, &result)) << e.name;
+        EXPECT_EQ(ours, std::string(result.ptr, result.size)) << e.name;
+        xdl_free(result.ptr);
+    }
+}
+
+// Test that no engine got slower relative to the calibration work
+TEST(XDiffPerfTest, TimeBudgets)
+{
+    for (Corpus &c : perfCorpora()) {
+        long sink = 0;
+        double calibration = bestOf(5, [&] { sink += calibrationWork(c.a, c.b); });
+        ASSERT_GT(sink, 0);
+
+        for (const TimeBudget &budget : timeBudgets) {
+            if (strcmp(budget.corpus, c.name))
+                continue;
+            unsigned long flags = engine(budget.engine).flags;
+            double t = bestOf(3, [&] { ASSERT_EQ(0, runDiff(c.a, c.b, flags, nullptr, nullptr)); });
+            double ratio = t / calibration;
+
+            RecordProperty(std::string(c.name) + "." + budget.engine, std::to_string(ratio));
+            EXPECT_LE(ratio, budget.ratio)
+                << budget.engine << " on " << c.name << " took " << t * 1e3 << " ms, "
+                << "calibration " << calibration * 1e3 << " ms";
+        }
+    }
+}
+
+// Test that no engine needs more memory or allocator calls than it used to
+TEST(XDiffPerfTest, AllocationBudgets)
+{
+    for (Corpus &c : perfCorpora()) {
+        double bytes = (double)(c.a.size() + c.b.size());
+        double lines = (double)(splitLines(c.a).size() + splitLines(c.b).size());
+
+        for (const AllocBudget &budget : allocBudgets) {
+            if (strcmp(budget.corpus, c.name))
+                continue;
+            CountingAlloc ca;
+            xdlmemstats_t stats;
+
+            ca.alloc.malloc = countMalloc;
+            ca.alloc.realloc = countRealloc;
+            ca.alloc.free = countFree;
+            ca.alloc.priv = &ca;
+            ASSERT_EQ(0, runDiff(c.a, c.b, engine(budget.engine).flags, &stats, &ca.alloc));
+
+            RecordProperty(std::string(c.name) + "." + budget.engine + ".peak",
+                           std::to_string(stats.peak / bytes));
+            RecordProperty(std::string(c.name) + "." + budget.engine + ".calls",
+                           std::to_string(ca.calls / lines));
+            EXPECT_LE(stats.peak / bytes, budget.peakPerByte) << budget.engine << " on " << c.name;
+            EXPECT_LE(ca.calls / lines, budget.callsPerLine) << budget.engine << " on " << c.name;
+        }
+    }
+}
@@ -0,0 +1,300 @@
+/*
+ *  LibXDiff by Davide Libenzi ( File Differential Library )
+ *  Copyright (C) 2003  Davide Libenzi
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Davide Libenzi <davidel@xmailserver.org>
+ *
+ */
+
+#include "xinclude.h"
+
+#define XDL_ARENA_CHUNK (64 * 1024)
+
+/* Alignment of every block, enough for any scalar type */
+#define XDL_ARENA_ALIGN 16
+
+#define XDL_ARENA_ROUND(n) (((n) + XDL_ARENA_ALIGN - 1) & ~(size_t)(XDL_ARENA_ALIGN - 1))
+
+/* Each block is preceded by a header holding its size */
+#define XDL_ARENA_HDR XDL_ARENA_ROUND(sizeof(size_t))
+
+typedef struct s_xdlachunk {
+    struct s_xdlachunk *next;
+    size_t size; /* Bytes of data */
+    size_t used;
+    /* Data follows, aligned */
+} xdlachunk_t;
+
+#define XDL_CHUNK_DATA(c) ((char *)(c) + XDL_ARENA_ROUND(sizeof(xdlachunk_t)))
+
+static xdlachunk_t *xdl_arena_chunk(size_t size)
+{
+    xdlachunk_t *c;
+
+    if (size > SIZE_MAX - XDL_ARENA_ROUND(sizeof(xdlachunk_t)) ||
+        !(c = (xdlachunk_t *)malloc(XDL_ARENA_ROUND(sizeof(xdlachunk_t)) + size)))
+        return NULL;
+    c->size = size;
+    c->used = 0;
+    return c;
+}
+
+static void *xdl_arena_malloc(void *priv, size_t size)
+{
+    xdlarena_t *arena = (xdlarena_t *)priv;
+    xdlachunk_t *c = arena->chunks;
+    size_t need;
+    char *ptr;
+
+    if (size > SIZE_MAX - 2 * XDL_ARENA_ALIGN)
+        return NULL;
+    need = XDL_ARENA_HDR + XDL_ARENA_ROUND(size);
+
+    if (!c || c->size - c->used < need) {
+        if (need > (size_t)arena->chunk_size / 2) {
+            /* Large blocks get a chunk of their own behind the current one */
+            if (!(c = xdl_arena_chunk(need)))
+                return NULL;
+            if (arena->chunks) {
+                c->next = arena->chunks->next;
+                arena->chunks->next = c;
+            } else {
+                c->next = NULL;
+                arena->chunks = c;
+            }
+        } else {
+            if ((c = arena->spare) != NULL)
+                arena->spare = c->next;
+            else if (!(c = xdl_arena_chunk(arena->chunk_size)))
+                return NULL;
+            c->next = arena->chunks;
+            arena->chunks = c;
+        }
+    }
+
+    ptr = XDL_CHUNK_DATA(c) + c->used;
+    c->used += need;
+    *(size_t *)ptr = size;
+    return ptr + XDL_ARENA_HDR;
+}
+
+/* Whether 'ptr' is the last block of the current chunk */
+static int xdl_arena_last(xdlarena_t *arena, char *ptr, size_t size)
+{
+    xdlachunk_t *c = arena->chunks;
+
+    return c && ptr + XDL_ARENA_ROUND(size) == XDL_CHUNK_DATA(c) + c->used;
+}
+
+static void xdl_arena_free_block(void *priv, void *ptr)
+{
+    xdlarena_t *arena = (xdlarena_t *)priv;
+    size_t size = *(size_t *)((char *)ptr - XDL_ARENA_HDR);
+
+    /* Only the last block can be given back; the rest waits for a reset */
+    if (xdl_arena_last(arena, (char *)ptr, size))
+        arena->chunks->used -= XDL_ARENA_HDR + XDL_ARENA_ROUND(size);
+}
+
+static void *xdl_arena_realloc(void *priv, void *ptr, size_t size)
+{
+    xdlarena_t *arena = (xdlarena_t *)priv;
+    size_t old;
+    void *res;
+
+    if (!ptr)
+        return xdl_arena_malloc(priv, size);
+    old = *(size_t *)((char *)ptr - XDL_ARENA_HDR);
+
+    /* Grow or shrink the last block in place */
+    if (xdl_arena_last(arena, (char *)ptr, old) && size <= SIZE_MAX - 2 * XDL_ARENA_ALIGN) {
+        xdlachunk_t *c = arena->chunks;
+        size_t used = c->used - XDL_ARENA_ROUND(old);
+
+        if (c->size - used >= XDL_ARENA_ROUND(size)) {
+            c->used = used + XDL_ARENA_ROUND(size);
+            *(size_t *)((char *)ptr - XDL_ARENA_HDR) = size;
+            return ptr;
+        }
+    }
+    if (size <= old) {
+        *(size_t *)((char *)ptr - XDL_ARENA_HDR) = size;
+        return ptr;
+    }
+    if (!(res = xdl_arena_malloc(priv, size)))
+        return NULL;
+    memcpy(res, ptr, old);
+    return res;
+}
+
+void xdl_arena_init(xdlarena_t *arena, long chunk_size)
+{
+    arena->alloc.malloc = xdl_arena_malloc;
+    arena->alloc.realloc = xdl_arena_realloc;
+    arena->alloc.free = xdl_arena_free_block;
+    arena->alloc.priv = arena;
+    arena->chunk_size = chunk_size > 0 ? chunk_size : XDL_ARENA_CHUNK;
+    arena->chunks = NULL;
+    arena->spare = NULL;
+}
+
+void xdl_arena_reset(xdlarena_t *arena)
+{
+    xdlachunk_t *c, *next;
+
+    for (c = arena->chunks; c; c = next) {
+        next = c->next;
+        if (c->size != (size_t)arena->chunk_size) {
+            free(c);
+            continue;
+        }
+        c->used = 0;
+        c->next = arena->spare;
+        arena->spare = c;
+    }
+    arena->chunks = NULL;
+}
+
+void xdl_arena_free(xdlarena_t *arena)
+{
+    xdlachunk_t *c, *next;
+
+    xdl_arena_reset(arena);
+    for (c = arena->spare; c; c = next) {
+        next = c->next;
+        free(c);
+    }
+    arena->spare = NULL;
+}
+
+/* Each metered block is preceded by a header holding its size */
+static void *xdl_meter_raw(xdlmeter_t *meter, void *ptr, size_t size)
+{
+    if (!meter->inner)
+        return realloc(ptr, size);
+    return ptr ? meter->inner->realloc(meter->inner->priv, ptr, size)
+               : meter->inner->malloc(meter->inner->priv, size);
+}
+
+/* Check that a block may go from 'old' to 'size' bytes */
+static int xdl_meter_take(xdlmeter_t *meter, size_t old, size_t size)
+{
+    if (size > LONG_MAX - XDL_ARENA_HDR ||
+        (meter->limit && size > old && (long)(size - old) > meter->limit - meter->live)) {
+        meter->exceeded = 1;
+        return -1;
+    }
+    return 0;
+}
+
+static void xdl_meter_count(xdlmeter_t *meter, long size)
+{
+    meter->live += size;
+    if (size > 0)
+        meter->stats->allocated[meter->phase] += size;
+    if (meter->live > meter->stats->peak)
+        meter->stats->peak = meter->live;
+}
+
+static void *xdl_meter_malloc(void *priv, size_t size)
+{
+    xdlmeter_t *meter = (xdlmeter_t *)priv;
+    char *ptr;
+
+    if (xdl_meter_take(meter, 0, size) < 0 ||
+        !(ptr = (char *)xdl_meter_raw(meter, NULL, XDL_ARENA_HDR + size)))
+        return NULL;
+    *(size_t *)ptr = size;
+    xdl_meter_count(meter, (long)size);
+    return ptr + XDL_ARENA_HDR;
+}
+
+static void *xdl_meter_realloc(void *priv, void *ptr, size_t size)
+{
+    xdlmeter_t *meter = (xdlmeter_t *)priv;
+    char *blk;
+    size_t old;
+
+    if (!ptr)
+        return xdl_meter_malloc(priv, size);
+    blk = (char *)ptr - XDL_ARENA_HDR;
+    old = *(size_t *)blk;
+    if (xdl_meter_take(meter, old, size) < 0 ||
+        !(blk = (char *)xdl_meter_raw(meter, blk, XDL_ARENA_HDR + size)))
+        return NULL;
+    *(size_t *)blk = size;
+    xdl_meter_count(meter, (long)size - (long)old);
+    return blk + XDL_ARENA_HDR;
+}
+
+static void xdl_meter_free(void *priv, void *ptr)
+{
+    xdlmeter_t *meter = (xdlmeter_t *)priv;
+    char *blk = (char *)ptr - XDL_ARENA_HDR;
+
+    meter->live -= (long)*(size_t *)blk;
+    if (!meter->inner)
+        free(blk);
+    else
+        meter->inner->free(meter->inner->priv, blk);
+}
+
+int xdl_meter_wanted(xpparam_t const *xpp)
+{
+    return xpp->max_memory > 0 || xpp->memstats;
+}
+
+void xdl_meter_init(xdlmeter_t *meter, xpparam_t const *xpp)
+{
+    meter->alloc.malloc = xdl_meter_malloc;
+    meter->alloc.realloc = xdl_meter_realloc;
+    meter->alloc.free = xdl_meter_free;
+    meter->alloc.priv = meter;
+    meter->inner = xpp->alloc;
+    meter->limit = xpp->max_memory > 0 ? xpp->max_memory : 0;
+    meter->live = 0;
+    meter->phase = XDL_MEM_PREPARE;
+    meter->exceeded = 0;
+    meter->stats = xpp->memstats ? xpp->memstats : &meter->own;
+    memset(meter->stats, 0, sizeof(*meter->stats));
+}
+
+static xdlmeter_t *xdl_meter_current(void)
+{
+    xdlalloc_t const *alloc = xdl_alloc_current();
+
+    return alloc && alloc->malloc == xdl_meter_malloc ? (xdlmeter_t *)alloc->priv : NULL;
+}
+
+void xdl_meter_phase(int phase)
+{
+    xdlmeter_t *meter = xdl_meter_current();
+
+    if (meter)
+        meter->phase = phase;
+}
+
+int xdl_meter_degrade(void)
+{
+    xdlmeter_t *meter = xdl_meter_current();
+
+    if (!meter || !meter->exceeded)
+        return 0;
+    meter->exceeded = 0;
+    meter->stats->degraded = 1;
+    return 1;
+}
@@ -0,0 +1,355 @@
+/*
+ *  LibXDiff by Davide Libenzi ( File Differential Library )
+ *  Copyright (C) 2003  Davide Libenzi
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Davide Libenzi <davidel@xmailserver.org>
+ *
+ */
+
+#include "xinclude.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * Delta format: the varint sizes of the source and target, the
+ * Adler-32 of the source in four little-endian bytes, then a sequence
+ * of operations. Each operation starts with the varint (len << 1 | copy).
+ * A literal (copy == 0) is followed by its 'len' bytes; a copy is
+ * followed by the zigzag varint distance of its source offset from the
+ * end of the previous copy, so that copies of consecutive source
+ * regions cost a single byte.
+ */
+
+#define XDL_BDIFF_BSIZE 16
+#define XDL_BDIFF_MIN_BSIZE 8
+
+/* Candidates of a hash bucket tried at each target offset */
+#define XDL_BDIFF_MAX_CHAIN 16
+
+/* Bytes of operations gathered before they are passed to out_line */
+#define XDL_BDIFF_OPBUF 4096
+
+/* Largest varint: 64 bits in 7-bit groups */
+#define XDL_BDIFF_VARINT_MAX 10
+
+#define XDL_BDIFF_HASH_MUL 0x01000193UL
+
+typedef struct s_bdiffout {
+    xdemitcb_t *ecb;
+    unsigned char ops[XDL_BDIFF_OPBUF];
+    long nops;
+    long last; /* Source offset just past the previous copy */
+} bdiffout_t;
+
+static unsigned long xdl_adler32(unsigned char const *data, long size)
+{
+    unsigned long a = 1, b = 0;
+
+    while (size > 0) {
+        /* 5552 bytes is the most that cannot overflow 32 bits */
+        long n = XDL_MIN(size, 5552);
+
+        size -= n;
+        for (; n > 0; n--) {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return ((b << 16) | a) & 0xffffffffUL;
+}
+
+static int xdl_put_varint(unsigned char *out, unsigned long val)
+{
+    int n = 0;
+
+    for (; val >= 0x80; val >>= 7)
+        out[n++] = (unsigned char)(val | 0x80);
+    out[n++] = (unsigned char)val;
+    return n;
+}
+
+static int xdl_get_varint(unsigned char const **data, unsigned char const *top,
+                          unsigned long *val)
+{
+    unsigned char const *ptr = *data;
+    unsigned long res = 0;
+    int shift;
+
+    for (shift = 0; ptr < top && shift < 64; shift += 7) {
+        res |= (unsigned long)(*ptr & 0x7f) << shift;
+        if (!(*ptr++ & 0x80)) {
+            *data = ptr;
+            *val = res;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static unsigned long xdl_bhash(unsigned char const *data, long bsize)
+{
+    unsigned long h = 0;
+    long i;
+
+    for (i = 0; i < bsize; i++)
+        h = (h * XDL_BDIFF_HASH_MUL + data[i]) & 0xffffffffUL;
+    return h;
+}
+
+static long xdl_bucket(unsigned long h, unsigned int hbits)
+{
+    return (long)(((h * 0x9e3779b1UL) & 0xffffffffUL) >> (32 - hbits));
+}
+
+/*
+ * Length of the common prefix of 'a' and 'b', up to 'size' bytes,
+ * compared sixteen or eight bytes at a time.
+ */
+static long xdl_match_fwd(unsigned char const *a, unsigned char const *b, long size)
+{
+    long n = 0;
+
+#if defined(__SSE2__)
+    for (; n + 16 <= size; n += 16) {
+        __m128i va = _mm_loadu_si128((__m128i const *)(a + n));
+        __m128i vb = _mm_loadu_si128((__m128i const *)(b + n));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) ^ 0xffff;
+
+        if (mask)
+            return n + __builtin_ctz(mask);
+    }
+#endif
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; n + 8 <= size; n += 8) {
+        uint64_t wa, wb;
+
+        memcpy(&wa, a + n, 8);
+        memcpy(&wb, b + n, 8);
+        if (wa != wb)
+            return n + __builtin_ctzll(wa ^ wb) / 8;
+    }
+#endif
+    for (; n < size && a[n] == b[n]; n++)
+        ;
+    return n;
+}
+
+static int xdl_bflush(bdiffout_t *bo, unsigned char const *lit, long size)
+{
+    mmbuffer_t mb[2];
+    int nbuf = 0;
+
+    if (bo->nops) {
+        mb[nbuf].ptr = (char *)bo->ops;
+        mb[nbuf++].size = bo->nops;
+    }
+    if (size) {
+        mb[nbuf].ptr = (char *)lit;
+        mb[nbuf++].size = size;
+    }
+    bo->nops = 0;
+    return nbuf ? bo->ecb->out_line(bo->ecb->priv, mb, nbuf) : 0;
+}
+
+static int xdl_bemit_literal(bdiffout_t *bo, unsigned char const *lit, long size)
+{
+    if (!size)
+        return 0;
+    if (bo->nops > XDL_BDIFF_OPBUF - XDL_BDIFF_VARINT_MAX && xdl_bflush(bo, NULL, 0) < 0)
+        return -1;
+    bo->nops += xdl_put_varint(bo->ops + bo->nops, (unsigned long)size << 1);
+    return xdl_bflush(bo, lit, size);
+}
+
+static int xdl_bemit_copy(bdiffout_t *bo, long off, long size)
+{
+    long dist = off - bo->last;
+
+    if (bo->nops > XDL_BDIFF_OPBUF - 2 * XDL_BDIFF_VARINT_MAX && xdl_bflush(bo, NULL, 0) < 0)
+        return -1;
+    bo->nops += xdl_put_varint(bo->ops + bo->nops, (unsigned long)size << 1 | 1);
+    bo->nops += xdl_put_varint(bo->ops + bo->nops,
+                               dist < 0 ? ((unsigned long)-dist << 1) - 1 : (unsigned long)dist << 1);
+    bo->last = off + size;
+    return 0;
+}
+
+int xdl_bdiff(mmfile_t *mmf1, mmfile_t *mmf2, bdiffparam_t const *bdp, xdemitcb_t *ecb)
+{
+    unsigned char const *src = (unsigned char const *)mmf1->ptr;
+    unsigned char const *tgt = (unsigned char const *)mmf2->ptr;
+    long ssize = mmf1->size, tsize = mmf2->size;
+    long bsize = bdp && bdp->bsize > 0 ? XDL_MAX(bdp->bsize, XDL_BDIFF_MIN_BSIZE) : XDL_BDIFF_BSIZE;
+    long nblk = ssize / bsize, hsize, i, lit, b;
+    long *head = NULL, *next = NULL;
+    unsigned long h = 0, pow = 1, sum;
+    unsigned int hbits;
+    bdiffout_t *bo;
+    int ret = -1;
+
+    if (!(bo = (bdiffout_t *)xdl_malloc(sizeof(*bo))))
+        return -1;
+    bo->ecb = ecb;
+    bo->nops = 0;
+    bo->last = 0;
+
+    bo->nops += xdl_put_varint(bo->ops, (unsigned long)ssize);
+    bo->nops += xdl_put_varint(bo->ops + bo->nops, (unsigned long)tsize);
+    sum = xdl_adler32(src, ssize);
+    for (i = 0; i < 4; i++)
+        bo->ops[bo->nops++] = (unsigned char)(sum >> (8 * i));
+
+    /* Index the source blocks; a run of equal blocks is indexed once */
+    hbits = xdl_hashbits((unsigned int)XDL_MAX(nblk, 1));
+    hsize = 1L << hbits;
+    if (!XDL_ALLOC_ARRAY(head, hsize) || !XDL_ALLOC_ARRAY(next, XDL_MAX(nblk, 1)))
+        goto out;
+    for (i = 0; i < hsize; i++)
+        head[i] = -1;
+    for (b = nblk - 1; b >= 0; b--) {
+        long k;
+
+        if (b > 0 && !memcmp(src + b * bsize, src + (b - 1) * bsize, bsize))
+            continue;
+        k = xdl_bucket(xdl_bhash(src + b * bsize, bsize), hbits);
+        next[b] = head[k];
+        head[k] = b;
+    }
+
+    for (i = 1; i < bsize; i++)
+        pow = (pow * XDL_BDIFF_HASH_MUL) & 0xffffffffUL;
+
+    /* Scan the target with a rolling hash and extend each block match */
+    lit = 0;
+    i = 0;
+    if (nblk && tsize >= bsize)
+        h = xdl_bhash(tgt, bsize);
+    while (nblk && i + bsize <= tsize) {
+        long best = 0, best_off = 0, best_back = 0, chain = 0;
+
+        for (b = head[xdl_bucket(h, hbits)]; b >= 0 && chain < XDL_BDIFF_MAX_CHAIN;
+             b = next[b], chain++) {
+            long s = b * bsize, fwd, back = 0;
+
+            fwd = xdl_match_fwd(src + s, tgt + i, XDL_MIN(ssize - s, tsize - i));
+            if (fwd < bsize)
+                continue;
+            while (back < i - lit && back < s && src[s - back - 1] == tgt[i - back - 1])
+                back++;
+            if (fwd + back > best) {
+                best = fwd + back;
+                best_off = s - back;
+                best_back = back;
+            }
+        }
+
+        if (best) {
+            if (xdl_bemit_literal(bo, tgt + lit, i - best_back - lit) < 0 ||
+                xdl_bemit_copy(bo, best_off, best) < 0)
+                goto out;
+            i += best - best_back;
+            lit = i;
+            if (i + bsize <= tsize)
+                h = xdl_bhash(tgt + i, bsize);
+            continue;
+        }
+        if (i + bsize < tsize)
+            h = ((h - tgt[i] * pow) * XDL_BDIFF_HASH_MUL + tgt[i + bsize]) & 0xffffffffUL;
+        i++;
+    }
+    if (xdl_bemit_literal(bo, tgt + lit, tsize - lit) < 0 || xdl_bflush(bo, NULL, 0) < 0)
+        goto out;
+    ret = 0;
+
+out:
+    xdl_free(head);
+    xdl_free(next);
+    xdl_free(bo);
+    return ret;
+}
+
+/* Parse the header of a delta; returns -1 if it is not one */
+static int xdl_bdiff_header(mmfile_t *mmfp, unsigned long *ssize, unsigned long *tsize,
+                            unsigned long *sum, unsigned char const **ops)
+{
+    unsigned char const *ptr = (unsigned char const *)mmfp->ptr;
+    unsigned char const *top = ptr + mmfp->size;
+    int i;
+
+    if (xdl_get_varint(&ptr, top, ssize) < 0 || xdl_get_varint(&ptr, top, tsize) < 0 ||
+        top - ptr < 4)
+        return -1;
+    for (*sum = 0, i = 0; i < 4; i++)
+        *sum |= (unsigned long)*ptr++ << (8 * i);
+    *ops = ptr;
+    return 0;
+}
+
+long xdl_bdiff_tgsize(mmfile_t *mmfp)
+{
+    unsigned long ssize, tsize, sum;
+    unsigned char const *ops;
+
+    if (xdl_bdiff_header(mmfp, &ssize, &tsize, &sum, &ops) < 0 || tsize > LONG_MAX)
+        return -1;
+    return (long)tsize;
+}
+
+int xdl_bpatch(mmfile_t *mmf, mmfile_t *mmfp, xdemitcb_t *ecb)
+{
+    unsigned char const *src = (unsigned char const *)mmf->ptr;
+    unsigned char const *ptr, *top = (unsigned char const *)mmfp->ptr + mmfp->size;
+    unsigned long ssize, tsize, sum, done = 0, last = 0;
+    mmbuffer_t mb;
+
+    if (xdl_bdiff_header(mmfp, &ssize, &tsize, &sum, &ptr) < 0 ||
+        ssize != (unsigned long)mmf->size || sum != xdl_adler32(src, mmf->size))
+        return -1;
+
+    while (ptr < top) {
+        unsigned long op, size, dist, off;
+
+        if (xdl_get_varint(&ptr, top, &op) < 0)
+            return -1;
+        size = op >> 1;
+        if (size > tsize - done)
+            return -1;
+        if (op & 1) {
+            if (xdl_get_varint(&ptr, top, &dist) < 0)
+                return -1;
+            off = dist & 1 ? last - ((dist + 1) >> 1) : last + (dist >> 1);
+            if (off > ssize || size > ssize - off)
+                return -1;
+            mb.ptr = (char *)src + off;
+            last = off + size;
+        } else {
+            if (size > (unsigned long)(top - ptr))
+                return -1;
+            mb.ptr = (char *)ptr;
+            ptr += size;
+        }
+        mb.size = (long)size;
+        if (size && ecb->out_line(ecb->priv, &mb, 1) < 0)
+            return -1;
+        done += size;
+    }
+    return done == tsize ? 0 : -1;
+}
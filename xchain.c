@@ -0,0 +1,110 @@
+/*
+ *  LibXDiff by Davide Libenzi ( File Differential Library )
+ *  Copyright (C) 2003  Davide Libenzi
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Davide Libenzi <davidel@xmailserver.org>
+ *
+ */
+
+#include "xinclude.h"
+
+struct s_xdlchain {
+    xpparam_t xpp;
+    long nr;          /* Versions in the chain */
+    xrecord_t **recs; /* The lines of each version, classed in one dictionary */
+    long *nrecs;
+    long nclass;
+};
+
+xdlchain_t *xdl_chain_new(mmfile_t *versions, long nr, xpparam_t const *xpp)
+{
+    xdlchain_t *chain;
+
+    if (nr < 1 || !(chain = (xdlchain_t *)xdl_calloc(1, sizeof(xdlchain_t))))
+        return NULL;
+    chain->xpp = *xpp;
+    chain->xpp.index1 = chain->xpp.index2 = NULL;
+    chain->xpp.alloc = NULL;
+    chain->xpp.max_memory = 0;
+    chain->xpp.memstats = NULL;
+    chain->xpp.stats = NULL;
+    chain->nr = nr;
+
+    if (!XDL_CALLOC_ARRAY(chain->recs, nr) || !XDL_CALLOC_ARRAY(chain->nrecs, nr) ||
+        (chain->nclass = xdl_classify_files(versions, nr, xpp->flags, chain->recs,
+                                            chain->nrecs)) < 0) {
+        xdl_chain_free(chain);
+        return NULL;
+    }
+
+    return chain;
+}
+
+long xdl_chain_steps(xdlchain_t const *chain)
+{
+    return chain->nr - 1;
+}
+
+int xdl_chain_do_diff(xdlchain_t const *chain, long step, xdfenv_t *xe)
+{
+    if (step < 0 || step >= chain->nr - 1)
+        return -1;
+    if (xdl_prepare_classed(chain->recs[step], chain->nrecs[step], chain->recs[step + 1],
+                            chain->nrecs[step + 1], chain->nclass, &chain->xpp, xe) < 0)
+        return -1;
+
+    return xdl_run_algorithm(&chain->xpp, xe);
+}
+
+int xdl_chain_diff(xdlchain_t const *chain, long step, xdemitconf_t const *xecfg,
+                   xdemitcb_t *ecb)
+{
+    xdfenv_t xe;
+
+    if (xdl_chain_do_diff(chain, step, &xe) < 0)
+        return -1;
+
+    return xdl_emit_prepared(&xe, &chain->xpp, xecfg, ecb);
+}
+
+int xdl_chain_line_map(xdlchain_t const *chain, long step, xdllinemap_t *map)
+{
+    xdfenv_t xe;
+    int ret;
+
+    memset(map, 0, sizeof(*map));
+    if (xdl_chain_do_diff(chain, step, &xe) < 0)
+        return -1;
+    ret = xdl_line_map_env(&xe, &chain->xpp, map);
+    xdl_free_env(&xe);
+
+    return ret;
+}
+
+void xdl_chain_free(xdlchain_t *chain)
+{
+    long i;
+
+    if (!chain)
+        return;
+    if (chain->recs)
+        for (i = 0; i < chain->nr; i++)
+            xdl_free(chain->recs[i]);
+    xdl_free(chain->recs);
+    xdl_free(chain->nrecs);
+    xdl_free(chain);
+}
@@ -0,0 +1,134 @@
+/*
+ *  LibXDiff by Davide Libenzi ( File Differential Library )
+ *  Copyright (C) 2003  Davide Libenzi
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Davide Libenzi <davidel@xmailserver.org>
+ *
+ */
+
+#include "xinclude.h"
+
+#include <stdlib.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define XDL_LOAD(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define XDL_STORE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#else
+#define XDL_LOAD(p) (*(p))
+#define XDL_STORE(p, v) (*(p) = (v))
+#endif
+
+static xdlkernels_t const xdl_kernels_scalar = {
+    xdl_find_eol_scalar, xdl_find_space_scalar, xdl_count_ctrl_scalar,
+    xdl_match_fwd_scalar, xdl_match_bwd_scalar,
+};
+
+#if defined(XDL_X86_KERNELS)
+static xdlkernels_t const xdl_kernels_sse2 = {
+    xdl_find_eol_sse2, xdl_find_space_sse2, xdl_count_ctrl_sse2,
+    xdl_match_fwd_sse2, xdl_match_bwd_sse2,
+};
+
+static xdlkernels_t const xdl_kernels_avx2 = {
+    xdl_find_eol_avx2, xdl_find_space_avx2, xdl_count_ctrl_avx2,
+    xdl_match_fwd_avx2, xdl_match_bwd_avx2,
+};
+
+/* Only the scans gain from the wider vectors; the rest stays AVX2 */
+static xdlkernels_t const xdl_kernels_avx512 = {
+    xdl_find_eol_avx512, xdl_find_space_avx2, xdl_count_ctrl_avx2,
+    xdl_match_fwd_avx2, xdl_match_bwd_avx2,
+};
+#endif
+
+/*
+ * Resolved once and read on every diff. Races between threads resolving
+ * at the same time are harmless: they all store the same values.
+ */
+static unsigned int xdl_cpu_mask = ~0U;
+static int xdl_cpu_detected;
+static unsigned int xdl_cpu_supported;
+static xdlkernels_t const *xdl_cpu_kernels;
+
+static unsigned int xdl_cpu_detect(void)
+{
+    unsigned int features = 0;
+    char const *force = getenv("XDL_FORCE_SCALAR");
+
+    if (force && *force && strcmp(force, "0"))
+        return 0;
+#if defined(XDL_X86_KERNELS)
+    /* These check that the operating system saves the wider registers too */
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        features |= XDL_CPU_SSE2;
+    if (__builtin_cpu_supports("avx2"))
+        features |= XDL_CPU_AVX2;
+    if (__builtin_cpu_supports("avx512bw"))
+        features |= XDL_CPU_AVX512BW;
+#endif
+    return features;
+}
+
+static xdlkernels_t const *xdl_kernels_for(unsigned int features)
+{
+#if defined(XDL_X86_KERNELS)
+    if ((features & (XDL_CPU_AVX512BW | XDL_CPU_AVX2)) == (XDL_CPU_AVX512BW | XDL_CPU_AVX2))
+        return &xdl_kernels_avx512;
+    if (features & XDL_CPU_AVX2)
+        return &xdl_kernels_avx2;
+    if (features & XDL_CPU_SSE2)
+        return &xdl_kernels_sse2;
+#else
+    (void)features;
+#endif
+    return &xdl_kernels_scalar;
+}
+
+static xdlkernels_t const *xdl_cpu_resolve(void)
+{
+    xdlkernels_t const *kernels;
+
+    if (!XDL_LOAD(&xdl_cpu_detected)) {
+        XDL_STORE(&xdl_cpu_supported, xdl_cpu_detect());
+        XDL_STORE(&xdl_cpu_detected, 1);
+    }
+    kernels = xdl_kernels_for(xdl_cpu_features());
+    XDL_STORE(&xdl_cpu_kernels, kernels);
+    return kernels;
+}
+
+xdlkernels_t const *xdl_kernels(void)
+{
+    xdlkernels_t const *kernels = XDL_LOAD(&xdl_cpu_kernels);
+
+    return kernels ? kernels : xdl_cpu_resolve();
+}
+
+unsigned int xdl_cpu_features(void)
+{
+    if (!XDL_LOAD(&xdl_cpu_detected))
+        xdl_cpu_resolve();
+    return XDL_LOAD(&xdl_cpu_supported) & XDL_LOAD(&xdl_cpu_mask);
+}
+
+unsigned int xdl_set_cpu_features(unsigned int mask)
+{
+    XDL_STORE(&xdl_cpu_mask, mask);
+    xdl_cpu_resolve();
+    return xdl_cpu_features();
+}
@@ -0,0 +1,79 @@
+/*
+ *  LibXDiff by Davide Libenzi ( File Differential Library )
+ *  Copyright (C) 2003  Davide Libenzi
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Davide Libenzi <davidel@xmailserver.org>
+ *
+ */
+
+#if !defined(XCPU_H)
+#define XCPU_H
+
+/*
+ * Vector kernels are built for x86 with GCC and Clang, each function for
+ * its own instruction set, so that one binary runs on any x86 CPU and
+ * uses what the CPU has.
+ */
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define XDL_X86_KERNELS
+#define XDL_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+/*
+ * Kernels of the hot loops, for the instruction sets the process may
+ * use. All variants of a kernel give the same results.
+ */
+typedef struct s_xdlkernels {
+    /* First '\n' in [ptr, top), or top */
+    char const *(*find_eol)(char const *ptr, char const *top);
+    /*
+     * First byte in [ptr, top) that may be whitespace, or top. Every byte
+     * XDL_ISSPACE() accepts is one, '\n' included; the caller checks.
+     */
+    char const *(*find_space)(char const *ptr, char const *top);
+    /* Control bytes that do not occur in text among 'size' bytes, or -1 at a NUL */
+    long (*count_ctrl)(unsigned char const *ptr, long size);
+    /* Leading entries equal in 'ha1' and 'ha2', up to 'n' */
+    long (*match_fwd)(unsigned long const *ha1, unsigned long const *ha2, long n);
+    /* Trailing entries equal before the ends 'ha1' and 'ha2', up to 'n' */
+    long (*match_bwd)(unsigned long const *ha1, unsigned long const *ha2, long n);
+} xdlkernels_t;
+
+/* Kernels of the best instruction set allowed, resolved on the first call */
+xdlkernels_t const *xdl_kernels(void);
+
+char const *xdl_find_eol_scalar(char const *ptr, char const *top);
+char const *xdl_find_space_scalar(char const *ptr, char const *top);
+long xdl_count_ctrl_scalar(unsigned char const *ptr, long size);
+long xdl_match_fwd_scalar(unsigned long const *ha1, unsigned long const *ha2, long n);
+long xdl_match_bwd_scalar(unsigned long const *ha1, unsigned long const *ha2, long n);
+
+#if defined(XDL_X86_KERNELS)
+char const *xdl_find_eol_sse2(char const *ptr, char const *top);
+char const *xdl_find_eol_avx2(char const *ptr, char const *top);
+char const *xdl_find_eol_avx512(char const *ptr, char const *top);
+char const *xdl_find_space_sse2(char const *ptr, char const *top);
+char const *xdl_find_space_avx2(char const *ptr, char const *top);
+long xdl_count_ctrl_sse2(unsigned char const *ptr, long size);
+long xdl_count_ctrl_avx2(unsigned char const *ptr, long size);
+long xdl_match_fwd_sse2(unsigned long const *ha1, unsigned long const *ha2, long n);
+long xdl_match_fwd_avx2(unsigned long const *ha1, unsigned long const *ha2, long n);
+long xdl_match_bwd_sse2(unsigned long const *ha1, unsigned long const *ha2, long n);
+long xdl_match_bwd_avx2(unsigned long const *ha1, unsigned long const *ha2, long n);
+#endif
+
+#endif /* #if !defined(XCPU_H) */
@@ -0,0 +1,234 @@
+/*
+ * xdiff-batch.c - Batch comparison of many file pairs for xdiff
+ * Reads a manifest of file pairs and writes one framed result per pair
+ */
+
+#include "xdiff-batch.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "xdiff-pool.h"
+#include "xinclude.h"
+
+/* One manifest entry together with its captured result */
+struct batch_item {
+    struct batch_pair pair;
+    struct outbuf out; /* Captured report of the comparison */
+    struct outbuf err; /* Captured diagnostics of the comparison */
+    int status;        /* Result of the callbacks */
+    int prepared;      /* Whether the prepare callback accepted the pair */
+};
+
+/* Work list shared by the worker threads */
+struct batch {
+    struct batch_item *items;
+    long nr;
+    long alloc;
+    batch_diff_fn fn;
+    void *priv;
+    struct loader *loader;
+    struct outbuf *out;
+    struct outbuf *err;
+    int ret;
+};
+
+static void release_item(struct batch_item *item)
+{
+    xdl_free(item->pair.id);
+    xdl_free(item->pair.data);
+    outbuf_release(&item->out);
+    outbuf_release(&item->err);
+    item->pair.id = NULL;
+    item->pair.data = NULL;
+}
+
+/*
+ * Split one manifest line into its tab-separated fields. The fields
+ * point into a single allocation owned by pair->id.
+ */
+static int parse_line(const char *line, size_t len, struct batch_pair *pair)
+{
+    char *fields[4] = { NULL, NULL, NULL, NULL };
+    char *copy, *p;
+    int nr = 0;
+
+    if (!(copy = (char *)xdl_malloc(len + 1)))
+        return -1;
+    memcpy(copy, line, len);
+    copy[len] = '\0';
+
+    for (p = copy; nr < 4; nr++) {
+        fields[nr] = p;
+        if (nr == 3 || !(p = strchr(p, '\t')))
+            break;
+        *p++ = '\0';
+    }
+    if (nr < 2 || !*fields[0] || !*fields[1] || !*fields[2]) {
+        xdl_free(copy);
+        errno = EINVAL;
+        return -1;
+    }
+
+    pair->id = fields[0];
+    pair->path1 = fields[1];
+    pair->path2 = fields[2];
+    pair->options = fields[3] && *fields[3] ? fields[3] : NULL;
+    pair->data = NULL;
+    return 0;
+}
+
+/* Read every pair listed in the manifest */
+static int read_manifest(struct batch *batch, const char *manifest)
+{
+    FILE *f = strcmp(manifest, "-") ? fopen(manifest, "r") : stdin;
+    const char *name = f == stdin ? "standard input" : manifest;
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    long lineno = 0;
+    int ret = 0;
+
+    if (!f) {
+        outbuf_printf(batch->err, "xdiff: cannot read manifest '%s': %s\n", manifest,
+                      strerror(errno));
+        return -1;
+    }
+
+    while ((len = getline(&line, &cap, f)) >= 0) {
+        struct batch_item *item;
+
+        lineno++;
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            len--;
+        if (!len || line[0] == '#')
+            continue;
+
+        if (XDL_ALLOC_GROW(batch->items, batch->nr + 1, batch->alloc)) {
+            outbuf_printf(batch->err, "xdiff: out of memory reading manifest\n");
+            ret = -1;
+            break;
+        }
+        item = &batch->items[batch->nr];
+        memset(item, 0, sizeof(*item));
+        if (parse_line(line, len, &item->pair) < 0) {
+            if (errno == EINVAL)
+                outbuf_printf(batch->err,
+                              "xdiff: %s:%ld: expected ID, FILE1 and FILE2 separated by tabs\n",
+                              name, lineno);
+            else
+                outbuf_printf(batch->err, "xdiff: out of memory reading manifest\n");
+            ret = -1;
+            break;
+        }
+        outbuf_init_mem(&item->out);
+        outbuf_init_mem(&item->err);
+        batch->nr++;
+    }
+    if (ret == 0 && ferror(f)) {
+        outbuf_printf(batch->err, "xdiff: cannot read manifest '%s': %s\n", name,
+                      strerror(errno));
+        ret = -1;
+    }
+
+    free(line);
+    if (f != stdin)
+        fclose(f);
+    return ret;
+}
+
+/* Files to load for one pair; rejected pairs have none */
+static const char *item_path(long task, int side, void *priv)
+{
+    struct batch *batch = (struct batch *)priv;
+    struct batch_item *item = &batch->items[task];
+
+    if (!item->prepared)
+        return NULL;
+    return side ? item->pair.path2 : item->pair.path1;
+}
+
+/* Compare one pair, capturing its output in memory */
+static void run_item(long task, int worker, void *priv)
+{
+    struct batch *batch = (struct batch *)priv;
+    struct batch_item *item = &batch->items[task];
+    const struct load_file *file1, *file2;
+
+    (void)worker;
+    if (!item->prepared)
+        return;
+    file1 = loader_get(batch->loader, task, 0);
+    file2 = loader_get(batch->loader, task, 1);
+    item->status = batch->fn(&item->pair, file1, file2, &item->out, &item->err, batch->priv);
+    loader_release(batch->loader, task);
+    if (item->out.error || item->err.error)
+        item->status = -1;
+}
+
+/* Write one finished pair as a frame and release its buffers */
+static void flush_item(long task, void *priv)
+{
+    struct batch *batch = (struct batch *)priv;
+    struct batch_item *item = &batch->items[task];
+    struct outbuf *payload = item->status < 0 ? &item->err : &item->out;
+
+    outbuf_printf(batch->out, "=== %s %d %lu\n", item->pair.id,
+                  item->status < 0 ? 2 : item->status, (unsigned long)payload->len);
+    outbuf_write(batch->out, payload->buf, payload->len);
+    if (item->status >= 0 && item->err.len) {
+        outbuf_flush(batch->out);
+        outbuf_write(batch->err, item->err.buf, item->err.len);
+        outbuf_flush(batch->err);
+    }
+
+    if (item->status < 0)
+        batch->ret = -1;
+    else if (item->status > 0 && batch->ret == 0)
+        batch->ret = 1;
+    release_item(item);
+}
+
+int diff_batch(const char *manifest, int jobs, batch_prepare_fn prepare, batch_diff_fn fn,
+               void *priv, struct outbuf *out, struct outbuf *err)
+{
+    struct batch batch;
+    long i;
+
+    memset(&batch, 0, sizeof(batch));
+    batch.fn = fn;
+    batch.priv = priv;
+    batch.out = out;
+    batch.err = err;
+
+    if (read_manifest(&batch, manifest) < 0) {
+        for (i = 0; i < batch.nr; i++)
+            release_item(&batch.items[i]);
+        xdl_free(batch.items);
+        return -1;
+    }
+
+    /* Per-pair setup is not required to be thread-safe */
+    for (i = 0; i < batch.nr; i++) {
+        struct batch_item *item = &batch.items[i];
+
+        if (prepare && prepare(&item->pair, &item->err, priv) < 0)
+            item->status = -1;
+        else
+            item->prepared = 1;
+    }
+
+    if (!(batch.loader = loader_start(batch.nr, jobs * LOAD_AHEAD, item_path, &batch))) {
+        outbuf_printf(err, "xdiff: out of memory\n");
+        for (i = 0; i < batch.nr; i++)
+            release_item(&batch.items[i]);
+        xdl_free(batch.items);
+        return -1;
+    }
+    run_ordered(batch.nr, jobs, run_item, flush_item, &batch);
+    loader_stop(batch.loader);
+    xdl_free(batch.items);
+
+    return batch.ret;
+}
@@ -0,0 +1,49 @@
+/*
+ * xdiff-batch.h - Batch comparison of many file pairs for xdiff
+ * Reads a manifest of file pairs and writes one framed result per pair
+ */
+
+#ifndef XDIFF_BATCH_H
+#define XDIFF_BATCH_H
+
+#include "xdiff-load.h"
+#include "xdiff-outbuf.h"
+
+/* One manifest entry */
+struct batch_pair {
+    char *id;
+    char *path1;
+    char *path2;
+    char *options; /* Per-pair options, or NULL */
+    void *data;    /* Set by the prepare callback, freed with xdl_free() */
+};
+
+/*
+ * Prepare one pair before it is dispatched, e.g. by parsing its
+ * options into 'pair->data'. Called on the calling thread in manifest
+ * order. Returns a negative value after writing a diagnostic to 'err'
+ * if the pair cannot be compared.
+ */
+typedef int (*batch_prepare_fn)(struct batch_pair *pair, struct outbuf *err, void *priv);
+
+/*
+ * Compare one prepared pair whose files have been loaded; same contract
+ * as dir_diff_fn. May run concurrently on several threads.
+ */
+typedef int (*batch_diff_fn)(const struct batch_pair *pair, const struct load_file *file1,
+                             const struct load_file *file2, struct outbuf *out,
+                             struct outbuf *err, void *priv);
+
+/*
+ * Compare every pair listed in 'manifest' ("-" for standard input) on
+ * up to 'jobs' threads and write the results to 'out' in manifest
+ * order, each preceded by a "=== ID STATUS SIZE" header line. STATUS is
+ * 0 if the files are identical, 1 if they differ and 2 on error, in
+ * which case the SIZE bytes of payload hold the diagnostics. Returns a
+ * negative value if the manifest cannot be read or any pair failed, 1
+ * if any pair differs and 0 otherwise.
+ */
+int diff_batch(const char *manifest, int jobs, batch_prepare_fn prepare, batch_diff_fn fn,
+               void *priv, struct outbuf *out, struct outbuf *err);
+
+#endif /* XDIFF_BATCH_H */
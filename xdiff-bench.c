@@ -0,0 +1,847 @@
+/*
+ * xdiff-bench.c - Benchmarks of the xdiff library
+ * Times every algorithm, merge and moved block detection on generated corpora
+ * and given file pairs, or whole runs of xdiff programs, and writes the results
+ * as JSON
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "xdiff-moved.h"
+#include "xinclude.h"
+
+/* Line length distributions of a generated corpus */
+enum line_len {
+    LEN_FIXED,   /* Every line has the mean length */
+    LEN_UNIFORM, /* Uniform between 1 and twice the mean */
+    LEN_CODE     /* Mostly short lines with a long tail, like source code */
+};
+
+/* Parameters of a generated corpus */
+struct corpus_spec {
+    const char *name;
+    long lines;        /* Lines of the base version */
+    double edit_rate;  /* Lines changed, inserted or deleted, per line */
+    enum line_len len; /* Distribution of the line lengths */
+    long mean_len;     /* Mean line length, without indentation */
+    double dup_ratio;  /* Lines taken from a small pool of common lines */
+    long moved_blocks; /* Blocks moved to another place in the new version */
+    double ws_churn;   /* Lines whose whitespace changes, per line */
+};
+
+static const struct corpus_spec corpora[] = {
+    { "small-code", 2000, 0.02, LEN_CODE, 28, 0.10, 2, 0.01 },
+    { "large-code", 200000, 0.01, LEN_CODE, 28, 0.10, 20, 0.01 },
+    { "dense-edits", 20000, 0.30, LEN_CODE, 28, 0.10, 0, 0.00 },
+    { "duplicates", 50000, 0.02, LEN_CODE, 28, 0.60, 5, 0.00 },
+    { "moved-blocks", 20000, 0.01, LEN_CODE, 28, 0.10, 200, 0.00 },
+    { "whitespace", 20000, 0.01, LEN_CODE, 28, 0.10, 0, 0.20 },
+    { "long-lines", 5000, 0.02, LEN_UNIFORM, 400, 0.00, 5, 0.01 },
+    { "short-lines", 100000, 0.02, LEN_FIXED, 4, 0.30, 10, 0.00 },
+};
+
+/* Lines that recur throughout source code */
+static const char *const common_lines[] = {
+    "}",          "{",       "",          "\treturn 0;", "\t}",         "\t\tbreak;",
+    "\telse",     "#endif",  "/*",        " */",         "\treturn -1;", "\t\t}",
+    "\t\treturn;", "default:", "\tint ret;", "\tgoto out;",
+};
+
+#define COMMON_LINES (sizeof(common_lines) / sizeof(common_lines[0]))
+
+/* Algorithms timed on every corpus, and the option selecting them in the CLI */
+static const struct {
+    const char *name;
+    unsigned long flags;
+    const char *option;
+} algorithms[] = {
+    { "myers", 0, NULL },
+    { "minimal", XDF_NEED_MINIMAL, "--minimal" },
+    { "patience", XDF_PATIENCE_DIFF, "--patience" },
+    { "histogram", XDF_HISTOGRAM_DIFF, "--histogram" },
+};
+
+#define ALGORITHMS (sizeof(algorithms) / sizeof(algorithms[0]))
+
+/* Files of one corpus: a base version and two edited ones */
+struct corpus {
+    char name[256];
+    const struct corpus_spec *spec; /* NULL for a given file pair */
+    long lines;                     /* Lines generated for the base version */
+    mmfile_t base, ours, theirs;    /* 'theirs' is empty for a given file pair */
+};
+
+/* Growable buffer the generator writes into */
+struct gbuf {
+    char *ptr;
+    long size, alloc;
+};
+
+/* Options of the run */
+struct bench_options {
+    long repeat;        /* Timed runs of each measurement, at least */
+    double min_time;    /* Seconds each measurement runs for, at least */
+    int quick;          /* Generate a tenth of the lines */
+    const char *filter; /* Only corpora whose name contains this */
+    unsigned long seed;
+    const char **cli;   /* xdiff programs to time instead of the library */
+    long ncli;
+};
+
+/* Output of one diff, counted by the callbacks */
+struct diff_count {
+    long hunks;
+    long bytes;
+};
+
+static unsigned long long rng_state;
+
+/* xorshift64*, so that corpora are the same on every platform */
+static unsigned long rng(void)
+{
+    unsigned long long x = rng_state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    rng_state = x;
+    return (unsigned long)((x * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+static double rng_unit(void)
+{
+    return (rng() & 0xffffff) / (double)0x1000000;
+}
+
+static long rng_range(long lo, long hi)
+{
+    return lo + (long)(rng() % (unsigned long)(hi - lo + 1));
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int gbuf_add(struct gbuf *gb, const char *data, long size)
+{
+    if (XDL_ALLOC_GROW(gb->ptr, gb->size + size, gb->alloc))
+        return -1;
+    memcpy(gb->ptr + gb->size, data, size);
+    gb->size += size;
+    return 0;
+}
+
+/* Append a new line drawn from the distributions of 'spec' */
+static int gen_line(const struct corpus_spec *spec, struct gbuf *gb)
+{
+    char line[4096];
+    long len, n = 0, indent, word;
+
+    if (rng_unit() < spec->dup_ratio) {
+        const char *common = common_lines[rng() % COMMON_LINES];
+
+        if (gbuf_add(gb, common, (long)strlen(common)) < 0)
+            return -1;
+        return gbuf_add(gb, "\n", 1);
+    }
+
+    switch (spec->len) {
+    case LEN_FIXED:
+        len = spec->mean_len;
+        break;
+    case LEN_UNIFORM:
+        len = rng_range(1, 2 * spec->mean_len);
+        break;
+    default:
+        /* Three lines in four are short, the rest up to four times the mean */
+        len = rng() % 4 ? rng_range(1, spec->mean_len) : rng_range(1, 4 * spec->mean_len);
+        break;
+    }
+    if (len > (long)sizeof(line) - 16)
+        len = sizeof(line) - 16;
+
+    for (indent = spec->len == LEN_CODE ? rng_range(0, 3) : 0; indent > 0; indent--)
+        line[n++] = '\t';
+    while (len > 0) {
+        for (word = XDL_MIN(rng_range(1, 8), len); word > 0; word--, len--)
+            line[n++] = (char)('a' + rng() % 26);
+        if (len > 0) {
+            line[n++] = ' ';
+            len--;
+        }
+    }
+    line[n++] = '\n';
+    return gbuf_add(gb, line, n);
+}
+
+/* Split a buffer into the offsets of its lines; 'starts' gets nrec + 1 entries */
+static long split_lines(const char *ptr, long size, long **starts)
+{
+    long nrec = 0, alloc = 0, i;
+
+    *starts = NULL;
+    for (i = 0; i < size; i++) {
+        if (i == 0 || ptr[i - 1] == '\n') {
+            if (XDL_ALLOC_GROW(*starts, nrec + 2, alloc))
+                return -1;
+            (*starts)[nrec++] = i;
+        }
+    }
+    if (XDL_ALLOC_GROW(*starts, nrec + 1, alloc))
+        return -1;
+    (*starts)[nrec] = size;
+    return nrec;
+}
+
+static void reverse(long *v, long lo, long hi)
+{
+    long t;
+
+    for (hi--; lo < hi; lo++, hi--) {
+        t = v[lo];
+        v[lo] = v[hi];
+        v[hi] = t;
+    }
+}
+
+/* Change the indentation or trailing whitespace of a line */
+static int churn_whitespace(const char *line, long len, struct gbuf *gb)
+{
+    long body = len - 1; /* Without the newline */
+
+    switch (rng() % 3) {
+    case 0:
+        if (gbuf_add(gb, "    ", 4) < 0)
+            return -1;
+        break;
+    case 1:
+        if (body > 0 && (line[0] == '\t' || line[0] == ' ')) {
+            line++;
+            len--;
+            body--;
+        }
+        break;
+    default:
+        return gbuf_add(gb, line, body) < 0 || gbuf_add(gb, "  \n", 3) < 0 ? -1 : 0;
+    }
+    return gbuf_add(gb, line, len);
+}
+
+/*
+ * Derive a new version of 'base': blocks move, then lines are replaced,
+ * deleted, inserted or have their whitespace changed at the rates of
+ * 'spec'.
+ */
+static int gen_version(const struct corpus_spec *spec, const mmfile_t *base, double edit_rate,
+                       long moved_blocks, mmfile_t *out)
+{
+    struct gbuf gb = { NULL, 0, 0 };
+    long *starts, *order = NULL, nrec, i, k;
+
+    if ((nrec = split_lines(base->ptr, base->size, &starts)) < 0)
+        return -1;
+    if (!XDL_ALLOC_ARRAY(order, nrec + 1))
+        goto fail;
+    for (i = 0; i < nrec; i++)
+        order[i] = i;
+
+    /* Move blocks of 5 to 30 lines by rotating the range between source and target */
+    for (k = 0; k < moved_blocks && nrec > 60; k++) {
+        long len = rng_range(5, 30), from = rng_range(0, nrec - len), to = rng_range(0, nrec - len);
+        long lo = XDL_MIN(from, to), hi = XDL_MAX(from, to) + len;
+        long mid = from < to ? lo + len : hi - len;
+
+        /* Rotate order[lo, hi) left so that order[mid] comes first */
+        reverse(order, lo, mid);
+        reverse(order, mid, hi);
+        reverse(order, lo, hi);
+    }
+
+    for (i = 0; i < nrec; i++) {
+        const char *line = base->ptr + starts[order[i]];
+        long len = starts[order[i] + 1] - starts[order[i]];
+        double r = rng_unit();
+
+        if (r < edit_rate) {
+            switch (rng() % 3) {
+            case 0: /* Replace */
+                if (gen_line(spec, &gb) < 0)
+                    goto fail;
+                break;
+            case 1: /* Delete */
+                break;
+            default: /* Insert */
+                if (gen_line(spec, &gb) < 0 || gbuf_add(&gb, line, len) < 0)
+                    goto fail;
+                break;
+            }
+        } else if (r < edit_rate + spec->ws_churn && line[len - 1] == '\n') {
+            if (churn_whitespace(line, len, &gb) < 0)
+                goto fail;
+        } else if (gbuf_add(&gb, line, len) < 0) {
+            goto fail;
+        }
+    }
+    xdl_free(order);
+    xdl_free(starts);
+    out->ptr = gb.ptr;
+    out->size = gb.size;
+    return 0;
+
+fail:
+    xdl_free(order);
+    xdl_free(starts);
+    xdl_free(gb.ptr);
+    return -1;
+}
+
+static int gen_corpus(const struct corpus_spec *spec, const struct bench_options *opts,
+                      struct corpus *c)
+{
+    struct gbuf gb = { NULL, 0, 0 };
+    long lines = opts->quick ? XDL_MAX(spec->lines / 10, 100) : spec->lines, i;
+
+    memset(c, 0, sizeof(*c));
+    snprintf(c->name, sizeof(c->name), "%s", spec->name);
+    c->spec = spec;
+    c->lines = lines;
+    rng_state = opts->seed * 2654435761ULL + 1;
+    for (i = 0; i < lines; i++)
+        if (gen_line(spec, &gb) < 0) {
+            xdl_free(gb.ptr);
+            return -1;
+        }
+    c->base.ptr = gb.ptr;
+    c->base.size = gb.size;
+
+    /* 'theirs' edits half as much and moves nothing, for merges with some conflicts */
+    if (gen_version(spec, &c->base, spec->edit_rate, spec->moved_blocks, &c->ours) < 0 ||
+        gen_version(spec, &c->base, spec->edit_rate / 2, 0, &c->theirs) < 0)
+        return -1;
+    return 0;
+}
+
+static char *slurp(const char *path, long *size)
+{
+    FILE *f = fopen(path, "rb");
+    char *buf = NULL;
+    long len;
+
+    if (!f)
+        return NULL;
+    if (fseek(f, 0, SEEK_END) == 0 && (len = ftell(f)) >= 0 && fseek(f, 0, SEEK_SET) == 0 &&
+        (buf = (char *)xdl_malloc(len + 1)) && fread(buf, 1, len, f) == (size_t)len) {
+        *size = len;
+    } else {
+        xdl_free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    return buf;
+}
+
+static void free_corpus(struct corpus *c)
+{
+    xdl_free(c->base.ptr);
+    xdl_free(c->ours.ptr);
+    xdl_free(c->theirs.ptr);
+}
+
+static int count_hunk(void *priv, long old_begin, long old_nr, long new_begin, long new_nr,
+                      const char *func, long funclen)
+{
+    (void)old_begin;
+    (void)old_nr;
+    (void)new_begin;
+    (void)new_nr;
+    (void)func;
+    (void)funclen;
+    ((struct diff_count *)priv)->hunks++;
+    return 0;
+}
+
+static int count_line(void *priv, mmbuffer_t *mb, int nbuf)
+{
+    struct diff_count *count = (struct diff_count *)priv;
+    int i;
+
+    for (i = 0; i < nbuf; i++)
+        count->bytes += mb[i].size;
+    return 0;
+}
+
+/* One operation to time */
+enum bench_op { OP_DIFF, OP_DIFF_ARENA, OP_MERGE, OP_MOVED, OP_CLI };
+
+static const char *const op_names[] = { "diff", "diff-arena", "merge", "moved", "cli" };
+
+struct bench_run {
+    enum bench_op op;
+    struct corpus *corpus;
+    unsigned long flags;
+    xdlarena_t *arena;
+    struct diff_count count; /* Output of the last run */
+    long conflicts;
+    long moved_lines;
+    const char *program;     /* xdiff program and its algorithm option, for OP_CLI */
+    const char *option;
+    const char *path1, *path2; /* The corpus written to files, for OP_CLI */
+};
+
+/*
+ * Run an xdiff program on the files of the corpus, its output going to
+ * /dev/null; both "no differences" and "differences" count as success.
+ */
+static int run_cli(struct bench_run *run)
+{
+    extern char **environ;
+    posix_spawn_file_actions_t actions;
+    char *argv[6];
+    int argc = 0, err, status;
+    pid_t pid;
+
+    argv[argc++] = (char *)run->program;
+    argv[argc++] = (char *)"-u";
+    if (run->option)
+        argv[argc++] = (char *)run->option;
+    argv[argc++] = (char *)run->path1;
+    argv[argc++] = (char *)run->path2;
+    argv[argc] = NULL;
+
+    if ((err = posix_spawn_file_actions_init(&actions)) != 0)
+        goto fail;
+    err = posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    if (!err)
+        err = posix_spawnp(&pid, run->program, &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (err)
+        goto fail;
+    if (waitpid(pid, &status, 0) < 0)
+        return -1;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) > 1) {
+        fprintf(stderr, "'%s' failed on %s\n", run->program, run->corpus->name);
+        return -1;
+    }
+    return 0;
+
+fail:
+    fprintf(stderr, "cannot run '%s': %s\n", run->program, strerror(err));
+    return -1;
+}
+
+static int run_once(struct bench_run *run, xdlmemstats_t *memstats)
+{
+    struct corpus *c = run->corpus;
+    xpparam_t xpp;
+    xdemitconf_t xecfg;
+    xdemitcb_t ecb;
+
+    memset(&xpp, 0, sizeof(xpp));
+    xpp.flags = run->flags;
+    xpp.memstats = memstats;
+    memset(&xecfg, 0, sizeof(xecfg));
+    xecfg.ctxlen = 3;
+    memset(&run->count, 0, sizeof(run->count));
+    memset(&ecb, 0, sizeof(ecb));
+    ecb.priv = &run->count;
+    ecb.out_hunk = count_hunk;
+    ecb.out_line = count_line;
+
+    switch (run->op) {
+    case OP_DIFF:
+        return xdl_diff(&c->base, &c->ours, &xpp, &xecfg, &ecb);
+    case OP_DIFF_ARENA: {
+        int ret;
+
+        xpp.alloc = &run->arena->alloc;
+        ret = xdl_diff(&c->base, &c->ours, &xpp, &xecfg, &ecb);
+        xdl_arena_reset(run->arena);
+        return ret;
+    }
+    case OP_CLI:
+        return run_cli(run);
+    case OP_MERGE: {
+        xmparam_t xmp;
+        mmbuffer_t result;
+        int ret;
+
+        memset(&xmp, 0, sizeof(xmp));
+        xmp.xpp = xpp;
+        xmp.level = XDL_MERGE_ZEALOUS_ALNUM;
+        xmp.marker_size = DEFAULT_CONFLICT_MARKER_SIZE;
+        if ((ret = xdl_merge(&c->base, &c->ours, &c->theirs, &xmp, &result)) < 0)
+            return -1;
+        run->conflicts = ret;
+        run->count.bytes = result.size;
+        xdl_free(result.ptr);
+        return 0;
+    }
+    default: {
+        struct moved_context ctx;
+        long nrec, line;
+        long *starts;
+
+        moved_context_init(&ctx, MOVED_MODE_PLAIN, MOVED_WS_NO);
+        if (collect_blocks_from_diff(&c->base, &c->ours, &xpp, &ctx) < 0 ||
+            (nrec = split_lines(c->ours.ptr, c->ours.size, &starts)) < 0) {
+            moved_context_free(&ctx);
+            return -1;
+        }
+        /* Ask about every added line, as the output of a diff would */
+        run->moved_lines = 0;
+        for (line = 1; line <= nrec; line++)
+            run->moved_lines += is_line_moved(&ctx, line, 0);
+        xdl_free(starts);
+        moved_context_free(&ctx);
+        return 0;
+    }
+    }
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void json_string(FILE *out, const char *str)
+{
+    fputc('"', out);
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\')
+            fprintf(out, "\\%c", *str);
+        else if ((unsigned char)*str < 0x20)
+            fprintf(out, "\\u%04x", *str);
+        else
+            fputc(*str, out);
+    }
+    fputc('"', out);
+}
+
+/*
+ * Time one operation: a first run reports the memory, then the
+ * operation repeats until both the run count and the time are reached.
+ */
+static int measure(struct bench_run *run, const char *algorithm, const struct bench_options *opts,
+                   FILE *out, int *first)
+{
+    xdlmemstats_t memstats;
+    double *times = NULL, start, total = 0;
+    long runs = 0, alloc = 0, bytes = run->corpus->base.size + run->corpus->ours.size;
+
+    if (run_once(run, &memstats) < 0)
+        return -1;
+    while (runs < opts->repeat || total < opts->min_time) {
+        double t;
+
+        start = now_s();
+        if (run_once(run, NULL) < 0) {
+            xdl_free(times);
+            return -1;
+        }
+        t = now_s() - start;
+        if (XDL_ALLOC_GROW(times, runs + 1, alloc))
+            return -1;
+        times[runs++] = t;
+        total += t;
+    }
+    qsort(times, runs, sizeof(*times), cmp_double);
+
+    fprintf(out, "%s\n    {\"corpus\": ", *first ? "" : ",");
+    json_string(out, run->corpus->name);
+    fprintf(out, ", \"op\": \"%s\", \"algorithm\": \"%s\",\n", op_names[run->op], algorithm);
+    fprintf(out, "     \"runs\": %ld, \"min_s\": %.6f, \"median_s\": %.6f, \"mb_per_s\": %.2f",
+            runs, times[0], times[runs / 2], times[0] > 0 ? bytes / 1e6 / times[0] : 0.0);
+    if (run->op == OP_CLI) {
+        /* The whole process: reading the files, the diff and writing the output */
+        fprintf(out, ",\n     \"program\": ");
+        json_string(out, run->program);
+    } else {
+        fprintf(out, ",\n     \"output_bytes\": %ld", run->count.bytes);
+    }
+    if (run->op != OP_MOVED && run->op != OP_CLI)
+        fprintf(out, ", \"peak_bytes\": %ld", memstats.peak);
+    if (run->op == OP_DIFF || run->op == OP_DIFF_ARENA)
+        fprintf(out, ", \"hunks\": %ld", run->count.hunks);
+    else if (run->op == OP_MERGE)
+        fprintf(out, ", \"conflicts\": %ld", run->conflicts);
+    else if (run->op == OP_MOVED)
+        fprintf(out, ", \"moved_lines\": %ld", run->moved_lines);
+    fputc('}', out);
+    *first = 0;
+
+    fprintf(stderr, "  %-10s %-10s %10.3f ms%s%s\n", op_names[run->op], algorithm, times[0] * 1e3,
+            run->op == OP_CLI ? "  " : "", run->op == OP_CLI ? run->program : "");
+    xdl_free(times);
+    return 0;
+}
+
+/* Write 'mf' to a new temporary file whose name goes to 'path' */
+static int write_temp(const mmfile_t *mf, char *path, size_t size)
+{
+    const char *dir = getenv("TMPDIR");
+    int fd;
+
+    snprintf(path, size, "%s/xdiff-bench-XXXXXX", dir && *dir ? dir : "/tmp");
+    if ((fd = mkstemp(path)) < 0)
+        return -1;
+    if (write(fd, mf->ptr, mf->size) != mf->size) {
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    return close(fd);
+}
+
+/* Time every program with every algorithm on the corpus, written to files */
+static int bench_cli(struct corpus *c, const struct bench_options *opts, FILE *out, int *first)
+{
+    struct bench_run run;
+    char path1[4096], path2[4096];
+    long p;
+    size_t i;
+    int ret = 0;
+
+    if (write_temp(&c->base, path1, sizeof(path1)) < 0)
+        return -1;
+    if (write_temp(&c->ours, path2, sizeof(path2)) < 0) {
+        unlink(path1);
+        return -1;
+    }
+    memset(&run, 0, sizeof(run));
+    run.op = OP_CLI;
+    run.corpus = c;
+    run.path1 = path1;
+    run.path2 = path2;
+    for (i = 0; i < ALGORITHMS && !ret; i++) {
+        run.option = algorithms[i].option;
+        for (p = 0; p < opts->ncli && !ret; p++) {
+            run.program = opts->cli[p];
+            ret = measure(&run, algorithms[i].name, opts, out, first);
+        }
+    }
+    unlink(path1);
+    unlink(path2);
+    return ret;
+}
+
+static int bench_corpus(struct corpus *c, const struct bench_options *opts, FILE *out, int *first)
+{
+    struct bench_run run;
+    xdlarena_t arena;
+    size_t i;
+    int ret = 0;
+
+    fprintf(stderr, "%s: %ld + %ld bytes\n", c->name, c->base.size, c->ours.size);
+    if (opts->ncli)
+        return bench_cli(c, opts, out, first);
+    memset(&run, 0, sizeof(run));
+    run.corpus = c;
+
+    run.op = OP_DIFF;
+    for (i = 0; i < ALGORITHMS && !ret; i++) {
+        run.flags = algorithms[i].flags;
+        ret = measure(&run, algorithms[i].name, opts, out, first);
+    }
+    if (ret)
+        return ret;
+
+    /* The same diff with an arena reset after each run instead of malloc() */
+    xdl_arena_init(&arena, 0);
+    run.op = OP_DIFF_ARENA;
+    run.flags = 0;
+    run.arena = &arena;
+    ret = measure(&run, "myers", opts, out, first);
+    xdl_arena_free(&arena);
+    run.arena = NULL;
+
+    if (!ret && c->theirs.ptr) {
+        run.op = OP_MERGE;
+        for (i = 0; i < ALGORITHMS && !ret; i++) {
+            run.flags = algorithms[i].flags;
+            ret = measure(&run, algorithms[i].name, opts, out, first);
+        }
+    }
+    if (!ret) {
+        run.op = OP_MOVED;
+        run.flags = 0;
+        ret = measure(&run, "myers", opts, out, first);
+    }
+    return ret;
+}
+
+static void write_corpus_info(FILE *out, const struct corpus *c, int first)
+{
+    const struct corpus_spec *s = c->spec;
+    static const char *const lens[] = { "fixed", "uniform", "code" };
+
+    fprintf(out, "%s\n    {\"name\": ", first ? "" : ",");
+    json_string(out, c->name);
+    fprintf(out, ", \"bytes1\": %ld, \"bytes2\": %ld", c->base.size, c->ours.size);
+    if (s)
+        fprintf(out,
+                ",\n     \"lines\": %ld, \"edit_rate\": %.3f, \"line_len\": \"%s\", "
+                "\"mean_len\": %ld,\n     \"dup_ratio\": %.3f, \"moved_blocks\": %ld, "
+                "\"ws_churn\": %.3f",
+                c->lines, s->edit_rate, lens[s->len], s->mean_len, s->dup_ratio, s->moved_blocks,
+                s->ws_churn);
+    fputc('}', out);
+}
+
+static void usage(const char *progname)
+{
+    fprintf(stderr, "Usage: %s [OPTIONS] [OLD NEW]...\n", progname);
+    fprintf(stderr, "\nTimes diffs, merges and moved block detection on generated corpora and\n");
+    fprintf(stderr, "on the given file pairs, and writes the results as JSON. With --cli, times\n");
+    fprintf(stderr, "'PROGRAM -u OLD NEW' with every algorithm instead.\n");
+    fprintf(stderr, "\nOptions:\n");
+    fprintf(stderr, "  -o, --output=FILE    Write the JSON to FILE (default: standard output)\n");
+    fprintf(stderr, "  -n, --repeat=N       Timed runs of each measurement, at least (default: 5)\n");
+    fprintf(stderr, "      --min-time=MS    Time each measurement runs for, at least (default: 100)\n");
+    fprintf(stderr, "      --quick          Generate corpora a tenth of the size\n");
+    fprintf(stderr, "      --filter=TEXT    Only generated corpora whose name contains TEXT\n");
+    fprintf(stderr, "      --no-generated   Only benchmark the given file pairs\n");
+    fprintf(stderr, "      --seed=N         Seed of the corpus generator (default: 1)\n");
+    fprintf(stderr, "      --cli=PROGRAM    Time the xdiff program PROGRAM; may be repeated\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = { { "output", required_argument, 0, 'o' },
+                                            { "repeat", required_argument, 0, 'n' },
+                                            { "min-time", required_argument, 0, 1 },
+                                            { "quick", no_argument, 0, 2 },
+                                            { "filter", required_argument, 0, 3 },
+                                            { "no-generated", no_argument, 0, 4 },
+                                            { "seed", required_argument, 0, 5 },
+                                            { "cli", required_argument, 0, 6 },
+                                            { "help", no_argument, 0, 'h' },
+                                            { 0, 0, 0, 0 } };
+    struct bench_options opts;
+    const char *output = NULL;
+    FILE *out = stdout;
+    struct corpus *all;
+    long ncorpora = 0, i;
+    int opt, generated = 1, first = 1, ret = 0;
+    size_t s;
+
+    opts.repeat = 5;
+    opts.min_time = 0.1;
+    opts.quick = 0;
+    opts.filter = NULL;
+    opts.seed = 1;
+    opts.cli = (const char **)xdl_malloc(argc * sizeof(*opts.cli));
+    opts.ncli = 0;
+    if (!opts.cli) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return 1;
+    }
+
+    while ((opt = getopt_long(argc, argv, "o:n:h", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'o':
+            output = optarg;
+            break;
+        case 'n':
+            opts.repeat = atol(optarg);
+            break;
+        case 1:
+            opts.min_time = atol(optarg) / 1e3;
+            break;
+        case 2:
+            opts.quick = 1;
+            break;
+        case 3:
+            opts.filter = optarg;
+            break;
+        case 4:
+            generated = 0;
+            break;
+        case 5:
+            opts.seed = strtoul(optarg, NULL, 10);
+            break;
+        case 6:
+            opts.cli[opts.ncli++] = optarg;
+            break;
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        default:
+            return 1;
+        }
+    }
+    if ((argc - optind) % 2 || opts.repeat < 1 || opts.min_time < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    all = (struct corpus *)xdl_calloc(sizeof(corpora) / sizeof(corpora[0]) + (argc - optind) / 2,
+                                      sizeof(*all));
+    if (!all) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return 1;
+    }
+    for (s = 0; generated && s < sizeof(corpora) / sizeof(corpora[0]); s++) {
+        if (opts.filter && !strstr(corpora[s].name, opts.filter))
+            continue;
+        if (gen_corpus(&corpora[s], &opts, &all[ncorpora]) < 0) {
+            fprintf(stderr, "%s: out of memory\n", argv[0]);
+            return 1;
+        }
+        ncorpora++;
+    }
+    for (i = optind; i < argc; i += 2) {
+        struct corpus *c = &all[ncorpora];
+
+        snprintf(c->name, sizeof(c->name), "%s:%s", argv[i], argv[i + 1]);
+        if (!(c->base.ptr = slurp(argv[i], &c->base.size)) ||
+            !(c->ours.ptr = slurp(argv[i + 1], &c->ours.size))) {
+            fprintf(stderr, "%s: cannot read '%s' or '%s': %s\n", argv[0], argv[i], argv[i + 1],
+                    strerror(errno));
+            return 1;
+        }
+        ncorpora++;
+    }
+
+    if (output && !(out = fopen(output, "w"))) {
+        fprintf(stderr, "%s: cannot write '%s': %s\n", argv[0], output, strerror(errno));
+        return 1;
+    }
+    fprintf(out, "{\n  \"benchmark\": \"xdiff\",\n  \"version\": 1,\n  \"quick\": %s,\n",
+            opts.quick ? "true" : "false");
+    fprintf(out, "  \"seed\": %lu,\n  \"corpora\": [", opts.seed);
+    for (i = 0; i < ncorpora; i++)
+        write_corpus_info(out, &all[i], i == 0);
+    fprintf(out, "\n  ],\n  \"results\": [");
+    for (i = 0; i < ncorpora && !ret; i++) {
+        if (bench_corpus(&all[i], &opts, out, &first) < 0) {
+            fprintf(stderr, "%s: benchmark of %s failed\n", argv[0], all[i].name);
+            ret = 1;
+        }
+    }
+    fprintf(out, "\n  ]\n}\n");
+
+    for (i = 0; i < ncorpora; i++)
+        free_corpus(&all[i]);
+    xdl_free(all);
+    xdl_free(opts.cli);
+    if (out != stdout && fclose(out) != 0) {
+        fprintf(stderr, "%s: cannot write '%s': %s\n", argv[0], output, strerror(errno));
+        ret = 1;
+    }
+    return ret;
+}
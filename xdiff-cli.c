@@ -4,27 +4,106 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "xdiff-batch.h"
+#include "xdiff-dir.h"
+#include "xdiff-history.h"
+#include "xdiff-index.h"
 #include "xdiff-moved.h"
+#include "xdiff-outbuf.h"
+#include "xdiff-rename.h"
+#include "xdiff-serve.h"
+#include "xdiff-stream.h"
 #include "xdiff.h"
 
+/* Bytes at the start of each file checked for binary content by default */
+#define BINARY_SCAN_DEFAULT (8 * 1024)
+
+/* How --similarity counts the lines two files share */
+#define SIMILARITY_EXACT 1
+#define SIMILARITY_SKETCH 2
+
+/* Options that control how a pair of files is compared */
+struct diff_options {
+    long context_lines;
+    int brief;
+    int recursive;
+    int text;         /* Compare binary files line by line too */
+    long binary_scan; /* Bytes checked for binary content, or 0 for the whole file */
+    int stats;        /* Report where each diff spent its time and memory */
+    unsigned long xpp_flags;
+    unsigned long emit_flags;
+    enum moved_mode moved_mode;
+    enum moved_ws_mode moved_ws_mode;
+};
+
+/* Options that only make sense for the whole invocation */
+struct run_options {
+    int recursive;
+    long jobs;
+    const char *batch;  /* Manifest of --batch, or NULL */
+    const char *serve;  /* Socket of --serve, or NULL */
+    const char *client; /* Socket of --client, or NULL */
+    long cache_size;    /* Bytes of prepared files kept by --serve */
+    long max_memory;    /* Bytes a comparison may use, or 0 for no limit */
+    int moved;          /* --moved was given with a mode other than no */
+    int bdiff;          /* Write a binary delta of FILE2 against FILE1 */
+    int bpatch;         /* Apply the binary delta FILE2 to FILE1 */
+    int index;          /* INDEX_USE and INDEX_WRITE for sidecar line indexes */
+    int history;        /* Compare each of the file arguments with the next */
+    int similarity;     /* SIMILARITY_EXACT or SIMILARITY_SKETCH to score FILE1 against FILE2 */
+    int renames;        /* Pair similar added and deleted files with -r; 2 to find copies too */
+    long rename_threshold; /* Least similarity of a rename or copy, in percent */
+    int help;
+};
+
+/* What a comparison may start from besides the two buffers */
+struct diff_prep {
+    xdlindex_t const *index1; /* Line indexes of the buffers, or NULL */
+    xdlindex_t const *index2;
+    xdlchain_t const *chain;  /* Chain whose step 'step' is between the buffers, or NULL */
+    long step;
+};
+
+/* Buffer holding the contents of one input file, reused across pairs */
+struct file_buf {
+    char *buf;
+    size_t alloc;
+};
+
+/* State shared by the comparisons of a directory or batch run */
+struct diff_run {
+    const struct diff_options *opts;
+};
+
 /* Forward declarations */
-static int read_file(const char *filename, mmfile_t *mf);
-static void free_file(mmfile_t *mf);
+static int read_file(const char *filename, mmfile_t *mf, struct file_buf *fb);
 static int out_hunk_cb(void *priv, long old_begin, long old_nr, long new_begin, long new_nr,
                        const char *func, long funclen);
 static int out_line_cb(void *priv, mmbuffer_t *mb, int nb);
+static int diff_files(const char *file1, const char *file2, const struct diff_options *opts,
+                      int index_mode, struct file_buf *bufs, struct outbuf *out,
+                      struct outbuf *err);
 static void usage(const char *progname);
 
+/* Program name for diagnostics */
+static const char *program_name = "xdiff";
+
 /* Context for callbacks */
 struct diff_context {
     const char *file1;
     const char *file2;
+    struct outbuf *out;
     int brief;
+    int recursive;
     int first_hunk;
     int has_differences;
     struct moved_context *moved_ctx;
@@ -32,64 +111,78 @@ struct diff_context {
     long current_new_line;
 };
 
-/* Read a file into memory */
-static int read_file(const char *filename, mmfile_t *mf)
+/*
+ * Read a file into the reusable buffer 'fb'. The buffer keeps its
+ * capacity, so a batch of comparisons settles on a few large
+ * allocations instead of two per pair.
+ */
+static int read_file(const char *filename, mmfile_t *mf, struct file_buf *fb)
 {
-    FILE *f;
-    long size;
-    char *buffer;
-    size_t nread;
-
-    f = fopen(filename, "rb");
-    if (!f) {
-        return -1;
-    }
+    struct stat st;
+    size_t len = 0, hint = 8192;
+    int fd, saved_errno;
 
-    /* Get file size */
-    if (fseek(f, 0, SEEK_END) < 0) {
-        fclose(f);
-        return -1;
-    }
-    size = ftell(f);
-    if (size < 0) {
-        fclose(f);
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
         return -1;
     }
-    if (fseek(f, 0, SEEK_SET) < 0) {
-        fclose(f);
-        return -1;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        /* One spare byte lets the first read() hit end of file */
+        hint = (size_t)st.st_size + 1;
     }
 
-    /* Allocate buffer */
-    buffer = (char *)xdl_malloc(size + 1);
-    if (!buffer) {
-        fclose(f);
-        return -1;
-    }
+    for (;;) {
+        ssize_t n;
 
-    /* Read file */
-    nread = fread(buffer, 1, size, f);
-    if (nread != (size_t)size || ferror(f)) {
-        xdl_free(buffer);
-        fclose(f);
-        return -1;
+        /* Keep room for the read and the terminating NUL */
+        if (fb->alloc - len < hint + 1) {
+            size_t alloc = fb->alloc ? fb->alloc : 8192;
+            char *buf;
+
+            while (alloc - len < hint + 1)
+                alloc *= 2;
+            buf = (char *)xdl_realloc(fb->buf, alloc);
+            if (!buf) {
+                close(fd);
+                errno = ENOMEM;
+                return -1;
+            }
+            fb->buf = buf;
+            fb->alloc = alloc;
+        }
+
+        n = read(fd, fb->buf + len, fb->alloc - len - 1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            saved_errno = errno;
+            close(fd);
+            errno = saved_errno;
+            return -1;
+        }
+        if (n == 0)
+            break;
+        len += n;
+        hint = 8192;
     }
-    fclose(f);
+    close(fd);
 
-    buffer[size] = '\0';
-    mf->ptr = buffer;
-    mf->size = size;
+    fb->buf[len] = '\0';
+    mf->ptr = fb->buf;
+    mf->size = (long)len;
 
     return 0;
 }
 
-/* Free file memory */
-static void free_file(mmfile_t *mf)
+/* Free the buffers of a finished run */
+static void release_bufs(struct file_buf *bufs, long nr)
 {
-    if (mf->ptr) {
-        xdl_free(mf->ptr);
-        mf->ptr = NULL;
-        mf->size = 0;
+    long i;
+
+    for (i = 0; i < nr; i++) {
+        xdl_free(bufs[i].buf);
+        bufs[i].buf = NULL;
+        bufs[i].alloc = 0;
     }
 }
 
@@ -107,8 +200,9 @@ static int out_hunk_cb(void *priv, long old_begin, long old_nr, long new_begin,
     }
 
     if (ctx->first_hunk) {
-        printf("--- %s\n", ctx->file1);
-        printf("+++ %s\n", ctx->file2);
+        if (ctx->recursive)
+            outbuf_printf(ctx->out, "diff -r %s %s\n", ctx->file1, ctx->file2);
+        outbuf_printf(ctx->out, "--- %s\n+++ %s\n", ctx->file1, ctx->file2);
         ctx->first_hunk = 0;
     }
 
@@ -116,11 +210,20 @@ static int out_hunk_cb(void *priv, long old_begin, long old_nr, long new_begin,
     ctx->current_old_line = old_begin;
     ctx->current_new_line = new_begin;
 
-    printf("@@ -%ld,%ld +%ld,%ld @@", old_begin, old_nr, new_begin, new_nr);
+    outbuf_write(ctx->out, "@@ -", 4);
+    outbuf_num(ctx->out, old_begin);
+    outbuf_putc(ctx->out, ',');
+    outbuf_num(ctx->out, old_nr);
+    outbuf_write(ctx->out, " +", 2);
+    outbuf_num(ctx->out, new_begin);
+    outbuf_putc(ctx->out, ',');
+    outbuf_num(ctx->out, new_nr);
+    outbuf_write(ctx->out, " @@", 3);
     if (func && funclen > 0) {
-        printf(" %.*s", (int)funclen, func);
+        outbuf_putc(ctx->out, ' ');
+        outbuf_write(ctx->out, func, funclen);
     }
-    printf("\n");
+    outbuf_putc(ctx->out, '\n');
 
     return 0;
 }
@@ -164,39 +267,452 @@ static int out_line_cb(void *priv, mmbuffer_t *mb, int nb)
                 if (is_moved) {
                     /* Mark moved lines with < and > prefix} */
                     if (line[0] == '-') {
-                        printf("<");
+                        outbuf_putc(ctx->out, '<');
                     } else if (line[0] == '+') {
-                        printf(">");
+                        outbuf_putc(ctx->out, '>');
                     }
-                    fwrite(line + 1, 1, size - 1, stdout);
+                    outbuf_write(ctx->out, line + 1, size - 1);
                     continue;
                 }
             }
         }
 
         /* Normal output */
-        fwrite(line, 1, size, stdout);
+        outbuf_write(ctx->out, line, size);
     }
 
     return 0;
 }
 
+/* Write the report of --stats for one diff to 'err' */
+static void print_stats(const char *file1, const char *file2, const xdlstats_t *st,
+                        const xdlmemstats_t *mem, struct outbuf *err)
+{
+    static const char *const phases[] = { "prepare", "cleanup", "algorithm",
+                                          "compact", "script",  "emit" };
+    static const char *const mem_phases[] = { "prepare", "algorithm", "script", "emit" };
+    double total = 0;
+    int i;
+
+    outbuf_printf(err, "%s: stats for %s and %s\n", program_name, file1, file2);
+    for (i = 0; i < XDL_PHASES; i++) {
+        outbuf_printf(err, "  %-12s %10.6fs\n", phases[i], st->time[i]);
+        total += st->time[i];
+    }
+    outbuf_printf(err, "  %-12s %10.6fs\n", "total", total);
+    outbuf_printf(err, "  records      %ld / %ld, %ld classes, %ld discarded\n", st->records1,
+                  st->records2, st->classes, st->discarded);
+    outbuf_printf(err, "  hash chains  %ld buckets in use, longest %ld\n", st->buckets,
+                  st->chain_max);
+    outbuf_printf(err, "  splits       %ld, edit cost %ld, %ld heuristic snakes, %ld cost cut-offs\n",
+                  st->splits, st->split_cost, st->heur_snakes, st->cost_cutoffs);
+    outbuf_printf(err, "  pinned       %ld interior runs, %ld records\n", st->pinned_runs,
+                  st->pinned);
+    outbuf_printf(err, "  fallbacks    %ld histogram, %ld patience\n", st->histogram_fallbacks,
+                  st->patience_fallbacks);
+    outbuf_printf(err, "  memory       peak %ldKB;", (mem->peak + 1023) / 1024);
+    for (i = 0; i < XDL_MEM_PHASES; i++)
+        outbuf_printf(err, " %s %ldKB", mem_phases[i], (mem->allocated[i] + 1023) / 1024);
+    outbuf_puts(err, "\n");
+}
+
+/*
+ * Compare two buffers and write the report to 'out'. 'prep' is
+ * optional. Returns a negative value on error, 1 if the buffers differ
+ * and 0 if they are identical.
+ */
+static int diff_buffers(const char *file1, const char *file2, mmfile_t *mf1, mmfile_t *mf2,
+                        const struct diff_prep *prep, const struct diff_options *opts,
+                        struct outbuf *out, struct outbuf *err)
+{
+    xdlchain_t const *chain = prep ? prep->chain : NULL;
+    struct moved_context moved_ctx;
+    xpparam_t xpp;
+    xdemitconf_t xecfg;
+    xdemitcb_t ecb;
+    struct diff_context ctx;
+    xdlstats_t stats;
+    xdlmemstats_t memstats;
+    int ret;
+
+    /* Binary files are only compared byte for byte */
+    if (!opts->text && (xdl_mmfile_is_binary(mf1, opts->binary_scan) ||
+                        xdl_mmfile_is_binary(mf2, opts->binary_scan))) {
+        if (mf1->size == mf2->size && !memcmp(mf1->ptr, mf2->ptr, mf1->size))
+            return 0;
+        outbuf_printf(out, "%s %s and %s differ\n", opts->brief ? "Files" : "Binary files", file1,
+                      file2);
+        return 1;
+    }
+
+    /* Initialize move detection */
+    moved_context_init(&moved_ctx, opts->moved_mode, opts->moved_ws_mode);
+
+    /* Configure xdiff parameters */
+    memset(&xpp, 0, sizeof(xpp));
+    xpp.flags = opts->xpp_flags;
+    xpp.index1 = prep ? prep->index1 : NULL;
+    xpp.index2 = prep ? prep->index2 : NULL;
+
+    memset(&xecfg, 0, sizeof(xecfg));
+    xecfg.ctxlen = opts->context_lines;
+    xecfg.interhunkctxlen = 0;
+    xecfg.flags = opts->emit_flags;
+
+    /* Collect blocks for move detection if enabled */
+    if (opts->moved_mode != MOVED_MODE_NO && !opts->brief) {
+        if ((chain ? collect_blocks_from_chain(chain, prep->step, xpp.flags, &moved_ctx)
+                   : collect_blocks_from_diff(mf1, mf2, &xpp, &moved_ctx)) < 0) {
+            outbuf_printf(err, "%s: failed to collect blocks for move detection\n", program_name);
+            ret = -1;
+            goto cleanup;
+        }
+    }
+
+    /* Set up callbacks */
+    ctx.file1 = file1;
+    ctx.file2 = file2;
+    ctx.out = out;
+    ctx.brief = opts->brief;
+    ctx.recursive = opts->recursive;
+    ctx.first_hunk = 1;
+    ctx.has_differences = 0;
+    ctx.moved_ctx = opts->moved_mode != MOVED_MODE_NO ? &moved_ctx : NULL;
+    ctx.current_old_line = 0;
+    ctx.current_new_line = 0;
+
+    memset(&ecb, 0, sizeof(ecb));
+    ecb.priv = &ctx;
+    ecb.out_hunk = out_hunk_cb;
+    ecb.out_line = out_line_cb;
+
+    if (opts->stats) {
+        xpp.stats = &stats;
+        xpp.memstats = &memstats;
+    }
+
+    /* Compute diff */
+    if ((chain ? xdl_chain_diff(chain, prep->step, &xecfg, &ecb)
+               : xdl_diff(mf1, mf2, &xpp, &xecfg, &ecb)) < 0) {
+        outbuf_printf(err, "%s: diff computation failed\n", program_name);
+        ret = -1;
+        goto cleanup;
+    }
+    if (opts->stats)
+        print_stats(file1, file2, &stats, &memstats, err);
+
+    if (opts->brief && ctx.has_differences)
+        outbuf_printf(out, "Files %s and %s differ\n", file1, file2);
+    ret = ctx.has_differences;
+
+cleanup:
+    moved_context_free(&moved_ctx);
+
+    return ret;
+}
+
+/*
+ * Compare two files and write the report to 'out', reading them into
+ * bufs[0] and bufs[1] and using their sidecar line indexes as
+ * 'index_mode' asks. Returns a negative value on error, 1 if the files
+ * differ and 0 if they are identical.
+ */
+static int diff_files(const char *file1, const char *file2, const struct diff_options *opts,
+                      int index_mode, struct file_buf *bufs, struct outbuf *out,
+                      struct outbuf *err)
+{
+    mmfile_t mf1, mf2;
+    struct index_file ix1, ix2;
+    struct diff_prep prep;
+    int ret;
+
+    /* Read files */
+    if (read_file(file1, &mf1, &bufs[0]) < 0) {
+        outbuf_printf(err, "%s: cannot read file '%s': %s\n", program_name, file1, strerror(errno));
+        return -1;
+    }
+
+    if (read_file(file2, &mf2, &bufs[1]) < 0) {
+        outbuf_printf(err, "%s: cannot read file '%s': %s\n", program_name, file2, strerror(errno));
+        return -1;
+    }
+
+    if (index_open(file1, &mf1, opts->xpp_flags, index_mode, &ix1, err) < 0) {
+        index_close(&ix1);
+        return -1;
+    }
+    if (index_open(file2, &mf2, opts->xpp_flags, index_mode, &ix2, err) < 0) {
+        index_close(&ix2);
+        index_close(&ix1);
+        return -1;
+    }
+    memset(&prep, 0, sizeof(prep));
+    prep.index1 = ix1.valid ? &ix1.index : NULL;
+    prep.index2 = ix2.valid ? &ix2.index : NULL;
+    ret = diff_buffers(file1, file2, &mf1, &mf2, &prep, opts, out, err);
+    index_close(&ix2);
+    index_close(&ix1);
+    return ret;
+}
+
+/*
+ * Compare two files in windows of 'max_memory' bytes in all, with the
+ * callbacks of diff_buffers(). Moved lines are not marked.
+ */
+static int diff_large_files(const char *file1, const char *file2,
+                            const struct diff_options *opts, long max_memory, struct outbuf *out,
+                            struct outbuf *err)
+{
+    struct stream_options sopts;
+    xdemitconf_t xecfg;
+    xdemitcb_t ecb;
+    struct diff_context ctx;
+
+    sopts.max_memory = max_memory;
+    sopts.xpp_flags = opts->xpp_flags;
+    sopts.brief = opts->brief;
+    sopts.text = opts->text;
+    sopts.binary_scan = opts->binary_scan;
+
+    memset(&xecfg, 0, sizeof(xecfg));
+    xecfg.ctxlen = opts->context_lines;
+    xecfg.flags = opts->emit_flags;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.file1 = file1;
+    ctx.file2 = file2;
+    ctx.out = out;
+    ctx.brief = opts->brief;
+    ctx.first_hunk = 1;
+
+    memset(&ecb, 0, sizeof(ecb));
+    ecb.priv = &ctx;
+    ecb.out_hunk = out_hunk_cb;
+    ecb.out_line = out_line_cb;
+
+    return diff_stream(file1, file2, &sopts, &xecfg, &ecb, out, err);
+}
+
+/*
+ * Whether two files are too large to be compared in memory within
+ * 'max_memory' bytes. Files that cannot be stat()ed are left to the
+ * in-memory path to report.
+ */
+static int needs_stream(const char *file1, const char *file2, long max_memory)
+{
+    struct stat st1, st2;
+
+    if (!max_memory || stat(file1, &st1) < 0 || stat(file2, &st2) < 0)
+        return 0;
+    return (double)(st1.st_size + st2.st_size) * STREAM_BYTES_FACTOR > (double)max_memory;
+}
+
+/* Write the delta or patched file produced by xdl_bdiff() or xdl_bpatch() */
+static int out_binary_cb(void *priv, mmbuffer_t *mb, int nb)
+{
+    struct outbuf *out = (struct outbuf *)priv;
+    int i;
+
+    for (i = 0; i < nb; i++)
+        outbuf_write(out, mb[i].ptr, mb[i].size);
+    return out->error ? -1 : 0;
+}
+
+/*
+ * Write a binary delta that turns 'file1' into 'file2', or with
+ * 'patch' set, apply the delta 'file2' to 'file1'.
+ */
+static int binary_delta(const char *file1, const char *file2, int patch, struct outbuf *out,
+                        struct outbuf *err)
+{
+    struct file_buf bufs[2];
+    mmfile_t mf1, mf2;
+    xdemitcb_t ecb;
+    int ret = -1;
+
+    memset(bufs, 0, sizeof(bufs));
+    if (read_file(file1, &mf1, &bufs[0]) < 0) {
+        outbuf_printf(err, "%s: cannot read file '%s': %s\n", program_name, file1, strerror(errno));
+        goto out;
+    }
+    if (read_file(file2, &mf2, &bufs[1]) < 0) {
+        outbuf_printf(err, "%s: cannot read file '%s': %s\n", program_name, file2, strerror(errno));
+        goto out;
+    }
+
+    memset(&ecb, 0, sizeof(ecb));
+    ecb.priv = out;
+    ecb.out_line = out_binary_cb;
+    if (patch) {
+        ret = xdl_bpatch(&mf1, &mf2, &ecb);
+        if (ret < 0 && !out->error)
+            outbuf_printf(err, "%s: '%s' is not a delta against '%s'\n", program_name, file2,
+                          file1);
+    } else {
+        ret = xdl_bdiff(&mf1, &mf2, NULL, &ecb);
+        if (ret < 0 && !out->error)
+            outbuf_printf(err, "%s: out of memory\n", program_name);
+    }
+
+out:
+    release_bufs(bufs, 2);
+    return ret;
+}
+
+/* Print how many lines 'file1' and 'file2' share, measured as 'mode' says */
+static int similarity(const char *file1, const char *file2, int mode, unsigned long flags,
+                      struct outbuf *out, struct outbuf *err)
+{
+    struct file_buf bufs[2];
+    mmfile_t mf1, mf2;
+    xdlsimilarity_t sim;
+    xdlsketch_t sk1, sk2;
+    int ret = -1;
+
+    memset(bufs, 0, sizeof(bufs));
+    if (read_file(file1, &mf1, &bufs[0]) < 0) {
+        outbuf_printf(err, "%s: cannot read file '%s': %s\n", program_name, file1, strerror(errno));
+        goto out;
+    }
+    if (read_file(file2, &mf2, &bufs[1]) < 0) {
+        outbuf_printf(err, "%s: cannot read file '%s': %s\n", program_name, file2, strerror(errno));
+        goto out;
+    }
+
+    if (mode == SIMILARITY_SKETCH) {
+        if (xdl_sketch(&mf1, flags, &sk1) < 0 || xdl_sketch(&mf2, flags, &sk2) < 0) {
+            outbuf_printf(err, "%s: out of memory\n", program_name);
+            goto out;
+        }
+        xdl_sketch_similarity(&sk1, &sk2, &sim);
+    } else if (xdl_similarity(&mf1, &mf2, flags, &sim) < 0) {
+        outbuf_printf(err, "%s: out of memory\n", program_name);
+        goto out;
+    }
+
+    outbuf_printf(out, "%d%% similar: %ld of %ld and %ld lines shared\n", rename_score(&sim),
+                  sim.shared, sim.nrec1, sim.nrec2);
+    ret = 0;
+
+out:
+    release_bufs(bufs, 2);
+    return ret;
+}
+
+/* Compare two files loaded ahead by a directory or batch run */
+static int diff_loaded(const struct load_file *file1, const struct load_file *file2,
+                       const struct diff_options *opts, struct outbuf *out, struct outbuf *err)
+{
+    const struct load_file *bad = file1->error ? file1 : file2->error ? file2 : NULL;
+
+    if (bad) {
+        outbuf_printf(err, "%s: cannot read file '%s': %s\n", program_name, bad->path,
+                      strerror(bad->error));
+        return -1;
+    }
+
+    return diff_buffers(file1->path, file2->path, (mmfile_t *)&file1->mf, (mmfile_t *)&file2->mf,
+                        NULL, opts, out, err);
+}
+
+/* Compare one file pair found by the directory walk */
+static int diff_dir_pair(const struct load_file *file1, const struct load_file *file2,
+                         struct outbuf *out, struct outbuf *err, void *priv)
+{
+    struct diff_run *run = (struct diff_run *)priv;
+
+    return diff_loaded(file1, file2, run->opts, out, err);
+}
+
+/* Compare one version with the next for --history */
+static int diff_history_step(xdlchain_t const *chain, long step, const struct load_file *file1,
+                             const struct load_file *file2, struct outbuf *out,
+                             struct outbuf *err, void *priv)
+{
+    struct diff_run *run = (struct diff_run *)priv;
+    struct diff_prep prep;
+
+    memset(&prep, 0, sizeof(prep));
+    prep.chain = chain;
+    prep.step = step;
+    return diff_buffers(file1->path, file2->path, (mmfile_t *)&file1->mf, (mmfile_t *)&file2->mf,
+                        &prep, run->opts, out, err);
+}
+
+/* Compare one file pair listed in a batch manifest */
+static int diff_batch_pair(const struct batch_pair *pair, const struct load_file *file1,
+                           const struct load_file *file2, struct outbuf *out, struct outbuf *err,
+                           void *priv)
+{
+    (void)priv;
+    return diff_loaded(file1, file2, (const struct diff_options *)pair->data, out, err);
+}
+
 /* Print usage information */
 static void usage(const char *progname)
 {
     fprintf(stderr, "Usage: %s [OPTIONS] FILE1 FILE2\n", progname);
+    fprintf(stderr, "       %s -r [OPTIONS] DIR1 DIR2\n", progname);
+    fprintf(stderr, "       %s --history [OPTIONS] FILE1 FILE2 [FILE3...]\n", progname);
+    fprintf(stderr, "       %s --batch[=MANIFEST] [OPTIONS]\n", progname);
+    fprintf(stderr, "       %s --serve=SOCKET [OPTIONS]\n", progname);
+    fprintf(stderr, "       %s --bdiff OLD NEW > DELTA\n", progname);
+    fprintf(stderr, "       %s --bpatch OLD DELTA > NEW\n", progname);
+    fprintf(stderr, "       %s --similarity[=MODE] [OPTIONS] FILE1 FILE2\n", progname);
     fprintf(stderr, "\nOptions:\n");
     fprintf(stderr,
             "  -u, --unified[=N]          Output unified diff format (default: 3 context lines)\n");
     fprintf(stderr,
             "  -c, --context[=N]          Output context diff format (default: 3 context lines)\n");
     fprintf(stderr, "  -q, --brief                Output only whether files differ\n");
+    fprintf(stderr, "  -r, --recursive            Recursively compare subdirectories; two files are\n"
+                    "                             compared as files\n");
+    fprintf(stderr,
+            "  -M, --find-renames[=N]     With -r, report files at least N%% similar as renames "
+            "(default: %d)\n",
+            RENAME_THRESHOLD_DEFAULT);
+    fprintf(stderr,
+            "  -C, --find-copies[=N]      With -r, also report files copied from kept ones\n");
+    fprintf(stderr,
+            "      --history              Compare each version of a file with the next\n");
+    fprintf(stderr,
+            "      --batch[=MANIFEST]     Compare the file pairs listed in MANIFEST "
+            "(default: stdin)\n");
+    fprintf(stderr,
+            "      --serve=SOCKET         Answer diff and merge requests on a Unix socket\n");
+    fprintf(stderr,
+            "      --cache-size=MB        Memory for prepared files with --serve (default: 256)\n");
+    fprintf(stderr,
+            "      --client=SOCKET        Have the server at SOCKET compare FILE1 and FILE2\n");
+    fprintf(stderr,
+            "      --max-memory=MB        Compare files too large for MB of memory in windows\n");
+    fprintf(stderr,
+            "      --bdiff                Write a binary delta that turns FILE1 into FILE2\n");
+    fprintf(stderr, "      --bpatch               Apply the binary delta FILE2 to FILE1\n");
+    fprintf(stderr,
+            "      --similarity[=MODE]    Print how many lines FILE1 and FILE2 share (exact, "
+            "sketch)\n");
+    fprintf(stderr,
+            "  -j, --jobs=N               Compare up to N file pairs in parallel with -r, "
+            "--batch or --history\n");
     fprintf(stderr, "  -w, --ignore-all-space     Ignore all whitespace\n");
     fprintf(stderr, "  -b, --ignore-space-change  Ignore whitespace changes\n");
     fprintf(stderr, "  -B, --ignore-blank-lines   Ignore blank lines\n");
+    fprintf(stderr, "  -a, --text                 Compare binary files line by line too\n");
+    fprintf(stderr,
+            "      --binary-scan=KB       Check the first KB of each file for binary content "
+            "(0: all; default: 8)\n");
     fprintf(stderr, "      --minimal              Produce minimal diff\n");
     fprintf(stderr, "      --patience             Use patience diff algorithm\n");
     fprintf(stderr, "      --histogram            Use histogram diff algorithm\n");
+    fprintf(stderr,
+            "      --stats                Report the time and memory of each diff on stderr\n");
+    fprintf(stderr,
+            "      --use-index            Use the line index in FILE" INDEX_SUFFIX
+            " when it matches FILE\n");
+    fprintf(stderr,
+            "      --write-index          Write FILE" INDEX_SUFFIX
+            " for each file whose index is missing or stale\n");
     fprintf(stderr, "  -h, --help                 Show this help message\n");
     fprintf(stderr,
             "      --moved[=MODE]         Detect moved blocks (no, plain, blocks, zebra, "
@@ -206,29 +722,63 @@ static void usage(const char *progname)
             "ignore-change, ignore-at-eol)\n");
 }
 
-int main(int argc, char *argv[])
+/* Restart getopt_long() so that it can parse another argument vector */
+static void reset_getopt(void)
+{
+#if defined(__GLIBC__)
+    optind = 0;
+#else
+    optind = 1;
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+    optreset = 1;
+#endif
+#endif
+}
+
+/* Parse the number of context lines given to -u or -c */
+static int parse_context(int argc, char *argv[], long *context_lines, struct outbuf *err)
+{
+    if (optarg) {
+        *context_lines = atol(optarg);
+    } else if (optind < argc && argv[optind]) {
+        /* Check if next argument looks like a number */
+        char *endptr;
+        long val = strtol(argv[optind], &endptr, 10);
+        if (*endptr == '\0' && endptr != argv[optind]) {
+            /* It's a number, consume it */
+            *context_lines = val;
+            optind++;
+        }
+        /* Otherwise, it's probably a filename, use default */
+    }
+    if (*context_lines < 0) {
+        outbuf_printf(err, "%s: invalid number of context lines\n", program_name);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Parse options into 'opts', which holds the defaults on entry. Options
+ * that apply to the whole invocation go to 'run'; when 'run' is NULL
+ * the arguments come from a batch manifest and those options are
+ * rejected. Returns the index of the first operand, or -1 after writing
+ * a diagnostic to 'err'.
+ */
+static int parse_options(int argc, char *argv[], struct diff_options *opts,
+                         struct run_options *run, struct outbuf *err)
 {
     int opt;
     int option_index = 0;
-    long context_lines = 3;
-    int brief = 0;
-    unsigned long xpp_flags = 0;
-    unsigned long emit_flags = 0;
     int algorithm_set = 0;
-    enum moved_mode moved_mode = MOVED_MODE_PLAIN;
-    enum moved_ws_mode moved_ws_mode = MOVED_WS_NO;
-    struct moved_context moved_ctx;
-    mmfile_t mf1, mf2;
-    xpparam_t xpp;
-    xdemitconf_t xecfg;
-    xdemitcb_t ecb;
-    struct diff_context ctx;
-    int ret = 0;
-    const char *file1 = NULL, *file2 = NULL;
 
     static struct option long_options[] = { { "unified", optional_argument, 0, 'u' },
                                             { "context", optional_argument, 0, 'c' },
                                             { "brief", no_argument, 0, 'q' },
+                                            { "recursive", no_argument, 0, 'r' },
+                                            { "jobs", required_argument, 0, 'j' },
+                                            { "find-renames", optional_argument, 0, 'M' },
+                                            { "find-copies", optional_argument, 0, 'C' },
                                             { "ignore-all-space", no_argument, 0, 'w' },
                                             { "ignore-space-change", no_argument, 0, 'b' },
                                             { "ignore-blank-lines", no_argument, 0, 'B' },
@@ -238,214 +788,585 @@ int main(int argc, char *argv[])
                                             { "help", no_argument, 0, 'h' },
                                             { "moved", optional_argument, 0, 4 },
                                             { "moved-ws", required_argument, 0, 5 },
+                                            { "batch", optional_argument, 0, 6 },
+                                            { "serve", required_argument, 0, 7 },
+                                            { "client", required_argument, 0, 8 },
+                                            { "cache-size", required_argument, 0, 9 },
+                                            { "max-memory", required_argument, 0, 10 },
+                                            { "bdiff", no_argument, 0, 11 },
+                                            { "bpatch", no_argument, 0, 12 },
+                                            { "text", no_argument, 0, 'a' },
+                                            { "binary-scan", required_argument, 0, 13 },
+                                            { "stats", no_argument, 0, 14 },
+                                            { "use-index", no_argument, 0, 15 },
+                                            { "write-index", no_argument, 0, 16 },
+                                            { "history", no_argument, 0, 17 },
+                                            { "similarity", optional_argument, 0, 18 },
                                             { 0, 0, 0, 0 } };
 
-    /* Initialize file structures */
-    mf1.ptr = NULL;
-    mf1.size = 0;
-    mf2.ptr = NULL;
-    mf2.size = 0;
+    reset_getopt();
+    /* Manifest options are reported in the pair's frame, not on stderr */
+    opterr = run != NULL;
+
+    while ((opt = getopt_long(argc, argv, "u::c::qrj:M::C::wbBah", long_options, &option_index)) !=
+           -1) {
+        if (!run && (opt == 'r' || opt == 'j' || opt == 'M' || opt == 'C' || opt == 'h' ||
+                     (opt >= 6 && opt <= 12) || opt == 15 || opt == 16 || opt == 17 || opt == 18)) {
+            outbuf_printf(err, "%s: option '%s' cannot be used per pair\n", program_name,
+                          argv[optind - 1]);
+            return -1;
+        }
 
-    /* Parse command-line options */
-    while ((opt = getopt_long(argc, argv, "u::c::qwbBh", long_options, &option_index)) != -1) {
         switch (opt) {
         case 'u':
-            if (optarg) {
-                context_lines = atol(optarg);
-                if (context_lines < 0) {
-                    fprintf(stderr, "%s: invalid number of context lines\n", argv[0]);
-                    return 1;
-                }
-            } else if (optind < argc && argv[optind]) {
-                /* Check if next argument looks like a number */
-                char *endptr;
-                long val = strtol(argv[optind], &endptr, 10);
-                if (*endptr == '\0' && endptr != argv[optind]) {
-                    /* It's a number, consume it */
-                    context_lines = val;
-                    optind++;
-                    if (context_lines < 0) {
-                        fprintf(stderr, "%s: invalid number of context lines\n", argv[0]);
-                        return 1;
-                    }
-                }
-                /* Otherwise, it's probably a filename, use default */
+        case 'c':
+            if (parse_context(argc, argv, &opts->context_lines, err) < 0)
+                return -1;
+            break;
+        case 'q':
+            opts->brief = 1;
+            break;
+        case 'r':
+            run->recursive = 1;
+            break;
+        case 'j': {
+            char *endptr;
+            run->jobs = strtol(optarg, &endptr, 10);
+            if (*endptr != '\0' || endptr == optarg || run->jobs < 1) {
+                outbuf_printf(err, "%s: invalid number of jobs: %s\n", program_name, optarg);
+                return -1;
             }
             break;
-        case 'c':
+        }
+        case 'M':
+        case 'C':
             if (optarg) {
-                context_lines = atol(optarg);
-                if (context_lines < 0) {
-                    fprintf(stderr, "%s: invalid number of context lines\n", argv[0]);
-                    return 1;
-                }
-            } else if (optind < argc && argv[optind]) {
-                /* Check if next argument looks like a number */
                 char *endptr;
-                long val = strtol(argv[optind], &endptr, 10);
-                if (*endptr == '\0' && endptr != argv[optind]) {
-                    /* It's a number, consume it */
-                    context_lines = val;
-                    optind++;
-                    if (context_lines < 0) {
-                        fprintf(stderr, "%s: invalid number of context lines\n", argv[0]);
-                        return 1;
-                    }
+                run->rename_threshold = strtol(optarg, &endptr, 10);
+                if (*endptr == '%')
+                    endptr++;
+                if (*endptr != '\0' || endptr == optarg || run->rename_threshold < 0 ||
+                    run->rename_threshold > 100) {
+                    outbuf_printf(err, "%s: invalid similarity threshold: %s\n", program_name,
+                                  optarg);
+                    return -1;
                 }
-                /* Otherwise, it's probably a filename, use default */
             }
-            break;
-        case 'q':
-            brief = 1;
+            if (run->renames < (opt == 'C' ? 2 : 1))
+                run->renames = opt == 'C' ? 2 : 1;
             break;
         case 'w':
-            xpp_flags |= XDF_IGNORE_WHITESPACE;
+            opts->xpp_flags |= XDF_IGNORE_WHITESPACE;
             break;
         case 'b':
-            xpp_flags |= XDF_IGNORE_WHITESPACE_CHANGE;
+            opts->xpp_flags |= XDF_IGNORE_WHITESPACE_CHANGE;
             break;
         case 'B':
-            xpp_flags |= XDF_IGNORE_BLANK_LINES;
+            opts->xpp_flags |= XDF_IGNORE_BLANK_LINES;
+            break;
+        case 'a':
+            opts->text = 1;
             break;
         case 1: /* --minimal */
-            xpp_flags |= XDF_NEED_MINIMAL;
+            opts->xpp_flags |= XDF_NEED_MINIMAL;
             break;
         case 2: /* --patience */
-            if (algorithm_set) {
-                fprintf(stderr, "%s: only one diff algorithm can be specified\n", argv[0]);
-                return 1;
-            }
-            xpp_flags |= XDF_PATIENCE_DIFF;
-            algorithm_set = 1;
-            break;
         case 3: /* --histogram */
             if (algorithm_set) {
-                fprintf(stderr, "%s: only one diff algorithm can be specified\n", argv[0]);
-                return 1;
+                outbuf_printf(err, "%s: only one diff algorithm can be specified\n",
+                              program_name);
+                return -1;
             }
-            xpp_flags |= XDF_HISTOGRAM_DIFF;
+            /* Replaces the default algorithm of a batch */
+            opts->xpp_flags &= ~XDF_DIFF_ALGORITHM_MASK;
+            opts->xpp_flags |= opt == 2 ? XDF_PATIENCE_DIFF : XDF_HISTOGRAM_DIFF;
             algorithm_set = 1;
             break;
         case 'h':
-            usage(argv[0]);
-            return 0;
+            run->help = 1;
+            return optind;
         case 4: /* --moved */
             if (!optarg || strcmp(optarg, "plain") == 0) {
-                moved_mode = MOVED_MODE_PLAIN;
+                opts->moved_mode = MOVED_MODE_PLAIN;
             } else if (strcmp(optarg, "blocks") == 0) {
-                moved_mode = MOVED_MODE_BLOCKS;
+                opts->moved_mode = MOVED_MODE_BLOCKS;
             } else if (strcmp(optarg, "zebra") == 0) {
-                moved_mode = MOVED_MODE_ZEBRA;
+                opts->moved_mode = MOVED_MODE_ZEBRA;
             } else if (strcmp(optarg, "dimmed-zebra") == 0) {
-                moved_mode = MOVED_MODE_DIMMED_ZEBRA;
+                opts->moved_mode = MOVED_MODE_DIMMED_ZEBRA;
             } else if (strcmp(optarg, "no") == 0) {
-                moved_mode = MOVED_MODE_NO;
+                opts->moved_mode = MOVED_MODE_NO;
             } else {
-                fprintf(stderr, "%s: invalid moved mode: %s\n", argv[0], optarg);
-                return 1;
+                outbuf_printf(err, "%s: invalid moved mode: %s\n", program_name, optarg);
+                return -1;
             }
+            if (run)
+                run->moved = opts->moved_mode != MOVED_MODE_NO;
             break;
         case 5: /* --moved-ws */
             if (strcmp(optarg, "ignore-all") == 0) {
-                moved_ws_mode = MOVED_WS_IGNORE_ALL;
+                opts->moved_ws_mode = MOVED_WS_IGNORE_ALL;
             } else if (strcmp(optarg, "ignore-change") == 0) {
-                moved_ws_mode = MOVED_WS_IGNORE_CHANGE;
+                opts->moved_ws_mode = MOVED_WS_IGNORE_CHANGE;
             } else if (strcmp(optarg, "ignore-at-eol") == 0) {
-                moved_ws_mode = MOVED_WS_IGNORE_AT_EOL;
+                opts->moved_ws_mode = MOVED_WS_IGNORE_AT_EOL;
             } else {
-                fprintf(stderr, "%s: invalid moved-ws mode: %s\n", argv[0], optarg);
-                return 1;
+                outbuf_printf(err, "%s: invalid moved-ws mode: %s\n", program_name, optarg);
+                return -1;
+            }
+            break;
+        case 6: /* --batch */
+            run->batch = optarg ? optarg : "-";
+            break;
+        case 7: /* --serve */
+            run->serve = optarg;
+            break;
+        case 8: /* --client */
+            run->client = optarg;
+            break;
+        case 9: { /* --cache-size */
+            char *endptr;
+            long mb = strtol(optarg, &endptr, 10);
+            if (*endptr != '\0' || endptr == optarg || mb < 0 || mb > LONG_MAX / (1024 * 1024)) {
+                outbuf_printf(err, "%s: invalid cache size: %s\n", program_name, optarg);
+                return -1;
+            }
+            run->cache_size = mb * 1024 * 1024;
+            break;
+        }
+        case 10: { /* --max-memory */
+            char *endptr;
+            long mb = strtol(optarg, &endptr, 10);
+            if (*endptr != '\0' || endptr == optarg || mb < 1 || mb > LONG_MAX / (1024 * 1024)) {
+                outbuf_printf(err, "%s: invalid memory limit: %s\n", program_name, optarg);
+                return -1;
+            }
+            run->max_memory = mb * 1024 * 1024;
+            break;
+        }
+        case 11: /* --bdiff */
+            run->bdiff = 1;
+            break;
+        case 12: /* --bpatch */
+            run->bpatch = 1;
+            break;
+        case 13: { /* --binary-scan */
+            char *endptr;
+            long kb = strtol(optarg, &endptr, 10);
+            if (*endptr != '\0' || endptr == optarg || kb < 0 || kb > LONG_MAX / 1024) {
+                outbuf_printf(err, "%s: invalid binary scan size: %s\n", program_name, optarg);
+                return -1;
+            }
+            opts->binary_scan = kb * 1024;
+            break;
+        }
+        case 14: /* --stats */
+            opts->stats = 1;
+            break;
+        case 15: /* --use-index */
+            run->index |= INDEX_USE;
+            break;
+        case 16: /* --write-index */
+            run->index |= INDEX_WRITE;
+            break;
+        case 17: /* --history */
+            run->history = 1;
+            break;
+        case 18: /* --similarity */
+            if (!optarg || strcmp(optarg, "exact") == 0) {
+                run->similarity = SIMILARITY_EXACT;
+            } else if (strcmp(optarg, "sketch") == 0) {
+                run->similarity = SIMILARITY_SKETCH;
+            } else {
+                outbuf_printf(err, "%s: invalid similarity mode: %s\n", program_name, optarg);
+                return -1;
             }
             break;
         case '?':
-            return 1;
         default:
-            return 1;
+            if (!run)
+                outbuf_printf(err, "%s: invalid option '%s'\n", program_name, argv[optind - 1]);
+            return -1;
         }
     }
+    return optind;
+}
 
-    /* Get file arguments */
-    if (optind + 2 != argc) {
-        fprintf(stderr, "%s: exactly two file arguments required\n", argv[0]);
+/*
+ * Parse per-pair options on top of a copy of 'defaults'. Runs on the
+ * main thread, or under a lock, since getopt_long() is not reentrant.
+ * Returns the options, to be freed with xdl_free(), or NULL after
+ * writing a diagnostic to 'err'.
+ */
+static struct diff_options *parse_pair_options(const char *options,
+                                               const struct diff_options *defaults,
+                                               struct outbuf *err)
+{
+    struct diff_options *opts;
+    char **argv = NULL, *args = NULL, *tok;
+    int argc = 0, ret = -1;
+
+    if (!(opts = (struct diff_options *)xdl_malloc(sizeof(*opts)))) {
+        outbuf_printf(err, "%s: out of memory\n", program_name);
+        return NULL;
+    }
+    *opts = *defaults;
+    if (!options || !*options)
+        return opts;
+
+    /* Split the options on blanks; each word needs at most two bytes */
+    argv = (char **)xdl_malloc((strlen(options) / 2 + 3) * sizeof(*argv));
+    if (!argv || !(args = strdup(options))) {
+        outbuf_printf(err, "%s: out of memory\n", program_name);
+        goto cleanup;
+    }
+    argv[argc++] = (char *)program_name;
+    for (tok = strtok(args, " \t"); tok; tok = strtok(NULL, " \t"))
+        argv[argc++] = tok;
+    argv[argc] = NULL;
+
+    ret = parse_options(argc, argv, opts, NULL, err);
+    if (ret >= 0 && ret < argc) {
+        outbuf_printf(err, "%s: unexpected argument '%s' in pair options\n", program_name,
+                      argv[ret]);
+        ret = -1;
+    }
+
+cleanup:
+    free(args);
+    xdl_free(argv);
+    if (ret < 0) {
+        xdl_free(opts);
+        return NULL;
+    }
+    return opts;
+}
+
+/* Parse the options column of a manifest entry */
+static int prepare_batch_pair(struct batch_pair *pair, struct outbuf *err, void *priv)
+{
+    struct diff_run *run = (struct diff_run *)priv;
+
+    pair->data = parse_pair_options(pair->options, run->opts, err);
+    return pair->data ? 0 : -1;
+}
+
+/* Parse the options of a request to the server */
+static int parse_serve_options(const char *options, void **data, unsigned long *flags,
+                               struct outbuf *err, void *priv)
+{
+    struct diff_options *opts = parse_pair_options(options, (const struct diff_options *)priv, err);
+
+    if (!opts)
+        return -1;
+    *data = opts;
+    *flags = opts->xpp_flags;
+    return 0;
+}
+
+/* Answer a diff request of the server from its prepared files */
+static int diff_serve_pair(void *data, const struct serve_file *file1,
+                           const struct serve_file *file2, struct outbuf *out, struct outbuf *err,
+                           void *priv)
+{
+    struct diff_prep prep;
+
+    (void)priv;
+    memset(&prep, 0, sizeof(prep));
+    prep.index1 = file1->index;
+    prep.index2 = file2->index;
+    return diff_buffers(file1->name, file2->name, file1->mf, file2->mf, &prep,
+                        (const struct diff_options *)data, out, err);
+}
+
+/* Spell out the options that the server needs to reproduce a local diff */
+static void format_options(const struct diff_options *opts, struct outbuf *ob)
+{
+    static const char *const moved[] = { "no", "plain", "blocks", "zebra", "dimmed-zebra" };
+    static const char *const moved_ws[] = { "no", "ignore-all", "ignore-change",
+                                            "ignore-at-eol" };
+
+    outbuf_printf(ob, "-u %ld --moved=%s", opts->context_lines, moved[opts->moved_mode]);
+    if (opts->moved_ws_mode != MOVED_WS_NO)
+        outbuf_printf(ob, " --moved-ws=%s", moved_ws[opts->moved_ws_mode]);
+    if (opts->brief)
+        outbuf_puts(ob, " -q");
+    if (opts->text)
+        outbuf_puts(ob, " -a");
+    if (opts->binary_scan != BINARY_SCAN_DEFAULT)
+        outbuf_printf(ob, " --binary-scan=%ld", opts->binary_scan / 1024);
+    if (opts->stats)
+        outbuf_puts(ob, " --stats");
+    if (opts->xpp_flags & XDF_IGNORE_WHITESPACE)
+        outbuf_puts(ob, " -w");
+    if (opts->xpp_flags & XDF_IGNORE_WHITESPACE_CHANGE)
+        outbuf_puts(ob, " -b");
+    if (opts->xpp_flags & XDF_IGNORE_BLANK_LINES)
+        outbuf_puts(ob, " -B");
+    if (opts->xpp_flags & XDF_NEED_MINIMAL)
+        outbuf_puts(ob, " --minimal");
+    if (XDF_DIFF_ALG(opts->xpp_flags) == XDF_PATIENCE_DIFF)
+        outbuf_puts(ob, " --patience");
+    else if (XDF_DIFF_ALG(opts->xpp_flags) == XDF_HISTOGRAM_DIFF)
+        outbuf_puts(ob, " --histogram");
+    outbuf_putc(ob, '\0');
+}
+
+/*
+ * Have the server at 'socket' compare two local files. The files are
+ * passed by absolute path and labelled as given on the command line.
+ */
+static int diff_remote(const char *socket, const char *file1, const char *file2,
+                       const struct diff_options *opts, struct outbuf *out, struct outbuf *err)
+{
+    struct serve_conn *conn;
+    struct serve_input inputs[2];
+    struct outbuf options, payload;
+    char *paths[2];
+    int i, ret = -1;
+
+    paths[0] = paths[1] = NULL;
+    for (i = 0; i < 2; i++) {
+        if (!(paths[i] = realpath(i ? file2 : file1, NULL))) {
+            int saved_errno = errno;
+
+            outbuf_printf(err, "%s: cannot read file '%s': %s\n", program_name,
+                          i ? file2 : file1, strerror(saved_errno));
+            free(paths[0]);
+            free(paths[1]);
+            return -1;
+        }
+        inputs[i].path = paths[i];
+        inputs[i].data = NULL;
+        inputs[i].size = 0;
+        inputs[i].label = i ? file2 : file1;
+    }
+
+    outbuf_init_mem(&options);
+    outbuf_init_mem(&payload);
+    format_options(opts, &options);
+    if (options.error) {
+        outbuf_printf(err, "%s: out of memory\n", program_name);
+    } else if ((conn = serve_connect(socket, err)) != NULL) {
+        ret = serve_request(conn, "diff", options.buf, inputs, 2, &payload);
+        if (ret < 0) {
+            outbuf_printf(err, "%s: lost connection to '%s'\n", program_name, socket);
+        } else if (ret == 2) {
+            outbuf_write(err, payload.buf, payload.len);
+            ret = -1;
+        } else {
+            outbuf_write(out, payload.buf, payload.len);
+        }
+        serve_close(conn);
+    }
+
+    outbuf_release(&options);
+    outbuf_release(&payload);
+    free(paths[0]);
+    free(paths[1]);
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    struct run_options run_opts;
+    struct diff_options opts;
+    struct diff_run run;
+    struct outbuf out, err;
+    struct stat st1, st2;
+    int ret = 0;
+    int first;
+    const char *file1 = NULL, *file2 = NULL;
+
+    program_name = argv[0];
+
+    memset(&run_opts, 0, sizeof(run_opts));
+    run_opts.cache_size = SERVE_CACHE_SIZE;
+    run_opts.rename_threshold = RENAME_THRESHOLD_DEFAULT;
+    opts.context_lines = 3;
+    opts.brief = 0;
+    opts.recursive = 0;
+    opts.text = 0;
+    opts.binary_scan = BINARY_SCAN_DEFAULT;
+    opts.stats = 0;
+    opts.xpp_flags = 0;
+    opts.emit_flags = 0;
+    opts.moved_mode = MOVED_MODE_PLAIN;
+    opts.moved_ws_mode = MOVED_WS_NO;
+
+    outbuf_init_fd(&out, STDOUT_FILENO);
+    outbuf_init_fd(&err, STDERR_FILENO);
+
+    /* Parse command-line options */
+    first = parse_options(argc, argv, &opts, &run_opts, &err);
+    if (first < 0) {
+        ret = -1;
+        goto out;
+    }
+    if (run_opts.help) {
         usage(argv[0]);
-        return 1;
+        goto out;
     }
 
-    file1 = argv[optind];
-    file2 = argv[optind + 1];
+    if (run_opts.client && (run_opts.batch || run_opts.recursive || run_opts.serve)) {
+        outbuf_printf(&err, "%s: --client cannot be combined with -r, --batch or --serve\n",
+                      argv[0]);
+        ret = -1;
+        goto out;
+    }
 
-    /* Read files */
-    if (read_file(file1, &mf1) < 0) {
-        fprintf(stderr, "%s: cannot read file '%s': %s\n", argv[0], file1, strerror(errno));
-        ret = 1;
-        goto cleanup;
+    if (run_opts.max_memory &&
+        (run_opts.batch || run_opts.recursive || run_opts.serve || run_opts.client)) {
+        outbuf_printf(&err, "%s: --max-memory cannot be combined with -r, --batch, --serve or "
+                      "--client\n", argv[0]);
+        ret = -1;
+        goto out;
+    }
+    if (run_opts.max_memory && (opts.xpp_flags & XDF_IGNORE_BLANK_LINES)) {
+        outbuf_printf(&err, "%s: --max-memory cannot be combined with -B\n", argv[0]);
+        ret = -1;
+        goto out;
     }
 
-    if (read_file(file2, &mf2) < 0) {
-        fprintf(stderr, "%s: cannot read file '%s': %s\n", argv[0], file2, strerror(errno));
-        ret = 1;
-        goto cleanup;
+    if ((run_opts.bdiff || run_opts.bpatch) &&
+        (run_opts.bdiff + run_opts.bpatch > 1 || run_opts.batch || run_opts.recursive ||
+         run_opts.serve || run_opts.client || run_opts.max_memory)) {
+        outbuf_printf(&err, "%s: --bdiff and --bpatch cannot be combined with each other or with "
+                      "-r, --batch, --serve, --client or --max-memory\n", argv[0]);
+        ret = -1;
+        goto out;
     }
 
-    /* Configure xdiff parameters */
-    memset(&xpp, 0, sizeof(xpp));
-    xpp.flags = xpp_flags;
+    if (run_opts.index &&
+        (run_opts.batch || run_opts.recursive || run_opts.serve || run_opts.client ||
+         run_opts.max_memory || run_opts.bdiff || run_opts.bpatch)) {
+        outbuf_printf(&err, "%s: --use-index and --write-index only apply to the comparison of "
+                      "two files\n", argv[0]);
+        ret = -1;
+        goto out;
+    }
 
-    memset(&xecfg, 0, sizeof(xecfg));
-    xecfg.ctxlen = context_lines;
-    xecfg.interhunkctxlen = 0;
-    xecfg.flags = emit_flags;
+    if (run_opts.history &&
+        (run_opts.batch || run_opts.recursive || run_opts.serve || run_opts.client ||
+         run_opts.max_memory || run_opts.bdiff || run_opts.bpatch || run_opts.index ||
+         opts.stats)) {
+        outbuf_printf(&err, "%s: --history cannot be combined with -r, --batch, --serve, "
+                      "--client, --max-memory, --bdiff, --bpatch, --use-index, --write-index or "
+                      "--stats\n", argv[0]);
+        ret = -1;
+        goto out;
+    }
 
-    /* Initialize move detection */
-    moved_context_init(&moved_ctx, moved_mode, moved_ws_mode);
+    if (run_opts.similarity &&
+        (run_opts.batch || run_opts.recursive || run_opts.serve || run_opts.client ||
+         run_opts.max_memory || run_opts.bdiff || run_opts.bpatch || run_opts.index ||
+         run_opts.history)) {
+        outbuf_printf(&err, "%s: --similarity cannot be combined with -r, --batch, --serve, "
+                      "--client, --max-memory, --bdiff, --bpatch, --use-index, --write-index or "
+                      "--history\n", argv[0]);
+        ret = -1;
+        goto out;
+    }
 
-    /* Collect blocks for move detection if enabled */
-    if (moved_mode != MOVED_MODE_NO) {
-        if (collect_blocks_from_diff(&mf1, &mf2, &xpp, &moved_ctx) < 0) {
-            fprintf(stderr, "%s: failed to collect blocks for move detection\n", argv[0]);
-            moved_context_free(&moved_ctx);
-            ret = 1;
-            goto cleanup;
+    if (run_opts.renames && (!run_opts.recursive || run_opts.batch || run_opts.serve ||
+                             run_opts.client || run_opts.max_memory)) {
+        outbuf_printf(&err, "%s: --find-renames and --find-copies need -r and cannot be combined "
+                      "with --batch, --serve, --client or --max-memory\n", argv[0]);
+        ret = -1;
+        goto out;
+    }
+
+    if (run_opts.serve) {
+        if (first != argc) {
+            outbuf_printf(&err, "%s: no file arguments allowed with --serve\n", argv[0]);
+            ret = -1;
+            goto out;
         }
+        outbuf_flush(&err);
+        ret = serve(run_opts.serve, run_opts.cache_size, parse_serve_options, diff_serve_pair,
+                    &opts, &err);
+        goto out;
     }
 
-    /* Set up callbacks */
-    ctx.file1 = file1;
-    ctx.file2 = file2;
-    ctx.brief = brief;
-    ctx.first_hunk = 1;
-    ctx.has_differences = 0;
-    ctx.moved_ctx = moved_mode != MOVED_MODE_NO ? &moved_ctx : NULL;
-    ctx.current_old_line = 0;
-    ctx.current_new_line = 0;
+    /* Get file arguments */
+    if (run_opts.batch     ? first != argc
+        : run_opts.history ? first + 2 > argc
+                           : first + 2 != argc) {
+        outbuf_printf(&err, "%s: %s\n", argv[0],
+                      run_opts.batch     ? "no file arguments allowed with --batch"
+                      : run_opts.history ? "at least two file arguments required"
+                                         : "exactly two file arguments required");
+        outbuf_flush(&err);
+        usage(argv[0]);
+        ret = -1;
+        goto out;
+    }
 
-    memset(&ecb, 0, sizeof(ecb));
-    ecb.priv = &ctx;
-    ecb.out_hunk = out_hunk_cb;
-    ecb.out_line = out_line_cb;
+    if (!run_opts.jobs)
+        run_opts.jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    if (run_opts.jobs < 1)
+        run_opts.jobs = 1;
+    run.opts = &opts;
 
-    /* Compute diff */
-    ret = xdl_diff(&mf1, &mf2, &xpp, &xecfg, &ecb);
+    if (run_opts.batch) {
+        ret = diff_batch(run_opts.batch, (int)run_opts.jobs, prepare_batch_pair, diff_batch_pair,
+                         &run, &out, &err);
+    } else if (run_opts.history) {
+        xpparam_t xpp;
 
-    if (ret < 0) {
-        fprintf(stderr, "%s: diff computation failed\n", argv[0]);
-        ret = 1;
-    } else if (brief) {
-        /* In brief mode, exit with status 1 if files differ, 0 if same */
-        if (ctx.has_differences) {
-            printf("Files %s and %s differ\n", file1, file2);
-            ret = 1; /* Files differ */
+        memset(&xpp, 0, sizeof(xpp));
+        xpp.flags = opts.xpp_flags;
+        ret = diff_history(argv + first, argc - first, &xpp, (int)run_opts.jobs,
+                           diff_history_step, &run, &out, &err);
+    } else {
+        file1 = argv[first];
+        file2 = argv[first + 1];
+
+        if (run_opts.bdiff || run_opts.bpatch) {
+            ret = binary_delta(file1, file2, run_opts.bpatch, &out, &err);
+        } else if (run_opts.similarity) {
+            ret = similarity(file1, file2, run_opts.similarity, opts.xpp_flags, &out, &err);
+        } else if (run_opts.client) {
+            ret = diff_remote(run_opts.client, file1, file2, &opts, &out, &err);
+        } else if (run_opts.recursive && stat(file1, &st1) == 0 && stat(file2, &st2) == 0 &&
+            S_ISDIR(st1.st_mode) && S_ISDIR(st2.st_mode)) {
+            struct rename_options renames;
+
+            renames.copies = run_opts.renames > 1;
+            renames.threshold = (int)run_opts.rename_threshold;
+            renames.flags = opts.xpp_flags;
+            opts.recursive = 1;
+            ret = diff_directories(file1, file2, run_opts.renames ? &renames : NULL,
+                                   (int)run_opts.jobs, diff_dir_pair, &run, &out, &err);
+        } else if (needs_stream(file1, file2, run_opts.max_memory)) {
+            if (run_opts.moved || opts.stats) {
+                outbuf_printf(&err, "%s: --moved and --stats cannot be used on files compared in "
+                              "windows with --max-memory\n", argv[0]);
+                ret = -1;
+            } else {
+                ret = diff_large_files(file1, file2, &opts, run_opts.max_memory, &out, &err);
+            }
         } else {
-            ret = 0; /* Files are identical */
+            struct file_buf bufs[2];
+
+            memset(bufs, 0, sizeof(bufs));
+            ret = diff_files(file1, file2, &opts, run_opts.index, bufs, &out, &err);
+            release_bufs(bufs, 2);
         }
-    } else {
-        ret = 0; /* Success */
     }
 
-cleanup:
-    moved_context_free(&moved_ctx);
-    free_file(&mf1);
-    free_file(&mf2);
+out:
+    if (outbuf_flush(&out) < 0 && ret >= 0) {
+        outbuf_printf(&err, "%s: write error: %s\n", argv[0], strerror(errno));
+        ret = -1;
+    }
+    outbuf_flush(&err);
+    outbuf_release(&out);
+    outbuf_release(&err);
 
-    return ret;
+    if (ret < 0)
+        return 1;
+
+    /* In brief mode, exit with status 1 if files differ, 0 if same */
+    return opts.brief ? ret : 0;
 }
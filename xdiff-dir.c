@@ -0,0 +1,526 @@
+/*
+ * xdiff-dir.c - Recursive directory comparison for xdiff
+ * Similar to diff -r
+ */
+
+#include "xdiff-dir.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "xdiff-pool.h"
+#include "xinclude.h"
+
+/* One unit of output, in the order it must appear */
+struct dir_item {
+    char *path1;   /* File pair to compare, or NULL for a plain message */
+    char *path2;
+    char *message;     /* Message printed before the diff, or instead of it */
+    struct outbuf out; /* Captured report of the comparison */
+    struct outbuf err; /* Captured diagnostics of the comparison */
+    int status;        /* Result of the callback */
+};
+
+/* Work list shared by the worker threads */
+struct dir_walk {
+    struct dir_item *items;
+    long nr;
+    long alloc;
+    dir_diff_fn fn;
+    void *priv;
+    struct loader *loader;
+    struct outbuf *out; /* Destination of the ordered results */
+    struct outbuf *err; /* Diagnostics of the walk itself */
+    int ret;
+    const struct rename_options *renames; /* Rename detection, or NULL */
+    struct rename_file *files;            /* Files that may be renamed or copied */
+    long nfiles;
+    long afiles;
+};
+
+/* A directory being walked, linked to the directory it is in */
+struct dir_visit {
+    dev_t dev;
+    ino_t ino;
+    const struct dir_visit *up;
+};
+
+static char *path_join(const char *dir, const char *name)
+{
+    size_t dlen = strlen(dir), nlen = strlen(name);
+    int slash = dlen > 0 && dir[dlen - 1] != '/';
+    char *path = (char *)xdl_malloc(dlen + slash + nlen + 1);
+
+    if (!path)
+        return NULL;
+    memcpy(path, dir, dlen);
+    if (slash)
+        path[dlen] = '/';
+    memcpy(path + dlen + slash, name, nlen + 1);
+    return path;
+}
+
+static int name_cmp(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void free_names(char **names, long nr)
+{
+    long i;
+
+    for (i = 0; i < nr; i++)
+        xdl_free(names[i]);
+    xdl_free(names);
+}
+
+/* Read the entries of a directory, sorted by name */
+static int read_names(const char *dir, char ***names_out, long *nr_out)
+{
+    DIR *d;
+    struct dirent *de;
+    char **names = NULL;
+    long nr = 0, alloc = 0;
+
+    if (!(d = opendir(dir)))
+        return -1;
+    while ((de = readdir(d)) != NULL) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+            continue;
+        if (XDL_ALLOC_GROW(names, nr + 1, alloc) || !(names[nr] = strdup(de->d_name))) {
+            closedir(d);
+            free_names(names, nr);
+            errno = ENOMEM;
+            return -1;
+        }
+        nr++;
+    }
+    closedir(d);
+
+    qsort(names, nr, sizeof(*names), name_cmp);
+    *names_out = names;
+    *nr_out = nr;
+    return 0;
+}
+
+static struct dir_item *new_item(struct dir_walk *walk)
+{
+    struct dir_item *item;
+
+    if (XDL_ALLOC_GROW(walk->items, walk->nr + 1, walk->alloc))
+        return NULL;
+    item = &walk->items[walk->nr++];
+    memset(item, 0, sizeof(*item));
+    outbuf_init_mem(&item->out);
+    outbuf_init_mem(&item->err);
+    return item;
+}
+
+/* Format a message into a new buffer */
+static char *format_message(const char *fmt, va_list ap)
+{
+    va_list cp;
+    char *message;
+    int len;
+
+    va_copy(cp, ap);
+    len = vsnprintf(NULL, 0, fmt, cp);
+    va_end(cp);
+    if (len < 0 || !(message = (char *)xdl_malloc(len + 1)))
+        return NULL;
+    vsnprintf(message, len + 1, fmt, ap);
+    return message;
+}
+
+static int set_message(struct dir_item *item, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    item->message = format_message(fmt, ap);
+    va_end(ap);
+    return item->message ? 0 : -1;
+}
+
+static int add_message(struct dir_walk *walk, const char *fmt, ...)
+{
+    struct dir_item *item;
+    va_list ap;
+
+    if (!(item = new_item(walk)))
+        return -1;
+    va_start(ap, fmt);
+    item->message = format_message(fmt, ap);
+    va_end(ap);
+    return item->message ? 0 : -1;
+}
+
+/*
+ * Item for a problem with one entry, reported in walk order into its
+ * 'err'; the walk goes on but the comparison fails in the end.
+ */
+static struct dir_item *new_error(struct dir_walk *walk)
+{
+    struct dir_item *item = new_item(walk);
+
+    if (item)
+        item->status = -1;
+    return item;
+}
+
+/* Whether the directory 'st' is 'v' or one of the directories it is in */
+static int in_walk(const struct dir_visit *v, const struct stat *st)
+{
+    for (; v; v = v->up)
+        if (v->dev == st->st_dev && v->ino == st->st_ino)
+            return 1;
+    return 0;
+}
+
+/* Record a file rename detection may pair, taking over 'path' */
+static int add_rename_file(struct dir_walk *walk, char *path, int side, int kept, long tag)
+{
+    struct rename_file *file;
+
+    if (!path)
+        return -1;
+    if (XDL_ALLOC_GROW(walk->files, walk->nfiles + 1, walk->afiles)) {
+        walk->nfiles = 0;
+        xdl_free(path);
+        return -1;
+    }
+    file = &walk->files[walk->nfiles++];
+    memset(file, 0, sizeof(*file));
+    file->path = path;
+    file->side = side;
+    file->kept = kept;
+    file->tag = tag;
+    return 0;
+}
+
+/*
+ * Record the regular files under 'path', which is only in the tree of
+ * 'side', for rename detection; 'tag' is the item that stands for
+ * 'path'. The files of a directory get an empty item each, after the
+ * message of the directory, which becomes their rename if they are
+ * paired. Entries that cannot be read, and directories that loop back
+ * into 'up', the directory 'path' is in, are left out.
+ */
+static int add_one_sided(struct dir_walk *walk, char *path, int side, long tag,
+                         const struct dir_visit *up)
+{
+    struct dir_visit visit;
+    struct stat st;
+    char **names, *child;
+    long nr, i;
+    int ret = 0;
+
+    if (!path)
+        return -1;
+    if (stat(path, &st) == 0 && S_ISREG(st.st_mode))
+        return add_rename_file(walk, path, side, 0, tag);
+    if (stat(path, &st) < 0 || !S_ISDIR(st.st_mode) || in_walk(up, &st) ||
+        read_names(path, &names, &nr) < 0) {
+        xdl_free(path);
+        return 0;
+    }
+    visit.dev = st.st_dev;
+    visit.ino = st.st_ino;
+    visit.up = up;
+    for (i = 0; i < nr && ret == 0; i++) {
+        if (!(child = path_join(path, names[i])) || !new_item(walk)) {
+            xdl_free(child);
+            ret = -1;
+        } else {
+            ret = add_one_sided(walk, child, side, walk->nr - 1, &visit);
+        }
+    }
+    free_names(names, nr);
+    xdl_free(path);
+    return ret;
+}
+
+static void free_rename_files(struct dir_walk *walk)
+{
+    long i;
+
+    for (i = 0; i < walk->nfiles; i++)
+        xdl_free((char *)walk->files[i].path);
+    xdl_free(walk->files);
+    walk->files = NULL;
+    walk->nfiles = walk->afiles = 0;
+}
+
+/*
+ * Turn the item of each paired added file into its rename or copy, and
+ * drop the message of a renamed file that was only in the first tree.
+ */
+static int apply_renames(struct dir_walk *walk)
+{
+    struct rename_file *dst, *src;
+    struct dir_item *item;
+    long i;
+
+    for (i = 0; i < walk->nfiles; i++) {
+        dst = &walk->files[i];
+        if (dst->match < 0)
+            continue;
+        src = &walk->files[dst->match];
+        item = &walk->items[dst->tag];
+        xdl_free(item->message);
+        if (set_message(item, "File %s %s to %s (%d%% similar)\n", src->path,
+                        dst->copy ? "copied" : "renamed", dst->path, dst->score) < 0 ||
+            !(item->path1 = strdup(src->path)) || !(item->path2 = strdup(dst->path)))
+            return -1;
+        if (!dst->copy && src->tag >= 0) {
+            xdl_free(walk->items[src->tag].message);
+            walk->items[src->tag].message = NULL;
+        }
+    }
+    return 0;
+}
+
+static const char *file_kind(mode_t mode)
+{
+    if (S_ISDIR(mode))
+        return "directory";
+    if (S_ISREG(mode))
+        return "regular file";
+    return "special file";
+}
+
+/*
+ * Merge the sorted listings of two directories into the work list,
+ * recursing into subdirectories present on both sides. 'up1' and 'up2'
+ * are 'dir1' and 'dir2' with the directories they are in, so a symbolic
+ * link back into either walk is reported as a loop instead of followed.
+ */
+static int walk_dirs(struct dir_walk *walk, const char *dir1, const char *dir2,
+                     const struct dir_visit *up1, const struct dir_visit *up2)
+{
+    char **names1 = NULL, **names2 = NULL;
+    long nr1 = 0, nr2 = 0, i1 = 0, i2 = 0;
+    int ret = -1;
+
+    if (read_names(dir1, &names1, &nr1) < 0) {
+        outbuf_printf(walk->err, "xdiff: cannot read directory '%s': %s\n", dir1,
+                      strerror(errno));
+        return -1;
+    }
+    if (read_names(dir2, &names2, &nr2) < 0) {
+        outbuf_printf(walk->err, "xdiff: cannot read directory '%s': %s\n", dir2,
+                      strerror(errno));
+        free_names(names1, nr1);
+        return -1;
+    }
+
+    while (i1 < nr1 || i2 < nr2) {
+        int cmp = i1 == nr1 ? 1 : i2 == nr2 ? -1 : strcmp(names1[i1], names2[i2]);
+        char *path1 = NULL, *path2 = NULL;
+        const char *bad = NULL;
+        struct stat st1, st2;
+
+        if (cmp < 0) {
+            if (add_message(walk, "Only in %s: %s\n", dir1, names1[i1]) < 0 ||
+                (walk->renames &&
+                 add_one_sided(walk, path_join(dir1, names1[i1]), 0, walk->nr - 1, up1) < 0))
+                goto out;
+            i1++;
+            continue;
+        }
+        if (cmp > 0) {
+            if (add_message(walk, "Only in %s: %s\n", dir2, names2[i2]) < 0 ||
+                (walk->renames &&
+                 add_one_sided(walk, path_join(dir2, names2[i2]), 1, walk->nr - 1, up2) < 0))
+                goto out;
+            i2++;
+            continue;
+        }
+
+        path1 = path_join(dir1, names1[i1++]);
+        path2 = path_join(dir2, names2[i2++]);
+        if (!path1 || !path2) {
+            xdl_free(path1);
+            xdl_free(path2);
+            goto out;
+        }
+        if (stat(path1, &st1) < 0)
+            bad = path1;
+        else if (stat(path2, &st2) < 0)
+            bad = path2;
+        if (bad) {
+            const char *reason = strerror(errno);
+            struct dir_item *item = new_error(walk);
+
+            if (item)
+                outbuf_printf(&item->err, "xdiff: cannot stat '%s': %s\n", bad, reason);
+            xdl_free(path1);
+            xdl_free(path2);
+            if (!item)
+                goto out;
+        } else if (S_ISDIR(st1.st_mode) && S_ISDIR(st2.st_mode)) {
+            struct dir_visit visit1 = {st1.st_dev, st1.st_ino, up1};
+            struct dir_visit visit2 = {st2.st_dev, st2.st_ino, up2};
+            struct dir_item *item;
+            int res = 0;
+
+            if (in_walk(up1, &st1) || in_walk(up2, &st2)) {
+                if ((item = new_error(walk)))
+                    outbuf_printf(&item->err, "xdiff: %s: recursive directory loop\n",
+                                  in_walk(up1, &st1) ? path1 : path2);
+                else
+                    res = -1;
+            } else {
+                res = walk_dirs(walk, path1, path2, &visit1, &visit2);
+            }
+            xdl_free(path1);
+            xdl_free(path2);
+            if (res < 0)
+                goto out;
+        } else if (S_ISREG(st1.st_mode) && S_ISREG(st2.st_mode)) {
+            struct dir_item *item = new_item(walk);
+            if (!item) {
+                xdl_free(path1);
+                xdl_free(path2);
+                goto out;
+            }
+            item->path1 = path1;
+            item->path2 = path2;
+            if (walk->renames && walk->renames->copies &&
+                add_rename_file(walk, strdup(path1), 0, 1, -1) < 0)
+                goto out;
+        } else {
+            int res = add_message(walk, "File %s is a %s while file %s is a %s\n", path1,
+                                  file_kind(st1.st_mode), path2, file_kind(st2.st_mode));
+            xdl_free(path1);
+            xdl_free(path2);
+            if (res < 0)
+                goto out;
+        }
+    }
+    ret = 0;
+
+out:
+    free_names(names1, nr1);
+    free_names(names2, nr2);
+    return ret;
+}
+
+/* Files to load for one item; messages have none */
+static const char *item_path(long task, int side, void *priv)
+{
+    struct dir_walk *walk = (struct dir_walk *)priv;
+    struct dir_item *item = &walk->items[task];
+
+    return side ? item->path2 : item->path1;
+}
+
+/* Compare one file pair, capturing its output in memory */
+static void run_item(long task, int worker, void *priv)
+{
+    struct dir_walk *walk = (struct dir_walk *)priv;
+    struct dir_item *item = &walk->items[task];
+    const struct load_file *file1, *file2;
+
+    (void)worker;
+    if (!item->path1)
+        return;
+    file1 = loader_get(walk->loader, task, 0);
+    file2 = loader_get(walk->loader, task, 1);
+    item->status = walk->fn(file1, file2, &item->out, &item->err, walk->priv);
+    loader_release(walk->loader, task);
+    if (item->out.error || item->err.error)
+        item->status = -1;
+}
+
+static void release_item(struct dir_item *item)
+{
+    xdl_free(item->message);
+    xdl_free(item->path1);
+    xdl_free(item->path2);
+    outbuf_release(&item->out);
+    outbuf_release(&item->err);
+    item->message = item->path1 = item->path2 = NULL;
+}
+
+/* Print one finished item and release its buffers */
+static void flush_item(long task, void *priv)
+{
+    struct dir_walk *walk = (struct dir_walk *)priv;
+    struct dir_item *item = &walk->items[task];
+    struct outbuf *out = walk->out, *err = walk->err;
+    int status = 0;
+
+    if (item->message) {
+        outbuf_puts(out, item->message);
+        status = 1;
+    }
+    if (item->err.len) {
+        outbuf_flush(out);
+        outbuf_write(err, item->err.buf, item->err.len);
+        outbuf_flush(err);
+    }
+    if (item->path1)
+        outbuf_write(out, item->out.buf, item->out.len);
+    status = item->status < 0 ? item->status : XDL_MAX(status, item->status);
+    release_item(item);
+    if (status < 0)
+        walk->ret = -1;
+    else if (status > 0 && walk->ret == 0)
+        walk->ret = 1;
+}
+
+int diff_directories(const char *dir1, const char *dir2, const struct rename_options *renames,
+                     int jobs, dir_diff_fn fn, void *priv, struct outbuf *out, struct outbuf *err)
+{
+    struct dir_walk walk;
+    struct dir_visit top1 = {0, 0, NULL}, top2 = {0, 0, NULL};
+    struct stat st;
+    long i;
+
+    memset(&walk, 0, sizeof(walk));
+    walk.fn = fn;
+    walk.priv = priv;
+    walk.out = out;
+    walk.err = err;
+    walk.renames = renames;
+
+    if (stat(dir1, &st) == 0) {
+        top1.dev = st.st_dev;
+        top1.ino = st.st_ino;
+    }
+    if (stat(dir2, &st) == 0) {
+        top2.dev = st.st_dev;
+        top2.ino = st.st_ino;
+    }
+    if (walk_dirs(&walk, dir1, dir2, &top1, &top2) < 0)
+        goto fail;
+    if (walk.nfiles && find_renames(walk.files, walk.nfiles, renames, jobs, err) < 0)
+        goto fail;
+    if (apply_renames(&walk) < 0) {
+        outbuf_printf(err, "xdiff: out of memory\n");
+        goto fail;
+    }
+    free_rename_files(&walk);
+    if (!(walk.loader = loader_start(walk.nr, jobs * LOAD_AHEAD, item_path, &walk))) {
+        outbuf_printf(err, "xdiff: out of memory\n");
+        goto fail;
+    }
+
+    /* Results are emitted strictly in walk order */
+    run_ordered(walk.nr, jobs, run_item, flush_item, &walk);
+    loader_stop(walk.loader);
+    xdl_free(walk.items);
+
+    return walk.ret;
+
+fail:
+    free_rename_files(&walk);
+    for (i = 0; i < walk.nr; i++)
+        release_item(&walk.items[i]);
+    xdl_free(walk.items);
+    return -1;
+}
@@ -0,0 +1,38 @@
+/*
+ * xdiff-dir.h - Recursive directory comparison for xdiff
+ * Similar to diff -r
+ */
+
+#ifndef XDIFF_DIR_H
+#define XDIFF_DIR_H
+
+#include "xdiff-load.h"
+#include "xdiff-outbuf.h"
+#include "xdiff-rename.h"
+
+/*
+ * Compare one pair of regular files, already loaded into memory; a
+ * file that could not be read has its 'error' set. The report goes to
+ * 'out' and diagnostics go to 'err'; both are private to the call, so
+ * the callback may run concurrently on several threads. Returns a
+ * negative value on error, 1 if the files differ and 0 if they are
+ * identical.
+ */
+typedef int (*dir_diff_fn)(const struct load_file *file1, const struct load_file *file2,
+                           struct outbuf *out, struct outbuf *err, void *priv);
+
+/*
+ * Walk both directory trees, pair up entries by name and compare the
+ * file pairs with 'fn' on a pool of 'jobs' threads while the files of
+ * the next pairs are loaded in the background. With 'renames', files
+ * only in the second tree that find_renames() pairs with a file of the
+ * first are reported as a rename or copy line followed by their
+ * comparison, in place of their "Only in" line; a renamed file loses
+ * its own. Results are written to 'out' and 'err' in sorted path order
+ * regardless of completion order. Returns a negative value on error, 1
+ * if any difference was found and 0 if the trees are identical.
+ */
+int diff_directories(const char *dir1, const char *dir2, const struct rename_options *renames,
+                     int jobs, dir_diff_fn fn, void *priv, struct outbuf *out, struct outbuf *err);
+
+#endif /* XDIFF_DIR_H */
@@ -0,0 +1,132 @@
+/*
+ * xdiff-history.c - Comparison of successive versions of a file for xdiff
+ * Prepares every version once and diffs each one against the next
+ */
+
+#include "xdiff-history.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include "xdiff-pool.h"
+#include "xinclude.h"
+
+/* One step together with its captured result */
+struct history_step {
+    struct outbuf out;
+    struct outbuf err;
+    int status;
+};
+
+/* State shared by the worker threads */
+struct history {
+    char *const *paths;
+    long nr;
+    const struct load_file **files;
+    xdlchain_t *chain;
+    struct history_step *steps;
+    history_diff_fn fn;
+    void *priv;
+    struct outbuf *out;
+    struct outbuf *err;
+    int ret;
+};
+
+/* Versions are loaded two to a task */
+static const char *version_path(long task, int side, void *priv)
+{
+    struct history *hist = (struct history *)priv;
+    long i = 2 * task + side;
+
+    return i < hist->nr ? hist->paths[i] : NULL;
+}
+
+/* Compare one version with the next, capturing the output in memory */
+static void run_step(long task, int worker, void *priv)
+{
+    struct history *hist = (struct history *)priv;
+    struct history_step *step = &hist->steps[task];
+
+    (void)worker;
+    step->status = hist->fn(hist->chain, task, hist->files[task], hist->files[task + 1],
+                            &step->out, &step->err, hist->priv);
+    if (step->out.error || step->err.error)
+        step->status = -1;
+}
+
+/* Write one finished step and release its buffers */
+static void flush_step(long task, void *priv)
+{
+    struct history *hist = (struct history *)priv;
+    struct history_step *step = &hist->steps[task];
+
+    outbuf_write(hist->out, step->out.buf, step->out.len);
+    if (step->err.len) {
+        outbuf_flush(hist->out);
+        outbuf_write(hist->err, step->err.buf, step->err.len);
+        outbuf_flush(hist->err);
+    }
+
+    if (step->status < 0)
+        hist->ret = -1;
+    else if (step->status > 0 && hist->ret == 0)
+        hist->ret = 1;
+    outbuf_release(&step->out);
+    outbuf_release(&step->err);
+}
+
+int diff_history(char *const *paths, long nr, xpparam_t const *xpp, int jobs, history_diff_fn fn,
+                 void *priv, struct outbuf *out, struct outbuf *err)
+{
+    struct history hist;
+    struct loader *loader = NULL;
+    mmfile_t *versions = NULL;
+    long i, ntasks = (nr + 1) / 2;
+
+    memset(&hist, 0, sizeof(hist));
+    hist.paths = paths;
+    hist.nr = nr;
+    hist.fn = fn;
+    hist.priv = priv;
+    hist.out = out;
+    hist.err = err;
+
+    /* Every version stays loaded until the last step is done */
+    if (!XDL_ALLOC_ARRAY(hist.files, nr) || !XDL_ALLOC_ARRAY(versions, nr) ||
+        !XDL_CALLOC_ARRAY(hist.steps, nr) ||
+        !(loader = loader_start(ntasks, (int)ntasks, version_path, &hist))) {
+        outbuf_printf(err, "xdiff: out of memory\n");
+        hist.ret = -1;
+        goto out;
+    }
+    for (i = 0; i < nr; i++) {
+        hist.files[i] = loader_get(loader, i / 2, i & 1);
+        if (hist.files[i]->error) {
+            outbuf_printf(err, "xdiff: cannot read file '%s': %s\n", paths[i],
+                          strerror(hist.files[i]->error));
+            hist.ret = -1;
+            goto out;
+        }
+        versions[i] = hist.files[i]->mf;
+    }
+
+    if (!(hist.chain = xdl_chain_new(versions, nr, xpp))) {
+        outbuf_printf(err, "xdiff: out of memory\n");
+        hist.ret = -1;
+        goto out;
+    }
+    for (i = 0; i < nr - 1; i++) {
+        outbuf_init_mem(&hist.steps[i].out);
+        outbuf_init_mem(&hist.steps[i].err);
+    }
+    run_ordered(nr - 1, jobs, run_step, flush_step, &hist);
+
+out:
+    xdl_chain_free(hist.chain);
+    if (loader)
+        loader_stop(loader);
+    xdl_free(hist.steps);
+    xdl_free(versions);
+    xdl_free(hist.files);
+    return hist.ret;
+}
@@ -0,0 +1,31 @@
+/*
+ * xdiff-history.h - Comparison of successive versions of a file for xdiff
+ * Prepares every version once and diffs each one against the next
+ */
+
+#ifndef XDIFF_HISTORY_H
+#define XDIFF_HISTORY_H
+
+#include "xdiff-load.h"
+#include "xdiff-outbuf.h"
+
+/*
+ * Compare the versions of step 'step' of 'chain', loaded as 'file1'
+ * and 'file2'; same contract as dir_diff_fn. May run concurrently on
+ * several threads.
+ */
+typedef int (*history_diff_fn)(xdlchain_t const *chain, long step, const struct load_file *file1,
+                               const struct load_file *file2, struct outbuf *out,
+                               struct outbuf *err, void *priv);
+
+/*
+ * Load the 'nr' versions in 'paths', class their lines once with the
+ * flags of 'xpp' and compare each version with the next with 'fn' on
+ * up to 'jobs' threads. Results are written to 'out' and 'err' in
+ * version order. Returns a negative value on error, 1 if any version
+ * differs from the next and 0 otherwise.
+ */
+int diff_history(char *const *paths, long nr, xpparam_t const *xpp, int jobs, history_diff_fn fn,
+                 void *priv, struct outbuf *out, struct outbuf *err);
+
+#endif /* XDIFF_HISTORY_H */
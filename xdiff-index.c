@@ -0,0 +1,142 @@
+/*
+ * xdiff-index.c - Sidecar line index files for xdiff
+ * Keeps the line index of a large, rarely changing file next to it on disk
+ */
+
+#include "xdiff-index.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "xinclude.h"
+
+/* Path of the sidecar of 'path', to be freed with xdl_free() */
+static char *sidecar_path(const char *path, const char *suffix)
+{
+    size_t len = strlen(path), slen = strlen(suffix);
+    char *p;
+
+    if (!(p = (char *)xdl_malloc(len + slen + 1)))
+        return NULL;
+    memcpy(p, path, len);
+    memcpy(p + len, suffix, slen + 1);
+    return p;
+}
+
+/* Map the sidecar at 'side' and load it if it matches 'mf' */
+static void map_sidecar(const char *side, mmfile_t *mf, unsigned long flags,
+                        struct index_file *ix)
+{
+    struct stat st;
+    void *map;
+    int fd;
+
+    if ((fd = open(side, O_RDONLY)) < 0)
+        return;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+        close(fd);
+        return;
+    }
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return;
+    if (xdl_index_load(mf, flags, (const char *)map, (long)st.st_size, &ix->index) < 0) {
+        munmap(map, (size_t)st.st_size);
+        return;
+    }
+    ix->map = map;
+    ix->map_len = (size_t)st.st_size;
+    ix->valid = 1;
+}
+
+/* Write 'image' to 'side' through a temporary file renamed over it */
+static int write_sidecar(const char *side, const mmbuffer_t *image)
+{
+    char *tmp;
+    long done = 0;
+    int fd, saved_errno;
+
+    if (!(tmp = sidecar_path(side, ".XXXXXX"))) {
+        errno = ENOMEM;
+        return -1;
+    }
+    if ((fd = mkstemp(tmp)) < 0) {
+        saved_errno = errno;
+        xdl_free(tmp);
+        errno = saved_errno;
+        return -1;
+    }
+    /* Readable like the files it describes, rather than the 0600 of mkstemp() */
+    fchmod(fd, 0644);
+    while (done < image->size) {
+        ssize_t n = write(fd, image->ptr + done, image->size - done);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            saved_errno = errno;
+            close(fd);
+            goto fail;
+        }
+        done += n;
+    }
+    if (close(fd) < 0 || rename(tmp, side) < 0) {
+        saved_errno = errno;
+        goto fail;
+    }
+    xdl_free(tmp);
+    return 0;
+
+fail:
+    unlink(tmp);
+    xdl_free(tmp);
+    errno = saved_errno;
+    return -1;
+}
+
+int index_open(const char *path, mmfile_t *mf, unsigned long flags, int mode,
+               struct index_file *ix, struct outbuf *err)
+{
+    mmbuffer_t image;
+    char *side;
+    int ret = 0;
+
+    memset(ix, 0, sizeof(*ix));
+    if (!mode)
+        return 0;
+    if (!(side = sidecar_path(path, INDEX_SUFFIX))) {
+        outbuf_printf(err, "xdiff: out of memory\n");
+        return -1;
+    }
+    if (mode & INDEX_USE)
+        map_sidecar(side, mf, flags, ix);
+
+    if (!ix->valid && (mode & INDEX_WRITE)) {
+        if (xdl_index_build(mf, flags, &ix->index) < 0 || xdl_index_save(&ix->index, &image) < 0) {
+            outbuf_printf(err, "xdiff: out of memory\n");
+            ret = -1;
+        } else {
+            ix->valid = 1;
+            if (write_sidecar(side, &image) < 0) {
+                outbuf_printf(err, "xdiff: cannot write index '%s': %s\n", side,
+                              strerror(errno));
+                ret = -1;
+            }
+            xdl_free(image.ptr);
+        }
+    }
+    xdl_free(side);
+    return ret;
+}
+
+void index_close(struct index_file *ix)
+{
+    xdl_index_free(&ix->index);
+    if (ix->map)
+        munmap(ix->map, ix->map_len);
+    memset(ix, 0, sizeof(*ix));
+}
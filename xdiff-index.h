@@ -0,0 +1,45 @@
+/*
+ * xdiff-index.h - Sidecar line index files for xdiff
+ * Keeps the line index of a large, rarely changing file next to it on disk
+ */
+
+#ifndef XDIFF_INDEX_H
+#define XDIFF_INDEX_H
+
+#include <stddef.h>
+
+#include "xdiff-outbuf.h"
+#include "xdiff.h"
+
+/* Suffix appended to the path of a file to name its sidecar index */
+#define INDEX_SUFFIX ".xdi"
+
+/* Use the sidecar index of a file when it matches the file */
+#define INDEX_USE 1
+
+/* Write the sidecar index of a file when it is missing or out of date */
+#define INDEX_WRITE 2
+
+/* Line index of one input file */
+struct index_file {
+    xdlindex_t index;
+    void *map;      /* Mapping of the sidecar the index points into, or NULL */
+    size_t map_len; /* Length of that mapping */
+    int valid;      /* Whether 'index' describes the file */
+};
+
+/*
+ * Get the line index of 'mf', the content of 'path', for the whitespace
+ * flags in 'flags'. With INDEX_USE the sidecar is mapped and used if it
+ * was written for this content and these flags; with INDEX_WRITE an
+ * index is built and written to the sidecar otherwise. Returns -1 after
+ * writing a diagnostic to 'err' if the sidecar cannot be written, and
+ * 0 otherwise, with 'ix->valid' set if an index is available.
+ */
+int index_open(const char *path, mmfile_t *mf, unsigned long flags, int mode,
+               struct index_file *ix, struct outbuf *err);
+
+/* Release an index, unmapping its sidecar */
+void index_close(struct index_file *ix);
+
+#endif /* XDIFF_INDEX_H */
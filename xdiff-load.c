@@ -0,0 +1,617 @@
+/*
+ * xdiff-load.c - Read-ahead of input files for xdiff
+ * Loads the files of upcoming comparisons while earlier ones are diffed
+ */
+
+#include "xdiff-load.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "xinclude.h"
+
+/* I/O threads used when io_uring is not available */
+#define LOAD_THREADS 4
+
+/* Reads kept in flight through io_uring */
+#define LOAD_QUEUE_DEPTH 64
+
+/* Condition variables that waiters are spread over, a power of two */
+#define LOAD_WAKE 16
+
+/* Load state of one file */
+enum load_state { LOAD_IDLE = 0, LOAD_BUSY, LOAD_READY };
+
+struct load_entry {
+    struct load_file file;
+    size_t alloc; /* Capacity of file.mf.ptr */
+    enum load_state state;
+    int waiting; /* Threads waiting for the file */
+    int ring;    /* Whether the load went through io_uring */
+    int fd;      /* Open descriptor while the read is in flight */
+    long off;    /* Bytes read so far */
+    long size; /* Size of the file when it was opened */
+};
+
+/* Buffer kept for reuse by later loads */
+struct load_buf {
+    char *ptr;
+    size_t alloc;
+};
+
+#ifdef HAVE_IO_URING
+/* Submission and completion rings shared with the kernel */
+struct uring {
+    int fd;
+    unsigned entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_len, cq_len, sqes_len;
+    unsigned queued;   /* Entries published but not yet submitted */
+    unsigned inflight; /* Entries submitted and not yet completed */
+};
+#endif
+
+struct loader {
+    long nr;
+    long depth;
+    load_path_fn path;
+    void *priv;
+    struct load_entry *files; /* Two per task */
+    long next;                /* Next file to start loading */
+    long active;              /* Tasks started and not yet released */
+    struct load_buf *spare;
+    long nspare;
+    pthread_mutex_t lock;
+    pthread_cond_t ready[LOAD_WAKE]; /* A file finished loading */
+    pthread_cond_t room;             /* A task was released */
+    int starved; /* Loader threads wait for the window to drain */
+    int stop;
+    pthread_t threads[LOAD_THREADS];
+    int nthreads;
+#ifdef HAVE_IO_URING
+    struct uring ring;
+#endif
+};
+
+/*
+ * Start loading file 'i', taking a spare buffer if there is one.
+ * Returns NULL if there is no such file: without a first file the task
+ * is complete, without a second one only that side is. Called with the
+ * lock held.
+ */
+static struct load_entry *start(struct loader *ld, long i)
+{
+    struct load_entry *e = &ld->files[i];
+
+    if (!(e->file.path = ld->path(i / 2, i & 1, ld->priv))) {
+        e->state = LOAD_READY;
+        if (!(i & 1))
+            e[1].state = LOAD_READY;
+        return NULL;
+    }
+    if (!(i & 1))
+        ld->active++;
+    if (ld->nspare) {
+        ld->nspare--;
+        e->file.mf.ptr = ld->spare[ld->nspare].ptr;
+        e->alloc = ld->spare[ld->nspare].alloc;
+    }
+    e->state = LOAD_BUSY;
+    return e;
+}
+
+/*
+ * Pick the next file to load ahead, or NULL if the read-ahead window is
+ * full or every file has been started. Files already taken over by
+ * loader_get() are skipped. Called with the lock held.
+ */
+static struct load_entry *claim(struct loader *ld)
+{
+    while (!ld->stop && ld->next < 2 * ld->nr) {
+        long i = ld->next;
+        struct load_entry *e;
+
+        if (ld->files[i].state != LOAD_IDLE) {
+            ld->next++;
+            continue;
+        }
+        if (!(i & 1) && ld->active >= ld->depth && ld->path(i / 2, 0, ld->priv))
+            return NULL;
+        ld->next++;
+        if ((e = start(ld, i)) != NULL)
+            return e;
+    }
+    return NULL;
+}
+
+/* Make room for 'size' bytes plus the terminating NUL */
+static int reserve(struct load_entry *e, size_t size)
+{
+    char *ptr;
+    size_t alloc = e->alloc ? e->alloc : 8192;
+
+    if (e->alloc > size)
+        return 0;
+    while (alloc <= size)
+        alloc *= 2;
+    if (!(ptr = (char *)xdl_realloc(e->file.mf.ptr, alloc)))
+        return -1;
+    e->file.mf.ptr = ptr;
+    e->alloc = alloc;
+    return 0;
+}
+
+/* Read the rest of an open file with plain read() calls */
+static void read_rest(struct load_entry *e, size_t hint)
+{
+    for (;;) {
+        ssize_t n;
+
+        if (reserve(e, e->off + hint) < 0) {
+            e->file.error = ENOMEM;
+            return;
+        }
+        n = read(e->fd, e->file.mf.ptr + e->off, e->alloc - e->off - 1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            e->file.error = errno;
+            return;
+        }
+        if (n == 0)
+            break;
+        e->off += n;
+        hint = 8192;
+    }
+}
+
+/* Finish a load: close the file and publish the result */
+static void finish(struct loader *ld, struct load_entry *e)
+{
+    if (e->fd >= 0)
+        close(e->fd);
+    e->fd = -1;
+    if (!e->file.error && reserve(e, e->off) < 0)
+        e->file.error = ENOMEM;
+    if (!e->file.error) {
+        e->file.mf.ptr[e->off] = '\0';
+        e->file.mf.size = e->off;
+    }
+
+    pthread_mutex_lock(&ld->lock);
+    e->state = LOAD_READY;
+    if (e->waiting)
+        pthread_cond_broadcast(&ld->ready[(e - ld->files) & (LOAD_WAKE - 1)]);
+    pthread_mutex_unlock(&ld->lock);
+}
+
+/* Load one file synchronously */
+static void load_sync(struct loader *ld, struct load_entry *e)
+{
+    struct stat st;
+    size_t hint = 8192;
+
+    e->off = 0;
+    if ((e->fd = open(e->file.path, O_RDONLY | O_CLOEXEC)) < 0) {
+        e->file.error = errno;
+    } else {
+        /* One spare byte lets the first read() hit end of file */
+        if (fstat(e->fd, &st) == 0 && S_ISREG(st.st_mode))
+            hint = (size_t)st.st_size + 1;
+        read_rest(e, hint);
+    }
+    finish(ld, e);
+}
+
+/* Wait until loader_release() has drained half of the window */
+static void wait_room(struct loader *ld)
+{
+    ld->starved = 1;
+    pthread_cond_wait(&ld->room, &ld->lock);
+}
+
+static void *io_thread(void *arg)
+{
+    struct loader *ld = (struct loader *)arg;
+
+    for (;;) {
+        struct load_entry *e;
+
+        pthread_mutex_lock(&ld->lock);
+        while (!(e = claim(ld)) && !ld->stop && ld->next < 2 * ld->nr)
+            wait_room(ld);
+        pthread_mutex_unlock(&ld->lock);
+        if (!e)
+            break;
+        load_sync(ld, e);
+    }
+    return NULL;
+}
+
+#ifdef HAVE_IO_URING
+
+static int uring_setup(struct uring *r, unsigned entries)
+{
+    struct io_uring_params p;
+    struct io_uring_probe *probe;
+    size_t probe_len = sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op);
+    int ok;
+
+    memset(r, 0, sizeof(*r));
+    memset(&p, 0, sizeof(p));
+    if ((r->fd = (int)syscall(__NR_io_uring_setup, entries, &p)) < 0)
+        return -1;
+
+    /* Opening and reading through the ring needs Linux 5.6 */
+    if (!(probe = (struct io_uring_probe *)xdl_calloc(1, probe_len))) {
+        close(r->fd);
+        return -1;
+    }
+    ok = syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PROBE, probe, 256) == 0 &&
+         probe->last_op >= IORING_OP_READ &&
+         (probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED) &&
+         (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED);
+    xdl_free(probe);
+    if (!ok) {
+        close(r->fd);
+        return -1;
+    }
+
+    r->entries = p.sq_entries;
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        r->sq_len = r->cq_len = XDL_MAX(r->sq_len, r->cq_len);
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+                     IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED)
+        goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ptr = r->sq_ptr;
+    } else {
+        r->cq_ptr = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+                         IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED)
+            goto fail;
+    }
+    r->sqes = (struct io_uring_sqe *)mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+                                          MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        r->sqes = NULL;
+        goto fail;
+    }
+
+    r->sq_head = (unsigned *)((char *)r->sq_ptr + p.sq_off.head);
+    r->sq_tail = (unsigned *)((char *)r->sq_ptr + p.sq_off.tail);
+    r->sq_mask = (unsigned *)((char *)r->sq_ptr + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)((char *)r->sq_ptr + p.sq_off.array);
+    r->cq_head = (unsigned *)((char *)r->cq_ptr + p.cq_off.head);
+    r->cq_tail = (unsigned *)((char *)r->cq_ptr + p.cq_off.tail);
+    r->cq_mask = (unsigned *)((char *)r->cq_ptr + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)((char *)r->cq_ptr + p.cq_off.cqes);
+    return 0;
+
+fail:
+    if (r->sq_ptr && r->sq_ptr != MAP_FAILED)
+        munmap(r->sq_ptr, r->sq_len);
+    if (r->cq_ptr && r->cq_ptr != MAP_FAILED && r->cq_ptr != r->sq_ptr)
+        munmap(r->cq_ptr, r->cq_len);
+    close(r->fd);
+    return -1;
+}
+
+static void uring_free(struct uring *r)
+{
+    munmap(r->sqes, r->sqes_len);
+    if (r->cq_ptr != r->sq_ptr)
+        munmap(r->cq_ptr, r->cq_len);
+    munmap(r->sq_ptr, r->sq_len);
+    close(r->fd);
+}
+
+/* Queue one request; the caller keeps inflight below the ring size */
+static struct io_uring_sqe *uring_sqe(struct uring *r, unsigned char opcode, int fd,
+                                      struct load_entry *e)
+{
+    unsigned tail = *r->sq_tail, idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = (unsigned long long)(uintptr_t)e;
+    r->sq_array[idx] = idx;
+    r->queued++;
+    r->inflight++;
+    return sqe;
+}
+
+/* Make the entries filled in by uring_sqe() visible to the kernel */
+static void uring_publish(struct uring *r)
+{
+    __atomic_store_n(r->sq_tail, *r->sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+static void queue_open(struct uring *r, struct load_entry *e)
+{
+    struct io_uring_sqe *sqe = uring_sqe(r, IORING_OP_OPENAT, AT_FDCWD, e);
+
+    sqe->addr = (unsigned long long)(uintptr_t)e->file.path;
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    uring_publish(r);
+}
+
+static void queue_read(struct uring *r, struct load_entry *e, size_t len)
+{
+    struct io_uring_sqe *sqe = uring_sqe(r, IORING_OP_READ, e->fd, e);
+
+    sqe->addr = (unsigned long long)(uintptr_t)(e->file.mf.ptr + e->off);
+    sqe->len = (unsigned)len;
+    sqe->off = (unsigned long long)e->off;
+    uring_publish(r);
+}
+
+/*
+ * Advance one load after a completion: an open is followed by reads of
+ * the whole file plus one byte to see its end, anything unusual is
+ * finished synchronously.
+ */
+static void uring_complete(struct loader *ld, struct load_entry *e, int res)
+{
+    struct uring *r = &ld->ring;
+    struct stat st;
+
+    if (e->fd < 0) {
+        if (res < 0) {
+            e->file.error = -res;
+            finish(ld, e);
+            return;
+        }
+        e->fd = res;
+        e->off = 0;
+        if (fstat(e->fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size >= INT_MAX) {
+            read_rest(e, 8192);
+            finish(ld, e);
+            return;
+        }
+        e->size = (long)st.st_size;
+        if (reserve(e, e->size) < 0) {
+            e->file.error = ENOMEM;
+            finish(ld, e);
+            return;
+        }
+        queue_read(r, e, e->size + 1);
+        return;
+    }
+
+    if (res == -EINTR || res == -EAGAIN) {
+        queue_read(r, e, e->size + 1 - e->off);
+        return;
+    }
+    if (res < 0) {
+        e->file.error = -res;
+        finish(ld, e);
+        return;
+    }
+    e->off += res;
+    if (res > 0 && e->off < e->size) {
+        queue_read(r, e, e->size + 1 - e->off);
+        return;
+    }
+    /* A file that grew while being read is finished with read() */
+    if (e->off > e->size)
+        read_rest(e, 8192);
+    finish(ld, e);
+}
+
+/*
+ * The ring failed: load the files it was working on again with read(),
+ * leaving the rest to io_thread().
+ */
+static void uring_abandon(struct loader *ld)
+{
+    long i;
+
+    for (i = 0; i < ld->next; i++) {
+        struct load_entry *e = &ld->files[i];
+
+        pthread_mutex_lock(&ld->lock);
+        if (e->state != LOAD_BUSY || !e->ring) {
+            pthread_mutex_unlock(&ld->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&ld->lock);
+        if (e->fd >= 0)
+            close(e->fd);
+        e->file.error = 0;
+        load_sync(ld, e);
+    }
+}
+
+static void *uring_thread(void *arg)
+{
+    struct loader *ld = (struct loader *)arg;
+    struct uring *r = &ld->ring;
+
+    for (;;) {
+        struct load_entry *e;
+        unsigned head, tail;
+        int n;
+
+        pthread_mutex_lock(&ld->lock);
+        while (r->inflight < r->entries && (e = claim(ld)) != NULL) {
+            e->ring = 1;
+            e->fd = -1;
+            queue_open(r, e);
+        }
+        if (!r->inflight) {
+            if (ld->stop || ld->next == 2 * ld->nr) {
+                pthread_mutex_unlock(&ld->lock);
+                break;
+            }
+            wait_room(ld);
+            pthread_mutex_unlock(&ld->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&ld->lock);
+
+        n = (int)syscall(__NR_io_uring_enter, r->fd, r->queued, 1, IORING_ENTER_GETEVENTS, NULL,
+                         0);
+        if (n < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            uring_abandon(ld);
+            return io_thread(ld);
+        }
+        if (n > 0)
+            r->queued -= XDL_MIN((unsigned)n, r->queued);
+
+        head = *r->cq_head;
+        tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+
+            r->inflight--;
+            uring_complete(ld, (struct load_entry *)(uintptr_t)cqe->user_data, cqe->res);
+        }
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+#endif /* HAVE_IO_URING */
+
+struct loader *loader_start(long nr, int depth, load_path_fn path, void *priv)
+{
+    struct loader *ld;
+    long i;
+
+    if (!(ld = (struct loader *)xdl_calloc(1, sizeof(*ld))))
+        return NULL;
+    ld->nr = nr;
+    ld->depth = depth > 0 ? depth : 1;
+    ld->path = path;
+    ld->priv = priv;
+    if (!XDL_CALLOC_ARRAY(ld->files, 2 * nr + 1) || !XDL_ALLOC_ARRAY(ld->spare, 2 * ld->depth)) {
+        xdl_free(ld->files);
+        xdl_free(ld);
+        return NULL;
+    }
+    for (i = 0; i < 2 * nr; i++)
+        ld->files[i].fd = -1;
+    pthread_mutex_init(&ld->lock, NULL);
+    for (i = 0; i < LOAD_WAKE; i++)
+        pthread_cond_init(&ld->ready[i], NULL);
+    pthread_cond_init(&ld->room, NULL);
+
+#ifdef HAVE_IO_URING
+    if (!getenv("XDIFF_NO_IO_URING") && uring_setup(&ld->ring, LOAD_QUEUE_DEPTH) == 0) {
+        if (pthread_create(&ld->threads[0], NULL, uring_thread, ld) == 0) {
+            ld->nthreads = 1;
+            return ld;
+        }
+        uring_free(&ld->ring);
+        ld->ring.fd = -1;
+    } else {
+        ld->ring.fd = -1;
+    }
+#endif
+
+    for (; ld->nthreads < LOAD_THREADS; ld->nthreads++)
+        if (pthread_create(&ld->threads[ld->nthreads], NULL, io_thread, ld) != 0)
+            break;
+    return ld;
+}
+
+const struct load_file *loader_get(struct loader *ld, long task, int side)
+{
+    long i = 2 * task + side;
+    struct load_entry *e = &ld->files[i];
+
+    pthread_mutex_lock(&ld->lock);
+    /* Load the file here rather than wait if read-ahead is behind */
+    if (e->state == LOAD_IDLE && start(ld, i)) {
+        pthread_mutex_unlock(&ld->lock);
+        load_sync(ld, e);
+        pthread_mutex_lock(&ld->lock);
+    }
+    while (e->state != LOAD_READY) {
+        e->waiting++;
+        pthread_cond_wait(&ld->ready[i & (LOAD_WAKE - 1)], &ld->lock);
+        e->waiting--;
+    }
+    pthread_mutex_unlock(&ld->lock);
+    return &e->file;
+}
+
+void loader_release(struct loader *ld, long task)
+{
+    struct load_entry *e = &ld->files[2 * task];
+    int side;
+
+    pthread_mutex_lock(&ld->lock);
+    if (!e->file.path) {
+        pthread_mutex_unlock(&ld->lock);
+        return;
+    }
+    for (side = 0; side < 2; side++, e++) {
+        if (e->file.mf.ptr && ld->nspare < 2 * ld->depth) {
+            ld->spare[ld->nspare].ptr = e->file.mf.ptr;
+            ld->spare[ld->nspare++].alloc = e->alloc;
+        } else {
+            xdl_free(e->file.mf.ptr);
+        }
+        e->file.mf.ptr = NULL;
+        e->file.mf.size = 0;
+        e->alloc = 0;
+    }
+    ld->active--;
+    /* Refill in batches rather than waking the loader for every task */
+    if (ld->starved && ld->active <= ld->depth / 2) {
+        ld->starved = 0;
+        pthread_cond_broadcast(&ld->room);
+    }
+    pthread_mutex_unlock(&ld->lock);
+}
+
+void loader_stop(struct loader *ld)
+{
+    long i;
+    int t;
+
+    pthread_mutex_lock(&ld->lock);
+    ld->stop = 1;
+    pthread_cond_broadcast(&ld->room);
+    pthread_mutex_unlock(&ld->lock);
+    for (t = 0; t < ld->nthreads; t++)
+        pthread_join(ld->threads[t], NULL);
+#ifdef HAVE_IO_URING
+    if (ld->ring.fd >= 0)
+        uring_free(&ld->ring);
+#endif
+
+    for (i = 0; i < 2 * ld->nr; i++)
+        xdl_free(ld->files[i].file.mf.ptr);
+    for (i = 0; i < ld->nspare; i++)
+        xdl_free(ld->spare[i].ptr);
+    pthread_cond_destroy(&ld->room);
+    for (i = 0; i < LOAD_WAKE; i++)
+        pthread_cond_destroy(&ld->ready[i]);
+    pthread_mutex_destroy(&ld->lock);
+    xdl_free(ld->spare);
+    xdl_free(ld->files);
+    xdl_free(ld);
+}
@@ -0,0 +1,45 @@
+/*
+ * xdiff-load.h - Read-ahead of input files for xdiff
+ * Loads the files of upcoming comparisons while earlier ones are diffed
+ */
+
+#ifndef XDIFF_LOAD_H
+#define XDIFF_LOAD_H
+
+#include "xdiff.h"
+
+/* Tasks kept loaded ahead of each worker */
+#define LOAD_AHEAD 4
+
+/* One loaded input file */
+struct load_file {
+    const char *path;
+    mmfile_t mf; /* Content, NUL-terminated */
+    int error;   /* errno of a failed load, or 0 */
+};
+
+/*
+ * Path of one side (0 or 1) of a task, or NULL for side 0 if the task
+ * has no files to load and for side 1 if it has only one. Called with
+ * the loader lock held.
+ */
+typedef const char *(*load_path_fn)(long task, int side, void *priv);
+
+/*
+ * Start loading the files of tasks [0, nr) in order, keeping at most
+ * 'depth' tasks loaded ahead of loader_release(). Reads are issued
+ * through io_uring where available and by a few I/O threads otherwise.
+ * Returns NULL if out of memory.
+ */
+struct loader *loader_start(long nr, int depth, load_path_fn path, void *priv);
+
+/* Wait for one side of a task to be loaded */
+const struct load_file *loader_get(struct loader *ld, long task, int side);
+
+/* Give back the buffers of a finished task */
+void loader_release(struct loader *ld, long task);
+
+/* Stop the loader and free all of its buffers */
+void loader_stop(struct loader *ld);
+
+#endif /* XDIFF_LOAD_H */
@@ -0,0 +1,231 @@
+/*
+ * xdiff-loadtest.c - Load generator for xdiff --serve
+ * Replays one request from several connections and reports latencies
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "xdiff-outbuf.h"
+#include "xdiff-serve.h"
+#include "xinclude.h"
+
+/* Request replayed by every connection */
+struct load {
+    const char *socket;
+    const char *command;
+    const char *options;
+    struct serve_input inputs[3];
+    int nr;
+    long requests; /* Requests per connection */
+};
+
+/* Results of one connection */
+struct client {
+    struct load *load;
+    pthread_t thread;
+    double *latency; /* Milliseconds per request */
+    long done;
+    long errors;
+};
+
+static double now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void *run_client(void *arg)
+{
+    struct client *c = (struct client *)arg;
+    struct load *load = c->load;
+    struct serve_conn *conn;
+    struct outbuf payload, err;
+    long i;
+
+    outbuf_init_mem(&payload);
+    outbuf_init_mem(&err);
+    if (!(conn = serve_connect(load->socket, &err))) {
+        fwrite(err.buf, 1, err.len, stderr);
+        c->errors = load->requests;
+        goto out;
+    }
+    for (i = 0; i < load->requests; i++) {
+        double start = now_ms();
+        int status;
+
+        outbuf_reset(&payload);
+        status = serve_request(conn, load->command, load->options, load->inputs, load->nr,
+                               &payload);
+        if (status < 0) {
+            c->errors += load->requests - i;
+            break;
+        }
+        if (status == 2)
+            c->errors++;
+        c->latency[c->done++] = now_ms() - start;
+    }
+    serve_close(conn);
+
+out:
+    outbuf_release(&payload);
+    outbuf_release(&err);
+    return NULL;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Read a whole file for inline requests */
+static char *slurp(const char *path, long *size)
+{
+    FILE *f = fopen(path, "rb");
+    char *buf = NULL;
+    long len;
+
+    if (!f)
+        return NULL;
+    if (fseek(f, 0, SEEK_END) == 0 && (len = ftell(f)) >= 0 && fseek(f, 0, SEEK_SET) == 0 &&
+        (buf = (char *)xdl_malloc(len + 1)) && fread(buf, 1, len, f) == (size_t)len) {
+        *size = len;
+    } else {
+        xdl_free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    return buf;
+}
+
+static void usage(const char *progname)
+{
+    fprintf(stderr, "Usage: %s [OPTIONS] SOCKET FILE1 FILE2\n", progname);
+    fprintf(stderr, "       %s --merge [OPTIONS] SOCKET BASE OURS THEIRS\n", progname);
+    fprintf(stderr, "\nOptions:\n");
+    fprintf(stderr, "  -c, --connections=N  Number of concurrent connections (default: 4)\n");
+    fprintf(stderr, "  -n, --requests=N     Requests per connection (default: 1000)\n");
+    fprintf(stderr, "      --inline         Send file contents instead of paths\n");
+    fprintf(stderr, "      --merge          Send merge requests\n");
+    fprintf(stderr, "      --options=OPTS   Options of every request\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = { { "connections", required_argument, 0, 'c' },
+                                            { "requests", required_argument, 0, 'n' },
+                                            { "inline", no_argument, 0, 1 },
+                                            { "merge", no_argument, 0, 2 },
+                                            { "options", required_argument, 0, 3 },
+                                            { "help", no_argument, 0, 'h' },
+                                            { 0, 0, 0, 0 } };
+    struct load load;
+    struct client *clients;
+    double *all, start, elapsed;
+    long connections = 4, total = 0, errors = 0, i, j;
+    int opt, inline_data = 0, ret = 0;
+
+    memset(&load, 0, sizeof(load));
+    load.command = "diff";
+    load.options = "";
+    load.requests = 1000;
+
+    while ((opt = getopt_long(argc, argv, "c:n:h", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'c':
+            connections = atol(optarg);
+            break;
+        case 'n':
+            load.requests = atol(optarg);
+            break;
+        case 1:
+            inline_data = 1;
+            break;
+        case 2:
+            load.command = "merge";
+            break;
+        case 3:
+            load.options = optarg;
+            break;
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        default:
+            return 1;
+        }
+    }
+    load.nr = strcmp(load.command, "merge") ? 2 : 3;
+    if (optind + 1 + load.nr != argc || connections < 1 || load.requests < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    load.socket = argv[optind];
+
+    for (i = 0; i < load.nr; i++) {
+        struct serve_input *in = &load.inputs[i];
+        const char *file = argv[optind + 1 + i];
+
+        in->label = file;
+        if (inline_data)
+            in->data = slurp(file, &in->size);
+        else
+            in->path = realpath(file, NULL);
+        if (!in->data && !in->path) {
+            fprintf(stderr, "%s: cannot read file '%s': %s\n", argv[0], file, strerror(errno));
+            return 1;
+        }
+    }
+
+    clients = (struct client *)xdl_calloc(connections, sizeof(*clients));
+    all = (double *)xdl_malloc(connections * load.requests * sizeof(*all));
+    if (!clients || !all) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return 1;
+    }
+    start = now_ms();
+    for (i = 0; i < connections; i++) {
+        clients[i].load = &load;
+        clients[i].latency = all + i * load.requests;
+        if (pthread_create(&clients[i].thread, NULL, run_client, &clients[i]) != 0) {
+            fprintf(stderr, "%s: cannot start thread\n", argv[0]);
+            return 1;
+        }
+    }
+    for (i = 0; i < connections; i++)
+        pthread_join(clients[i].thread, NULL);
+    elapsed = now_ms() - start;
+
+    /* Gather the latencies of all connections in front of the array */
+    for (i = 0; i < connections; i++) {
+        for (j = 0; j < clients[i].done; j++)
+            all[total + j] = clients[i].latency[j];
+        total += clients[i].done;
+        errors += clients[i].errors;
+    }
+    qsort(all, total, sizeof(*all), cmp_double);
+
+    printf("requests   %ld (%ld errors)\n", total, errors);
+    printf("throughput %.1f requests/s\n", elapsed > 0 ? total * 1e3 / elapsed : 0.0);
+    if (total)
+        printf("latency    p50 %.3f ms, p99 %.3f ms, max %.3f ms\n", all[(total - 1) / 2],
+               all[(total * 99 - 1) / 100], all[total - 1]);
+    if (errors)
+        ret = 1;
+
+    for (i = 0; i < load.nr; i++) {
+        xdl_free((char *)load.inputs[i].data);
+        free((char *)load.inputs[i].path);
+    }
+    xdl_free(all);
+    xdl_free(clients);
+    return ret;
+}
@@ -175,24 +175,19 @@ void moved_context_free(struct moved_context *ctx)
     ctx->added_blocks = NULL;
 }
 
-/* Collect blocks from diff changes */
-int collect_blocks_from_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
-                             struct moved_context *ctx)
+/* Collect blocks from the changes marked in a diffed environment, which is freed */
+static int collect_blocks_from_env(xdfenv_t *env, unsigned long flags, struct moved_context *ctx)
 {
-    xdfenv_t xe;
+    xdfenv_t xe = *env;
     xdchange_t *xscr = NULL;
     xdchange_t *xch;
     xrecord_t **recs1;
     xrecord_t **recs2;
     int ret = -1;
 
-    /* Do diff computation */
-    if (xdl_do_diff(mf1, mf2, xpp, &xe) < 0)
-        return -1;
-
     /* Build change script */
-    if (xdl_change_compact(&xe.xdf1, &xe.xdf2, xpp->flags) < 0 ||
-        xdl_change_compact(&xe.xdf2, &xe.xdf1, xpp->flags) < 0 ||
+    if (xdl_change_compact(&xe.xdf1, &xe.xdf2, flags) < 0 ||
+        xdl_change_compact(&xe.xdf2, &xe.xdf1, flags) < 0 ||
         xdl_build_script(&xe, &xscr) < 0) {
         xdl_free_env(&xe);
         return -1;
@@ -320,6 +315,30 @@ cleanup:
     return ret;
 }
 
+/* Collect blocks from diff changes */
+int collect_blocks_from_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+                             struct moved_context *ctx)
+{
+    xdfenv_t xe;
+
+    /* Do diff computation */
+    if (xdl_do_diff(mf1, mf2, xpp, &xe) < 0)
+        return -1;
+
+    return collect_blocks_from_env(&xe, xpp->flags, ctx);
+}
+
+int collect_blocks_from_chain(xdlchain_t const *chain, long step, unsigned long flags,
+                              struct moved_context *ctx)
+{
+    xdfenv_t xe;
+
+    if (xdl_chain_do_diff(chain, step, &xe) < 0)
+        return -1;
+
+    return collect_blocks_from_env(&xe, flags, ctx);
+}
+
 /* Check if a line is marked as moved */
 int is_line_moved(struct moved_context *ctx, long line_num, int is_deleted)
 {
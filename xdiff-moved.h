@@ -60,6 +60,10 @@ void moved_context_free(struct moved_context *ctx);
 int collect_blocks_from_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
                              struct moved_context *ctx);
 
+/* Collect blocks from the changes of one step of a chain of versions */
+int collect_blocks_from_chain(xdlchain_t const *chain, long step, unsigned long flags,
+                              struct moved_context *ctx);
+
 /* Check if a line is marked as moved */
 int is_line_moved(struct moved_context *ctx, long line_num, int is_deleted);
 
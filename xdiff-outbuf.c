@@ -0,0 +1,193 @@
+/*
+ * xdiff-outbuf.c - Buffered output for the xdiff CLI
+ * Collects output in a large buffer and flushes it with write()/writev()
+ */
+
+#include "xdiff-outbuf.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "xinclude.h"
+
+/* Room needed by xdl_num_out() for any long */
+#define NUM_MAX 24
+
+void outbuf_init_fd(struct outbuf *ob, int fd)
+{
+    ob->len = 0;
+    ob->fd = fd;
+    ob->error = 0;
+    ob->alloc = OUTBUF_SIZE;
+    if (!(ob->buf = (char *)xdl_malloc(ob->alloc))) {
+        ob->alloc = 0;
+        ob->error = 1;
+    }
+}
+
+void outbuf_init_mem(struct outbuf *ob)
+{
+    ob->buf = NULL;
+    ob->len = 0;
+    ob->alloc = 0;
+    ob->fd = -1;
+    ob->error = 0;
+}
+
+/* Write all of iov to the descriptor, resuming after partial writes */
+static int write_all(int fd, struct iovec *iov, int cnt)
+{
+    while (cnt > 0) {
+        ssize_t n = writev(fd, iov, cnt);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        while (cnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+/* Make room for len more bytes in a memory buffer */
+static int grow(struct outbuf *ob, size_t len)
+{
+    size_t alloc = ob->alloc ? ob->alloc : 4096;
+    char *buf;
+
+    while (alloc - ob->len < len)
+        alloc *= 2;
+    if (!(buf = (char *)xdl_realloc(ob->buf, alloc))) {
+        ob->error = 1;
+        return -1;
+    }
+    ob->buf = buf;
+    ob->alloc = alloc;
+    return 0;
+}
+
+int outbuf_flush(struct outbuf *ob)
+{
+    struct iovec iov;
+
+    if (ob->fd >= 0 && ob->len) {
+        iov.iov_base = ob->buf;
+        iov.iov_len = ob->len;
+        if (write_all(ob->fd, &iov, 1) < 0)
+            ob->error = 1;
+        ob->len = 0;
+    }
+    return ob->error ? -1 : 0;
+}
+
+void outbuf_write(struct outbuf *ob, const char *data, size_t len)
+{
+    /* Empty captures have no buffer at all */
+    if (!len)
+        return;
+    if (ob->alloc - ob->len >= len) {
+        memcpy(ob->buf + ob->len, data, len);
+        ob->len += len;
+        return;
+    }
+    if (ob->fd < 0) {
+        if (grow(ob, len) < 0)
+            return;
+        memcpy(ob->buf + ob->len, data, len);
+        ob->len += len;
+        return;
+    }
+
+    /*
+     * The data does not fit: hand the pending bytes and the new data
+     * to the kernel in one writev() instead of copying it first.
+     */
+    {
+        struct iovec iov[2];
+
+        iov[0].iov_base = ob->buf;
+        iov[0].iov_len = ob->len;
+        iov[1].iov_base = (char *)data;
+        iov[1].iov_len = len;
+        if (write_all(ob->fd, iov, 2) < 0)
+            ob->error = 1;
+        ob->len = 0;
+    }
+}
+
+void outbuf_putc(struct outbuf *ob, char c)
+{
+    if (ob->len == ob->alloc) {
+        outbuf_write(ob, &c, 1);
+        return;
+    }
+    ob->buf[ob->len++] = c;
+}
+
+void outbuf_puts(struct outbuf *ob, const char *str)
+{
+    outbuf_write(ob, str, strlen(str));
+}
+
+void outbuf_num(struct outbuf *ob, long val)
+{
+    char num[NUM_MAX];
+
+    if (ob->alloc - ob->len >= NUM_MAX) {
+        ob->len += xdl_num_out(ob->buf + ob->len, val);
+        return;
+    }
+    outbuf_write(ob, num, xdl_num_out(num, val));
+}
+
+void outbuf_printf(struct outbuf *ob, const char *fmt, ...)
+{
+    char small[256];
+    char *str = small;
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(small, sizeof(small), fmt, ap);
+    va_end(ap);
+    if (len < 0) {
+        ob->error = 1;
+        return;
+    }
+    if ((size_t)len >= sizeof(small)) {
+        if (!(str = (char *)xdl_malloc(len + 1))) {
+            ob->error = 1;
+            return;
+        }
+        va_start(ap, fmt);
+        vsnprintf(str, len + 1, fmt, ap);
+        va_end(ap);
+    }
+    outbuf_write(ob, str, len);
+    if (str != small)
+        xdl_free(str);
+}
+
+void outbuf_reset(struct outbuf *ob)
+{
+    ob->len = 0;
+    ob->error = ob->buf || ob->fd < 0 ? 0 : 1;
+}
+
+void outbuf_release(struct outbuf *ob)
+{
+    xdl_free(ob->buf);
+    ob->buf = NULL;
+    ob->len = ob->alloc = 0;
+}
@@ -0,0 +1,57 @@
+/*
+ * xdiff-outbuf.h - Buffered output for the xdiff CLI
+ * Collects output in a large buffer and flushes it with write()/writev()
+ */
+
+#ifndef XDIFF_OUTBUF_H
+#define XDIFF_OUTBUF_H
+
+#include <stddef.h>
+
+/* Default buffer size for descriptor-backed output */
+#define OUTBUF_SIZE (256 * 1024)
+
+/* Output buffer */
+struct outbuf {
+    char *buf;
+    size_t len;   /* Bytes pending in buf */
+    size_t alloc; /* Capacity of buf */
+    int fd;       /* Destination descriptor, or -1 to collect in memory */
+    int error;    /* Set once a write or allocation has failed */
+};
+
+/* Initialize a buffer that is flushed to a file descriptor */
+void outbuf_init_fd(struct outbuf *ob, int fd);
+
+/* Initialize a buffer that grows in memory until released */
+void outbuf_init_mem(struct outbuf *ob);
+
+/* Append bytes, flushing or growing the buffer as needed */
+void outbuf_write(struct outbuf *ob, const char *data, size_t len);
+
+/* Append a single character */
+void outbuf_putc(struct outbuf *ob, char c);
+
+/* Append a NUL-terminated string */
+void outbuf_puts(struct outbuf *ob, const char *str);
+
+/* Append the decimal representation of a number */
+void outbuf_num(struct outbuf *ob, long val);
+
+/* Append formatted text */
+void outbuf_printf(struct outbuf *ob, const char *fmt, ...)
+#if defined(__GNUC__)
+    __attribute__((format(printf, 2, 3)))
+#endif
+    ;
+
+/* Write pending bytes to the descriptor; returns -1 if any write failed */
+int outbuf_flush(struct outbuf *ob);
+
+/* Discard pending bytes and errors, keeping the buffer for reuse */
+void outbuf_reset(struct outbuf *ob);
+
+/* Free the buffer (pending descriptor output is not flushed) */
+void outbuf_release(struct outbuf *ob);
+
+#endif /* XDIFF_OUTBUF_H */
@@ -0,0 +1,110 @@
+/*
+ * xdiff-pool.c - Ordered worker pool for the xdiff CLI
+ * Runs independent tasks on threads and consumes the results in order
+ */
+
+#include "xdiff-pool.h"
+
+#include <pthread.h>
+
+#include "xinclude.h"
+
+/* State shared by the worker threads */
+struct pool {
+    long nr;
+    long next;  /* Next task to hand out */
+    char *done; /* Completion flag of every task */
+    pool_task_fn run;
+    void *priv;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+/* Argument of one worker thread */
+struct pool_worker {
+    struct pool *pool;
+    int id;
+    pthread_t thread;
+};
+
+static void *worker(void *arg)
+{
+    struct pool_worker *w = (struct pool_worker *)arg;
+    struct pool *pool = w->pool;
+
+    for (;;) {
+        long task;
+
+        pthread_mutex_lock(&pool->lock);
+        if (pool->next == pool->nr) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        task = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+
+        pool->run(task, w->id, pool->priv);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->done[task] = 1;
+        pthread_cond_broadcast(&pool->cond);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return NULL;
+}
+
+int pool_workers(long nr, int jobs)
+{
+    if (jobs > nr)
+        jobs = (int)nr;
+    return jobs > 1 ? jobs : 1;
+}
+
+void run_ordered(long nr, int jobs, pool_task_fn run, pool_done_fn done, void *priv)
+{
+    struct pool pool;
+    struct pool_worker *workers = NULL;
+    long i;
+    int nthreads = 0;
+
+    jobs = pool_workers(nr, jobs);
+    memset(&pool, 0, sizeof(pool));
+    if (jobs > 1 && XDL_CALLOC_ARRAY(pool.done, nr) && XDL_ALLOC_ARRAY(workers, jobs)) {
+        pool.nr = nr;
+        pool.run = run;
+        pool.priv = priv;
+        pthread_mutex_init(&pool.lock, NULL);
+        pthread_cond_init(&pool.cond, NULL);
+        for (; nthreads < jobs; nthreads++) {
+            workers[nthreads].pool = &pool;
+            workers[nthreads].id = nthreads;
+            if (pthread_create(&workers[nthreads].thread, NULL, worker, &workers[nthreads]) != 0)
+                break;
+        }
+    }
+
+    if (!nthreads) {
+        /* No threads: run every task right here, one at a time */
+        for (i = 0; i < nr; i++) {
+            run(i, 0, priv);
+            done(i, priv);
+        }
+    } else {
+        for (i = 0; i < nr; i++) {
+            pthread_mutex_lock(&pool.lock);
+            while (!pool.done[i])
+                pthread_cond_wait(&pool.cond, &pool.lock);
+            pthread_mutex_unlock(&pool.lock);
+            done(i, priv);
+        }
+        for (i = 0; i < nthreads; i++)
+            pthread_join(workers[i].thread, NULL);
+    }
+
+    if (pool.done && workers) {
+        pthread_cond_destroy(&pool.cond);
+        pthread_mutex_destroy(&pool.lock);
+    }
+    xdl_free(workers);
+    xdl_free(pool.done);
+}
@@ -0,0 +1,26 @@
+/*
+ * xdiff-pool.h - Ordered worker pool for the xdiff CLI
+ * Runs independent tasks on threads and consumes the results in order
+ */
+
+#ifndef XDIFF_POOL_H
+#define XDIFF_POOL_H
+
+/* Run one task; 'worker' identifies the calling thread in [0, jobs) */
+typedef void (*pool_task_fn)(long task, int worker, void *priv);
+
+/* Consume one finished task; called on the calling thread in task order */
+typedef void (*pool_done_fn)(long task, void *priv);
+
+/* Number of workers that run_ordered() will use for 'nr' tasks */
+int pool_workers(long nr, int jobs);
+
+/*
+ * Run tasks [0, nr) on up to 'jobs' threads, handing each finished task
+ * to 'done' in ascending order as soon as it and all earlier tasks have
+ * completed. Falls back to running the tasks one by one on the calling
+ * thread when no threads are needed or none can be started.
+ */
+void run_ordered(long nr, int jobs, pool_task_fn run, pool_done_fn done, void *priv);
+
+#endif /* XDIFF_POOL_H */
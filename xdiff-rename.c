@@ -0,0 +1,255 @@
+/*
+ * xdiff-rename.c - Rename and copy detection for xdiff -r
+ * Pairs added files with similar deleted or kept ones, found through line sketches
+ */
+
+#include "xdiff-rename.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "xdiff-load.h"
+#include "xdiff-pool.h"
+#include "xinclude.h"
+
+/*
+ * Sources sharing one sketch hash beyond this many are not candidates
+ * through it: such a hash is a line common to many files, like a
+ * license header, and would make the search quadratic again.
+ */
+#define RENAME_BUCKET_MAX 64
+
+/*
+ * Points a sketch estimate may fall short of the threshold by and still
+ * make a pair a candidate, for the exact count to decide.
+ */
+#define RENAME_SKETCH_SLACK 10
+
+/* State shared by the sketching and scoring threads */
+struct rename_scan {
+    struct rename_file *files;
+    xdlsketch_t *sketches;
+    struct rename_pair *pairs;
+    struct loader *loader;
+    unsigned long flags;
+};
+
+/* One hash of a source sketch; runs of equal hashes are the buckets */
+struct rename_entry {
+    unsigned long ha;
+    long src;
+};
+
+/* A candidate pair, scored by the exact count of its shared lines */
+struct rename_pair {
+    long dst, src;
+    int score; /* -1 if either file cannot be read */
+};
+
+int rename_score(const xdlsimilarity_t *sim)
+{
+    long most = XDL_MAX(sim->nrec1, sim->nrec2);
+
+    return most ? (int)(sim->shared * 100.0 / most) : 100;
+}
+
+static const char *file_path(long task, int side, void *priv)
+{
+    struct rename_scan *scan = (struct rename_scan *)priv;
+
+    return side ? NULL : scan->files[task].path;
+}
+
+/* Sketch one file; one that cannot be read or sketched keeps an empty sketch */
+static void sketch_file(long task, int worker, void *priv)
+{
+    struct rename_scan *scan = (struct rename_scan *)priv;
+    const struct load_file *file = loader_get(scan->loader, task, 0);
+
+    (void)worker;
+    if (!file->error)
+        xdl_sketch((mmfile_t *)&file->mf, scan->flags, &scan->sketches[task]);
+    loader_release(scan->loader, task);
+}
+
+/* Results stay with their task until all tasks ran */
+static void task_done(long task, void *priv)
+{
+    (void)task;
+    (void)priv;
+}
+
+/* Both files of a candidate pair, source first */
+static const char *pair_path(long task, int side, void *priv)
+{
+    struct rename_scan *scan = (struct rename_scan *)priv;
+    const struct rename_pair *pair = &scan->pairs[task];
+
+    return scan->files[side ? pair->dst : pair->src].path;
+}
+
+/* Count the lines a candidate pair shares exactly */
+static void score_pair(long task, int worker, void *priv)
+{
+    struct rename_scan *scan = (struct rename_scan *)priv;
+    struct rename_pair *pair = &scan->pairs[task];
+    const struct load_file *src = loader_get(scan->loader, task, 0);
+    const struct load_file *dst = loader_get(scan->loader, task, 1);
+    xdlsimilarity_t sim;
+
+    (void)worker;
+    pair->score = -1;
+    if (!src->error && !dst->error &&
+        xdl_similarity((mmfile_t *)&src->mf, (mmfile_t *)&dst->mf, scan->flags, &sim) == 0)
+        pair->score = rename_score(&sim);
+    loader_release(scan->loader, task);
+}
+
+static int entry_cmp(const void *a, const void *b)
+{
+    const struct rename_entry *e1 = (const struct rename_entry *)a;
+    const struct rename_entry *e2 = (const struct rename_entry *)b;
+
+    if (e1->ha != e2->ha)
+        return e1->ha < e2->ha ? -1 : 1;
+    return e1->src < e2->src ? -1 : e1->src > e2->src;
+}
+
+/* Best pairs first, then in the order of the files */
+static int pair_cmp(const void *a, const void *b)
+{
+    const struct rename_pair *p1 = (const struct rename_pair *)a;
+    const struct rename_pair *p2 = (const struct rename_pair *)b;
+
+    if (p1->score != p2->score)
+        return p2->score - p1->score;
+    if (p1->dst != p2->dst)
+        return p1->dst < p2->dst ? -1 : 1;
+    return p1->src < p2->src ? -1 : p1->src > p2->src;
+}
+
+/* First entry whose hash is not below 'ha' */
+static long entry_find(const struct rename_entry *entries, long nr, unsigned long ha)
+{
+    long lo = 0, hi = nr, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (entries[mid].ha < ha)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+int find_renames(struct rename_file *files, long nr, const struct rename_options *opts, int jobs,
+                 struct outbuf *err)
+{
+    struct rename_scan scan;
+    struct rename_entry *entries = NULL;
+    struct rename_pair *pairs = NULL;
+    long *seen = NULL;
+    char *renamed = NULL;
+    long i, k, lo, hi, nentries = 0, npairs = 0, apairs = 0;
+    xdlsimilarity_t sim;
+    int ret = -1;
+
+    for (i = 0; i < nr; i++) {
+        files[i].match = -1;
+        files[i].score = 0;
+        files[i].copy = 0;
+    }
+
+    memset(&scan, 0, sizeof(scan));
+    scan.files = files;
+    scan.flags = opts->flags;
+    if (!XDL_CALLOC_ARRAY(scan.sketches, nr) ||
+        !(scan.loader = loader_start(nr, jobs * LOAD_AHEAD, file_path, &scan)))
+        goto out;
+    run_ordered(nr, jobs, sketch_file, task_done, &scan);
+    loader_stop(scan.loader);
+    scan.loader = NULL;
+
+    /* Index the hashes of the source sketches */
+    for (i = 0; i < nr; i++)
+        if (!files[i].side)
+            nentries += scan.sketches[i].nr;
+    if (!XDL_ALLOC_ARRAY(entries, nentries + 1))
+        goto out;
+    for (i = 0, nentries = 0; i < nr; i++)
+        for (k = 0; !files[i].side && k < scan.sketches[i].nr; k++) {
+            entries[nentries].ha = scan.sketches[i].min[k];
+            entries[nentries++].src = i;
+        }
+    qsort(entries, nentries, sizeof(*entries), entry_cmp);
+
+    /* Estimate every source sharing a bucket with an added file, once */
+    if (!XDL_ALLOC_ARRAY(seen, nr + 1) || !XDL_CALLOC_ARRAY(renamed, nr + 1))
+        goto out;
+    for (i = 0; i < nr; i++)
+        seen[i] = -1;
+    for (i = 0; i < nr; i++) {
+        if (!files[i].side)
+            continue;
+        for (k = 0; k < scan.sketches[i].nr; k++) {
+            lo = entry_find(entries, nentries, scan.sketches[i].min[k]);
+            for (hi = lo; hi < nentries && entries[hi].ha == scan.sketches[i].min[k]; hi++)
+                ;
+            if (hi - lo > RENAME_BUCKET_MAX)
+                continue;
+            for (; lo < hi; lo++) {
+                if (seen[entries[lo].src] == i)
+                    continue;
+                seen[entries[lo].src] = i;
+                xdl_sketch_similarity(&scan.sketches[entries[lo].src], &scan.sketches[i], &sim);
+                if (rename_score(&sim) < opts->threshold - RENAME_SKETCH_SLACK)
+                    continue;
+                if (XDL_ALLOC_GROW(pairs, npairs + 1, apairs))
+                    goto out;
+                pairs[npairs].dst = i;
+                pairs[npairs++].src = entries[lo].src;
+            }
+        }
+    }
+
+    /* The sketches only pick the candidates; the exact count scores them */
+    scan.pairs = pairs;
+    if (npairs && !(scan.loader = loader_start(npairs, jobs * LOAD_AHEAD, pair_path, &scan)))
+        goto out;
+    run_ordered(npairs, jobs, score_pair, task_done, &scan);
+    if (scan.loader)
+        loader_stop(scan.loader);
+    for (i = k = 0; i < npairs; i++)
+        if (pairs[i].score >= opts->threshold)
+            pairs[k++] = pairs[i];
+    npairs = k;
+
+    qsort(pairs, npairs, sizeof(*pairs), pair_cmp);
+    for (k = 0; k < npairs; k++) {
+        struct rename_file *dst = &files[pairs[k].dst];
+        long src = pairs[k].src;
+
+        if (dst->match >= 0)
+            continue;
+        if (!files[src].kept && !renamed[src])
+            renamed[src] = 1;
+        else if (opts->copies)
+            dst->copy = 1;
+        else
+            continue;
+        dst->match = src;
+        dst->score = pairs[k].score;
+    }
+    ret = 0;
+
+out:
+    if (ret < 0)
+        outbuf_printf(err, "xdiff: out of memory\n");
+    xdl_free(renamed);
+    xdl_free(seen);
+    xdl_free(pairs);
+    xdl_free(entries);
+    xdl_free(scan.sketches);
+    return ret;
+}
@@ -0,0 +1,51 @@
+/*
+ * xdiff-rename.h - Rename and copy detection for xdiff -r
+ * Pairs added files with similar deleted or kept ones, found through line sketches
+ */
+
+#ifndef XDIFF_RENAME_H
+#define XDIFF_RENAME_H
+
+#include "xdiff-outbuf.h"
+#include "xdiff.h"
+
+/* Least similarity of a rename or copy when none is given, in percent */
+#define RENAME_THRESHOLD_DEFAULT 50
+
+/* How to look for renamed and copied files */
+struct rename_options {
+    int copies;          /* Also pair added files with files kept in both trees */
+    int threshold;       /* Least similarity of a pair, in percent */
+    unsigned long flags; /* Whitespace flags the lines are compared under */
+};
+
+/* A file that may be one side of a rename or copy */
+struct rename_file {
+    const char *path;
+    int side;   /* 0 for a deleted or kept file of the first tree, 1 for an added file */
+    int kept;   /* A first-tree file also in the second tree, only ever copied */
+    long tag;   /* Left alone by find_renames(), for the caller */
+    long match; /* Set by find_renames(): the file an added file came from, or -1 */
+    int score;  /* Similarity to that file, in percent */
+    int copy;   /* Whether the match is a copy rather than a rename */
+};
+
+/* Similarity in percent: the shared lines as a part of the longer file */
+int rename_score(const xdlsimilarity_t *sim);
+
+/*
+ * Sketch the lines of 'files', loading them on 'jobs' threads, and pair
+ * each added file with the most similar deleted file at or above the
+ * threshold, or with copies also a kept file. The candidates of an added
+ * file are the files whose sketches share a hash with its own and whose
+ * sketch estimate comes near the threshold; each candidate pair is then
+ * loaded and scored by the exact count of its shared lines, on the same
+ * threads, and the best pairs are taken first. A
+ * deleted file is renamed once, and with copies copied after that. Files
+ * that cannot be read are left unpaired. Returns -1 after writing a
+ * diagnostic to 'err' if out of memory, and 0 otherwise.
+ */
+int find_renames(struct rename_file *files, long nr, const struct rename_options *opts, int jobs,
+                 struct outbuf *err);
+
+#endif /* XDIFF_RENAME_H */
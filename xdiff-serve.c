@@ -0,0 +1,921 @@
+/*
+ * xdiff-serve.c - Diff server for xdiff over a Unix domain socket
+ * Keeps prepared files in an LRU cache across requests
+ */
+
+#include "xdiff-serve.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "xinclude.h"
+
+/* Longest command or input line accepted */
+#define SERVE_LINE_MAX 8192
+
+/* Bytes re-read at a time to check that a cached file that grew was only appended to */
+#define SERVE_GROW_CHUNK (64 * 1024)
+
+/* Receive buffer of a connection */
+#define SERVE_READ_SIZE (64 * 1024)
+
+/* Buffered connection, used by both the server and the client */
+struct serve_conn {
+    int fd;
+    char *buf;
+    size_t pos; /* Start of the unread bytes in buf */
+    size_t len; /* End of the unread bytes in buf */
+    struct outbuf wr;
+};
+
+/* A prepared file held by the cache */
+struct cache_entry {
+    struct cache_entry *prev, *next; /* LRU list, most recently used first */
+    char *path;                      /* Source path, or NULL for inline content */
+    dev_t dev;
+    ino_t ino;
+    long long mtime;     /* Modification time of the source, in nanoseconds */
+    uint64_t hash;       /* Content hash of inline content */
+    unsigned long flags; /* Whitespace flags of the index */
+    mmfile_t mf;
+    xdlindex_t index;
+    size_t bytes; /* Memory charged to the cache */
+    int refs;     /* Requests using the entry */
+    int cached;   /* Whether the entry is linked in the LRU list */
+};
+
+/* LRU cache of prepared files */
+struct file_cache {
+    pthread_mutex_t lock;
+    struct cache_entry *head, *tail;
+    size_t bytes;
+    size_t limit;
+    long nr;
+    unsigned long hits, misses;
+    unsigned long grown; /* Misses served by extending an entry that grew */
+};
+
+/* State shared by the connection threads */
+struct server {
+    struct file_cache cache;
+    pthread_mutex_t parse_lock;
+    serve_parse_fn parse;
+    serve_diff_fn diff;
+    void *priv;
+};
+
+/* Argument of a connection thread */
+struct connection {
+    struct server *srv;
+    int fd;
+};
+
+static volatile sig_atomic_t stop_serving;
+
+static void stop_handler(int sig)
+{
+    (void)sig;
+    stop_serving = 1;
+}
+
+static struct serve_conn *conn_open(int fd)
+{
+    struct serve_conn *conn;
+
+    if (!(conn = (struct serve_conn *)xdl_malloc(sizeof(*conn))))
+        return NULL;
+    if (!(conn->buf = (char *)xdl_malloc(SERVE_READ_SIZE))) {
+        xdl_free(conn);
+        return NULL;
+    }
+    conn->fd = fd;
+    conn->pos = conn->len = 0;
+    outbuf_init_fd(&conn->wr, fd);
+    return conn;
+}
+
+void serve_close(struct serve_conn *conn)
+{
+    if (!conn)
+        return;
+    close(conn->fd);
+    outbuf_release(&conn->wr);
+    xdl_free(conn->buf);
+    xdl_free(conn);
+}
+
+/* Read more bytes into the buffer; returns -1 at end of stream */
+static int conn_fill(struct serve_conn *conn)
+{
+    ssize_t n;
+
+    if (conn->pos) {
+        memmove(conn->buf, conn->buf + conn->pos, conn->len - conn->pos);
+        conn->len -= conn->pos;
+        conn->pos = 0;
+    }
+    do
+        n = read(conn->fd, conn->buf + conn->len, SERVE_READ_SIZE - conn->len);
+    while (n < 0 && errno == EINTR);
+    if (n <= 0)
+        return -1;
+    conn->len += n;
+    return 0;
+}
+
+/*
+ * Read one line, without its newline. The line stays valid until the
+ * next read from the connection. Returns NULL at end of stream or if
+ * the line is too long.
+ */
+static char *conn_line(struct serve_conn *conn)
+{
+    size_t scanned = 0;
+    char *line, *eol;
+
+    while (!(eol = (char *)memchr(conn->buf + conn->pos + scanned, '\n',
+                                  conn->len - conn->pos - scanned))) {
+        scanned = conn->len - conn->pos;
+        if (scanned >= SERVE_LINE_MAX || conn_fill(conn) < 0)
+            return NULL;
+    }
+    *eol = '\0';
+    line = conn->buf + conn->pos;
+    conn->pos = eol + 1 - conn->buf;
+    return line;
+}
+
+/* Read exactly 'size' bytes into 'dst', or discard them if it is NULL */
+static int conn_read(struct serve_conn *conn, char *dst, size_t size)
+{
+    while (size) {
+        size_t n;
+
+        if (conn->pos == conn->len && conn_fill(conn) < 0)
+            return -1;
+        n = XDL_MIN(size, conn->len - conn->pos);
+        if (dst) {
+            memcpy(dst, conn->buf + conn->pos, n);
+            dst += n;
+        }
+        conn->pos += n;
+        size -= n;
+    }
+    return 0;
+}
+
+/* Split 'str' at the first 'sep', returning the rest or NULL */
+static char *split_field(char *str, int sep)
+{
+    char *p = strchr(str, sep);
+
+    if (!p)
+        return NULL;
+    *p = '\0';
+    return p + 1;
+}
+
+static uint64_t content_hash(const char *data, size_t size)
+{
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ size, w;
+
+    for (; size >= 8; data += 8, size -= 8) {
+        memcpy(&w, data, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    for (; size; data++, size--)
+        h = (h ^ (unsigned char)*data) * 0x100000001b3ULL;
+    return h;
+}
+
+static void free_entry(struct cache_entry *e)
+{
+    xdl_index_free(&e->index);
+    xdl_free(e->mf.ptr);
+    xdl_free(e->path);
+    xdl_free(e);
+}
+
+/* Remove an entry from the LRU list; the cache lock must be held */
+static void cache_unlink(struct file_cache *cache, struct cache_entry *e)
+{
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        cache->head = e->next;
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        cache->tail = e->prev;
+    e->prev = e->next = NULL;
+    e->cached = 0;
+    cache->bytes -= e->bytes;
+    cache->nr--;
+}
+
+/* Insert an entry at the head of the LRU list; the cache lock must be held */
+static void cache_link(struct file_cache *cache, struct cache_entry *e)
+{
+    e->prev = NULL;
+    e->next = cache->head;
+    if (cache->head)
+        cache->head->prev = e;
+    else
+        cache->tail = e;
+    cache->head = e;
+    e->cached = 1;
+    cache->bytes += e->bytes;
+    cache->nr++;
+}
+
+/*
+ * Look up the entry matching 'key' and take a reference on it. Entries
+ * for the same path that no longer match the file on disk are dropped,
+ * except that an unused one for the same file, now larger, is handed
+ * out in '*grown' when it is set, for the caller to extend or free.
+ */
+static struct cache_entry *cache_find(struct file_cache *cache, const struct cache_entry *key,
+                                      struct cache_entry **grown)
+{
+    struct cache_entry *e, *next, *found = NULL, *stale = NULL;
+
+    pthread_mutex_lock(&cache->lock);
+    for (e = cache->head; e; e = next) {
+        next = e->next;
+        if (e->flags != key->flags || !e->path != !key->path)
+            continue;
+        if (key->path) {
+            if (strcmp(e->path, key->path))
+                continue;
+            if (e->dev == key->dev && e->ino == key->ino && e->mtime == key->mtime &&
+                e->mf.size == key->mf.size) {
+                found = e;
+                break;
+            }
+            cache_unlink(cache, e);
+            if (e->refs)
+                continue;
+            if (grown && !*grown && e->dev == key->dev && e->ino == key->ino &&
+                e->mf.size < key->mf.size) {
+                *grown = e;
+            } else {
+                e->next = stale;
+                stale = e;
+            }
+        } else if (e->hash == key->hash && e->mf.size == key->mf.size &&
+                   !memcmp(e->mf.ptr, key->mf.ptr, key->mf.size)) {
+            found = e;
+            break;
+        }
+    }
+    if (found) {
+        found->refs++;
+        cache->hits++;
+        if (found != cache->head) {
+            cache_unlink(cache, found);
+            cache_link(cache, found);
+        }
+    } else {
+        cache->misses++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    for (; stale; stale = next) {
+        next = stale->next;
+        free_entry(stale);
+    }
+    return found;
+}
+
+/* Add a referenced entry, evicting the least recently used ones */
+static void cache_insert(struct file_cache *cache, struct cache_entry *e)
+{
+    struct cache_entry *victim, *evicted = NULL;
+
+    if (e->bytes > cache->limit)
+        return;
+
+    pthread_mutex_lock(&cache->lock);
+    cache_link(cache, e);
+    while (cache->bytes > cache->limit && (victim = cache->tail) != e) {
+        cache_unlink(cache, victim);
+        if (!victim->refs) {
+            victim->next = evicted;
+            evicted = victim;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    for (; evicted; evicted = victim) {
+        victim = evicted->next;
+        free_entry(evicted);
+    }
+}
+
+/* Drop a reference taken by a lookup or a load */
+static void cache_release(struct file_cache *cache, struct cache_entry *e)
+{
+    int unused;
+
+    pthread_mutex_lock(&cache->lock);
+    unused = --e->refs == 0 && !e->cached;
+    pthread_mutex_unlock(&cache->lock);
+    if (unused)
+        free_entry(e);
+}
+
+/* Index freshly loaded content and hand it to the cache */
+static struct cache_entry *cache_add(struct file_cache *cache, struct cache_entry *key)
+{
+    struct cache_entry *e;
+
+    if (!(e = (struct cache_entry *)xdl_malloc(sizeof(*e))))
+        return NULL;
+    *e = *key;
+    if (xdl_index_build(&e->mf, e->flags, &e->index) < 0) {
+        xdl_free(e);
+        return NULL;
+    }
+    e->bytes = e->mf.size + e->index.nrec * (sizeof(*e->index.ends) + sizeof(*e->index.ha)) +
+               sizeof(*e);
+    e->refs = 1;
+    e->cached = 0;
+    cache_insert(cache, e);
+    return e;
+}
+
+/* Read exactly 'size' bytes at 'offset' */
+static int read_at(int fd, char *dst, long size, off_t offset)
+{
+    while (size) {
+        ssize_t n = pread(fd, dst, size, offset);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        dst += n;
+        size -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+/*
+ * Extend a cached file that grew in place, as logs do: when all of its
+ * cached bytes are still there, only the bytes past them are split and
+ * hashed into the index.
+ */
+static int grow_entry(struct file_cache *cache, struct cache_entry *e, int fd,
+                      const struct cache_entry *key)
+{
+    long old = e->mf.size, pos, n = 0;
+    char *probe, *ptr;
+
+    if (!(probe = (char *)xdl_malloc(SERVE_GROW_CHUNK)))
+        return -1;
+    for (pos = 0; pos < old; pos += n) {
+        n = XDL_MIN(old - pos, SERVE_GROW_CHUNK);
+        if (read_at(fd, probe, n, pos) < 0 || memcmp(probe, e->mf.ptr + pos, n))
+            break;
+    }
+    xdl_free(probe);
+    if (pos < old)
+        return -1;
+    if (!(ptr = (char *)xdl_realloc(e->mf.ptr, key->mf.size + 1)))
+        return -1;
+    e->mf.ptr = ptr;
+    if (read_at(fd, ptr + old, key->mf.size - old, old) < 0)
+        return -1;
+    e->mf.size = key->mf.size;
+    if (xdl_index_append(&e->mf, &e->index) < 0)
+        return -1;
+
+    e->mtime = key->mtime;
+    e->bytes = e->mf.size + e->index.nrec * (sizeof(*e->index.ends) + sizeof(*e->index.ha)) +
+               sizeof(*e);
+    e->refs = 1;
+    pthread_mutex_lock(&cache->lock);
+    cache->grown++;
+    pthread_mutex_unlock(&cache->lock);
+    cache_insert(cache, e);
+    return 0;
+}
+
+/* Load a server-side file, preferably from the cache */
+static struct cache_entry *load_path(struct file_cache *cache, const char *path,
+                                     unsigned long flags, struct outbuf *err)
+{
+    struct cache_entry key, *e = NULL, *grown = NULL;
+    struct stat st;
+    long done = 0;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+        outbuf_printf(err, "xdiff: cannot read file '%s': %s\n", path, strerror(errno));
+        goto out;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        outbuf_printf(err, "xdiff: cannot read file '%s': not a regular file\n", path);
+        goto out;
+    }
+
+    memset(&key, 0, sizeof(key));
+    key.path = (char *)path;
+    key.dev = st.st_dev;
+    key.ino = st.st_ino;
+    key.mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    key.mf.size = (long)st.st_size;
+    key.flags = flags;
+    if ((e = cache_find(cache, &key, &grown)))
+        goto out;
+    if (grown) {
+        if (!grow_entry(cache, grown, fd, &key)) {
+            e = grown;
+            goto out;
+        }
+        free_entry(grown);
+    }
+
+    if (!(key.mf.ptr = (char *)xdl_malloc(key.mf.size + 1)) || !(key.path = strdup(path))) {
+        outbuf_printf(err, "xdiff: out of memory\n");
+        xdl_free(key.mf.ptr);
+        goto out;
+    }
+    while (done < key.mf.size) {
+        ssize_t n = read(fd, key.mf.ptr + done, key.mf.size - done);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            outbuf_printf(err, "xdiff: cannot read file '%s': %s\n", path,
+                          n < 0 ? strerror(errno) : "file changed while reading");
+            break;
+        }
+        done += n;
+    }
+    if (done == key.mf.size && !(e = cache_add(cache, &key)))
+        outbuf_printf(err, "xdiff: out of memory\n");
+    if (!e) {
+        xdl_free(key.mf.ptr);
+        xdl_free(key.path);
+    }
+
+out:
+    if (fd >= 0)
+        close(fd);
+    return e;
+}
+
+/* Load inline content sent by the client, preferably from the cache */
+static struct cache_entry *load_data(struct file_cache *cache, struct serve_conn *conn,
+                                     long size, unsigned long flags, struct outbuf *err, int *fatal)
+{
+    struct cache_entry key, *e;
+
+    memset(&key, 0, sizeof(key));
+    if (!(key.mf.ptr = (char *)xdl_malloc(size + 1))) {
+        outbuf_printf(err, "xdiff: out of memory\n");
+        *fatal = conn_read(conn, NULL, size) < 0;
+        return NULL;
+    }
+    if (conn_read(conn, key.mf.ptr, size) < 0) {
+        xdl_free(key.mf.ptr);
+        *fatal = 1;
+        return NULL;
+    }
+    key.mf.size = size;
+    key.hash = content_hash(key.mf.ptr, size);
+    key.flags = flags;
+
+    if ((e = cache_find(cache, &key, NULL))) {
+        xdl_free(key.mf.ptr);
+        return e;
+    }
+    if (!(e = cache_add(cache, &key))) {
+        outbuf_printf(err, "xdiff: out of memory\n");
+        xdl_free(key.mf.ptr);
+    }
+    return e;
+}
+
+/*
+ * Read the 'nr' inputs of a request. With 'load' unset the inputs are
+ * only consumed. Returns -2 if the stream is unusable, -1 after writing
+ * a diagnostic to 'err' if an input could not be loaded and 0 on
+ * success; entries[] and labels[] must be released in every case.
+ */
+static int read_inputs(struct server *srv, struct serve_conn *conn, int nr, int load,
+                       unsigned long flags, struct cache_entry **entries, char **labels,
+                       struct outbuf *err)
+{
+    int i, ret = 0;
+
+    for (i = 0; i < nr; i++) {
+        entries[i] = NULL;
+        labels[i] = NULL;
+    }
+    for (i = 0; i < nr; i++) {
+        char *line, *value, *label, *end;
+        int fatal = 0;
+
+        if (!(line = conn_line(conn)) || !(value = split_field(line, '\t')))
+            return -2;
+        label = split_field(value, '\t');
+
+        if (!strcmp(line, "path")) {
+            if (!(labels[i] = strdup(label ? label : value)))
+                ret = -1;
+            else if (load && ret == 0 && !(entries[i] = load_path(&srv->cache, value, flags, err)))
+                ret = -1;
+        } else if (!strcmp(line, "data")) {
+            long size = strtol(value, &end, 10);
+
+            if (*end || end == value || size < 0)
+                return -2;
+            if (!(labels[i] = strdup(label ? label : "-")))
+                ret = -1;
+            if (!load || ret < 0) {
+                if (conn_read(conn, NULL, size) < 0)
+                    return -2;
+            } else if (!(entries[i] = load_data(&srv->cache, conn, size, flags, err, &fatal))) {
+                if (fatal)
+                    return -2;
+                ret = -1;
+            }
+        } else {
+            return -2;
+        }
+    }
+    return ret;
+}
+
+static void release_inputs(struct server *srv, int nr, struct cache_entry **entries,
+                           char **labels)
+{
+    int i;
+
+    for (i = 0; i < nr; i++) {
+        if (entries[i])
+            cache_release(&srv->cache, entries[i]);
+        free(labels[i]);
+    }
+}
+
+static int do_diff(struct server *srv, struct serve_conn *conn, const char *options,
+                   struct outbuf *out, struct outbuf *err)
+{
+    struct cache_entry *entries[2];
+    struct serve_file files[2];
+    char *labels[2];
+    unsigned long flags = 0;
+    void *data = NULL;
+    int i, ret;
+
+    pthread_mutex_lock(&srv->parse_lock);
+    ret = srv->parse(options, &data, &flags, err, srv->priv);
+    pthread_mutex_unlock(&srv->parse_lock);
+
+    i = read_inputs(srv, conn, 2, ret >= 0, flags & XDF_WHITESPACE_FLAGS, entries, labels, err);
+    if (i == -2) {
+        ret = -2;
+    } else if (ret >= 0 && i == 0) {
+        for (i = 0; i < 2; i++) {
+            files[i].name = labels[i];
+            files[i].mf = &entries[i]->mf;
+            files[i].index = &entries[i]->index;
+        }
+        ret = srv->diff(data, &files[0], &files[1], out, err, srv->priv);
+    } else {
+        ret = -1;
+    }
+
+    release_inputs(srv, 2, entries, labels);
+    xdl_free(data);
+    return ret;
+}
+
+/* Parse the options of a merge request */
+static int parse_merge_options(char *options, xmparam_t *xmp, struct outbuf *err)
+{
+    char *tok, *save;
+
+    memset(xmp, 0, sizeof(*xmp));
+    xmp->level = XDL_MERGE_ZEALOUS;
+    for (tok = strtok_r(options, " \t", &save); tok; tok = strtok_r(NULL, " \t", &save)) {
+        if (!strcmp(tok, "--diff3"))
+            xmp->style = XDL_MERGE_DIFF3;
+        else if (!strcmp(tok, "--zdiff3"))
+            xmp->style = XDL_MERGE_ZEALOUS_DIFF3;
+        else if (!strcmp(tok, "--ours"))
+            xmp->favor = XDL_MERGE_FAVOR_OURS;
+        else if (!strcmp(tok, "--theirs"))
+            xmp->favor = XDL_MERGE_FAVOR_THEIRS;
+        else if (!strcmp(tok, "--union"))
+            xmp->favor = XDL_MERGE_FAVOR_UNION;
+        else if (!strcmp(tok, "-w") || !strcmp(tok, "--ignore-all-space"))
+            xmp->xpp.flags |= XDF_IGNORE_WHITESPACE;
+        else if (!strcmp(tok, "-b") || !strcmp(tok, "--ignore-space-change"))
+            xmp->xpp.flags |= XDF_IGNORE_WHITESPACE_CHANGE;
+        else if (!strcmp(tok, "--minimal"))
+            xmp->xpp.flags |= XDF_NEED_MINIMAL;
+        else if (!strcmp(tok, "--patience"))
+            xmp->xpp.flags = (xmp->xpp.flags & ~XDF_DIFF_ALGORITHM_MASK) | XDF_PATIENCE_DIFF;
+        else if (!strcmp(tok, "--histogram"))
+            xmp->xpp.flags = (xmp->xpp.flags & ~XDF_DIFF_ALGORITHM_MASK) | XDF_HISTOGRAM_DIFF;
+        else {
+            outbuf_printf(err, "xdiff: invalid merge option '%s'\n", tok);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int do_merge(struct server *srv, struct serve_conn *conn, char *options,
+                    struct outbuf *out, struct outbuf *err)
+{
+    struct cache_entry *entries[3];
+    char *labels[3];
+    xmparam_t xmp;
+    mmbuffer_t result;
+    int i, ret;
+
+    ret = parse_merge_options(options, &xmp, err);
+    i = read_inputs(srv, conn, 3, ret >= 0, xmp.xpp.flags & XDF_WHITESPACE_FLAGS, entries,
+                    labels, err);
+    if (i == -2) {
+        ret = -2;
+    } else if (ret >= 0 && i == 0) {
+        /* Both diffs of the merge are against the base */
+        xmp.xpp.index1 = &entries[0]->index;
+        xmp.xpp.index2 = &entries[1]->index;
+        xmp.ancestor = labels[0];
+        xmp.file1 = labels[1];
+        xmp.file2 = labels[2];
+        ret = xdl_merge(&entries[0]->mf, &entries[1]->mf, &entries[2]->mf, &xmp, &result);
+        if (ret < 0) {
+            outbuf_printf(err, "xdiff: merge failed\n");
+        } else {
+            outbuf_write(out, result.ptr, result.size);
+            xdl_free(result.ptr);
+            ret = ret > 0;
+        }
+    } else {
+        ret = -1;
+    }
+
+    release_inputs(srv, 3, entries, labels);
+    return ret;
+}
+
+static int do_stats(struct server *srv, struct outbuf *out)
+{
+    struct file_cache *cache = &srv->cache;
+
+    pthread_mutex_lock(&cache->lock);
+    outbuf_printf(out, "entries %ld\nbytes %lu\nhits %lu\nmisses %lu\ngrown %lu\n", cache->nr,
+                  (unsigned long)cache->bytes, cache->hits, cache->misses, cache->grown);
+    pthread_mutex_unlock(&cache->lock);
+    return 0;
+}
+
+/* Answer the requests of one client until it disconnects */
+static void *connection(void *arg)
+{
+    struct connection *c = (struct connection *)arg;
+    struct server *srv = c->srv;
+    struct serve_conn *conn;
+    struct outbuf out, err;
+    char *line, *cmd = NULL;
+
+    if (!(conn = conn_open(c->fd))) {
+        close(c->fd);
+        xdl_free(c);
+        return NULL;
+    }
+    xdl_free(c);
+    outbuf_init_mem(&out);
+    outbuf_init_mem(&err);
+
+    while ((line = conn_line(conn)) != NULL) {
+        struct outbuf *payload;
+        char *options;
+        int ret;
+
+        /* The line is overwritten by the inputs that follow it */
+        free(cmd);
+        if (!(cmd = strdup(line)))
+            break;
+        options = split_field(cmd, '\t');
+        outbuf_reset(&out);
+        outbuf_reset(&err);
+
+        if (!strcmp(cmd, "diff"))
+            ret = do_diff(srv, conn, options ? options : "", &out, &err);
+        else if (!strcmp(cmd, "merge"))
+            ret = do_merge(srv, conn, options ? options : cmd + strlen(cmd), &out, &err);
+        else if (!strcmp(cmd, "stats"))
+            ret = do_stats(srv, &out);
+        else
+            ret = -2;
+
+        if (ret == -2 && !err.len)
+            outbuf_printf(&err, "xdiff: malformed request\n");
+        if (out.error || err.error)
+            ret = ret == -2 ? -2 : -1;
+        payload = ret < 0 ? &err : &out;
+        outbuf_printf(&conn->wr, "%d %lu\n", ret < 0 ? 2 : ret, (unsigned long)payload->len);
+        outbuf_write(&conn->wr, payload->buf, payload->len);
+        if (outbuf_flush(&conn->wr) < 0 || ret == -2)
+            break;
+    }
+
+    free(cmd);
+    outbuf_release(&out);
+    outbuf_release(&err);
+    serve_close(conn);
+    return NULL;
+}
+
+int serve(const char *path, long cache_size, serve_parse_fn parse, serve_diff_fn diff, void *priv,
+          struct outbuf *err)
+{
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    struct server *srv;
+    struct stat st;
+    pthread_attr_t attr;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        outbuf_printf(err, "xdiff: socket path too long: %s\n", path);
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        outbuf_printf(err, "xdiff: cannot create socket: %s\n", strerror(errno));
+        return -1;
+    }
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        /* Reuse the path of a dead server, but never steal a live one */
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            outbuf_printf(err, "xdiff: socket '%s' is already in use\n", path);
+            close(fd);
+            return -1;
+        }
+        unlink(path);
+    }
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        outbuf_printf(err, "xdiff: cannot listen on '%s': %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    /*
+     * Connection threads may still be running when the server stops,
+     * so the shared state is deliberately never freed.
+     */
+    if (!(srv = (struct server *)xdl_malloc(sizeof(*srv)))) {
+        outbuf_printf(err, "xdiff: out of memory\n");
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    memset(srv, 0, sizeof(*srv));
+    pthread_mutex_init(&srv->cache.lock, NULL);
+    pthread_mutex_init(&srv->parse_lock, NULL);
+    srv->cache.limit = cache_size;
+    srv->parse = parse;
+    srv->diff = diff;
+    srv->priv = priv;
+
+    /* Interrupt accept() rather than restarting it */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    while (!stop_serving) {
+        struct connection *c;
+        pthread_t thread;
+        int cfd = accept(fd, NULL, NULL);
+
+        if (cfd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            outbuf_printf(err, "xdiff: accept failed: %s\n", strerror(errno));
+            break;
+        }
+        if (!(c = (struct connection *)xdl_malloc(sizeof(*c)))) {
+            close(cfd);
+            continue;
+        }
+        c->srv = srv;
+        c->fd = cfd;
+        if (pthread_create(&thread, &attr, connection, c) != 0) {
+            close(cfd);
+            xdl_free(c);
+        }
+    }
+    pthread_attr_destroy(&attr);
+
+    close(fd);
+    unlink(path);
+    return 0;
+}
+
+struct serve_conn *serve_connect(const char *path, struct outbuf *err)
+{
+    struct sockaddr_un addr;
+    struct serve_conn *conn;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        outbuf_printf(err, "xdiff: socket path too long: %s\n", path);
+        return NULL;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+        connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        outbuf_printf(err, "xdiff: cannot connect to '%s': %s\n", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+    if (!(conn = conn_open(fd))) {
+        outbuf_printf(err, "xdiff: out of memory\n");
+        close(fd);
+    }
+    return conn;
+}
+
+int serve_request(struct serve_conn *conn, const char *command, const char *options,
+                  const struct serve_input *inputs, int nr, struct outbuf *payload)
+{
+    char *line, *end;
+    long status, size;
+    int i;
+
+    outbuf_puts(&conn->wr, command);
+    if (options) {
+        outbuf_putc(&conn->wr, '\t');
+        outbuf_puts(&conn->wr, options);
+    }
+    outbuf_putc(&conn->wr, '\n');
+    for (i = 0; i < nr; i++) {
+        const struct serve_input *in = &inputs[i];
+
+        if (in->path)
+            outbuf_printf(&conn->wr, "path\t%s", in->path);
+        else
+            outbuf_printf(&conn->wr, "data\t%ld", in->size);
+        if (in->label)
+            outbuf_printf(&conn->wr, "\t%s", in->label);
+        outbuf_putc(&conn->wr, '\n');
+        if (!in->path)
+            outbuf_write(&conn->wr, in->data, in->size);
+    }
+    if (outbuf_flush(&conn->wr) < 0)
+        return -1;
+
+    if (!(line = conn_line(conn)))
+        return -1;
+    status = strtol(line, &end, 10);
+    if (*end != ' ' || status < 0 || status > 2)
+        return -1;
+    size = strtol(end + 1, &end, 10);
+    if (*end || size < 0)
+        return -1;
+
+    /* Hand over what is already buffered, then read straight into the payload */
+    while (size) {
+        long n;
+
+        if (conn->pos == conn->len && conn_fill(conn) < 0)
+            return -1;
+        n = XDL_MIN(size, (long)(conn->len - conn->pos));
+        outbuf_write(payload, conn->buf + conn->pos, n);
+        conn->pos += n;
+        size -= n;
+    }
+    return (int)status;
+}
@@ -0,0 +1,94 @@
+/*
+ * xdiff-serve.h - Diff server for xdiff over a Unix domain socket
+ * Keeps prepared files in an LRU cache across requests
+ */
+
+#ifndef XDIFF_SERVE_H
+#define XDIFF_SERVE_H
+
+#include "xdiff-outbuf.h"
+#include "xdiff.h"
+
+/*
+ * Protocol
+ *
+ * A connection carries any number of requests, answered in order. A
+ * request is a command line followed by its inputs:
+ *
+ *   diff<TAB>OPTIONS          two inputs: old and new file
+ *   merge<TAB>OPTIONS         three inputs: base, ours and theirs
+ *   stats                     no input; reports the cache counters
+ *
+ * Each input is either a file on the server side or inline content:
+ *
+ *   path<TAB>PATH[<TAB>LABEL]
+ *   data<TAB>SIZE[<TAB>LABEL] followed by SIZE bytes
+ *
+ * The answer is a line "STATUS SIZE" followed by SIZE bytes of payload.
+ * STATUS is 0 if the files are identical or merged cleanly, 1 if they
+ * differ or the merge has conflicts and 2 on error, in which case the
+ * payload holds the diagnostics.
+ */
+
+/* Default capacity of the prepared file cache */
+#define SERVE_CACHE_SIZE (256L * 1024 * 1024)
+
+/* One input of a request */
+struct serve_file {
+    const char *name;          /* Label used in the output */
+    mmfile_t *mf;              /* Content, owned by the cache */
+    xdlindex_t const *index;   /* Line index of the content */
+};
+
+/*
+ * Parse the options of a diff request into 'data', which is freed with
+ * xdl_free(), and report the whitespace flags they select so that the
+ * matching line index can be used. Calls are serialized, so the
+ * callback does not need to be reentrant. Returns a negative value
+ * after writing a diagnostic to 'err' if the options are invalid.
+ */
+typedef int (*serve_parse_fn)(const char *options, void **data, unsigned long *flags,
+                              struct outbuf *err, void *priv);
+
+/*
+ * Answer a diff request; same contract as dir_diff_fn. May run
+ * concurrently on several threads.
+ */
+typedef int (*serve_diff_fn)(void *data, const struct serve_file *file1,
+                             const struct serve_file *file2, struct outbuf *out, struct outbuf *err,
+                             void *priv);
+
+/*
+ * Listen on the socket at 'path' and answer requests until SIGINT or
+ * SIGTERM, keeping up to 'cache_size' bytes of prepared files. Returns
+ * a negative value if the socket cannot be set up, 0 otherwise.
+ */
+int serve(const char *path, long cache_size, serve_parse_fn parse, serve_diff_fn diff, void *priv,
+          struct outbuf *err);
+
+/* Client side of a connection */
+struct serve_conn;
+
+/* One input sent by a client: a server-side path or inline content */
+struct serve_input {
+    const char *path; /* Path on the server, or NULL to send 'data' */
+    const char *data;
+    long size;
+    const char *label; /* Label used in the output, or NULL */
+};
+
+/* Connect to a server; returns NULL after writing a diagnostic to 'err' */
+struct serve_conn *serve_connect(const char *path, struct outbuf *err);
+
+/*
+ * Send one request and wait for its answer, which is appended to
+ * 'payload'. Returns the status of the answer, or -1 if the connection
+ * failed.
+ */
+int serve_request(struct serve_conn *conn, const char *command, const char *options,
+                  const struct serve_input *inputs, int nr, struct outbuf *payload);
+
+/* Close a connection */
+void serve_close(struct serve_conn *conn);
+
+#endif /* XDIFF_SERVE_H */
@@ -0,0 +1,928 @@
+/*
+ * xdiff-stream.c - Bounded-memory comparison of large files for xdiff
+ * Cuts both files into windows at common anchor lines and diffs each window
+ */
+
+#include "xdiff-stream.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "xinclude.h"
+
+/*
+ * Share of the memory budget given to the window of each file: both
+ * windows are diffed at STREAM_BYTES_FACTOR, and the text emitted for a
+ * window pair and a hunk kept open take about four windows more
+ */
+#define STREAM_WINDOW_SHARE (2 * STREAM_BYTES_FACTOR + 4)
+
+/* Smallest window, in bytes */
+#define STREAM_WINDOW_MIN (64 * 1024)
+
+/* Windows read past a window looking for where the other one resumes */
+#define STREAM_PROBE_WINDOWS 8
+
+/* Matching lines that make a unique match an anchor */
+#define STREAM_ANCHOR_LINES 3
+
+/* Consecutive lines that have to match for the other window to resume */
+#define STREAM_PROBE_LINES 8
+
+/* Window over one input file */
+struct stream_file {
+    const char *path;
+    int fd;
+    char *buf;
+    long len;    /* Bytes in buf */
+    long alloc;  /* Capacity of buf */
+    int eof;     /* The rest of the file is in buf */
+    off_t pos;   /* File offset of the end of buf */
+    long *lines; /* Start of each line in buf, then the end of the last one */
+    long nr;     /* Lines in buf */
+    long lalloc;
+};
+
+/* Hunk of a window pair as emitted by xdl_emit_diff(), in lines of the windows */
+struct window_hunk {
+    long s1, n1; /* First line, from 0, and line count in each window */
+    long s2, n2;
+    long lead;   /* Context lines before the first change */
+    long trail;  /* Context lines after the last change */
+    size_t func; /* Function name in the text of the window pair */
+    long funclen;
+    size_t body;        /* Lines of the hunk in the text */
+    size_t minus_end;   /* End of the deleted lines starting the body */
+    size_t plus_start;  /* Start of the inserted lines ending the last change */
+    size_t changes_end; /* End of the last changed line in the text */
+    size_t end;
+};
+
+/* Output of xdl_emit_diff() for one window pair */
+struct window_diff {
+    struct window_hunk *hunks;
+    long nr;
+    long alloc;
+    struct outbuf text;
+    size_t run_start; /* End of the last line in the text that is not inserted */
+};
+
+/*
+ * Hunk whose end is not known yet, and how finished hunks reach the
+ * callbacks of the caller. A hunk stays open while its last change is
+ * too close to the end of the window to tell where it stops.
+ */
+struct hunk_emitter {
+    xdemitcb_t *ecb;
+    long ctxlen;
+    long spill_limit; /* Hunk bytes kept in memory before spilling */
+    int error;        /* A callback or the temporary file failed */
+    int open;         /* A hunk is being collected */
+    long s1, n1;      /* First line, from 0, and line count in each file */
+    long s2, n2;
+    struct outbuf func;
+    struct outbuf body;
+    struct outbuf plus; /* Inserted lines ending the open hunk, kept after later deletions */
+    FILE *spill;        /* Body of a hunk too large for memory */
+    struct outbuf ring; /* Up to ctxlen lines before the windows, as context */
+    struct outbuf swap;
+    long *ring_lines; /* Start of each line in ring, then the end of the last one */
+    long ring_nr;
+};
+
+/* Slot of the table matching the lines of both windows */
+struct anchor_slot {
+    unsigned long ha;
+    long a, b;   /* Last line with this content in each window */
+    long na, nb; /* Occurrences in each window */
+};
+
+/* Record the header of a hunk of the window pair */
+static int window_hunk_cb(void *priv, long old_begin, long old_nr, long new_begin, long new_nr,
+                          const char *func, long funclen)
+{
+    struct window_diff *wd = (struct window_diff *)priv;
+    struct window_hunk *h;
+
+    if (XDL_ALLOC_GROW(wd->hunks, wd->nr + 1, wd->alloc))
+        return -1;
+    h = &wd->hunks[wd->nr++];
+    memset(h, 0, sizeof(*h));
+    h->s1 = old_nr ? old_begin - 1 : old_begin;
+    h->n1 = old_nr;
+    h->s2 = new_nr ? new_begin - 1 : new_begin;
+    h->n2 = new_nr;
+    h->func = wd->text.len;
+    h->funclen = funclen;
+    if (funclen > 0)
+        outbuf_write(&wd->text, func, funclen);
+    h->body = h->minus_end = h->plus_start = h->changes_end = h->end = wd->text.len;
+    wd->run_start = wd->text.len;
+    return wd->text.error ? -1 : 0;
+}
+
+/* Record one line of the last hunk, as given by xdl_emit_diffrec() */
+static int window_line_cb(void *priv, mmbuffer_t *mb, int nb)
+{
+    struct window_diff *wd = (struct window_diff *)priv;
+    struct window_hunk *h = &wd->hunks[wd->nr - 1];
+    size_t start = wd->text.len;
+    int i;
+
+    for (i = 0; i < nb; i++)
+        outbuf_write(&wd->text, mb[i].ptr, mb[i].size);
+    if (mb[0].ptr[0] == ' ') {
+        if (h->changes_end == h->body)
+            h->lead++;
+        h->trail++;
+        wd->run_start = wd->text.len;
+    } else {
+        if (mb[0].ptr[0] == '-') {
+            if (h->minus_end == start)
+                h->minus_end = wd->text.len;
+            wd->run_start = wd->text.len;
+        }
+        h->plus_start = wd->run_start;
+        h->changes_end = wd->text.len;
+        h->trail = 0;
+    }
+    h->end = wd->text.len;
+    return wd->text.error ? -1 : 0;
+}
+
+static int text_line_cb(void *priv, mmbuffer_t *mb, int nb)
+{
+    int i;
+
+    for (i = 0; i < nb; i++)
+        outbuf_write((struct outbuf *)priv, mb[i].ptr, mb[i].size);
+    return 0;
+}
+
+/* Add line 'i' of 'sf' as context to 'ob' */
+static void context_line(struct outbuf *ob, struct stream_file *sf, long i)
+{
+    xdemitcb_t ecb;
+
+    memset(&ecb, 0, sizeof(ecb));
+    ecb.priv = ob;
+    ecb.out_line = text_line_cb;
+    xdl_emit_diffrec(sf->buf + sf->lines[i], sf->lines[i + 1] - sf->lines[i], " ", 1, &ecb);
+}
+
+static void ring_reset(struct hunk_emitter *e)
+{
+    outbuf_reset(&e->ring);
+    e->ring_nr = 0;
+}
+
+/*
+ * Keep the last lines up to 'to' of the window of the second file,
+ * from 'from' on, as the leading context of a hunk starting the next
+ * window
+ */
+static void ring_save(struct hunk_emitter *e, struct stream_file *sf, long from, long to)
+{
+    long n = XDL_MIN(e->ctxlen, to - from), old = XDL_MIN(e->ring_nr, e->ctxlen - n), i;
+    long off = e->ring_lines[e->ring_nr - old];
+    struct outbuf tmp;
+
+    outbuf_reset(&e->swap);
+    outbuf_write(&e->swap, e->ring.buf + off, e->ring.len - off);
+    for (i = 0; i <= old; i++)
+        e->ring_lines[i] = e->ring_lines[e->ring_nr - old + i] - off;
+    for (i = 0; i < n; i++) {
+        context_line(&e->swap, sf, to - n + i);
+        e->ring_lines[old + i + 1] = (long)e->swap.len;
+    }
+    tmp = e->ring;
+    e->ring = e->swap;
+    e->swap = tmp;
+    e->ring_nr = old + n;
+    if (e->ring.error)
+        e->error = 1;
+}
+
+static void emit_add(struct hunk_emitter *e, const char *ptr, size_t size)
+{
+    outbuf_write(&e->body, ptr, size);
+    if ((long)e->body.len <= e->spill_limit)
+        return;
+    if (!e->spill && !(e->spill = tmpfile())) {
+        e->error = 1;
+        return;
+    }
+    if (fwrite(e->body.buf, 1, e->body.len, e->spill) != e->body.len)
+        e->error = 1;
+    outbuf_reset(&e->body);
+}
+
+/* Move the inserted lines ending the open hunk into its body */
+static void emit_flush(struct hunk_emitter *e)
+{
+    emit_add(e, e->plus.buf, e->plus.len);
+    outbuf_reset(&e->plus);
+}
+
+static void emit_plus(struct hunk_emitter *e, const char *ptr, size_t size)
+{
+    outbuf_write(&e->plus, ptr, size);
+    if ((long)e->plus.len > e->spill_limit)
+        emit_flush(e);
+}
+
+static int emit_add_cb(void *priv, mmbuffer_t *mb, int nb)
+{
+    int i;
+
+    for (i = 0; i < nb; i++)
+        emit_add((struct hunk_emitter *)priv, mb[i].ptr, mb[i].size);
+    return 0;
+}
+
+/* Add line 'i' of the window of the second file as context */
+static void emit_context(struct hunk_emitter *e, struct stream_file *sf, long i)
+{
+    xdemitcb_t ecb;
+
+    memset(&ecb, 0, sizeof(ecb));
+    ecb.priv = e;
+    ecb.out_line = emit_add_cb;
+    xdl_emit_diffrec(sf->buf + sf->lines[i], sf->lines[i + 1] - sf->lines[i], " ", 1, &ecb);
+}
+
+static void emit_open(struct hunk_emitter *e, long s1, long s2, const char *func, long funclen)
+{
+    e->open = 1;
+    e->s1 = s1;
+    e->s2 = s2;
+    e->n1 = e->n2 = 0;
+    outbuf_reset(&e->func);
+    if (funclen > 0)
+        outbuf_write(&e->func, func, funclen);
+}
+
+static void emit_text(struct hunk_emitter *e, const char *ptr, size_t size)
+{
+    mmbuffer_t mb;
+
+    mb.ptr = (char *)ptr;
+    mb.size = (long)size;
+    if (size && e->ecb->out_line(e->ecb->priv, &mb, 1) < 0)
+        e->error = 1;
+}
+
+/* Hand the hunk to the callbacks of the caller */
+static void emit_close(struct hunk_emitter *e)
+{
+    char chunk[8192];
+    size_t n;
+
+    emit_flush(e);
+    if (e->ecb->out_hunk(e->ecb->priv, e->n1 ? e->s1 + 1 : e->s1, e->n1,
+                         e->n2 ? e->s2 + 1 : e->s2, e->n2, e->func.buf, (long)e->func.len) < 0)
+        e->error = 1;
+    if (e->spill) {
+        rewind(e->spill);
+        while ((n = fread(chunk, 1, sizeof(chunk), e->spill)) > 0)
+            emit_text(e, chunk, n);
+        if (ferror(e->spill))
+            e->error = 1;
+        fclose(e->spill);
+        e->spill = NULL;
+    }
+    emit_text(e, e->body.buf, e->body.len);
+    outbuf_reset(&e->body);
+    e->open = 0;
+}
+
+/* Read until the window is full or the file ends */
+static int read_window(struct stream_file *sf)
+{
+    while (!sf->eof && sf->len < sf->alloc) {
+        ssize_t n = read(sf->fd, sf->buf + sf->len, sf->alloc - sf->len);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+            sf->eof = 1;
+        sf->len += n;
+        sf->pos += n;
+    }
+    return 0;
+}
+
+/*
+ * Read until the window is full or the file ends and index its lines.
+ * A line longer than the window grows it.
+ */
+static int fill(struct stream_file *sf)
+{
+    for (;;) {
+        char *p, *end;
+
+        if (read_window(sf) < 0)
+            return -1;
+
+        sf->nr = 0;
+        if (XDL_ALLOC_GROW(sf->lines, 1, sf->lalloc))
+            goto nomem;
+        sf->lines[0] = 0;
+        for (p = sf->buf, end = sf->buf + sf->len;
+             p < end && (p = (char *)memchr(p, '\n', end - p)) != NULL;) {
+            p++;
+            if (XDL_ALLOC_GROW(sf->lines, sf->nr + 2, sf->lalloc))
+                goto nomem;
+            sf->lines[++sf->nr] = p - sf->buf;
+        }
+        if (sf->eof && sf->lines[sf->nr] < sf->len) {
+            if (XDL_ALLOC_GROW(sf->lines, sf->nr + 2, sf->lalloc))
+                goto nomem;
+            sf->lines[++sf->nr] = sf->len;
+        }
+        if (sf->nr || sf->eof)
+            return 0;
+
+        if (!(p = (char *)xdl_realloc(sf->buf, sf->alloc * 2)))
+            goto nomem;
+        sf->buf = p;
+        sf->alloc *= 2;
+    }
+
+nomem:
+    errno = ENOMEM;
+    return -1;
+}
+
+/* Drop the first 'off' bytes of the window */
+static void drop(struct stream_file *sf, long off)
+{
+    memmove(sf->buf, sf->buf + off, sf->len - off);
+    sf->len -= off;
+}
+
+/* Drop the first 'k' lines of the window */
+static void consume(struct stream_file *sf, long k)
+{
+    drop(sf, sf->lines[k]);
+}
+
+/*
+ * Compare the rest of two files byte for byte, without splitting them
+ * into lines. Returns 1 if they are the same, 0 if not and -1 on a
+ * read error, with 'bad' set to the file that failed.
+ */
+static int same_bytes(struct stream_file *a, struct stream_file *b, struct stream_file **bad)
+{
+    for (;;) {
+        long n = XDL_MIN(a->len, b->len);
+
+        if (memcmp(a->buf, b->buf, n))
+            return 0;
+        drop(a, n);
+        drop(b, n);
+        *bad = read_window(a) < 0 ? a : read_window(b) < 0 ? b : NULL;
+        if (*bad)
+            return -1;
+        if (!a->len || !b->len)
+            return a->len == b->len;
+    }
+}
+
+static unsigned long line_hash(struct stream_file *sf, long i, unsigned long flags)
+{
+    char const *ptr = sf->buf + sf->lines[i];
+
+    return xdl_hash_record(&ptr, sf->buf + sf->lines[i + 1], flags);
+}
+
+static int line_match(struct stream_file *sf1, long i, struct stream_file *sf2, long j,
+                      unsigned long flags)
+{
+    return xdl_recmatch(sf1->buf + sf1->lines[i], sf1->lines[i + 1] - sf1->lines[i],
+                        sf2->buf + sf2->lines[j], sf2->lines[j + 1] - sf2->lines[j], flags);
+}
+
+/*
+ * Whether a unique match is preceded by matching lines too, or starts
+ * both windows; a lone match is too often a coincidence in files whose
+ * lines repeat.
+ */
+static int anchored(struct stream_file *a, long i, struct stream_file *b, long j,
+                    unsigned long flags)
+{
+    long k;
+
+    for (k = 1; k < STREAM_ANCHOR_LINES; k++) {
+        if (i < k || j < k)
+            return i == j;
+        if (!line_match(a, i - k, b, j - k, flags))
+            return 0;
+    }
+    return 1;
+}
+
+/* Find the slot of line 'i' of 'sf', or the empty slot it belongs in */
+static long find_slot(struct anchor_slot *tab, long mask, struct stream_file *a,
+                      struct stream_file *b, struct stream_file *sf, long i, unsigned long ha,
+                      unsigned long flags)
+{
+    long s;
+
+    for (s = ha & mask;; s = (s + 1) & mask) {
+        struct anchor_slot *slot = &tab[s];
+
+        if (!slot->na && !slot->nb)
+            return s;
+        if (slot->ha == ha && (slot->na ? line_match(a, slot->a, sf, i, flags)
+                                        : line_match(b, slot->b, sf, i, flags)))
+            return s;
+    }
+}
+
+/* Search state of probe(): the last STREAM_PROBE_LINES lines seen */
+struct probe_state {
+    unsigned long target[STREAM_PROBE_LINES];
+    unsigned long seen[STREAM_PROBE_LINES];
+    long start[STREAM_PROBE_LINES]; /* Distance of each seen line */
+    long nr;                        /* Lines in target */
+    long count;                     /* Lines seen so far */
+};
+
+/* Add one line at 'dist' bytes; returns whether the target ends there */
+static int probe_line(struct probe_state *ps, const char *ptr, const char *top, long dist,
+                      unsigned long flags)
+{
+    long slot = ps->count++ % ps->nr, i;
+
+    ps->seen[slot] = xdl_hash_record(&ptr, top, flags);
+    ps->start[slot] = dist;
+    if (ps->count < ps->nr)
+        return 0;
+    for (i = 0; i < ps->nr; i++)
+        if (ps->seen[(ps->count + i) % ps->nr] != ps->target[i])
+            return 0;
+    return 1;
+}
+
+/*
+ * Find where the first lines of the window of 'sf' occur next in
+ * 'other', from the start of its window and up to STREAM_PROBE_WINDOWS
+ * windows past it, read without being kept. Returns the distance in
+ * bytes and sets '*line' to the line of the window it is at, or -1 past
+ * the window; returns -1 if not found and -2 if out of memory.
+ */
+static long probe(struct stream_file *sf, struct stream_file *other, unsigned long flags,
+                  long *line)
+{
+    struct probe_state ps;
+    long window = other->alloc, done = 0, have = 0, found = -1, i;
+    char *scratch;
+
+    memset(&ps, 0, sizeof(ps));
+    ps.nr = XDL_MIN(sf->nr, STREAM_PROBE_LINES);
+    for (i = 0; i < ps.nr; i++)
+        ps.target[i] = line_hash(sf, i, flags);
+
+    for (i = 0; i < other->nr; i++) {
+        if (probe_line(&ps, other->buf + other->lines[i], other->buf + other->lines[i + 1],
+                       other->lines[i], flags)) {
+            *line = i + 1 - ps.nr;
+            return ps.start[ps.count % ps.nr];
+        }
+    }
+    if (other->eof)
+        return -1;
+
+    /* Carry on past the window, from the start of its partial last line */
+    *line = -1;
+    if (!(scratch = (char *)xdl_malloc(window)))
+        return -2;
+    done = other->lines[other->nr];
+    while (done < window * (STREAM_PROBE_WINDOWS + 1)) {
+        off_t off = other->pos - other->len + done + have;
+        ssize_t n = off < other->pos ? (ssize_t)XDL_MIN(other->pos - off, window - have)
+                                     : pread(other->fd, scratch + have, window - have, off);
+        char *p = scratch, *end, *nl;
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        if (off < other->pos)
+            memcpy(scratch + have, other->buf + (other->len - (other->pos - off)), n);
+        for (end = scratch + have + n; (nl = (char *)memchr(p, '\n', end - p)) != NULL;
+             p = nl + 1) {
+            if (probe_line(&ps, p, nl + 1, done + (p - scratch), flags)) {
+                found = ps.start[ps.count % ps.nr];
+                goto out;
+            }
+        }
+        /* A line longer than a window ends the search */
+        if (p == scratch && end - scratch == window)
+            break;
+        have = end - p;
+        memmove(scratch, p, have);
+        done += p - scratch;
+    }
+
+out:
+    xdl_free(scratch);
+    return found;
+}
+
+/*
+ * With no line to line up on, guess whether the windows start with an
+ * insertion, a deletion or a replacement by looking for the first
+ * lines of each window in the other file. The side whose lines resume
+ * at the shorter distance is kept and the other one is taken up to
+ * there.
+ */
+static int guess_cut(struct stream_file *a, struct stream_file *b, unsigned long flags, long *ka,
+                     long *kb)
+{
+    long la, lb;
+    long da = probe(a, b, flags, &la), db = probe(b, a, flags, &lb);
+
+    if (da == -2 || db == -2)
+        return -1;
+
+    if (da == 0 || db == 0) {
+        /* Already lined up, only on lines repeated too often */
+        *ka = (a->nr + 1) / 2;
+        *kb = (b->nr + 1) / 2;
+    } else if (da > 0 && (db < 0 || da <= db)) {
+        /* The second file has lines inserted before the first resumes */
+        *ka = 0;
+        *kb = la > 0 ? la : b->nr;
+    } else if (db > 0) {
+        *ka = lb > 0 ? lb : a->nr;
+        *kb = 0;
+    } else {
+        *ka = (a->nr + 1) / 2;
+        *kb = (b->nr + 1) / 2;
+    }
+    return 0;
+}
+
+/*
+ * Choose how many lines of each window to diff next: up to and
+ * including the last line of the longest in-order chain of lines that
+ * are unique in both windows, or what guess_cut() makes of windows
+ * without such lines. Returns -1 if out of memory.
+ */
+static int find_cut(struct stream_file *a, struct stream_file *b, unsigned long flags, long *ka,
+                    long *kb)
+{
+    struct anchor_slot *tab = NULL;
+    long *slot_of = NULL, *pa = NULL, *pb = NULL, *tails = NULL, *prev = NULL;
+    long size = 2, mask, i, npairs = 0, len = 0;
+    int ret = -1;
+
+    if (!a->nr || !b->nr) {
+        *ka = a->nr;
+        *kb = b->nr;
+        return 0;
+    }
+
+    while (size < 2 * (a->nr + b->nr))
+        size *= 2;
+    mask = size - 1;
+    if (!XDL_CALLOC_ARRAY(tab, size) || !XDL_ALLOC_ARRAY(slot_of, a->nr))
+        goto out;
+
+    for (i = 0; i < a->nr; i++) {
+        unsigned long ha = line_hash(a, i, flags);
+        long s = find_slot(tab, mask, a, b, a, i, ha, flags);
+
+        tab[s].ha = ha;
+        tab[s].a = i;
+        tab[s].na++;
+        slot_of[i] = s;
+    }
+    for (i = 0; i < b->nr; i++) {
+        unsigned long ha = line_hash(b, i, flags);
+        long s = find_slot(tab, mask, a, b, b, i, ha, flags);
+
+        tab[s].ha = ha;
+        tab[s].b = i;
+        tab[s].nb++;
+    }
+
+    /* Unique matches in the order of the first window */
+    if (!XDL_ALLOC_ARRAY(pa, a->nr) || !XDL_ALLOC_ARRAY(pb, a->nr) ||
+        !XDL_ALLOC_ARRAY(tails, a->nr) || !XDL_ALLOC_ARRAY(prev, a->nr))
+        goto out;
+    for (i = 0; i < a->nr; i++) {
+        struct anchor_slot *slot = &tab[slot_of[i]];
+
+        if (slot->na == 1 && slot->nb == 1 && anchored(a, i, b, slot->b, flags)) {
+            pa[npairs] = i;
+            pb[npairs++] = slot->b;
+        }
+    }
+    if (!npairs) {
+        ret = guess_cut(a, b, flags, ka, kb);
+        goto out;
+    }
+    xdl_free(tab);
+    tab = NULL;
+
+    /* Longest chain increasing in the second window too */
+    for (i = 0; i < npairs; i++) {
+        long lo = 0, hi = len;
+
+        while (lo < hi) {
+            long mid = (lo + hi) / 2;
+
+            if (pb[tails[mid]] < pb[i])
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        prev[i] = lo ? tails[lo - 1] : -1;
+        tails[lo] = i;
+        if (lo == len)
+            len++;
+    }
+
+    *ka = pa[tails[len - 1]] + 1;
+    *kb = pb[tails[len - 1]] + 1;
+    ret = 0;
+
+out:
+    xdl_free(tab);
+    xdl_free(slot_of);
+    xdl_free(pa);
+    xdl_free(pb);
+    xdl_free(tails);
+    xdl_free(prev);
+    return ret;
+}
+
+/* Diff the first 'ka' and 'kb' lines of the windows into 'wd' */
+static int diff_window(struct stream_file *a, long ka, struct stream_file *b, long kb,
+                       unsigned long flags, xdemitconf_t const *xecfg, struct window_diff *wd)
+{
+    mmfile_t mf1, mf2;
+    xpparam_t xpp;
+    xdemitcb_t ecb;
+
+    mf1.ptr = a->buf;
+    mf1.size = a->lines[ka];
+    mf2.ptr = b->buf;
+    mf2.size = b->lines[kb];
+    memset(&xpp, 0, sizeof(xpp));
+    xpp.flags = flags;
+    memset(&ecb, 0, sizeof(ecb));
+    ecb.priv = wd;
+    ecb.out_hunk = window_hunk_cb;
+    ecb.out_line = window_line_cb;
+
+    wd->nr = 0;
+    outbuf_reset(&wd->text);
+    return xdl_diff(&mf1, &mf2, &xpp, xecfg, &ecb);
+}
+
+/*
+ * Pass the hunks of a window pair to the emitter. The last hunk stays
+ * open unless the window pair is the last one or is followed by more
+ * than twice the context of equal lines, which no later change can
+ * join. Sets '*k1' and '*k2' to the lines of the windows the next
+ * window pair starts after: the end of the last change of an open
+ * hunk, or else the end of the windows.
+ */
+static void emit_window(struct hunk_emitter *e, struct window_diff *wd, struct stream_file *b,
+                        long ka, long kb, long ctxlen, long base1, long base2, int last, long *k1,
+                        long *k2)
+{
+    long end1 = 0, end2 = 0, i, j;
+
+    if (e->open && (!wd->nr || wd->hunks[0].s1 + wd->hunks[0].lead > 2 * ctxlen)) {
+        emit_flush(e);
+        for (j = 0; j < XDL_MIN(ctxlen, XDL_MIN(ka, kb)); j++)
+            emit_context(e, b, j);
+        e->n1 += j;
+        e->n2 += j;
+        emit_close(e);
+        end1 = end2 = j;
+        ring_reset(e);
+    }
+    for (i = 0; i < wd->nr; i++) {
+        struct window_hunk *h = &wd->hunks[i];
+        long e1 = h->s1 + h->n1 - h->trail, e2 = h->s2 + h->n2 - h->trail;
+        size_t from = h->body;
+
+        if (e->open && !h->s1 && !h->s2 && !h->lead) {
+            /* The change goes on, its deleted lines before the inserted ones */
+            emit_add(e, wd->text.buf + h->body, h->minus_end - h->body);
+            from = h->minus_end;
+            if (from < h->plus_start)
+                emit_flush(e);
+        } else if (e->open) {
+            /* Joined by the equal lines starting the windows */
+            emit_flush(e);
+            for (j = 0; j < h->s2; j++)
+                emit_context(e, b, j);
+            e->n1 += h->s1;
+            e->n2 += h->s2;
+        } else if (h->lead < ctxlen && !h->s1 && !h->s2 && e->ring_nr) {
+            /* Leading context from the windows before */
+            long r = XDL_MIN(e->ring_nr, ctxlen - h->lead), off = e->ring_lines[e->ring_nr - r];
+
+            emit_open(e, base1 - r, base2 - r, wd->text.buf + h->func, h->funclen);
+            emit_add(e, e->ring.buf + off, e->ring.len - off);
+            e->n1 += r;
+            e->n2 += r;
+        } else {
+            emit_open(e, base1 + h->s1, base2 + h->s2, wd->text.buf + h->func, h->funclen);
+        }
+        emit_add(e, wd->text.buf + from, h->plus_start - from);
+        e->n1 += e1 - h->s1;
+        e->n2 += e2 - h->s2;
+
+        if (last || i + 1 < wd->nr || (ka - e1 > 2 * ctxlen && kb - e2 > 2 * ctxlen)) {
+            emit_flush(e);
+            emit_add(e, wd->text.buf + h->plus_start, h->end - h->plus_start);
+            e->n1 += h->trail;
+            e->n2 += h->trail;
+            emit_close(e);
+            end1 = h->s1 + h->n1;
+            end2 = h->s2 + h->n2;
+            ring_reset(e);
+        } else {
+            emit_plus(e, wd->text.buf + h->plus_start, h->changes_end - h->plus_start);
+            end1 = e1;
+            end2 = e2;
+        }
+    }
+
+    if (e->open) {
+        *k1 = end1;
+        *k2 = end2;
+        return;
+    }
+    ring_save(e, b, end2, kb);
+    *k1 = ka;
+    *k2 = kb;
+}
+
+static int open_file(struct stream_file *sf, const char *path, long window, struct outbuf *err)
+{
+    memset(sf, 0, sizeof(*sf));
+    sf->path = path;
+    if ((sf->fd = open(path, O_RDONLY)) < 0 ||
+        !(sf->buf = (char *)xdl_malloc(sf->alloc = window))) {
+        outbuf_printf(err, "xdiff: cannot read file '%s': %s\n", path,
+                      sf->fd < 0 ? strerror(errno) : "out of memory");
+        return -1;
+    }
+    return 0;
+}
+
+static void close_file(struct stream_file *sf)
+{
+    if (sf->fd >= 0)
+        close(sf->fd);
+    xdl_free(sf->buf);
+    xdl_free(sf->lines);
+}
+
+int diff_stream(const char *file1, const char *file2, const struct stream_options *opts,
+                xdemitconf_t const *xecfg, xdemitcb_t *ecb, struct outbuf *out,
+                struct outbuf *err)
+{
+    struct stream_file a, b;
+    struct window_diff wd;
+    struct hunk_emitter e;
+    xdemitconf_t wcfg;
+    long window = XDL_MAX(opts->max_memory / STREAM_WINDOW_SHARE, STREAM_WINDOW_MIN);
+    long base1 = 0, base2 = 0;
+    int differ = 0, ret = -1;
+
+    memset(&e, 0, sizeof(e));
+    e.ecb = ecb;
+    e.ctxlen = xecfg->ctxlen;
+    e.spill_limit = window;
+    outbuf_init_mem(&e.func);
+    outbuf_init_mem(&e.body);
+    outbuf_init_mem(&e.plus);
+    outbuf_init_mem(&e.ring);
+    outbuf_init_mem(&e.swap);
+    memset(&wd, 0, sizeof(wd));
+    outbuf_init_mem(&wd.text);
+    memset(&b, 0, sizeof(b));
+    b.fd = -1;
+
+    /* Hunks are joined across windows by context line counts */
+    wcfg = *xecfg;
+    wcfg.interhunkctxlen = 0;
+    wcfg.flags &= XDL_EMIT_FUNCNAMES;
+    wcfg.hunk_func = NULL;
+
+    if (open_file(&a, file1, window, err) < 0) {
+        close_file(&a);
+        return -1;
+    }
+    if (open_file(&b, file2, window, err) < 0)
+        goto out;
+    if (!XDL_CALLOC_ARRAY(e.ring_lines, e.ctxlen + 1)) {
+        outbuf_printf(err, "xdiff: out of memory\n");
+        goto out;
+    }
+
+    /* Binary files are only compared byte for byte */
+    if (!opts->text) {
+        struct stream_file *bad = read_window(&a) < 0 ? &a : read_window(&b) < 0 ? &b : NULL;
+        mmfile_t mf1, mf2;
+        int same;
+
+        mf1.ptr = a.buf;
+        mf1.size = a.len;
+        mf2.ptr = b.buf;
+        mf2.size = b.len;
+        if (!bad && (xdl_mmfile_is_binary(&mf1, opts->binary_scan) ||
+                     xdl_mmfile_is_binary(&mf2, opts->binary_scan))) {
+            if ((same = same_bytes(&a, &b, &bad)) == 0)
+                outbuf_printf(out, "%s %s and %s differ\n", opts->brief ? "Files" : "Binary files",
+                              file1, file2);
+            ret = !same;
+        }
+        if (bad) {
+            outbuf_printf(err, "xdiff: cannot read file '%s': %s\n", bad->path,
+                          strerror(errno));
+            ret = -1;
+        }
+        if (bad || ret >= 0)
+            goto out;
+    }
+
+    for (;;) {
+        struct stream_file *bad = fill(&a) < 0 ? &a : fill(&b) < 0 ? &b : NULL;
+        int last = a.eof && b.eof;
+        long ka, kb, k1, k2;
+
+        if (bad) {
+            outbuf_printf(err, "xdiff: cannot read file '%s': %s\n", bad->path,
+                          strerror(errno));
+            goto out;
+        }
+        if (!a.nr && !b.nr)
+            break;
+
+        if (last) {
+            ka = a.nr;
+            kb = b.nr;
+        } else if (find_cut(&a, &b, opts->xpp_flags, &ka, &kb) < 0) {
+            outbuf_printf(err, "xdiff: out of memory\n");
+            goto out;
+        }
+        if (diff_window(&a, ka, &b, kb, opts->xpp_flags, &wcfg, &wd) < 0) {
+            outbuf_printf(err, "xdiff: diff computation failed\n");
+            goto out;
+        }
+        differ |= wd.nr > 0;
+        if (opts->brief && differ)
+            break;
+
+        emit_window(&e, &wd, &b, ka, kb, wcfg.ctxlen, base1, base2, last, &k1, &k2);
+        if (e.error)
+            break;
+        if (last)
+            break;
+        consume(&a, k1);
+        consume(&b, k2);
+        base1 += k1;
+        base2 += k2;
+    }
+
+    if (e.open)
+        emit_close(&e);
+    if (e.error) {
+        outbuf_printf(err, "xdiff: cannot write temporary file: %s\n", strerror(errno));
+        goto out;
+    }
+    if (opts->brief && differ)
+        outbuf_printf(out, "Files %s and %s differ\n", file1, file2);
+    ret = differ;
+
+out:
+    close_file(&a);
+    close_file(&b);
+    if (e.spill)
+        fclose(e.spill);
+    outbuf_release(&e.func);
+    outbuf_release(&e.body);
+    outbuf_release(&e.plus);
+    outbuf_release(&e.ring);
+    outbuf_release(&e.swap);
+    xdl_free(e.ring_lines);
+    xdl_free(wd.hunks);
+    outbuf_release(&wd.text);
+    return ret;
+}
@@ -0,0 +1,50 @@
+/*
+ * xdiff-stream.h - Bounded-memory comparison of large files for xdiff
+ * Cuts both files into windows at common anchor lines and diffs each window
+ */
+
+#ifndef XDIFF_STREAM_H
+#define XDIFF_STREAM_H
+
+#include "xdiff-outbuf.h"
+#include "xdiff.h"
+
+/*
+ * Memory an in-memory diff needs per input byte; inputs larger than the
+ * budget divided by this are compared in windows. The peak is about
+ * twice the input plus 73 bytes a line for the records of
+ * xdl_prepare_env(), which comes to 4.4 on lines of 30 bytes and 8.6 on
+ * lines of 11; lines shorter than that still go over.
+ */
+#define STREAM_BYTES_FACTOR 9
+
+/* Options of a bounded-memory comparison */
+struct stream_options {
+    long max_memory;         /* Bytes to stay within, roughly */
+    unsigned long xpp_flags; /* XDF_* flags of the window diffs */
+    int brief;               /* Only report whether the files differ */
+    int text;                /* Compare binary files line by line too */
+    long binary_scan;        /* Bytes of each file checked for binary content, or 0 for all */
+};
+
+/*
+ * Compare two files while holding only a window of each in memory.
+ * Windows are cut after the last line that is unique in both windows
+ * and in order with the other unique matches, so that most windows
+ * line up with the same region of both files. Each window pair goes
+ * through xdl_diff() with 'xecfg', whose flags other than
+ * XDL_EMIT_FUNCNAMES are ignored, and its hunks reach 'ecb' renumbered
+ * for the whole files, joined with the hunks of the next window pair
+ * where their context meets. A hunk body may reach out_line() in
+ * pieces that do not end at line ends. Where a window pair holds the
+ * whole files, or is cut in a run of equal lines, the hunks are those
+ * of the in-memory comparison; a change that spans a cut may come out
+ * larger. "Binary files ... differ" and, with 'brief', "Files ...
+ * differ" are written to 'out'. Returns a negative value on error, 1 if
+ * the files differ and 0 if they are identical.
+ */
+int diff_stream(const char *file1, const char *file2, const struct stream_options *opts,
+                xdemitconf_t const *xecfg, xdemitcb_t *ecb, struct outbuf *out,
+                struct outbuf *err);
+
+#endif /* XDIFF_STREAM_H */
@@ -42,6 +42,9 @@ extern "C" {
 
 #define XDF_IGNORE_BLANK_LINES (1 << 7)
 
+/* Classify the identical ends of the second file too; for testing, as the output is the same */
+#define XDF_NO_TRIM_COMMON (1 << 8)
+
 #define XDF_PATIENCE_DIFF (1 << 14)
 #define XDF_HISTOGRAM_DIFF (1 << 15)
 #define XDF_DIFF_ALGORITHM_MASK (XDF_PATIENCE_DIFF | XDF_HISTOGRAM_DIFF)
@@ -79,6 +82,87 @@ typedef struct s_mmbuffer {
     long size;
 } mmbuffer_t;
 
+/*
+ * Line index of a buffer: where each line ends and the hash of its
+ * content under a set of whitespace flags. Built once with
+ * xdl_index_build(), it lets repeated diffs against the same buffer
+ * skip splitting and hashing it. xdl_index_append() extends it over the
+ * bytes a growing buffer gained since.
+ */
+typedef struct s_xdlindex {
+    char const *ptr;     /* Buffer the index describes */
+    long size;           /* Size of that buffer */
+    unsigned long flags; /* Whitespace flags the hashes were computed with */
+    long nrec;           /* Number of lines */
+    long *ends;          /* Offset just past each line */
+    unsigned long *ha;   /* Hash of each line */
+    int image;           /* Whether ends and ha point into an image, see xdl_index_load() */
+} xdlindex_t;
+
+/*
+ * Memory allocator. The functions receive 'priv' as their first
+ * argument and follow the contracts of malloc(), realloc() and free().
+ */
+typedef struct s_xdlalloc {
+    void *(*malloc)(void *priv, size_t size);
+    void *(*realloc)(void *priv, void *ptr, size_t size);
+    void (*free)(void *priv, void *ptr);
+    void *priv;
+} xdlalloc_t;
+
+/*
+ * Bump allocator that releases everything it handed out at once. Blocks
+ * are carved from chunks of 'chunk_size' bytes; larger requests get a
+ * chunk of their own. Pass '&arena.alloc' as xpparam_t.alloc.
+ */
+typedef struct s_xdlarena {
+    xdlalloc_t alloc;
+    long chunk_size;
+    struct s_xdlachunk *chunks; /* Chunks in use, the current one first */
+    struct s_xdlachunk *spare;  /* Chunks kept for reuse by xdl_arena_reset() */
+} xdlarena_t;
+
+/* Phases of a diff that xdlmemstats_t accounts memory to */
+#define XDL_MEM_PREPARE 0   /* Reading the records and classifying them */
+#define XDL_MEM_ALGORITHM 1 /* Myers, patience or histogram */
+#define XDL_MEM_SCRIPT 2    /* Compacting changes and building the edit script */
+#define XDL_MEM_EMIT 3      /* Producing the output */
+#define XDL_MEM_PHASES 4
+
+/* Memory usage of one xdl_diff() or xdl_merge() call */
+typedef struct s_xdlmemstats {
+    long allocated[XDL_MEM_PHASES]; /* Bytes allocated during each phase */
+    long peak;                      /* Most bytes in use at once */
+    int degraded;                   /* The budget forced a coarser diff */
+} xdlmemstats_t;
+
+/* Phases of a diff that xdlstats_t times */
+#define XDL_PHASE_PREPARE 0   /* Reading, hashing and classifying the records */
+#define XDL_PHASE_CLEANUP 1   /* Discarding records without a match */
+#define XDL_PHASE_ALGORITHM 2 /* Myers, patience or histogram */
+#define XDL_PHASE_COMPACT 3   /* Sliding changes to nicer boundaries */
+#define XDL_PHASE_SCRIPT 4    /* Building the edit script */
+#define XDL_PHASE_EMIT 5      /* Producing the output, callbacks included */
+#define XDL_PHASES 6
+
+/* What one xdl_diff() or xdl_merge() call did; a merge adds up two diffs */
+typedef struct s_xdlstats {
+    double time[XDL_PHASES];  /* Wall time of each phase, in seconds */
+    long records1, records2;  /* Lines of each file */
+    long classes;             /* Distinct lines */
+    long discarded;           /* Lines the cleanup took out of the algorithm */
+    long buckets;             /* Classifier hash buckets in use */
+    long chain_max;           /* Longest classifier hash chain */
+    long splits;              /* Boxes split by the Myers algorithm */
+    long split_cost;          /* Sum of the edit costs of those splits */
+    long heur_snakes;         /* Splits taken at a long snake before the middle */
+    long cost_cutoffs;        /* Splits cut short at the maximum edit cost */
+    long pinned_runs;         /* Long interior runs matched before the Myers algorithm */
+    long pinned;              /* Records in those runs */
+    long histogram_fallbacks; /* Regions the histogram diff passed to Myers */
+    long patience_fallbacks;  /* Regions the patience diff passed to Myers */
+} xdlstats_t;
+
 typedef struct s_xpparam {
     unsigned long flags;
 
@@ -89,6 +173,36 @@ typedef struct s_xpparam {
     /* See Documentation/diff-options.txt. */
     char **anchors;
     size_t anchors_nr;
+
+    /*
+     * Optional line indexes of the first and second file. An index is
+     * only used when it was built for the very same buffer and
+     * whitespace flags, and is ignored otherwise.
+     */
+    xdlindex_t const *index1;
+    xdlindex_t const *index2;
+
+    /*
+     * Optional allocator for the memory used while the call runs. The
+     * output of xdl_merge() is always allocated with xdl_malloc(). This
+     * and the fields below are per call and are ignored by xdl_incr_new()
+     * and xdl_chain_new().
+     */
+    xdlalloc_t const *alloc;
+
+    /*
+     * Optional cap on the bytes in use at once, 0 for none. Past it
+     * allocations fail; the Myers, patience and histogram algorithms
+     * then all mark the whole differing middle as changed rather than
+     * failing.
+     */
+    long max_memory;
+
+    /* Optional report of the memory the call used */
+    xdlmemstats_t *memstats;
+
+    /* Optional report of where the call spent its time */
+    xdlstats_t *stats;
 } xpparam_t;
 
 typedef struct s_xdemitcb {
@@ -117,12 +231,155 @@ typedef struct s_bdiffparam {
     long bsize;
 } bdiffparam_t;
 
+/* Instruction sets the vector kernels of the library use, for xdl_cpu_features() */
+#define XDL_CPU_SSE2 (1 << 0)
+#define XDL_CPU_AVX2 (1 << 1)
+#define XDL_CPU_AVX512BW (1 << 2)
+
+/*
+ * The XDL_CPU_* instruction sets the library uses: those the CPU and the
+ * operating system support, or none if the environment variable
+ * XDL_FORCE_SCALAR is set to anything but "0". xdl_set_cpu_features()
+ * restricts them to 'mask' for the whole process, 0 forcing the portable
+ * kernels and ~0U allowing all again, and returns the ones now in use.
+ */
+unsigned int xdl_cpu_features(void);
+unsigned int xdl_set_cpu_features(unsigned int mask);
+
 void *xdl_mmfile_first(mmfile_t *mmf, long *size);
+int xdl_index_build(mmfile_t *mf, unsigned long flags, xdlindex_t *index);
+int xdl_index_append(mmfile_t *mf, xdlindex_t *index);
+
+/*
+ * Serialized index, to keep next to a large file that rarely changes.
+ * xdl_index_save() allocates the image with xdl_malloc(). xdl_index_load()
+ * accepts an image, typically mapped from disk, only if it was saved on
+ * the same platform with the same whitespace flags for content with the
+ * same size and checksum as 'mf', is intact itself and has its lines
+ * end at the newlines of 'mf'; the index then points into the image,
+ * which must outlive it.
+ */
+int xdl_index_save(xdlindex_t const *index, mmbuffer_t *image);
+int xdl_index_load(mmfile_t *mf, unsigned long flags, char const *image, long size,
+                   xdlindex_t *index);
+void xdl_index_free(xdlindex_t *index);
 long xdl_mmfile_size(mmfile_t *mmf);
+int xdl_mmfile_is_binary(mmfile_t *mmf, long limit);
+void xdl_arena_init(xdlarena_t *arena, long chunk_size);
+void xdl_arena_reset(xdlarena_t *arena);
+void xdl_arena_free(xdlarena_t *arena);
 
 int xdl_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp, xdemitconf_t const *xecfg,
              xdemitcb_t *ecb);
 
+/*
+ * Diff of a fixed first file against a second one being edited. Each
+ * xdl_incr_edit() splits again only the lines it touches and re-diffs
+ * only the region around them, between unchanged lines, so the cost of
+ * an edit does not grow with the size of the files; xdl_incr_append()
+ * likewise re-diffs only from the last change on when either file
+ * grows, 'mf1' then giving the whole, possibly moved, first file. The
+ * first file's buffer and the regexes of 'xpp' must outlive the object.
+ *
+ * The object keeps memory across calls, so it does not take the
+ * per-call settings of 'xpp': 'index1', 'index2', 'alloc', 'max_memory',
+ * 'memstats' and 'stats' are ignored. All of its memory comes from
+ * xdl_malloc(), no diff is ever degraded for memory and no report is
+ * written.
+ */
+typedef struct s_xdlincr xdlincr_t;
+
+xdlincr_t *xdl_incr_new(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp);
+int xdl_incr_edit(xdlincr_t *inc, long offset, long len, char const *text, long size);
+int xdl_incr_append(xdlincr_t *inc, mmfile_t *mf1, char const *text, long size);
+long xdl_incr_size(xdlincr_t const *inc);
+long xdl_incr_read(xdlincr_t const *inc, long offset, char *dest, long size);
+int xdl_incr_hunks(xdlincr_t const *inc, xdl_emit_hunk_consume_func_t fn, void *priv);
+int xdl_incr_emit(xdlincr_t *inc, xdemitconf_t const *xecfg, xdemitcb_t *ecb);
+void xdl_incr_free(xdlincr_t *inc);
+
+/*
+ * Diffs of successive versions of a file. xdl_chain_new() splits and
+ * hashes every version once and classes the lines of all of them in a
+ * single dictionary, so xdl_chain_diff() of step i, between versions i
+ * and i + 1, starts straight from the classed lines. Different steps
+ * may be diffed at once from several threads. The versions' buffers and
+ * the regexes of 'xpp' must outlive the chain.
+ *
+ * Like xdl_incr_new(), the chain keeps memory across calls, and its
+ * steps may run at once, so 'index1', 'index2', 'alloc', 'max_memory',
+ * 'memstats' and 'stats' of 'xpp' are ignored: memory comes from
+ * xdl_malloc(), no step is degraded for memory and no report is
+ * written.
+ */
+typedef struct s_xdlchain xdlchain_t;
+
+xdlchain_t *xdl_chain_new(mmfile_t *versions, long nr, xpparam_t const *xpp);
+long xdl_chain_steps(xdlchain_t const *chain);
+int xdl_chain_diff(xdlchain_t const *chain, long step, xdemitconf_t const *xecfg,
+                   xdemitcb_t *ecb);
+void xdl_chain_free(xdlchain_t *chain);
+
+/*
+ * Where the lines of file1 are in file2, as the runs of lines the diff
+ * leaves unchanged: lines [start1[k], start1[k] + len[k]) of file1 are
+ * lines [start2[k], start2[k] + len[k]) of file2, and the lines of
+ * either file outside the runs were deleted or added. Lines count from
+ * 0. xdl_line_map_new() and xdl_line_map_old() look a line up in
+ * O(log nr) and return -1 for a changed line. A change that
+ * XDF_IGNORE_BLANK_LINES or 'ignore_regex' hides from the diff counts as
+ * unchanged when it has as many lines in both files, which then pair up
+ * in order. xdl_line_map() runs with the allocator, memory cap and
+ * reports of 'xpp' like xdl_diff(), but the arrays of the map always
+ * come from xdl_malloc().
+ */
+typedef struct s_xdllinemap {
+    long nrec1, nrec2; /* Lines in each file */
+    long nr;           /* Runs of unchanged lines, in order in both files */
+    long *start1;
+    long *start2;
+    long *len;
+} xdllinemap_t;
+
+int xdl_line_map(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp, xdllinemap_t *map);
+int xdl_chain_line_map(xdlchain_t const *chain, long step, xdllinemap_t *map);
+long xdl_line_map_new(xdllinemap_t const *map, long line1);
+long xdl_line_map_old(xdllinemap_t const *map, long line2);
+void xdl_line_map_free(xdllinemap_t *map);
+
+/*
+ * How many lines two files share, counting a line as many times as the
+ * file having it less often has it, without running a diff. A score
+ * such as shared / max(nrec1, nrec2) follows. xdl_similarity() counts
+ * exactly from the classes of the lines. xdl_sketch() keeps the
+ * XDL_SKETCH_SIZE smallest hashes of the lines of one file, the copies
+ * of a repeated line hashed apart, and xdl_sketch_similarity()
+ * estimates the count from two sketches, for comparing each of many
+ * files with many others. xdl_sketch() reads the file once, counting
+ * the copies of each distinct line in a table it frees before
+ * returning, and fails only when that table cannot be allocated.
+ */
+#define XDL_SKETCH_SIZE 128
+
+typedef struct s_xdlsimilarity {
+    long nrec1, nrec2; /* Lines in each file */
+    long shared;       /* Lines found in both */
+} xdlsimilarity_t;
+
+typedef struct s_xdlsketch {
+    long nrec;                          /* Lines of the file */
+    long nr;                            /* Hashes kept, fewer for fewer lines */
+    unsigned long min[XDL_SKETCH_SIZE]; /* Smallest hashes of the lines, ascending */
+} xdlsketch_t;
+
+int xdl_similarity(mmfile_t *mf1, mmfile_t *mf2, unsigned long flags, xdlsimilarity_t *sim);
+int xdl_sketch(mmfile_t *mf, unsigned long flags, xdlsketch_t *sk);
+void xdl_sketch_similarity(xdlsketch_t const *sk1, xdlsketch_t const *sk2, xdlsimilarity_t *sim);
+
+int xdl_bdiff(mmfile_t *mmf1, mmfile_t *mmf2, bdiffparam_t const *bdp, xdemitcb_t *ecb);
+int xdl_bpatch(mmfile_t *mmf, mmfile_t *mmfp, xdemitcb_t *ecb);
+long xdl_bdiff_tgsize(mmfile_t *mmfp);
+
 typedef struct s_xmparam {
     xpparam_t xpp;
     int marker_size;
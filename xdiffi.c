@@ -23,17 +23,122 @@
 
 #include "xinclude.h"
 
+#if defined(XDL_X86_KERNELS)
+#include <immintrin.h>
+#endif
+
 #define XDL_MAX_COST_MIN 256
 #define XDL_HEUR_MIN_COST 256
 #define XDL_LINE_MAX (long)((1UL << (CHAR_BIT * sizeof(long) - 1)) - 1)
 #define XDL_SNAKE_CNT 20
 #define XDL_K_HEUR 4
+#define XDL_PIN_MIN_RECS 16384
+#define XDL_PIN_MIN_RUN 256
 
 typedef struct s_xdpsplit {
     long i1, i2;
     int min_lo, min_hi;
 } xdpsplit_t;
 
+/* A run of matching records around a record unique in both files */
+typedef struct s_xdlpin {
+    long i1, i2, len;
+    long weight; /* Records matched by the heaviest ordered set of runs ending here */
+    long prev;   /* Run before this one in that set, or -1 */
+} xdlpin_t;
+
+long xdl_match_fwd_scalar(unsigned long const *ha1, unsigned long const *ha2, long n)
+{
+    long i;
+
+    for (i = 0; i < n && ha1[i] == ha2[i]; i++)
+        ;
+    return i;
+}
+
+long xdl_match_bwd_scalar(unsigned long const *ha1, unsigned long const *ha2, long n)
+{
+    long i;
+
+    for (i = 0; i < n && ha1[-i - 1] == ha2[-i - 1]; i++)
+        ;
+    return i;
+}
+
+#if defined(XDL_X86_KERNELS)
+/*
+ * Snakes compare whole vectors of hashes bytewise, so that the kernels
+ * do not depend on the width of unsigned long; a mismatching byte
+ * locates the first (or last) mismatching entry.
+ */
+#define XDL_HA_PER(bytes) ((long)((bytes) / sizeof(unsigned long)))
+
+XDL_TARGET("sse2") long xdl_match_fwd_sse2(unsigned long const *ha1, unsigned long const *ha2,
+                                           long n)
+{
+    long i = 0;
+
+    for (; i + XDL_HA_PER(16) <= n; i += XDL_HA_PER(16)) {
+        __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((__m128i const *)(ha1 + i)),
+                                    _mm_loadu_si128((__m128i const *)(ha2 + i)));
+        unsigned int ne = ~(unsigned int)_mm_movemask_epi8(eq) & 0xffff;
+
+        if (ne)
+            return i + __builtin_ctz(ne) / (long)sizeof(unsigned long);
+    }
+    return i + xdl_match_fwd_scalar(ha1 + i, ha2 + i, n - i);
+}
+
+XDL_TARGET("sse2") long xdl_match_bwd_sse2(unsigned long const *ha1, unsigned long const *ha2,
+                                           long n)
+{
+    long i = 0;
+
+    for (; i + XDL_HA_PER(16) <= n; i += XDL_HA_PER(16)) {
+        __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((__m128i const *)(ha1 - i - XDL_HA_PER(16))),
+                                    _mm_loadu_si128((__m128i const *)(ha2 - i - XDL_HA_PER(16))));
+        unsigned int ne = ~(unsigned int)_mm_movemask_epi8(eq) & 0xffff;
+
+        if (ne)
+            return i + __builtin_clz(ne << 16) / (long)sizeof(unsigned long);
+    }
+    return i + xdl_match_bwd_scalar(ha1 - i, ha2 - i, n - i);
+}
+
+XDL_TARGET("avx2") long xdl_match_fwd_avx2(unsigned long const *ha1, unsigned long const *ha2,
+                                           long n)
+{
+    long i = 0;
+
+    for (; i + XDL_HA_PER(32) <= n; i += XDL_HA_PER(32)) {
+        __m256i eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i const *)(ha1 + i)),
+                                       _mm256_loadu_si256((__m256i const *)(ha2 + i)));
+        unsigned int ne = ~(unsigned int)_mm256_movemask_epi8(eq);
+
+        if (ne)
+            return i + __builtin_ctz(ne) / (long)sizeof(unsigned long);
+    }
+    return i + xdl_match_fwd_sse2(ha1 + i, ha2 + i, n - i);
+}
+
+XDL_TARGET("avx2") long xdl_match_bwd_avx2(unsigned long const *ha1, unsigned long const *ha2,
+                                           long n)
+{
+    long i = 0;
+
+    for (; i + XDL_HA_PER(32) <= n; i += XDL_HA_PER(32)) {
+        __m256i eq =
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i const *)(ha1 - i - XDL_HA_PER(32))),
+                              _mm256_loadu_si256((__m256i const *)(ha2 - i - XDL_HA_PER(32))));
+        unsigned int ne = ~(unsigned int)_mm256_movemask_epi8(eq);
+
+        if (ne)
+            return i + __builtin_clz(ne) / (long)sizeof(unsigned long);
+    }
+    return i + xdl_match_bwd_sse2(ha1 - i, ha2 - i, n - i);
+}
+#endif
+
 /*
  * See "An O(ND) Difference Algorithm and its Variations", by Eugene Myers.
  * Basically considers a "box" (off1, off2, lim1, lim2) and scan from both
@@ -53,6 +158,8 @@ static long xdl_split(unsigned long const *ha1, long off1, long lim1, unsigned l
     long fmin = fmid, fmax = fmid;
     long bmin = bmid, bmax = bmid;
     long ec, d, i1, i2, prev1, best, dd, v, k;
+    long (*match_fwd)(unsigned long const *, unsigned long const *, long) = xenv->kernels->match_fwd;
+    long (*match_bwd)(unsigned long const *, unsigned long const *, long) = xenv->kernels->match_bwd;
 
     /*
      * Set initial diagonal values for both forward and backward path.
@@ -88,8 +195,10 @@ static long xdl_split(unsigned long const *ha1, long off1, long lim1, unsigned l
                 i1 = kvdf[d + 1];
             prev1 = i1;
             i2 = i1 - d;
-            for (; i1 < lim1 && i2 < lim2 && ha1[i1] == ha2[i2]; i1++, i2++)
-                ;
+            if (i1 < lim1 && i2 < lim2 && ha1[i1] == ha2[i2]) {
+                i1 += match_fwd(ha1 + i1, ha2 + i2, XDL_MIN(lim1 - i1, lim2 - i2));
+                i2 = i1 - d;
+            }
             if (i1 - prev1 > xenv->snake_cnt)
                 got_snake = 1;
             kvdf[d] = i1;
@@ -126,8 +235,10 @@ static long xdl_split(unsigned long const *ha1, long off1, long lim1, unsigned l
                 i1 = kvdb[d + 1] - 1;
             prev1 = i1;
             i2 = i1 - d;
-            for (; i1 > off1 && i2 > off2 && ha1[i1 - 1] == ha2[i2 - 1]; i1--, i2--)
-                ;
+            if (i1 > off1 && i2 > off2 && ha1[i1 - 1] == ha2[i2 - 1]) {
+                i1 -= match_bwd(ha1 + i1, ha2 + i2, XDL_MIN(i1 - off1, i2 - off2));
+                i2 = i1 - d;
+            }
             if (prev1 - i1 > xenv->snake_cnt)
                 got_snake = 1;
             kvdb[d] = i1;
@@ -173,6 +284,8 @@ static long xdl_split(unsigned long const *ha1, long off1, long lim1, unsigned l
             if (best > 0) {
                 spl->min_lo = 1;
                 spl->min_hi = 0;
+                if (xenv->stats)
+                    xenv->stats->heur_snakes++;
                 return ec;
             }
 
@@ -196,6 +309,8 @@ static long xdl_split(unsigned long const *ha1, long off1, long lim1, unsigned l
             if (best > 0) {
                 spl->min_lo = 0;
                 spl->min_hi = 1;
+                if (xenv->stats)
+                    xenv->stats->heur_snakes++;
                 return ec;
             }
         }
@@ -243,6 +358,8 @@ static long xdl_split(unsigned long const *ha1, long off1, long lim1, unsigned l
                 spl->min_lo = 0;
                 spl->min_hi = 1;
             }
+            if (xenv->stats)
+                xenv->stats->cost_cutoffs++;
             return ec;
         }
     }
@@ -257,14 +374,17 @@ int xdl_recs_cmp(diffdata_t *dd1, long off1, long lim1, diffdata_t *dd2, long of
                  long *kvdf, long *kvdb, int need_min, xdalgoenv_t *xenv)
 {
     unsigned long const *ha1 = dd1->ha, *ha2 = dd2->ha;
+    long n;
 
     /*
      * Shrink the box by walking through each diagonal snake (SW and NE).
      */
-    for (; off1 < lim1 && off2 < lim2 && ha1[off1] == ha2[off2]; off1++, off2++)
-        ;
-    for (; off1 < lim1 && off2 < lim2 && ha1[lim1 - 1] == ha2[lim2 - 1]; lim1--, lim2--)
-        ;
+    n = xenv->kernels->match_fwd(ha1 + off1, ha2 + off2, XDL_MIN(lim1 - off1, lim2 - off2));
+    off1 += n;
+    off2 += n;
+    n = xenv->kernels->match_bwd(ha1 + lim1, ha2 + lim2, XDL_MIN(lim1 - off1, lim2 - off2));
+    lim1 -= n;
+    lim2 -= n;
 
     /*
      * If one dimension is empty, then all records on the other one must
@@ -284,14 +404,20 @@ int xdl_recs_cmp(diffdata_t *dd1, long off1, long lim1, diffdata_t *dd2, long of
             rchg1[rindex1[off1]] = 1;
     } else {
         xdpsplit_t spl;
+        long ec;
         spl.i1 = spl.i2 = 0;
 
         /*
          * Divide ...
          */
-        if (xdl_split(ha1, off1, lim1, ha2, off2, lim2, kvdf, kvdb, need_min, &spl, xenv) < 0) {
+        ec = xdl_split(ha1, off1, lim1, ha2, off2, lim2, kvdf, kvdb, need_min, &spl, xenv);
+        if (ec < 0) {
             return -1;
         }
+        if (xenv->stats) {
+            xenv->stats->splits++;
+            xenv->stats->split_cost += ec;
+        }
 
         /*
          * ... et Impera.
@@ -305,16 +431,178 @@ int xdl_recs_cmp(diffdata_t *dd1, long off1, long lim1, diffdata_t *dd2, long of
     return 0;
 }
 
+/*
+ * Find the runs of at least XDL_PIN_MIN_RUN matching records in the
+ * box [off1, lim1) x [off2, lim2) that hold a record unique in both
+ * files there, and keep the heaviest set of them that is in order in
+ * both. Returns the number of runs stored in 'ppins', in file order,
+ * 0 if there are none and -1 on error.
+ */
+static long xdl_find_pins(diffdata_t *dd1, long off1, long lim1, diffdata_t *dd2, long off2,
+                          long lim2, xdlkernels_t const *kernels, xdlpin_t **ppins)
+{
+    unsigned long const *ha1 = dd1->ha, *ha2 = dd2->ha;
+    long i, j, k, n, back, nclass, npins, apins, best;
+    unsigned char *cnt;
+    long *pos2;
+    xdlpin_t *pins;
+
+    for (i = off1, nclass = 0; i < lim1; i++)
+        nclass = XDL_MAX(nclass, (long)ha1[i] + 1);
+    for (j = off2; j < lim2; j++)
+        nclass = XDL_MAX(nclass, (long)ha2[j] + 1);
+    if (!XDL_CALLOC_ARRAY(cnt, 2 * nclass))
+        return -1;
+    if (!XDL_ALLOC_ARRAY(pos2, nclass)) {
+        xdl_free(cnt);
+        return -1;
+    }
+
+    /* Counts saturate at 2, as only unique records serve as anchors */
+    for (i = off1; i < lim1; i++)
+        if (cnt[2 * ha1[i]] < 2)
+            cnt[2 * ha1[i]]++;
+    for (j = off2; j < lim2; j++) {
+        if (cnt[2 * ha2[j] + 1] < 2)
+            cnt[2 * ha2[j] + 1]++;
+        pos2[ha2[j]] = j;
+    }
+
+    /*
+     * Grow the diagonal run through each anchor. Later anchors on the
+     * same run would find it again, so the scan resumes past its end.
+     */
+    pins = NULL;
+    npins = apins = 0;
+    for (i = k = off1; i < lim1;) {
+        if (cnt[2 * ha1[i]] != 1 || cnt[2 * ha1[i] + 1] != 1) {
+            i++;
+            continue;
+        }
+        j = pos2[ha1[i]];
+        back = kernels->match_bwd(ha1 + i, ha2 + j, XDL_MIN(i - k, j - off2));
+        n = kernels->match_fwd(ha1 + i, ha2 + j, XDL_MIN(lim1 - i, lim2 - j));
+        if (back + n >= XDL_PIN_MIN_RUN) {
+            if (XDL_ALLOC_GROW(pins, npins + 1, apins)) {
+                xdl_free(pos2);
+                xdl_free(cnt);
+                return -1;
+            }
+            pins[npins].i1 = i - back;
+            pins[npins].i2 = j - back;
+            pins[npins].len = back + n;
+            npins++;
+            k = i + n;
+        }
+        i += n;
+    }
+    xdl_free(pos2);
+    xdl_free(cnt);
+
+    /*
+     * The runs are in order in the first file; a moved block may put
+     * them out of order in the second, so keep the heaviest chain.
+     */
+    for (k = 0, best = -1; k < npins; k++) {
+        pins[k].weight = pins[k].len;
+        pins[k].prev = -1;
+        for (i = 0; i < k; i++)
+            if (pins[i].i2 + pins[i].len <= pins[k].i2 &&
+                pins[i].weight + pins[k].len > pins[k].weight) {
+                pins[k].weight = pins[i].weight + pins[k].len;
+                pins[k].prev = i;
+            }
+        if (best < 0 || pins[k].weight > pins[best].weight)
+            best = k;
+    }
+    /* Turn the links of the chain forward, then move it to the front */
+    for (n = 0, j = -1, k = best; k >= 0; n++, j = k, k = back) {
+        back = pins[k].prev;
+        pins[k].prev = j;
+    }
+    for (i = 0, k = j; k >= 0; k = pins[k].prev)
+        pins[i++] = pins[k];
+
+    *ppins = pins;
+    return n;
+}
+
+/*
+ * Run the algorithm on the whole files or, when what is left between
+ * their common ends is large, on the gaps between the long interior
+ * runs that are pinned as matching beforehand, so that the runs never
+ * go through xdl_split().
+ */
+static int xdl_recs_cmp_pinned(diffdata_t *dd1, diffdata_t *dd2, long *kvdf, long *kvdb,
+                               int need_min, xdalgoenv_t *xenv)
+{
+    long k, n, npins, off1, off2, end1, end2;
+    xdlpin_t *pins;
+
+    n = xenv->kernels->match_fwd(dd1->ha, dd2->ha, XDL_MIN(dd1->nrec, dd2->nrec));
+    off1 = off2 = n;
+    n = xenv->kernels->match_bwd(dd1->ha + dd1->nrec, dd2->ha + dd2->nrec,
+                                 XDL_MIN(dd1->nrec - off1, dd2->nrec - off2));
+    end1 = dd1->nrec - n;
+    end2 = dd2->nrec - n;
+
+    if (need_min || end1 - off1 + end2 - off2 < XDL_PIN_MIN_RECS ||
+        (npins = xdl_find_pins(dd1, off1, end1, dd2, off2, end2, xenv->kernels, &pins)) <= 0)
+        return xdl_recs_cmp(dd1, off1, end1, dd2, off2, end2, kvdf, kvdb, need_min, xenv);
+
+    for (k = 0; k <= npins; k++) {
+        long lim1 = k < npins ? pins[k].i1 : end1;
+        long lim2 = k < npins ? pins[k].i2 : end2;
+
+        if (xdl_recs_cmp(dd1, off1, lim1, dd2, off2, lim2, kvdf, kvdb, need_min, xenv) < 0) {
+            xdl_free(pins);
+            return -1;
+        }
+        if (k < npins) {
+            off1 = lim1 + pins[k].len;
+            off2 = lim2 + pins[k].len;
+            if (xenv->stats) {
+                xenv->stats->pinned_runs++;
+                xenv->stats->pinned += pins[k].len;
+            }
+        }
+    }
+    xdl_free(pins);
+
+    return 0;
+}
+
+/*
+ * Mark every line between the common prefix and suffix as changed: the
+ * coarsest valid result, for when the memory budget allows no better.
+ */
+static void xdl_mark_all_changed(xdfile_t *xdf)
+{
+    long i;
+
+    for (i = xdf->dstart; i <= xdf->dend; i++)
+        xdf->rchg[i] = 1;
+}
+
 int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp, xdfenv_t *xe)
+{
+    if (xdl_prepare_env(mf1, mf2, xpp, xe) < 0)
+        return -1;
+    return xdl_run_algorithm(xpp, xe);
+}
+
+/* Mark the changed records of an environment that is already prepared */
+int xdl_run_algorithm(xpparam_t const *xpp, xdfenv_t *xe)
 {
     long ndiags;
     long *kvd, *kvdf, *kvdb;
     xdalgoenv_t xenv;
     diffdata_t dd1, dd2;
+    double t;
     int res;
 
-    if (xdl_prepare_env(mf1, mf2, xpp, xe) < 0)
-        return -1;
+    xdl_meter_phase(XDL_MEM_ALGORITHM);
+    t = xpp->stats ? xdl_clock() : 0;
 
     if (XDF_DIFF_ALG(xpp->flags) == XDF_PATIENCE_DIFF) {
         res = xdl_do_patience_diff(xpp, xe);
@@ -334,8 +622,8 @@ int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp, xdfenv_t *xe
      */
     ndiags = xe->xdf1.nreff + xe->xdf2.nreff + 3;
     if (!XDL_ALLOC_ARRAY(kvd, 2 * ndiags + 2)) {
-        xdl_free_env(xe);
-        return -1;
+        res = -1;
+        goto out;
     }
     kvdf = kvd;
     kvdb = kvdf + ndiags;
@@ -347,6 +635,8 @@ int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp, xdfenv_t *xe
         xenv.mxcost = XDL_MAX_COST_MIN;
     xenv.snake_cnt = XDL_SNAKE_CNT;
     xenv.heur_min = XDL_HEUR_MIN_COST;
+    xenv.stats = xpp->stats;
+    xenv.kernels = xdl_kernels();
 
     dd1.nrec = xe->xdf1.nreff;
     dd1.ha = xe->xdf1.ha;
@@ -357,17 +647,23 @@ int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp, xdfenv_t *xe
     dd2.rchg = xe->xdf2.rchg;
     dd2.rindex = xe->xdf2.rindex;
 
-    res = xdl_recs_cmp(&dd1, 0, dd1.nrec, &dd2, 0, dd2.nrec, kvdf, kvdb,
-                       (xpp->flags & XDF_NEED_MINIMAL) != 0, &xenv);
+    res = xdl_recs_cmp_pinned(&dd1, &dd2, kvdf, kvdb, (xpp->flags & XDF_NEED_MINIMAL) != 0,
+                              &xenv);
     xdl_free(kvd);
 out:
+    xdl_stats_time(xpp->stats, XDL_PHASE_ALGORITHM, &t);
+    if (res < 0 && xdl_meter_degrade()) {
+        xdl_mark_all_changed(&xe->xdf1);
+        xdl_mark_all_changed(&xe->xdf2);
+        res = 0;
+    }
     if (res < 0)
         xdl_free_env(xe);
 
     return res;
 }
 
-static xdchange_t *xdl_add_change(xdchange_t *xscr, long i1, long i2, long chg1, long chg2)
+xdchange_t *xdl_add_change(xdchange_t *xscr, long i1, long i2, long chg1, long chg2)
 {
     xdchange_t *xch;
 
@@ -960,8 +1256,8 @@ void xdl_free_script(xdchange_t *xscr)
     }
 }
 
-static int xdl_call_hunk_func(xdfenv_t *xe XDL_UNUSED, xdchange_t *xscr, xdemitcb_t *ecb,
-                              xdemitconf_t const *xecfg)
+int xdl_call_hunk_func(xdfenv_t *xe XDL_UNUSED, xdchange_t *xscr, xdemitcb_t *ecb,
+                       xdemitconf_t const *xecfg)
 {
     xdchange_t *xch, *xche;
 
@@ -1036,37 +1332,151 @@ static void xdl_mark_ignorable_regex(xdchange_t *xscr, const xdfenv_t *xe, xppar
     }
 }
 
-int xdl_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp, xdemitconf_t const *xecfg,
-             xdemitcb_t *ecb)
+void xdl_mark_ignorable(xdchange_t *xscr, xdfenv_t *xe, xpparam_t const *xpp)
+{
+    if (xpp->flags & XDF_IGNORE_BLANK_LINES)
+        xdl_mark_ignorable_lines(xscr, xe, xpp->flags);
+
+    if (xpp->ignore_regex)
+        xdl_mark_ignorable_regex(xscr, xe, xpp);
+}
+
+/* Callbacks of a diff with its own allocator, run with the C library's */
+typedef struct s_xdlcbshim {
+    xdemitcb_t *ecb;
+    xdemitconf_t const *xecfg;
+} xdlcbshim_t;
+
+static int xdl_shim_hunk(void *priv, long old_begin, long old_nr, long new_begin, long new_nr,
+                         const char *func, long funclen)
+{
+    xdlcbshim_t *shim = (xdlcbshim_t *)priv;
+    xdlalloc_t const *prev = xdl_alloc_push(NULL);
+    int ret = shim->ecb->out_hunk(shim->ecb->priv, old_begin, old_nr, new_begin, new_nr, func,
+                                  funclen);
+
+    xdl_alloc_pop(prev);
+    return ret;
+}
+
+static int xdl_shim_line(void *priv, mmbuffer_t *mb, int nbuf)
+{
+    xdlcbshim_t *shim = (xdlcbshim_t *)priv;
+    xdlalloc_t const *prev = xdl_alloc_push(NULL);
+    int ret = shim->ecb->out_line(shim->ecb->priv, mb, nbuf);
+
+    xdl_alloc_pop(prev);
+    return ret;
+}
+
+static int xdl_shim_hunk_func(long start_a, long count_a, long start_b, long count_b,
+                              void *cb_data)
+{
+    xdlcbshim_t *shim = (xdlcbshim_t *)cb_data;
+    xdlalloc_t const *prev = xdl_alloc_push(NULL);
+    int ret = shim->xecfg->hunk_func(start_a, count_a, start_b, count_b, shim->ecb->priv);
+
+    xdl_alloc_pop(prev);
+    return ret;
+}
+
+static long xdl_shim_find_func(const char *line, long line_len, char *buffer, long buffer_size,
+                               void *priv)
+{
+    xdlcbshim_t *shim = (xdlcbshim_t *)priv;
+    xdlalloc_t const *prev = xdl_alloc_push(NULL);
+    long ret = shim->xecfg->find_func(line, line_len, buffer, buffer_size,
+                                      shim->xecfg->find_func_priv);
+
+    xdl_alloc_pop(prev);
+    return ret;
+}
+
+static int xdl_diff_run(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+                        xdemitconf_t const *xecfg, xdemitcb_t *ecb)
 {
-    xdchange_t *xscr;
     xdfenv_t xe;
-    emit_func_t ef = xecfg->hunk_func ? xdl_call_hunk_func : xdl_emit_diff;
 
+    if (xpp->stats)
+        memset(xpp->stats, 0, sizeof(*xpp->stats));
     if (xdl_do_diff(mf1, mf2, xpp, &xe) < 0) {
         return -1;
     }
-    if (xdl_change_compact(&xe.xdf1, &xe.xdf2, xpp->flags) < 0 ||
-        xdl_change_compact(&xe.xdf2, &xe.xdf1, xpp->flags) < 0 ||
-        xdl_build_script(&xe, &xscr) < 0) {
-        xdl_free_env(&xe);
+    return xdl_emit_prepared(&xe, xpp, xecfg, ecb);
+}
+
+/* Turn the changes marked in an environment into a script, emit it and free the environment */
+int xdl_emit_prepared(xdfenv_t *xe, xpparam_t const *xpp, xdemitconf_t const *xecfg,
+                      xdemitcb_t *ecb)
+{
+    xdchange_t *xscr;
+    emit_func_t ef = xecfg->hunk_func ? xdl_call_hunk_func : xdl_emit_diff;
+    double t;
+
+    xdl_meter_phase(XDL_MEM_SCRIPT);
+    t = xpp->stats ? xdl_clock() : 0;
+    if (xdl_change_compact(&xe->xdf1, &xe->xdf2, xpp->flags) < 0 ||
+        xdl_change_compact(&xe->xdf2, &xe->xdf1, xpp->flags) < 0) {
+        xdl_free_env(xe);
+        return -1;
+    }
+    xdl_stats_time(xpp->stats, XDL_PHASE_COMPACT, &t);
+    if (xdl_build_script(xe, &xscr) < 0) {
+        xdl_free_env(xe);
         return -1;
     }
     if (xscr) {
-        if (xpp->flags & XDF_IGNORE_BLANK_LINES)
-            xdl_mark_ignorable_lines(xscr, &xe, xpp->flags);
-
-        if (xpp->ignore_regex)
-            xdl_mark_ignorable_regex(xscr, &xe, xpp);
-
-        if (ef(&xe, xscr, ecb, xecfg) < 0) {
+        xdl_mark_ignorable(xscr, xe, xpp);
+        xdl_stats_time(xpp->stats, XDL_PHASE_SCRIPT, &t);
+        xdl_meter_phase(XDL_MEM_EMIT);
+        if (ef(xe, xscr, ecb, xecfg) < 0) {
             xdl_free_script(xscr);
-            xdl_free_env(&xe);
+            xdl_free_env(xe);
             return -1;
         }
         xdl_free_script(xscr);
+        xdl_stats_time(xpp->stats, XDL_PHASE_EMIT, &t);
+    } else {
+        xdl_stats_time(xpp->stats, XDL_PHASE_SCRIPT, &t);
     }
-    xdl_free_env(&xe);
+    xdl_free_env(xe);
 
     return 0;
 }
+
+int xdl_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp, xdemitconf_t const *xecfg,
+             xdemitcb_t *ecb)
+{
+    xdlcbshim_t shim;
+    xdemitconf_t cfg;
+    xdemitcb_t cb;
+    xdlmeter_t meter;
+    xdlalloc_t const *prev;
+    int ret;
+
+    if (!xpp->alloc && !xdl_meter_wanted(xpp))
+        return xdl_diff_run(mf1, mf2, xpp, xecfg, ecb);
+
+    shim.ecb = ecb;
+    shim.xecfg = xecfg;
+    cfg = *xecfg;
+    cb.priv = &shim;
+    cb.out_hunk = ecb->out_hunk ? xdl_shim_hunk : NULL;
+    cb.out_line = ecb->out_line ? xdl_shim_line : NULL;
+    if (xecfg->hunk_func)
+        cfg.hunk_func = xdl_shim_hunk_func;
+    if (xecfg->find_func) {
+        cfg.find_func = xdl_shim_find_func;
+        cfg.find_func_priv = &shim;
+    }
+
+    if (xdl_meter_wanted(xpp)) {
+        xdl_meter_init(&meter, xpp);
+        prev = xdl_alloc_push(&meter.alloc);
+    } else {
+        prev = xdl_alloc_push(xpp->alloc);
+    }
+    ret = xdl_diff_run(mf1, mf2, xpp, &cfg, &cb);
+    xdl_alloc_pop(prev);
+    return ret;
+}
@@ -34,6 +34,8 @@ typedef struct s_xdalgoenv {
     long mxcost;
     long snake_cnt;
     long heur_min;
+    xdlstats_t *stats; /* Optional counters of the splits */
+    xdlkernels_t const *kernels;
 } xdalgoenv_t;
 
 typedef struct s_xdchange {
@@ -46,10 +48,18 @@ typedef struct s_xdchange {
 int xdl_recs_cmp(diffdata_t *dd1, long off1, long lim1, diffdata_t *dd2, long off2, long lim2,
                  long *kvdf, long *kvdb, int need_min, xdalgoenv_t *xenv);
 int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp, xdfenv_t *xe);
+int xdl_run_algorithm(xpparam_t const *xpp, xdfenv_t *xe);
+int xdl_chain_do_diff(xdlchain_t const *chain, long step, xdfenv_t *xe);
+int xdl_line_map_env(xdfenv_t *xe, xpparam_t const *xpp, xdllinemap_t *map);
 int xdl_change_compact(xdfile_t *xdf, xdfile_t *xdfo, long flags);
+xdchange_t *xdl_add_change(xdchange_t *xscr, long i1, long i2, long chg1, long chg2);
 int xdl_build_script(xdfenv_t *xe, xdchange_t **xscr);
 void xdl_free_script(xdchange_t *xscr);
+void xdl_mark_ignorable(xdchange_t *xscr, xdfenv_t *xe, xpparam_t const *xpp);
 int xdl_emit_diff(xdfenv_t *xe, xdchange_t *xscr, xdemitcb_t *ecb, xdemitconf_t const *xecfg);
+int xdl_call_hunk_func(xdfenv_t *xe, xdchange_t *xscr, xdemitcb_t *ecb, xdemitconf_t const *xecfg);
+int xdl_emit_prepared(xdfenv_t *xe, xpparam_t const *xpp, xdemitconf_t const *xecfg,
+                      xdemitcb_t *ecb);
 int xdl_do_patience_diff(xpparam_t const *xpp, xdfenv_t *env);
 int xdl_do_histogram_diff(xpparam_t const *xpp, xdfenv_t *env);
 
@@ -55,7 +55,7 @@ struct histindex {
         struct record *next;
     } **records,    /* an occurrence */
         **line_map; /* map of line to record chain */
-    chastore_t rcha;
+    chastore_t *rcha; /* shared by the whole diff, reset after each use */
     unsigned int *next_ptrs;
     unsigned int table_bits, records_size, line_map_size;
 
@@ -128,7 +128,7 @@ static int scanA(struct histindex *index, int line1, int count1)
          * This is the first time we have ever seen this particular
          * element in the sequence. Construct a new chain for it.
          */
-        if (!(rec = xdl_cha_alloc(&index->rcha)))
+        if (!(rec = xdl_cha_alloc(index->rcha)))
             return -1;
         rec->ptr = ptr;
         rec->cnt = 1;
@@ -220,6 +220,9 @@ static int fall_back_to_classic_diff(xpparam_t const *xpp, xdfenv_t *env, int li
 
     memset(&xpparam, 0, sizeof(xpparam));
     xpparam.flags = xpp->flags & ~XDF_DIFF_ALGORITHM_MASK;
+    xpparam.stats = xpp->stats;
+    if (xpp->stats)
+        xpp->stats->histogram_fallbacks++;
 
     return xdl_fall_back_diff(env, &xpparam, line1, count1, line2, count2);
 }
@@ -229,11 +232,11 @@ static inline void free_index(struct histindex *index)
     xdl_free(index->records);
     xdl_free(index->line_map);
     xdl_free(index->next_ptrs);
-    xdl_cha_free(&index->rcha);
+    xdl_cha_reset(index->rcha);
 }
 
-static int find_lcs(xpparam_t const *xpp, xdfenv_t *env, struct region *lcs, int line1, int count1,
-                    int line2, int count2)
+static int find_lcs(xpparam_t const *xpp, xdfenv_t *env, chastore_t *rcha, struct region *lcs,
+                    int line1, int count1, int line2, int count2)
 {
     int b_ptr;
     int ret = -1;
@@ -246,8 +249,7 @@ static int find_lcs(xpparam_t const *xpp, xdfenv_t *env, struct region *lcs, int
 
     index.records = NULL;
     index.line_map = NULL;
-    /* in case of early xdl_cha_free() */
-    index.rcha.head = NULL;
+    index.rcha = rcha;
 
     index.table_bits = xdl_hashbits(count1);
     index.records_size = 1 << index.table_bits;
@@ -261,10 +263,6 @@ static int find_lcs(xpparam_t const *xpp, xdfenv_t *env, struct region *lcs, int
     if (!XDL_CALLOC_ARRAY(index.next_ptrs, index.line_map_size))
         goto cleanup;
 
-    /* lines / 4 + 1 comes from xprepare.c:xdl_prepare_ctx() */
-    if (xdl_cha_init(&index.rcha, sizeof(struct record), count1 / 4 + 1) < 0)
-        goto cleanup;
-
     index.ptr_shift = line1;
     index.max_chain_length = 64;
 
@@ -286,8 +284,8 @@ cleanup:
     return ret;
 }
 
-static int histogram_diff(xpparam_t const *xpp, xdfenv_t *env, int line1, int count1, int line2,
-                          int count2)
+static int histogram_diff(xpparam_t const *xpp, xdfenv_t *env, chastore_t *rcha, int line1,
+                          int count1, int line2, int count2)
 {
     struct region lcs;
     int lcs_found;
@@ -312,7 +310,7 @@ redo:
     }
 
     memset(&lcs, 0, sizeof(lcs));
-    lcs_found = find_lcs(xpp, env, &lcs, line1, count1, line2, count2);
+    lcs_found = find_lcs(xpp, env, rcha, &lcs, line1, count1, line2, count2);
     if (lcs_found < 0)
         goto out;
     else if (lcs_found)
@@ -325,7 +323,8 @@ redo:
                 env->xdf2.rchg[line2++ - 1] = 1;
             result = 0;
         } else {
-            result = histogram_diff(xpp, env, line1, lcs.begin1 - line1, line2, lcs.begin2 - line2);
+            result = histogram_diff(xpp, env, rcha, line1, lcs.begin1 - line1, line2,
+                                    lcs.begin2 - line2);
             if (result)
                 goto out;
             /*
@@ -347,6 +346,20 @@ out:
 
 int xdl_do_histogram_diff(xpparam_t const *xpp, xdfenv_t *env)
 {
-    return histogram_diff(xpp, env, env->xdf1.dstart + 1, env->xdf1.dend - env->xdf1.dstart + 1,
-                          env->xdf2.dstart + 1, env->xdf2.dend - env->xdf2.dstart + 1);
+    chastore_t rcha;
+    int count1 = env->xdf1.dend - env->xdf1.dstart + 1;
+    int ret;
+
+    /*
+     * One store serves every level of the recursion: find_lcs() resets
+     * it when done, so the nodes of the first, largest index are reused.
+     * lines / 4 + 1 comes from xprepare.c:xdl_prepare_ctx()
+     */
+    if (xdl_cha_init(&rcha, sizeof(struct record), count1 / 4 + 1) < 0)
+        return -1;
+    ret = histogram_diff(xpp, env, &rcha, env->xdf1.dstart + 1, count1, env->xdf2.dstart + 1,
+                         env->xdf2.dend - env->xdf2.dstart + 1);
+    xdl_cha_free(&rcha);
+
+    return ret;
 }
@@ -30,6 +30,7 @@
 #include "xdiff.h"
 #include "xmacros.h"
 #include "xtypes.h"
+#include "xcpu.h"
 #include "xdiffi.h"
 #include "xemit.h"
 #include "xprepare.h"
@@ -0,0 +1,588 @@
+/*
+ *  LibXDiff by Davide Libenzi ( File Differential Library )
+ *  Copyright (C) 2003  Davide Libenzi
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Davide Libenzi <davidel@xmailserver.org>
+ *
+ */
+
+#include "xinclude.h"
+
+/* Unchanged lines of file2 re-diffed on each side of an edit */
+#define XDL_INCR_MARGIN 4
+
+/* Room left in the gap buffers when they grow, in bytes and in lines */
+#define XDL_INCR_TEXT_SLACK 4096
+#define XDL_INCR_LINE_SLACK 256
+
+/* File1 lines [i1, i1 + chg1) replaced by file2 lines [i2, i2 + chg2) */
+typedef struct s_xdlichg {
+    long i1, chg1;
+    long i2, chg2;
+} xdlichg_t;
+
+struct s_xdlincr {
+    xpparam_t xpp;
+    mmfile_t mf1;
+    long nrec1;
+    long *ends1; /* Offset just past each line of file1 */
+
+    /*
+     * File2 lives in a gap buffer whose gap always falls between two
+     * lines: bytes [0, gap) hold lines [0, lgap) and bytes [gend, alloc)
+     * the lines after them. ends2[0, lgap) are the offsets just past the
+     * lines before the gap, ends2[lgend, lalloc) the distances from the
+     * end of the buffer to the ends of the lines after it, so growing the
+     * buffer or moving the gap only touches the lines it moves over.
+     */
+    char *buf;
+    long alloc, gap, gend;
+    long *ends2;
+    long lalloc, lgap, lgend;
+    long nrec2;
+
+    xdlichg_t *chg; /* The script, in file order */
+    long nchg, achg;
+
+    int broken; /* Set when a failed edit left the script out of date */
+};
+
+static long xdl_incr_size2(xdlincr_t const *inc)
+{
+    return inc->gap + inc->alloc - inc->gend;
+}
+
+/* Offset in the buffer just past line i of file2 */
+static long xdl_incr_pend(xdlincr_t const *inc, long i)
+{
+    return i < inc->lgap ? inc->ends2[i] : inc->alloc - inc->ends2[inc->lgend + i - inc->lgap];
+}
+
+/* Offset in the text of file2 just past line i, as if there was no gap */
+static long xdl_incr_end(xdlincr_t const *inc, long i)
+{
+    return i < inc->lgap ? inc->ends2[i] : xdl_incr_pend(inc, i) - (inc->gend - inc->gap);
+}
+
+static long xdl_incr_start(xdlincr_t const *inc, long i)
+{
+    return i ? xdl_incr_end(inc, i - 1) : 0;
+}
+
+static char xdl_incr_byte(xdlincr_t const *inc, long offset)
+{
+    return inc->buf[offset < inc->gap ? offset : offset + inc->gend - inc->gap];
+}
+
+/* First line of file2 ending past 'offset', nrec2 if there is none */
+static long xdl_incr_line_at(xdlincr_t const *inc, long offset)
+{
+    long lo = 0, hi = inc->nrec2, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (xdl_incr_end(inc, mid) > offset)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
+/* Copy 'size' bytes of the text of file2 from 'offset' on */
+static void xdl_incr_copy(xdlincr_t const *inc, long offset, char *dest, long size)
+{
+    long front = XDL_MIN(XDL_MAX(inc->gap - offset, 0), size);
+
+    memcpy(dest, inc->buf + offset, front);
+    memcpy(dest + front, inc->buf + inc->gend + XDL_MAX(offset - inc->gap, 0), size - front);
+}
+
+/* Split [ptr, top) into lines, storing the offset past each from 'base' on when 'ends' is set */
+static long xdl_incr_split(char const *ptr, char const *top, long base, long *ends)
+{
+    char const *(*find_eol)(char const *, char const *) = xdl_kernels()->find_eol;
+    char const *cur, *eol;
+    long n = 0;
+
+    for (cur = ptr; cur < top; cur = eol) {
+        eol = find_eol(cur, top);
+        eol = eol < top ? eol + 1 : top;
+        if (ends)
+            ends[n] = base + (eol - ptr);
+        n++;
+    }
+    return n;
+}
+
+static int xdl_incr_grow_text(xdlincr_t *inc, long need)
+{
+    long tail = inc->alloc - inc->gend, nalloc;
+    char *buf;
+
+    if (inc->gend - inc->gap >= need)
+        return 0;
+    nalloc = inc->gap + tail + need;
+    nalloc += nalloc / 4 + XDL_INCR_TEXT_SLACK;
+    if (!(buf = (char *)xdl_realloc(inc->buf, nalloc)))
+        return -1;
+    memmove(buf + nalloc - tail, buf + inc->gend, tail);
+    inc->buf = buf;
+    inc->gend = nalloc - tail;
+    inc->alloc = nalloc;
+
+    return 0;
+}
+
+static int xdl_incr_grow_lines(xdlincr_t *inc, long need)
+{
+    long tail = inc->lalloc - inc->lgend, nalloc;
+    long *ends;
+
+    if (inc->lgend - inc->lgap >= need)
+        return 0;
+    nalloc = inc->lgap + tail + need;
+    nalloc += nalloc / 4 + XDL_INCR_LINE_SLACK;
+    if (!(ends = (long *)xdl_realloc(inc->ends2, nalloc * sizeof(long))))
+        return -1;
+    memmove(ends + nalloc - tail, ends + inc->lgend, tail * sizeof(long));
+    inc->ends2 = ends;
+    inc->lgend = nalloc - tail;
+    inc->lalloc = nalloc;
+
+    return 0;
+}
+
+/* Move the gap of file2 just before line l */
+static void xdl_incr_move_gap(xdlincr_t *inc, long l)
+{
+    long shift = inc->gend - inc->gap, pos;
+
+    if (l < inc->lgap) {
+        pos = l ? inc->ends2[l - 1] : 0;
+        memmove(inc->buf + pos + shift, inc->buf + pos, inc->gap - pos);
+        while (inc->lgap > l) {
+            inc->lgap--;
+            inc->lgend--;
+            inc->ends2[inc->lgend] = inc->alloc - (inc->ends2[inc->lgap] + shift);
+        }
+        inc->gap = pos;
+        inc->gend = pos + shift;
+    } else if (l > inc->lgap) {
+        pos = xdl_incr_pend(inc, l - 1);
+        memmove(inc->buf + inc->gap, inc->buf + inc->gend, pos - inc->gend);
+        while (inc->lgap < l) {
+            inc->ends2[inc->lgap] = inc->alloc - inc->ends2[inc->lgend] - shift;
+            inc->lgap++;
+            inc->lgend++;
+        }
+        inc->gap = pos - shift;
+        inc->gend = pos;
+    }
+}
+
+/*
+ * Diff file1 lines [p0, q1) against file2 lines [r0, r2), the latter
+ * copied out of the gap buffer, and return the changes in file
+ * coordinates.
+ */
+static int xdl_incr_diff(xdlincr_t *inc, long p0, long q1, long r0, long r2, xdlichg_t **out,
+                         long *nout)
+{
+    mmfile_t mf1, mf2;
+    xdfenv_t xe;
+    xdchange_t *xscr, *xch;
+    xdlichg_t *chg = NULL;
+    char *text = NULL;
+    long s1 = p0 ? inc->ends1[p0 - 1] : 0, s2 = xdl_incr_start(inc, r0), n = 0;
+    int ret = -1;
+
+    mf1.ptr = (char *)inc->mf1.ptr + s1;
+    mf1.size = (q1 ? inc->ends1[q1 - 1] : 0) - s1;
+    mf2.size = xdl_incr_start(inc, r2) - s2;
+    if (!mf2.size)
+        mf2.ptr = NULL;
+    else if (!(mf2.ptr = text = (char *)xdl_malloc(mf2.size)))
+        return -1;
+    else
+        xdl_incr_copy(inc, s2, text, mf2.size);
+
+    if (xdl_do_diff(&mf1, &mf2, &inc->xpp, &xe) < 0)
+        goto out;
+    if (xdl_change_compact(&xe.xdf1, &xe.xdf2, inc->xpp.flags) < 0 ||
+        xdl_change_compact(&xe.xdf2, &xe.xdf1, inc->xpp.flags) < 0 ||
+        xdl_build_script(&xe, &xscr) < 0) {
+        xdl_free_env(&xe);
+        goto out;
+    }
+    for (xch = xscr; xch; xch = xch->next)
+        n++;
+    if (n && !XDL_ALLOC_ARRAY(chg, n)) {
+        xdl_free_script(xscr);
+        xdl_free_env(&xe);
+        goto out;
+    }
+    for (n = 0, xch = xscr; xch; xch = xch->next, n++) {
+        chg[n].i1 = p0 + xch->i1;
+        chg[n].chg1 = xch->chg1;
+        chg[n].i2 = r0 + xch->i2;
+        chg[n].chg2 = xch->chg2;
+    }
+    xdl_free_script(xscr);
+    xdl_free_env(&xe);
+    *out = chg;
+    *nout = n;
+    ret = 0;
+
+out:
+    xdl_free(text);
+    return ret;
+}
+
+/*
+ * File2 lines [l0, l1) were replaced by dl more or fewer lines: re-diff
+ * the region around them, bounded by unchanged lines on each side, and
+ * splice its changes into the script.
+ */
+static int xdl_incr_update(xdlincr_t *inc, long l0, long l1, long dl)
+{
+    long r0 = XDL_MAX(l0 - XDL_INCR_MARGIN, 0);
+    long r1 = XDL_MIN(l1 + XDL_INCR_MARGIN, inc->nrec2 - dl);
+    long lo = 0, hi = inc->nchg, mid, k0, k1, k, delta0 = 0, delta1, nnew;
+    xdlichg_t *fresh;
+
+    /*
+     * Changes are separated by unchanged lines, so their ends grow
+     * strictly: find the first one reaching r0, then take every change
+     * overlapping or touching the region, which may widen it.
+     */
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (inc->chg[mid].i2 + inc->chg[mid].chg2 >= r0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    k0 = lo;
+    if (k0 < inc->nchg && inc->chg[k0].i2 < r0)
+        r0 = inc->chg[k0].i2;
+    for (k1 = k0; k1 < inc->nchg && inc->chg[k1].i2 <= r1; k1++)
+        r1 = XDL_MAX(r1, inc->chg[k1].i2 + inc->chg[k1].chg2);
+
+    for (k = 0; k < k0; k++)
+        delta0 += inc->chg[k].chg1 - inc->chg[k].chg2;
+    for (delta1 = delta0; k < k1; k++)
+        delta1 += inc->chg[k].chg1 - inc->chg[k].chg2;
+
+    if (xdl_incr_diff(inc, r0 + delta0, r1 + delta1, r0, r1 + dl, &fresh, &nnew) < 0)
+        return -1;
+    if (XDL_ALLOC_GROW(inc->chg, inc->nchg - (k1 - k0) + nnew, inc->achg) < 0) {
+        xdl_free(fresh);
+        inc->nchg = inc->achg = 0;
+        return -1;
+    }
+    memmove(inc->chg + k0 + nnew, inc->chg + k1, (inc->nchg - k1) * sizeof(xdlichg_t));
+    if (nnew)
+        memcpy(inc->chg + k0, fresh, nnew * sizeof(xdlichg_t));
+    inc->nchg += nnew - (k1 - k0);
+    for (k = k0 + nnew; k < inc->nchg; k++)
+        inc->chg[k].i2 += dl;
+    xdl_free(fresh);
+
+    return 0;
+}
+
+/*
+ * Only lines from d1 on in file1 and from d2 on in file2 changed: re-diff
+ * both files from before the last change reaching back to them.
+ */
+static int xdl_incr_update_tail(xdlincr_t *inc, long d1, long d2)
+{
+    long a1 = XDL_MAX(d1 - XDL_INCR_MARGIN, 0), a2 = XDL_MAX(d2 - XDL_INCR_MARGIN, 0);
+    long lo = 0, hi = inc->nchg, mid, k, k0, r0, delta = 0, nnew;
+    xdlichg_t *fresh;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (inc->chg[mid].i1 + inc->chg[mid].chg1 >= a1 ||
+            inc->chg[mid].i2 + inc->chg[mid].chg2 >= a2)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    k0 = lo;
+    for (k = 0; k < k0; k++)
+        delta += inc->chg[k].chg1 - inc->chg[k].chg2;
+
+    /*
+     * Both bounds fall in the unchanged run before change k0, unless one
+     * is inside that change, which then starts the region.
+     */
+    r0 = XDL_MIN(a2, a1 - delta);
+    if (k0 < inc->nchg && inc->chg[k0].i2 < r0)
+        r0 = inc->chg[k0].i2;
+
+    if (xdl_incr_diff(inc, r0 + delta, inc->nrec1, r0, inc->nrec2, &fresh, &nnew) < 0)
+        return -1;
+    if (XDL_ALLOC_GROW(inc->chg, k0 + nnew, inc->achg) < 0) {
+        xdl_free(fresh);
+        inc->nchg = inc->achg = 0;
+        return -1;
+    }
+    if (nnew)
+        memcpy(inc->chg + k0, fresh, nnew * sizeof(xdlichg_t));
+    inc->nchg = k0 + nnew;
+    xdl_free(fresh);
+
+    return 0;
+}
+
+xdlincr_t *xdl_incr_new(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp)
+{
+    xdlincr_t *inc;
+    long size2 = mf2->size;
+
+    if (!(inc = (xdlincr_t *)xdl_calloc(1, sizeof(xdlincr_t))))
+        return NULL;
+    inc->xpp = *xpp;
+    inc->xpp.index1 = inc->xpp.index2 = NULL;
+    inc->xpp.alloc = NULL;
+    inc->xpp.max_memory = 0;
+    inc->xpp.memstats = NULL;
+    inc->xpp.stats = NULL;
+    inc->mf1 = *mf1;
+
+    inc->nrec1 = xdl_incr_split(mf1->ptr, mf1->ptr + mf1->size, 0, NULL);
+    inc->nrec2 = xdl_incr_split(mf2->ptr, mf2->ptr + size2, 0, NULL);
+    inc->alloc = size2 + XDL_INCR_TEXT_SLACK;
+    inc->lalloc = inc->nrec2 + XDL_INCR_LINE_SLACK;
+    if (!XDL_ALLOC_ARRAY(inc->ends1, inc->nrec1 + 1) ||
+        !XDL_ALLOC_ARRAY(inc->buf, inc->alloc) || !XDL_ALLOC_ARRAY(inc->ends2, inc->lalloc)) {
+        xdl_incr_free(inc);
+        return NULL;
+    }
+    xdl_incr_split(mf1->ptr, mf1->ptr + mf1->size, 0, inc->ends1);
+    xdl_incr_split(mf2->ptr, mf2->ptr + size2, 0, inc->ends2);
+    if (size2)
+        memcpy(inc->buf, mf2->ptr, size2);
+    inc->gap = size2;
+    inc->gend = inc->alloc;
+    inc->lgap = inc->nrec2;
+    inc->lgend = inc->lalloc;
+
+    if (xdl_incr_diff(inc, 0, inc->nrec1, 0, inc->nrec2, &inc->chg, &inc->nchg) < 0) {
+        xdl_incr_free(inc);
+        return NULL;
+    }
+    inc->achg = inc->nchg;
+
+    return inc;
+}
+
+/*
+ * Replace 'len' bytes of file2 at 'offset' with 'text' and split again
+ * the lines touched. The lines holding the replaced bytes, plus the
+ * incomplete last line when appending to it, are split again; the next
+ * line is too when the edit ends just past a newline it may have
+ * removed. Lines [*l0, *l1) were replaced by *dl more or fewer ones.
+ */
+static int xdl_incr_splice(xdlincr_t *inc, long offset, long len, char const *text, long size,
+                           long *l0, long *l1, long *dl)
+{
+    long size2 = xdl_incr_size2(inc), start, m;
+
+    *l0 = xdl_incr_line_at(inc, offset);
+    if (*l0 == inc->nrec2 && *l0 && xdl_incr_byte(inc, size2 - 1) != '\n')
+        (*l0)--;
+    *l1 = xdl_incr_line_at(inc, offset + len);
+    if (*l1 < inc->nrec2)
+        (*l1)++;
+    *l1 = XDL_MAX(*l1, *l0);
+
+    if (xdl_incr_grow_text(inc, size - len) < 0)
+        return -1;
+    xdl_incr_move_gap(inc, *l1);
+    start = xdl_incr_start(inc, *l0);
+    m = xdl_incr_split(inc->buf + start, inc->buf + offset, 0, NULL) +
+        xdl_incr_split(text, text + size, 0, NULL) +
+        xdl_incr_split(inc->buf + offset + len, inc->buf + inc->gap, 0, NULL) + 2;
+    if (xdl_incr_grow_lines(inc, m) < 0)
+        return -1;
+
+    memmove(inc->buf + offset + size, inc->buf + offset + len, inc->gap - offset - len);
+    if (size)
+        memcpy(inc->buf + offset, text, size);
+    inc->gap += size - len;
+    m = xdl_incr_split(inc->buf + start, inc->buf + inc->gap, start, inc->ends2 + *l0);
+    inc->lgap = *l0 + m;
+    *dl = m - (*l1 - *l0);
+    inc->nrec2 += *dl;
+
+    return 0;
+}
+
+int xdl_incr_edit(xdlincr_t *inc, long offset, long len, char const *text, long size)
+{
+    long size2 = xdl_incr_size2(inc), l0, l1, dl;
+
+    if (inc->broken || offset < 0 || len < 0 || size < 0 || offset > size2 ||
+        len > size2 - offset)
+        return -1;
+    if (!len && !size)
+        return 0;
+    if (xdl_incr_splice(inc, offset, len, text, size, &l0, &l1, &dl) < 0)
+        return -1;
+    if (xdl_incr_update(inc, l0, l1, dl) < 0) {
+        inc->broken = 1;
+        return -1;
+    }
+
+    return 0;
+}
+
+int xdl_incr_append(xdlincr_t *inc, mmfile_t *mf1, char const *text, long size)
+{
+    long d1 = inc->nrec1, d2 = inc->nrec2, dl, n;
+    long *ends;
+
+    if (inc->broken || size < 0 || (mf1 && mf1->size < inc->mf1.size))
+        return -1;
+
+    if (mf1 && mf1->size > inc->mf1.size) {
+        if (d1 && mf1->ptr[inc->mf1.size - 1] != '\n')
+            d1--;
+        n = xdl_incr_split(mf1->ptr + (d1 ? inc->ends1[d1 - 1] : 0), mf1->ptr + mf1->size, 0,
+                           NULL);
+        if (!(ends = (long *)xdl_realloc(inc->ends1, (d1 + n + 1) * sizeof(long))))
+            return -1;
+        inc->ends1 = ends;
+        xdl_incr_split(mf1->ptr + (d1 ? ends[d1 - 1] : 0), mf1->ptr + mf1->size,
+                       d1 ? ends[d1 - 1] : 0, ends + d1);
+        inc->nrec1 = d1 + n;
+    }
+    if (mf1)
+        inc->mf1 = *mf1;
+    if (size && xdl_incr_splice(inc, xdl_incr_size2(inc), 0, text, size, &d2, &n, &dl) < 0)
+        return -1;
+
+    if ((d1 < inc->nrec1 || d2 < inc->nrec2) && xdl_incr_update_tail(inc, d1, d2) < 0) {
+        inc->broken = 1;
+        return -1;
+    }
+
+    return 0;
+}
+
+long xdl_incr_size(xdlincr_t const *inc)
+{
+    return xdl_incr_size2(inc);
+}
+
+long xdl_incr_read(xdlincr_t const *inc, long offset, char *dest, long size)
+{
+    size = XDL_MIN(size, xdl_incr_size2(inc) - offset);
+    if (offset < 0 || size <= 0)
+        return 0;
+    xdl_incr_copy(inc, offset, dest, size);
+
+    return size;
+}
+
+int xdl_incr_hunks(xdlincr_t const *inc, xdl_emit_hunk_consume_func_t fn, void *priv)
+{
+    long k;
+
+    if (inc->broken)
+        return -1;
+    for (k = 0; k < inc->nchg; k++)
+        if (fn(inc->chg[k].i1, inc->chg[k].chg1, inc->chg[k].i2, inc->chg[k].chg2, priv) < 0)
+            return -1;
+
+    return 0;
+}
+
+/* Records pointing in the two files, enough for the emitters */
+static int xdl_incr_file(xdfile_t *xdf, xrecord_t *recs, char const *ptr, long const *ends,
+                         long nrec)
+{
+    long i;
+
+    memset(xdf, 0, sizeof(*xdf));
+    if (!XDL_ALLOC_ARRAY(xdf->recs, nrec + 1))
+        return -1;
+    for (i = 0; i < nrec; i++) {
+        recs[i].next = NULL;
+        recs[i].ptr = ptr + (i ? ends[i - 1] : 0);
+        recs[i].size = ends[i] - (i ? ends[i - 1] : 0);
+        recs[i].ha = 0;
+        xdf->recs[i] = &recs[i];
+    }
+    xdf->nrec = nrec;
+
+    return 0;
+}
+
+int xdl_incr_emit(xdlincr_t *inc, xdemitconf_t const *xecfg, xdemitcb_t *ecb)
+{
+    xdfenv_t xe;
+    xdchange_t *xscr = NULL, *xch;
+    xrecord_t *recs = NULL;
+    long k;
+    int ret = -1;
+
+    if (inc->broken)
+        return -1;
+    if (!inc->nchg)
+        return 0;
+
+    /* Lay file2 out in one piece, by moving the gap to its end */
+    xdl_incr_move_gap(inc, inc->nrec2);
+    memset(&xe, 0, sizeof(xe));
+    if (!XDL_ALLOC_ARRAY(recs, inc->nrec1 + inc->nrec2 + 1) ||
+        xdl_incr_file(&xe.xdf1, recs, inc->mf1.ptr, inc->ends1, inc->nrec1) < 0 ||
+        xdl_incr_file(&xe.xdf2, recs + inc->nrec1, inc->buf, inc->ends2, inc->nrec2) < 0)
+        goto out;
+    for (k = inc->nchg - 1; k >= 0; k--) {
+        if (!(xch = xdl_add_change(xscr, inc->chg[k].i1, inc->chg[k].i2, inc->chg[k].chg1,
+                                   inc->chg[k].chg2)))
+            goto out;
+        xscr = xch;
+    }
+    xdl_mark_ignorable(xscr, &xe, &inc->xpp);
+    if (xecfg->hunk_func)
+        ret = xdl_call_hunk_func(&xe, xscr, ecb, xecfg);
+    else
+        ret = xdl_emit_diff(&xe, xscr, ecb, xecfg);
+
+out:
+    xdl_free_script(xscr);
+    xdl_free(xe.xdf2.recs);
+    xdl_free(xe.xdf1.recs);
+    xdl_free(recs);
+    return ret;
+}
+
+void xdl_incr_free(xdlincr_t *inc)
+{
+    if (!inc)
+        return;
+    xdl_free(inc->chg);
+    xdl_free(inc->ends2);
+    xdl_free(inc->buf);
+    xdl_free(inc->ends1);
+    xdl_free(inc);
+}
@@ -0,0 +1,180 @@
+/*
+ *  LibXDiff by Davide Libenzi ( File Differential Library )
+ *  Copyright (C) 2003  Davide Libenzi
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Davide Libenzi <davidel@xmailserver.org>
+ *
+ */
+
+#include "xinclude.h"
+
+/* The map belongs to the caller, so it comes from the C library */
+static long *xdl_map_alloc(long nr)
+{
+    xdlalloc_t const *prev = xdl_alloc_push(NULL);
+    long *ptr;
+
+    XDL_ALLOC_ARRAY(ptr, nr);
+    xdl_alloc_pop(prev);
+    return ptr;
+}
+
+/*
+ * Treat the lines of each change the diff would not show as unchanged,
+ * when the change has as many lines on both sides to pair up.
+ */
+static int xdl_map_ignorable(xdfenv_t *xe, xpparam_t const *xpp)
+{
+    xdchange_t *xscr, *xch;
+
+    if (!(xpp->flags & XDF_IGNORE_BLANK_LINES) && !xpp->ignore_regex)
+        return 0;
+    if (xdl_build_script(xe, &xscr) < 0)
+        return -1;
+    xdl_mark_ignorable(xscr, xe, xpp);
+    for (xch = xscr; xch; xch = xch->next) {
+        if (xch->ignore && xch->chg1 == xch->chg2) {
+            memset(xe->xdf1.rchg + xch->i1, 0, xch->chg1);
+            memset(xe->xdf2.rchg + xch->i2, 0, xch->chg2);
+        }
+    }
+    xdl_free_script(xscr);
+
+    return 0;
+}
+
+/* Record the runs of lines left unchanged in both files of a diffed environment */
+int xdl_line_map_env(xdfenv_t *xe, xpparam_t const *xpp, xdllinemap_t *map)
+{
+    char const *rchg1, *rchg2;
+    long i1, i2, n1, n2, k, nr;
+
+    xdl_meter_phase(XDL_MEM_SCRIPT);
+    if (xdl_change_compact(&xe->xdf1, &xe->xdf2, xpp->flags) < 0 ||
+        xdl_change_compact(&xe->xdf2, &xe->xdf1, xpp->flags) < 0 ||
+        xdl_map_ignorable(xe, xpp) < 0)
+        return -1;
+
+    /*
+     * The unchanged lines of the two files pair up in order, so a run
+     * ends wherever either side has a change. Count the runs first to
+     * size the arrays, then fill them.
+     */
+    rchg1 = xe->xdf1.rchg;
+    rchg2 = xe->xdf2.rchg;
+    n1 = xe->xdf1.nrec;
+    n2 = xe->xdf2.nrec;
+    for (k = 0; k < 2; k++) {
+        for (nr = 0, i1 = i2 = 0; i1 < n1 && i2 < n2;) {
+            if (rchg1[i1]) {
+                i1++;
+            } else if (rchg2[i2]) {
+                i2++;
+            } else {
+                if (k) {
+                    map->start1[nr] = i1;
+                    map->start2[nr] = i2;
+                }
+                for (; i1 < n1 && i2 < n2 && !rchg1[i1] && !rchg2[i2]; i1++, i2++)
+                    ;
+                if (k)
+                    map->len[nr] = i1 - map->start1[nr];
+                nr++;
+            }
+        }
+        if (!k) {
+            if (!(map->start1 = xdl_map_alloc(3 * nr + 1)))
+                return -1;
+            map->start2 = map->start1 + nr;
+            map->len = map->start2 + nr;
+        }
+    }
+    map->nrec1 = n1;
+    map->nrec2 = n2;
+    map->nr = nr;
+
+    return 0;
+}
+
+static int xdl_line_map_run(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+                            xdllinemap_t *map)
+{
+    xdfenv_t xe;
+    int ret;
+
+    if (xpp->stats)
+        memset(xpp->stats, 0, sizeof(*xpp->stats));
+    if (xdl_do_diff(mf1, mf2, xpp, &xe) < 0)
+        return -1;
+    ret = xdl_line_map_env(&xe, xpp, map);
+    xdl_free_env(&xe);
+
+    return ret;
+}
+
+int xdl_line_map(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp, xdllinemap_t *map)
+{
+    xdlalloc_t const *prev;
+    xdlmeter_t meter;
+    int ret;
+
+    memset(map, 0, sizeof(*map));
+    if (xdl_meter_wanted(xpp)) {
+        xdl_meter_init(&meter, xpp);
+        prev = xdl_alloc_push(&meter.alloc);
+    } else {
+        prev = xdl_alloc_push(xpp->alloc);
+    }
+    ret = xdl_line_map_run(mf1, mf2, xpp, map);
+    xdl_alloc_pop(prev);
+
+    return ret;
+}
+
+/* Line of the other file matching 'line', looked up by bisecting the runs */
+static long xdl_map_lookup(long const *from, long const *to, long const *len, long nr, long line)
+{
+    long lo, hi, mid;
+
+    for (lo = 0, hi = nr; lo < hi;) {
+        mid = lo + (hi - lo) / 2;
+        if (from[mid] <= line)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (!lo || line >= from[lo - 1] + len[lo - 1])
+        return -1;
+
+    return to[lo - 1] + line - from[lo - 1];
+}
+
+long xdl_line_map_new(xdllinemap_t const *map, long line1)
+{
+    return xdl_map_lookup(map->start1, map->start2, map->len, map->nr, line1);
+}
+
+long xdl_line_map_old(xdllinemap_t const *map, long line2)
+{
+    return xdl_map_lookup(map->start2, map->start1, map->len, map->nr, line2);
+}
+
+void xdl_line_map_free(xdllinemap_t *map)
+{
+    xdl_free(map->start1);
+    memset(map, 0, sizeof(*map));
+}
@@ -466,6 +466,16 @@ static int xdl_simplify_non_conflicts(xdfenv_t *xe1, xdmerge_t *m, int simplify_
     }
 }
 
+/* The result belongs to the caller, so it comes from the C library */
+static void *xdl_result_alloc(size_t size)
+{
+    xdlalloc_t const *prev = xdl_alloc_push(NULL);
+    void *ptr = xdl_malloc(size);
+
+    xdl_alloc_pop(prev);
+    return ptr;
+}
+
 /*
  * level == 0: mark all overlapping changes as conflict
  * level == 1: mark overlapping changes as conflict only if not identical
@@ -628,7 +638,7 @@ static int xdl_do_merge(xdfenv_t *xe1, xdchange_t *xscr1, xdfenv_t *xe2, xdchang
         int marker_size = xmp->marker_size;
         int size = xdl_fill_merge_buffer(xe1, name1, xe2, name2, ancestor_name, favor, changes,
                                          NULL, style, marker_size);
-        result->ptr = xdl_malloc(size);
+        result->ptr = xdl_result_alloc(size);
         if (!result->ptr) {
             xdl_cleanup_merge(changes);
             return -1;
@@ -640,50 +650,56 @@ static int xdl_do_merge(xdfenv_t *xe1, xdchange_t *xscr1, xdfenv_t *xe2, xdchang
     return xdl_cleanup_merge(changes);
 }
 
-int xdl_merge(mmfile_t *orig, mmfile_t *mf1, mmfile_t *mf2, xmparam_t const *xmp,
-              mmbuffer_t *result)
+static int xdl_merge_run(mmfile_t *orig, mmfile_t *mf1, mmfile_t *mf2, xmparam_t const *xmp,
+                         mmbuffer_t *result)
 {
     xdchange_t *xscr1 = NULL, *xscr2 = NULL;
     xdfenv_t xe1, xe2;
     int status = -1;
     xpparam_t const *xpp = &xmp->xpp;
+    double t;
 
-    result->ptr = NULL;
-    result->size = 0;
-
+    if (xpp->stats)
+        memset(xpp->stats, 0, sizeof(*xpp->stats));
     if (xdl_do_diff(orig, mf1, xpp, &xe1) < 0)
         return -1;
 
+    xdl_meter_phase(XDL_MEM_PREPARE);
     if (xdl_do_diff(orig, mf2, xpp, &xe2) < 0)
         goto free_xe1; /* avoid double free of xe2 */
 
+    xdl_meter_phase(XDL_MEM_SCRIPT);
+    t = xpp->stats ? xdl_clock() : 0;
     if (xdl_change_compact(&xe1.xdf1, &xe1.xdf2, xpp->flags) < 0 ||
         xdl_change_compact(&xe1.xdf2, &xe1.xdf1, xpp->flags) < 0 ||
-        xdl_build_script(&xe1, &xscr1) < 0)
+        xdl_change_compact(&xe2.xdf1, &xe2.xdf2, xpp->flags) < 0 ||
+        xdl_change_compact(&xe2.xdf2, &xe2.xdf1, xpp->flags) < 0)
         goto out;
+    xdl_stats_time(xpp->stats, XDL_PHASE_COMPACT, &t);
 
-    if (xdl_change_compact(&xe2.xdf1, &xe2.xdf2, xpp->flags) < 0 ||
-        xdl_change_compact(&xe2.xdf2, &xe2.xdf1, xpp->flags) < 0 ||
-        xdl_build_script(&xe2, &xscr2) < 0)
+    if (xdl_build_script(&xe1, &xscr1) < 0 || xdl_build_script(&xe2, &xscr2) < 0)
         goto out;
+    xdl_stats_time(xpp->stats, XDL_PHASE_SCRIPT, &t);
 
     if (!xscr1) {
-        result->ptr = xdl_malloc(mf2->size);
+        result->ptr = xdl_result_alloc(mf2->size);
         if (!result->ptr)
             goto out;
         status = 0;
         memcpy(result->ptr, mf2->ptr, mf2->size);
         result->size = mf2->size;
     } else if (!xscr2) {
-        result->ptr = xdl_malloc(mf1->size);
+        result->ptr = xdl_result_alloc(mf1->size);
         if (!result->ptr)
             goto out;
         status = 0;
         memcpy(result->ptr, mf1->ptr, mf1->size);
         result->size = mf1->size;
     } else {
+        xdl_meter_phase(XDL_MEM_EMIT);
         status = xdl_do_merge(&xe1, xscr1, &xe2, xscr2, xmp, result);
     }
+    xdl_stats_time(xpp->stats, XDL_PHASE_EMIT, &t);
 out:
     xdl_free_script(xscr1);
     xdl_free_script(xscr2);
@@ -694,3 +710,24 @@ free_xe1:
 
     return status;
 }
+
+int xdl_merge(mmfile_t *orig, mmfile_t *mf1, mmfile_t *mf2, xmparam_t const *xmp,
+              mmbuffer_t *result)
+{
+    xdlalloc_t const *prev;
+    xdlmeter_t meter;
+    int status;
+
+    if (xdl_meter_wanted(&xmp->xpp)) {
+        xdl_meter_init(&meter, &xmp->xpp);
+        prev = xdl_alloc_push(&meter.alloc);
+    } else {
+        prev = xdl_alloc_push(xmp->xpp.alloc);
+    }
+
+    result->ptr = NULL;
+    result->size = 0;
+    status = xdl_merge_run(orig, mf1, mf2, xmp, result);
+    xdl_alloc_pop(prev);
+    return status;
+}
@@ -300,6 +300,9 @@ static int fall_back_to_classic_diff(struct hashmap *map, int line1, int count1,
 
     memset(&xpp, 0, sizeof(xpp));
     xpp.flags = map->xpp->flags & ~XDF_DIFF_ALGORITHM_MASK;
+    xpp.stats = map->xpp->stats;
+    if (xpp.stats)
+        xpp.stats->patience_fallbacks++;
 
     return xdl_fall_back_diff(map->env, &xpp, line1, count1, line2, count2);
 }
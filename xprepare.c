@@ -37,6 +37,18 @@ typedef struct s_xdlclass {
     long len1, len2;
 } xdlclass_t;
 
+/*
+ * Byte ranges at both ends of the files that are identical. The first
+ * file classifies their lines as usual, the second file only splits
+ * them into records and takes the class of the matching record of the
+ * first file, so that the classes and their counts stay the same.
+ */
+typedef struct s_xdltrim {
+    long pfx, sfx;    /* bytes of common prefix and suffix */
+    xrecord_t **recs; /* records of the first file */
+    long sfx_rec;     /* first record of the suffix in the first file */
+} xdltrim_t;
+
 typedef struct s_xdlclassifier {
     unsigned int hbits;
     long hsize;
@@ -52,11 +64,18 @@ static int xdl_init_classifier(xdlclassifier_t *cf, long size, long flags);
 static void xdl_free_classifier(xdlclassifier_t *cf);
 static int xdl_classify_record(unsigned int pass, xdlclassifier_t *cf, xrecord_t **rhash,
                                unsigned int hbits, xrecord_t *rec);
+static void xdl_trimmed_record(xdlclassifier_t *cf, xrecord_t **rhash, unsigned int hbits,
+                               xrecord_t *rec, xrecord_t const *twin);
+static void xdl_trim_common(mmfile_t *mf1, mmfile_t *mf2, xdltrim_t *trim);
+static xdlindex_t const *xdl_index_usable(xdlindex_t const *index, mmfile_t *mf,
+                                          unsigned long flags);
 static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_t const *xpp,
-                           xdlclassifier_t *cf, xdfile_t *xdf);
+                           xdlclassifier_t *cf, xdltrim_t *trim, xdfile_t *xdf);
 static void xdl_free_ctx(xdfile_t *xdf);
 static int xdl_clean_mmatch(char const *dis, long i, long s, long e);
+static void xdl_cleanup_file(xdfile_t *xdf, char const *dis);
 static int xdl_cleanup_records(xdlclassifier_t *cf, xdfile_t *xdf1, xdfile_t *xdf2);
+static int xdl_cleanup_classed(long nclass, xdfile_t *xdf1, xdfile_t *xdf2);
 static int xdl_trim_ends(xdfile_t *xdf1, xdfile_t *xdf2);
 static int xdl_optimize_ctxs(xdlclassifier_t *cf, xdfile_t *xdf1, xdfile_t *xdf2);
 
@@ -94,35 +113,42 @@ static void xdl_free_classifier(xdlclassifier_t *cf)
     xdl_cha_free(&cf->ncha);
 }
 
-static int xdl_classify_record(unsigned int pass, xdlclassifier_t *cf, xrecord_t **rhash,
-                               unsigned int hbits, xrecord_t *rec)
+/* Look up the class of a hashed record, adding a new class for a line not seen before */
+static xdlclass_t *xdl_find_class(xdlclassifier_t *cf, xrecord_t const *rec)
 {
     long hi;
-    char const *line;
     xdlclass_t *rcrec;
 
-    line = rec->ptr;
     hi = (long)XDL_HASHLONG(rec->ha, cf->hbits);
     for (rcrec = cf->rchash[hi]; rcrec; rcrec = rcrec->next)
         if (rcrec->ha == rec->ha &&
             xdl_recmatch(rcrec->line, rcrec->size, rec->ptr, rec->size, cf->flags))
-            break;
+            return rcrec;
+
+    if (!(rcrec = xdl_cha_alloc(&cf->ncha)))
+        return NULL;
+    rcrec->idx = cf->count++;
+    if (XDL_ALLOC_GROW(cf->rcrecs, cf->count, cf->alloc))
+        return NULL;
+    cf->rcrecs[rcrec->idx] = rcrec;
+    rcrec->line = rec->ptr;
+    rcrec->size = rec->size;
+    rcrec->ha = rec->ha;
+    rcrec->len1 = rcrec->len2 = 0;
+    rcrec->next = cf->rchash[hi];
+    cf->rchash[hi] = rcrec;
+
+    return rcrec;
+}
 
-    if (!rcrec) {
-        if (!(rcrec = xdl_cha_alloc(&cf->ncha))) {
-            return -1;
-        }
-        rcrec->idx = cf->count++;
-        if (XDL_ALLOC_GROW(cf->rcrecs, cf->count, cf->alloc))
-            return -1;
-        cf->rcrecs[rcrec->idx] = rcrec;
-        rcrec->line = line;
-        rcrec->size = rec->size;
-        rcrec->ha = rec->ha;
-        rcrec->len1 = rcrec->len2 = 0;
-        rcrec->next = cf->rchash[hi];
-        cf->rchash[hi] = rcrec;
-    }
+static int xdl_classify_record(unsigned int pass, xdlclassifier_t *cf, xrecord_t **rhash,
+                               unsigned int hbits, xrecord_t *rec)
+{
+    long hi;
+    xdlclass_t *rcrec;
+
+    if (!(rcrec = xdl_find_class(cf, rec)))
+        return -1;
 
     (pass == 1) ? rcrec->len1++ : rcrec->len2++;
 
@@ -135,20 +161,280 @@ static int xdl_classify_record(unsigned int pass, xdlclassifier_t *cf, xrecord_t
     return 0;
 }
 
+/*
+ * Class a record of the second file in the trimmed common ranges, with
+ * the class of its identical twin in the first file.
+ */
+static void xdl_trimmed_record(xdlclassifier_t *cf, xrecord_t **rhash, unsigned int hbits,
+                               xrecord_t *rec, xrecord_t const *twin)
+{
+    long hi;
+
+    rec->ha = twin->ha;
+    cf->rcrecs[rec->ha]->len2++;
+
+    hi = (long)XDL_HASHLONG(rec->ha, hbits);
+    rec->next = rhash[hi];
+    rhash[hi] = rec;
+}
+
+/*
+ * Find the common byte prefix and suffix of the two files, snapped to
+ * line boundaries.
+ */
+static void xdl_trim_common(mmfile_t *mf1, mmfile_t *mf2, xdltrim_t *trim)
+{
+    char const *a = mf1->ptr, *b = mf2->ptr;
+    long size1 = mf1->size, size2 = mf2->size;
+    long pfx, sfx, lim;
+
+    trim->pfx = trim->sfx = 0;
+    trim->recs = NULL;
+    trim->sfx_rec = 0;
+
+    if (!(lim = XDL_MIN(size1, size2)))
+        return;
+    pfx = xdl_common_prefix(a, b, lim);
+    if (!(pfx == size1 && pfx == size2) && !(pfx > 0 && a[pfx - 1] == '\n'))
+        for (; pfx > 0 && a[pfx - 1] != '\n'; pfx--)
+            ;
+
+    lim -= pfx;
+    sfx = xdl_common_suffix(a + size1, b + size2, lim);
+    if (sfx < size1 - pfx && a[size1 - sfx - 1] != '\n') {
+        char const *eol = memchr(a + size1 - sfx, '\n', sfx);
+        sfx = eol ? (long)(a + size1 - eol - 1) : 0;
+    }
+    if (sfx < size2 - pfx && b[size2 - sfx - 1] != '\n') {
+        char const *eol = memchr(b + size2 - sfx, '\n', sfx);
+        sfx = eol ? (long)(b + size2 - eol - 1) : 0;
+    }
+
+    trim->pfx = pfx;
+    trim->sfx = sfx;
+}
+
+int xdl_index_build(mmfile_t *mf, unsigned long flags, xdlindex_t *index)
+{
+    long nrec, nends, nha, bsize;
+    char const *blk, *cur, *top;
+
+    memset(index, 0, sizeof(*index));
+    nends = nha = xdl_guess_lines(mf, XDL_GUESS_NLINES1) + 1;
+    if (!XDL_ALLOC_ARRAY(index->ends, nends) || !XDL_ALLOC_ARRAY(index->ha, nha))
+        goto abort;
+
+    nrec = 0;
+    if ((cur = blk = xdl_mmfile_first(mf, &bsize))) {
+        for (top = blk + bsize; cur < top;) {
+            unsigned long hav = xdl_hash_record(&cur, top, flags);
+
+            if (XDL_ALLOC_GROW(index->ends, nrec + 1, nends) ||
+                XDL_ALLOC_GROW(index->ha, nrec + 1, nha))
+                goto abort;
+            index->ends[nrec] = (long)(cur - blk);
+            index->ha[nrec++] = hav;
+        }
+    }
+
+    index->ptr = mf->ptr;
+    index->size = mf->size;
+    index->flags = flags & XDF_WHITESPACE_FLAGS;
+    index->nrec = nrec;
+
+    return 0;
+
+abort:
+    xdl_index_free(index);
+    return -1;
+}
+
+int xdl_index_append(mmfile_t *mf, xdlindex_t *index)
+{
+    long nrec = index->nrec, nends = nrec, nha = nrec, bsize;
+    char const *blk, *cur, *top;
+
+    if (mf->size < index->size || index->image)
+        return -1;
+    if (!(blk = xdl_mmfile_first(mf, &bsize)) || bsize == index->size) {
+        index->ptr = mf->ptr;
+        return 0;
+    }
+
+    /* An incomplete last line goes on with the appended bytes */
+    if (nrec && blk[index->size - 1] != '\n')
+        nrec--;
+    for (cur = blk + (nrec ? index->ends[nrec - 1] : 0), top = blk + bsize; cur < top;) {
+        unsigned long hav = xdl_hash_record(&cur, top, index->flags);
+
+        if (XDL_ALLOC_GROW(index->ends, nrec + 1, nends) ||
+            XDL_ALLOC_GROW(index->ha, nrec + 1, nha))
+            goto abort;
+        index->ends[nrec] = (long)(cur - blk);
+        index->ha[nrec++] = hav;
+    }
+
+    index->ptr = mf->ptr;
+    index->size = mf->size;
+    index->nrec = nrec;
+
+    return 0;
+
+abort:
+    xdl_index_free(index);
+    return -1;
+}
+
+/*
+ * Header of a saved index, followed by the ends and then the hashes of
+ * the lines as arrays of long in the byte order of the writer. The
+ * checksum covers the content the image was saved for, then the ends
+ * and hashes.
+ */
+typedef struct s_xdlimage {
+    char magic[8];
+    uint32_t order;    /* XDL_IMAGE_ORDER as written, to detect the byte order */
+    uint32_t wordsize; /* sizeof(long) of the writer */
+    uint64_t flags;
+    uint64_t size;
+    uint64_t checksum;
+    uint64_t nrec;
+} xdlimage_t;
+
+#define XDL_IMAGE_MAGIC "XDLINDX2"
+#define XDL_IMAGE_ORDER 0x01020304U
+
+/* Checksum 'h' carried on over 'size' more bytes */
+static uint64_t xdl_image_checksum(uint64_t h, char const *ptr, long size)
+{
+    uint64_t w;
+
+    h ^= (uint64_t)size * 0x9e3779b97f4a7c15ULL;
+    for (; size >= 8; ptr += 8, size -= 8) {
+        memcpy(&w, ptr, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    for (; size; ptr++, size--)
+        h = (h ^ (unsigned char)*ptr) * 0x100000001b3ULL;
+    return h;
+}
+
+int xdl_index_save(xdlindex_t const *index, mmbuffer_t *image)
+{
+    xdlimage_t hdr;
+    long asize = index->nrec * (long)sizeof(long);
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, XDL_IMAGE_MAGIC, sizeof(hdr.magic));
+    hdr.order = XDL_IMAGE_ORDER;
+    hdr.wordsize = sizeof(long);
+    hdr.flags = index->flags;
+    hdr.size = index->size;
+    hdr.nrec = index->nrec;
+
+    image->size = (long)sizeof(hdr) + 2 * asize;
+    if (!(image->ptr = (char *)xdl_malloc(image->size)))
+        return -1;
+    memcpy(image->ptr + sizeof(hdr), index->ends, asize);
+    memcpy(image->ptr + sizeof(hdr) + asize, index->ha, asize);
+    hdr.checksum = xdl_image_checksum(xdl_image_checksum(0, index->ptr, index->size),
+                                      image->ptr + sizeof(hdr), 2 * asize);
+    memcpy(image->ptr, &hdr, sizeof(hdr));
+
+    return 0;
+}
+
+int xdl_index_load(mmfile_t *mf, unsigned long flags, char const *image, long size,
+                   xdlindex_t *index)
+{
+    xdlimage_t hdr;
+    long i, nrec, pos;
+    long const *ends;
+    char const *nl;
+
+    memset(index, 0, sizeof(*index));
+    if (size < (long)sizeof(hdr) || (uintptr_t)image % sizeof(long))
+        return -1;
+    memcpy(&hdr, image, sizeof(hdr));
+    if (memcmp(hdr.magic, XDL_IMAGE_MAGIC, sizeof(hdr.magic)) || hdr.order != XDL_IMAGE_ORDER ||
+        hdr.wordsize != sizeof(long) || hdr.flags != (flags & XDF_WHITESPACE_FLAGS) ||
+        hdr.size != (uint64_t)mf->size ||
+        hdr.nrec > (uint64_t)(size - sizeof(hdr)) / (2 * sizeof(long)) ||
+        size != (long)(sizeof(hdr) + 2 * hdr.nrec * sizeof(long)))
+        return -1;
+
+    nrec = (long)hdr.nrec;
+    ends = (long const *)(image + sizeof(hdr));
+    if (xdl_image_checksum(xdl_image_checksum(0, mf->ptr, mf->size), image + sizeof(hdr),
+                           size - (long)sizeof(hdr)) != hdr.checksum)
+        return -1;
+
+    /*
+     * Each line must end just past a newline of the content, or at its
+     * end, so a damaged image cannot mislead xdl_prepare_ctx()
+     */
+    for (i = 0, pos = 0; i < nrec; i++) {
+        if (pos >= mf->size)
+            return -1;
+        nl = (char const *)memchr(mf->ptr + pos, '\n', mf->size - pos);
+        pos = nl ? (long)(nl - mf->ptr) + 1 : mf->size;
+        if (ends[i] != pos)
+            return -1;
+    }
+    if (pos != mf->size)
+        return -1;
+
+    index->ptr = mf->ptr;
+    index->size = mf->size;
+    index->flags = flags & XDF_WHITESPACE_FLAGS;
+    index->nrec = nrec;
+    index->ends = (long *)ends;
+    index->ha = (unsigned long *)(ends + nrec);
+    index->image = 1;
+
+    return 0;
+}
+
+void xdl_index_free(xdlindex_t *index)
+{
+    if (!index->image) {
+        xdl_free(index->ends);
+        xdl_free(index->ha);
+    }
+    memset(index, 0, sizeof(*index));
+}
+
+/*
+ * An index is only trusted for the buffer it was built from, which
+ * also rules it out for the sub-ranges diffed by the fall-back paths.
+ */
+static xdlindex_t const *xdl_index_usable(xdlindex_t const *index, mmfile_t *mf,
+                                          unsigned long flags)
+{
+    if (!index || index->ptr != mf->ptr || index->size != mf->size ||
+        index->flags != (flags & XDF_WHITESPACE_FLAGS))
+        return NULL;
+    return index;
+}
+
 static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_t const *xpp,
-                           xdlclassifier_t *cf, xdfile_t *xdf)
+                           xdlclassifier_t *cf, xdltrim_t *trim, xdfile_t *xdf)
 {
     unsigned int hbits;
-    long nrec, hsize, bsize;
+    long nrec, hsize, bsize, npfx, nsfx;
     unsigned long hav;
-    char const *blk, *cur, *top, *prev;
+    char const *blk, *cur, *top, *prev, *pfx_end, *sfx_start;
     xrecord_t *crec;
     xrecord_t **recs;
     xrecord_t **rhash;
     unsigned long *ha;
     char *rchg;
     long *rindex;
+    xdlindex_t const *index;
+    char const *(*find_eol)(char const *, char const *) = xdl_kernels()->find_eol;
 
+    index = xdl_index_usable(pass == 1 ? xpp->index1 : xpp->index2, mf, xpp->flags);
     ha = NULL;
     rindex = NULL;
     rchg = NULL;
@@ -165,11 +451,23 @@ static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_
     if (!XDL_CALLOC_ARRAY(rhash, hsize))
         goto abort;
 
-    nrec = 0;
+    nrec = npfx = nsfx = 0;
     if ((cur = blk = xdl_mmfile_first(mf, &bsize))) {
-        for (top = blk + bsize; cur < top;) {
+        top = blk + bsize;
+        pfx_end = blk + trim->pfx;
+        sfx_start = top - trim->sfx;
+        while (cur < top) {
             prev = cur;
-            hav = xdl_hash_record(&cur, top, xpp->flags);
+            if (index) {
+                cur = blk + index->ends[nrec];
+                hav = index->ha[nrec];
+            } else if (pass == 2 && (cur < pfx_end || cur >= sfx_start)) {
+                if ((cur = find_eol(cur, top)) < top)
+                    cur++;
+                hav = 0;
+            } else {
+                hav = xdl_hash_record(&cur, top, xpp->flags);
+            }
             if (XDL_ALLOC_GROW(recs, nrec + 1, narec))
                 goto abort;
             if (!(crec = xdl_cha_alloc(&xdf->rcha)))
@@ -178,7 +476,13 @@ static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_
             crec->size = (long)(cur - prev);
             crec->ha = hav;
             recs[nrec++] = crec;
-            if (xdl_classify_record(pass, cf, rhash, hbits, crec) < 0)
+            if (pass == 1 && prev == sfx_start)
+                trim->sfx_rec = nrec - 1;
+            if (pass == 2 && prev < pfx_end)
+                xdl_trimmed_record(cf, rhash, hbits, crec, trim->recs[npfx++]);
+            else if (pass == 2 && prev >= sfx_start)
+                xdl_trimmed_record(cf, rhash, hbits, crec, trim->recs[trim->sfx_rec + nsfx++]);
+            else if (xdl_classify_record(pass, cf, rhash, hbits, crec) < 0)
                 goto abort;
         }
     }
@@ -227,10 +531,32 @@ static void xdl_free_ctx(xdfile_t *xdf)
     xdl_cha_free(&xdf->rcha);
 }
 
+/* Count the records and classes, and the shape of the classifier's hash chains */
+static void xdl_classifier_stats(xdlclassifier_t *cf, xdfenv_t *xe, xdlstats_t *stats)
+{
+    long i, len;
+    xdlclass_t *rcrec;
+
+    stats->records1 += xe->xdf1.nrec;
+    stats->records2 += xe->xdf2.nrec;
+    stats->classes += cf->count;
+    for (i = 0; i < cf->hsize; i++) {
+        for (len = 0, rcrec = cf->rchash[i]; rcrec; rcrec = rcrec->next)
+            len++;
+        if (len)
+            stats->buckets++;
+        if (len > stats->chain_max)
+            stats->chain_max = len;
+    }
+}
+
 int xdl_prepare_env(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp, xdfenv_t *xe)
 {
     long enl1, enl2, sample;
     xdlclassifier_t cf;
+    xdltrim_t trim;
+    xdlindex_t const *index;
+    double t = xpp->stats ? xdl_clock() : 0;
 
     memset(&cf, 0, sizeof(cf));
 
@@ -244,32 +570,59 @@ int xdl_prepare_env(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp, xdfenv_t
     sample =
         (XDF_DIFF_ALG(xpp->flags) == XDF_HISTOGRAM_DIFF ? XDL_GUESS_NLINES2 : XDL_GUESS_NLINES1);
 
-    enl1 = xdl_guess_lines(mf1, sample) + 1;
-    enl2 = xdl_guess_lines(mf2, sample) + 1;
+    if ((index = xdl_index_usable(xpp->index1, mf1, xpp->flags)))
+        enl1 = index->nrec + 1;
+    else
+        enl1 = xdl_guess_lines(mf1, sample) + 1;
+    if ((index = xdl_index_usable(xpp->index2, mf2, xpp->flags)))
+        enl2 = index->nrec + 1;
+    else
+        enl2 = xdl_guess_lines(mf2, sample) + 1;
 
     if (xdl_init_classifier(&cf, enl1 + enl2 + 1, xpp->flags) < 0)
         return -1;
 
-    if (xdl_prepare_ctx(1, mf1, enl1, xpp, &cf, &xe->xdf1) < 0) {
+    /*
+     * Identical leading and trailing lines are hashed and looked up in
+     * the classifier once, for the first file only.
+     */
+    if (!(xpp->flags & XDF_NO_TRIM_COMMON))
+        xdl_trim_common(mf1, mf2, &trim);
+    else
+        memset(&trim, 0, sizeof(trim));
+
+    if (xdl_prepare_ctx(1, mf1, enl1, xpp, &cf, &trim, &xe->xdf1) < 0) {
         xdl_free_classifier(&cf);
         return -1;
     }
-    if (xdl_prepare_ctx(2, mf2, enl2, xpp, &cf, &xe->xdf2) < 0) {
+    trim.recs = xe->xdf1.recs;
+    if (xdl_prepare_ctx(2, mf2, enl2, xpp, &cf, &trim, &xe->xdf2) < 0) {
         xdl_free_ctx(&xe->xdf1);
         xdl_free_classifier(&cf);
         return -1;
     }
 
+    if (xpp->stats) {
+        xdl_classifier_stats(&cf, xe, xpp->stats);
+        xdl_stats_time(xpp->stats, XDL_PHASE_PREPARE, &t);
+    }
+
     if ((XDF_DIFF_ALG(xpp->flags) != XDF_PATIENCE_DIFF) &&
-        (XDF_DIFF_ALG(xpp->flags) != XDF_HISTOGRAM_DIFF) &&
-        xdl_optimize_ctxs(&cf, &xe->xdf1, &xe->xdf2) < 0) {
-        xdl_free_ctx(&xe->xdf2);
-        xdl_free_ctx(&xe->xdf1);
-        xdl_free_classifier(&cf);
-        return -1;
+        (XDF_DIFF_ALG(xpp->flags) != XDF_HISTOGRAM_DIFF)) {
+        if (xdl_optimize_ctxs(&cf, &xe->xdf1, &xe->xdf2) < 0) {
+            xdl_free_ctx(&xe->xdf2);
+            xdl_free_ctx(&xe->xdf1);
+            xdl_free_classifier(&cf);
+            return -1;
+        }
+        if (xpp->stats)
+            xpp->stats->discarded += xe->xdf1.dend - xe->xdf1.dstart + 1 - xe->xdf1.nreff +
+                                     xe->xdf2.dend - xe->xdf2.dstart + 1 - xe->xdf2.nreff;
+        xdl_stats_time(xpp->stats, XDL_PHASE_CLEANUP, &t);
     }
 
     xdl_free_classifier(&cf);
+    xdl_stats_time(xpp->stats, XDL_PHASE_PREPARE, &t);
 
     return 0;
 }
@@ -280,6 +633,186 @@ void xdl_free_env(xdfenv_t *xe)
     xdl_free_ctx(&xe->xdf1);
 }
 
+long xdl_classify_files(mmfile_t *mfs, long nr, unsigned long flags, xrecord_t **recs,
+                        long *nrecs)
+{
+    long i, n, nalloc, size, bsize, nclass;
+    char const *blk, *cur, *top;
+    xdlclassifier_t cf;
+    xrecord_t *rec;
+    xdlclass_t *rcrec;
+
+    /* Versions of the same file share most of their lines, size for the largest */
+    for (i = 0, size = 0; i < nr; i++) {
+        recs[i] = NULL;
+        nrecs[i] = 0;
+        size = XDL_MAX(size, xdl_guess_lines(&mfs[i], XDL_GUESS_NLINES1) + 1);
+    }
+    if (xdl_init_classifier(&cf, 2 * size + 1, flags) < 0)
+        return -1;
+
+    for (i = 0; i < nr; i++) {
+        nalloc = xdl_guess_lines(&mfs[i], XDL_GUESS_NLINES1) + 1;
+        if (!XDL_ALLOC_ARRAY(recs[i], nalloc))
+            goto abort;
+        n = 0;
+        if ((cur = blk = xdl_mmfile_first(&mfs[i], &bsize))) {
+            for (top = blk + bsize; cur < top;) {
+                if (XDL_ALLOC_GROW(recs[i], n + 1, nalloc))
+                    goto abort;
+                rec = &recs[i][n++];
+                rec->next = NULL;
+                rec->ptr = cur;
+                rec->ha = xdl_hash_record(&cur, top, flags);
+                rec->size = (long)(cur - rec->ptr);
+                if (!(rcrec = xdl_find_class(&cf, rec)))
+                    goto abort;
+                rec->ha = (unsigned long)rcrec->idx;
+            }
+        }
+        nrecs[i] = n;
+    }
+
+    nclass = cf.count;
+    xdl_free_classifier(&cf);
+
+    return nclass;
+
+abort:
+    for (i = 0; i < nr; i++) {
+        xdl_free(recs[i]);
+        recs[i] = NULL;
+    }
+    xdl_free_classifier(&cf);
+    return -1;
+}
+
+/* Lines of a range that starts at a line boundary, the last one possibly incomplete */
+static long xdl_count_lines(char const *ptr, long size)
+{
+    long n = 0;
+    char const *end = ptr + size;
+
+    for (; ptr < end && (ptr = memchr(ptr, '\n', end - ptr)); ptr++)
+        n++;
+
+    return n + (size && end[-1] != '\n');
+}
+
+/*
+ * Count the lines the two files have in common. Only the classes are
+ * built, with the number of times each file has them, and a line is
+ * shared as many times as the file having it less often has it. The
+ * identical lines at both ends are counted without being classified.
+ */
+int xdl_count_shared(mmfile_t *mf1, mmfile_t *mf2, unsigned long flags, xdlsimilarity_t *sim)
+{
+    mmfile_t *mfs[2] = { mf1, mf2 };
+    xdltrim_t trim;
+    xdlclassifier_t cf;
+    xdlclass_t *rcrec;
+    xrecord_t rec;
+    long i, n, common;
+    char const *cur, *top;
+
+    xdl_trim_common(mf1, mf2, &trim);
+    common = xdl_count_lines(mf1->ptr, trim.pfx) +
+             xdl_count_lines(mf1->ptr + mf1->size - trim.sfx, trim.sfx);
+    if (xdl_init_classifier(&cf, xdl_guess_lines(mf1, XDL_GUESS_NLINES1) +
+                                     xdl_guess_lines(mf2, XDL_GUESS_NLINES1) + 1,
+                            flags) < 0)
+        return -1;
+
+    rec.next = NULL;
+    for (i = 0; i < 2; i++) {
+        cur = mfs[i]->ptr + trim.pfx;
+        top = mfs[i]->ptr + mfs[i]->size - trim.sfx;
+        for (n = 0; cur < top; n++) {
+            rec.ptr = cur;
+            rec.ha = xdl_hash_record(&cur, top, flags);
+            rec.size = (long)(cur - rec.ptr);
+            if (!(rcrec = xdl_find_class(&cf, &rec))) {
+                xdl_free_classifier(&cf);
+                return -1;
+            }
+            i ? rcrec->len2++ : rcrec->len1++;
+        }
+        if (i)
+            sim->nrec2 = n + common;
+        else
+            sim->nrec1 = n + common;
+    }
+
+    sim->shared = common;
+    for (i = 0; i < cf.count; i++)
+        sim->shared += XDL_MIN(cf.rcrecs[i]->len1, cf.rcrecs[i]->len2);
+    xdl_free_classifier(&cf);
+
+    return 0;
+}
+
+/* Set up one side of an environment over records that are already classed */
+static int xdl_classed_ctx(xrecord_t *crecs, long nrec, xpparam_t const *xpp, xdfile_t *xdf)
+{
+    long i;
+    xrecord_t **recs = NULL;
+    char *rchg = NULL;
+    long *rindex = NULL;
+    unsigned long *ha = NULL;
+
+    /* The records belong to the caller, the store stays empty */
+    memset(xdf, 0, sizeof(*xdf));
+    if (xdl_cha_init(&xdf->rcha, sizeof(xrecord_t), 1) < 0)
+        return -1;
+    if (!XDL_ALLOC_ARRAY(recs, nrec + 1) || !XDL_CALLOC_ARRAY(rchg, nrec + 2))
+        goto abort;
+    if ((XDF_DIFF_ALG(xpp->flags) != XDF_PATIENCE_DIFF) &&
+        (XDF_DIFF_ALG(xpp->flags) != XDF_HISTOGRAM_DIFF)) {
+        if (!XDL_ALLOC_ARRAY(rindex, nrec + 1) || !XDL_ALLOC_ARRAY(ha, nrec + 1))
+            goto abort;
+    }
+    for (i = 0; i < nrec; i++)
+        recs[i] = &crecs[i];
+
+    xdf->nrec = nrec;
+    xdf->recs = recs;
+    xdf->rchg = rchg + 1;
+    xdf->rindex = rindex;
+    xdf->ha = ha;
+    xdf->dstart = 0;
+    xdf->dend = nrec - 1;
+
+    return 0;
+
+abort:
+    xdl_free(ha);
+    xdl_free(rindex);
+    xdl_free(rchg);
+    xdl_free(recs);
+    return -1;
+}
+
+int xdl_prepare_classed(xrecord_t *recs1, long nrec1, xrecord_t *recs2, long nrec2,
+                        long nclass, xpparam_t const *xpp, xdfenv_t *xe)
+{
+    if (xdl_classed_ctx(recs1, nrec1, xpp, &xe->xdf1) < 0)
+        return -1;
+    if (xdl_classed_ctx(recs2, nrec2, xpp, &xe->xdf2) < 0) {
+        xdl_free_ctx(&xe->xdf1);
+        return -1;
+    }
+
+    xdl_trim_ends(&xe->xdf1, &xe->xdf2);
+    if ((XDF_DIFF_ALG(xpp->flags) != XDF_PATIENCE_DIFF) &&
+        (XDF_DIFF_ALG(xpp->flags) != XDF_HISTOGRAM_DIFF) &&
+        xdl_cleanup_classed(nclass, &xe->xdf1, &xe->xdf2) < 0) {
+        xdl_free_env(xe);
+        return -1;
+    }
+
+    return 0;
+}
+
 static int xdl_clean_mmatch(char const *dis, long i, long s, long e)
 {
     long r, rdis0, rpdis0, rdis1, rpdis1;
@@ -345,7 +878,7 @@ static int xdl_clean_mmatch(char const *dis, long i, long s, long e)
  */
 static int xdl_cleanup_records(xdlclassifier_t *cf, xdfile_t *xdf1, xdfile_t *xdf2)
 {
-    long i, nm, nreff, mlim;
+    long i, nm, mlim;
     xrecord_t **recs;
     xdlclass_t *rcrec;
     char *dis, *dis1, *dis2;
@@ -371,35 +904,80 @@ static int xdl_cleanup_records(xdlclassifier_t *cf, xdfile_t *xdf1, xdfile_t *xd
         dis2[i] = (nm == 0) ? 0 : (nm >= mlim) ? 2 : 1;
     }
 
-    for (nreff = 0, i = xdf1->dstart, recs = &xdf1->recs[xdf1->dstart]; i <= xdf1->dend;
-         i++, recs++) {
-        if (dis1[i] == 1 ||
-            (dis1[i] == 2 && !xdl_clean_mmatch(dis1, i, xdf1->dstart, xdf1->dend))) {
-            xdf1->rindex[nreff] = i;
-            xdf1->ha[nreff] = (*recs)->ha;
-            nreff++;
-        } else
-            xdf1->rchg[i] = 1;
+    xdl_cleanup_file(xdf1, dis1);
+    xdl_cleanup_file(xdf2, dis2);
+
+    xdl_free(dis);
+
+    return 0;
+}
+
+/*
+ * The same for records classed ahead of time by xdl_classify_files(),
+ * counting the matches of each class in the lines left to diff.
+ */
+static int xdl_cleanup_classed(long nclass, xdfile_t *xdf1, xdfile_t *xdf2)
+{
+    long i, nm, mlim;
+    long *len1, *len2;
+    char *dis, *dis1, *dis2;
+
+    if (!XDL_CALLOC_ARRAY(len1, 2 * nclass + 1))
+        return -1;
+    len2 = len1 + nclass;
+    if (!XDL_CALLOC_ARRAY(dis, xdf1->nrec + xdf2->nrec + 2)) {
+        xdl_free(len1);
+        return -1;
     }
-    xdf1->nreff = nreff;
+    dis1 = dis;
+    dis2 = dis1 + xdf1->nrec + 1;
 
-    for (nreff = 0, i = xdf2->dstart, recs = &xdf2->recs[xdf2->dstart]; i <= xdf2->dend;
-         i++, recs++) {
-        if (dis2[i] == 1 ||
-            (dis2[i] == 2 && !xdl_clean_mmatch(dis2, i, xdf2->dstart, xdf2->dend))) {
-            xdf2->rindex[nreff] = i;
-            xdf2->ha[nreff] = (*recs)->ha;
-            nreff++;
-        } else
-            xdf2->rchg[i] = 1;
+    for (i = xdf1->dstart; i <= xdf1->dend; i++)
+        len1[xdf1->recs[i]->ha]++;
+    for (i = xdf2->dstart; i <= xdf2->dend; i++)
+        len2[xdf2->recs[i]->ha]++;
+
+    if ((mlim = xdl_bogosqrt(xdf1->nrec)) > XDL_MAX_EQLIMIT)
+        mlim = XDL_MAX_EQLIMIT;
+    for (i = xdf1->dstart; i <= xdf1->dend; i++) {
+        nm = len2[xdf1->recs[i]->ha];
+        dis1[i] = (nm == 0) ? 0 : (nm >= mlim) ? 2 : 1;
     }
-    xdf2->nreff = nreff;
+
+    if ((mlim = xdl_bogosqrt(xdf2->nrec)) > XDL_MAX_EQLIMIT)
+        mlim = XDL_MAX_EQLIMIT;
+    for (i = xdf2->dstart; i <= xdf2->dend; i++) {
+        nm = len1[xdf2->recs[i]->ha];
+        dis2[i] = (nm == 0) ? 0 : (nm >= mlim) ? 2 : 1;
+    }
+
+    xdl_cleanup_file(xdf1, dis1);
+    xdl_cleanup_file(xdf2, dis2);
 
     xdl_free(dis);
+    xdl_free(len1);
 
     return 0;
 }
 
+/* Keep the records the discard marks allow for the algorithm, and mark the others changed */
+static void xdl_cleanup_file(xdfile_t *xdf, char const *dis)
+{
+    long i, nreff;
+    xrecord_t **recs;
+
+    for (nreff = 0, i = xdf->dstart, recs = &xdf->recs[xdf->dstart]; i <= xdf->dend;
+         i++, recs++) {
+        if (dis[i] == 1 || (dis[i] == 2 && !xdl_clean_mmatch(dis, i, xdf->dstart, xdf->dend))) {
+            xdf->rindex[nreff] = i;
+            xdf->ha[nreff] = (*recs)->ha;
+            nreff++;
+        } else
+            xdf->rchg[i] = 1;
+    }
+    xdf->nreff = nreff;
+}
+
 /*
  * Early trim initial and terminal matching records.
  */
@@ -25,5 +25,10 @@
 
 int xdl_prepare_env(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp, xdfenv_t *xe);
 void xdl_free_env(xdfenv_t *xe);
+long xdl_classify_files(mmfile_t *mfs, long nr, unsigned long flags, xrecord_t **recs,
+                        long *nrecs);
+int xdl_count_shared(mmfile_t *mf1, mmfile_t *mf2, unsigned long flags, xdlsimilarity_t *sim);
+int xdl_prepare_classed(xrecord_t *recs1, long nrec1, xrecord_t *recs2, long nrec2,
+                        long nclass, xpparam_t const *xpp, xdfenv_t *xe);
 
 #endif /* #if !defined(XPREPARE_H) */
@@ -0,0 +1,170 @@
+/*
+ *  LibXDiff by Davide Libenzi ( File Differential Library )
+ *  Copyright (C) 2003  Davide Libenzi
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Davide Libenzi <davidel@xmailserver.org>
+ *
+ */
+
+#include "xinclude.h"
+
+int xdl_similarity(mmfile_t *mf1, mmfile_t *mf2, unsigned long flags, xdlsimilarity_t *sim)
+{
+    memset(sim, 0, sizeof(*sim));
+
+    return xdl_count_shared(mf1, mf2, flags, sim);
+}
+
+/* Spread the bits of a line hash, whose low bits alone are a poor sample */
+static unsigned long xdl_sketch_mix(unsigned long ha)
+{
+    uint64_t h = (uint64_t)ha;
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return (unsigned long)h;
+}
+
+/* Occurrences seen so far of one line, by its mixed hash */
+typedef struct s_xdlsketchslot {
+    unsigned long ha;
+    long nr; /* 0 for a free slot */
+} xdlsketchslot_t;
+
+typedef struct s_xdlsketchcount {
+    xdlsketchslot_t *slots;
+    long size; /* A power of two */
+    long used;
+} xdlsketchcount_t;
+
+/* Count one more occurrence of the line hashed 'h' and return how many came before */
+static long xdl_sketch_count(xdlsketchcount_t *cnt, unsigned long h)
+{
+    xdlsketchslot_t *slots, *slot;
+    long i, k;
+
+    if (2 * (cnt->used + 1) > cnt->size) {
+        long size = cnt->size ? 2 * cnt->size : 1024;
+
+        if (!XDL_CALLOC_ARRAY(slots, size))
+            return -1;
+        for (i = 0; i < cnt->size; i++) {
+            if (!cnt->slots[i].nr)
+                continue;
+            for (k = cnt->slots[i].ha & (size - 1); slots[k].nr; k = (k + 1) & (size - 1))
+                ;
+            slots[k] = cnt->slots[i];
+        }
+        xdl_free(cnt->slots);
+        cnt->slots = slots;
+        cnt->size = size;
+    }
+    for (k = h & (cnt->size - 1);; k = (k + 1) & (cnt->size - 1)) {
+        slot = &cnt->slots[k];
+        if (!slot->nr) {
+            slot->ha = h;
+            cnt->used++;
+            break;
+        }
+        if (slot->ha == h)
+            break;
+    }
+
+    return slot->nr++;
+}
+
+int xdl_sketch(mmfile_t *mf, unsigned long flags, xdlsketch_t *sk)
+{
+    xdlsketchcount_t cnt;
+    long bsize, lo, hi, mid, k;
+    char const *cur, *top;
+    unsigned long h;
+
+    memset(sk, 0, sizeof(*sk));
+    memset(&cnt, 0, sizeof(cnt));
+    if (!(cur = xdl_mmfile_first(mf, &bsize)))
+        return 0;
+    for (top = cur + bsize; cur < top; sk->nrec++) {
+        /*
+         * Each copy of a line is an element of its own, the k-th one
+         * hashed with k, so that the sketches of two files compare
+         * their lines with repeats as xdl_similarity() counts them.
+         */
+        h = xdl_sketch_mix(xdl_hash_record(&cur, top, flags));
+        if ((k = xdl_sketch_count(&cnt, h)) < 0) {
+            xdl_free(cnt.slots);
+            memset(sk, 0, sizeof(*sk));
+            return -1;
+        }
+        if (k)
+            h = xdl_sketch_mix(h ^ (unsigned long)k * 0x9e3779b97f4a7c15ULL);
+        /* Most lines are above the largest hash kept once the sketch fills up */
+        if (sk->nr == XDL_SKETCH_SIZE && h >= sk->min[XDL_SKETCH_SIZE - 1])
+            continue;
+        for (lo = 0, hi = sk->nr; lo < hi;) {
+            mid = lo + (hi - lo) / 2;
+            if (sk->min[mid] < h)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo < sk->nr && sk->min[lo] == h)
+            continue;
+        if (sk->nr < XDL_SKETCH_SIZE)
+            sk->nr++;
+        memmove(sk->min + lo + 1, sk->min + lo, (sk->nr - 1 - lo) * sizeof(sk->min[0]));
+        sk->min[lo] = h;
+    }
+    xdl_free(cnt.slots);
+
+    return 0;
+}
+
+void xdl_sketch_similarity(xdlsketch_t const *sk1, xdlsketch_t const *sk2, xdlsimilarity_t *sim)
+{
+    long i1, i2, n, both;
+    double j, shared;
+
+    /*
+     * The smallest hashes of the union of the two sets are the smallest
+     * of the two sketches merged, and each sketch tells whether its set
+     * has them. The fraction found in both estimates the Jaccard index
+     * shared / (nrec1 + nrec2 - shared), the sets holding every copy of
+     * a line.
+     */
+    for (i1 = i2 = n = both = 0; n < XDL_SKETCH_SIZE && (i1 < sk1->nr || i2 < sk2->nr); n++) {
+        if (i2 == sk2->nr || (i1 < sk1->nr && sk1->min[i1] < sk2->min[i2])) {
+            i1++;
+        } else if (i1 == sk1->nr || sk2->min[i2] < sk1->min[i1]) {
+            i2++;
+        } else {
+            i1++;
+            i2++;
+            both++;
+        }
+    }
+
+    sim->nrec1 = sk1->nrec;
+    sim->nrec2 = sk2->nrec;
+    j = n ? (double)both / n : 1;
+    shared = j * (double)(sk1->nrec + sk2->nrec) / (1 + j) + 0.5;
+    sim->shared = XDL_MIN((long)shared, XDL_MIN(sk1->nrec, sk2->nrec));
+}
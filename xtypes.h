@@ -26,14 +26,15 @@
 typedef struct s_chanode {
     struct s_chanode *next;
     long icurr;
+    long nsize; /* Bytes of items the node holds */
+    int huge;   /* Mapped with huge pages instead of allocated */
 } chanode_t;
 
 typedef struct s_chastore {
     chanode_t *head, *tail;
-    long isize, nsize;
+    long isize, nsize; /* Size of an item and of the next node */
+    long ncount;       /* Nodes allocated */
     chanode_t *ancur;
-    chanode_t *sncur;
-    long scurr;
 } chastore_t;
 
 typedef struct s_xrecord {
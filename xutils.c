@@ -22,6 +22,61 @@
 
 #include "xinclude.h"
 
+#include <time.h>
+
+#if defined(XDL_X86_KERNELS)
+#include <immintrin.h>
+#endif
+
+#if defined(XDL_HUGE_PAGES)
+#include <sys/mman.h>
+
+/* Transparent huge page size, and the smallest node that is mapped with them */
+#define XDL_HUGE_PAGE (2 * 1024 * 1024)
+#endif
+
+#define XDL_CMP_BLOCK 256
+
+/* Nodes of a chastore_t allocated at the initial size, and the largest node */
+#define XDL_CHA_FIXED_NODES 4
+#define XDL_CHA_MAX_NODE (16 * 1024 * 1024)
+
+#if defined(_MSC_VER)
+#define XDL_THREAD_LOCAL __declspec(thread)
+#else
+#define XDL_THREAD_LOCAL __thread
+#endif
+
+static XDL_THREAD_LOCAL xdlalloc_t const *xdl_cur_alloc;
+
+/* Control bytes allowed per byte of text, as a divisor */
+#define XDL_BINARY_CTRL_RATIO 32
+
+/* Seconds from an arbitrary point, for measuring intervals */
+double xdl_clock(void)
+{
+    struct timespec ts;
+
+#if defined(CLOCK_MONOTONIC)
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+    return (double)ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Add the time since '*t' to 'phase' and restart the interval */
+void xdl_stats_time(xdlstats_t *stats, int phase, double *t)
+{
+    double now;
+
+    if (!stats)
+        return;
+    now = xdl_clock();
+    stats->time[phase] += now - *t;
+    *t = now;
+}
+
 long xdl_bogosqrt(long n)
 {
     long i;
@@ -72,38 +127,96 @@ int xdl_cha_init(chastore_t *cha, long isize, long icount)
     cha->head = cha->tail = NULL;
     cha->isize = isize;
     cha->nsize = icount * isize;
-    cha->ancur = cha->sncur = NULL;
-    cha->scurr = 0;
+    cha->ncount = 0;
+    cha->ancur = NULL;
 
     return 0;
 }
 
+#if defined(XDL_HUGE_PAGES)
+static chanode_t *xdl_cha_map(long size)
+{
+    size_t len = (sizeof(chanode_t) + size + XDL_HUGE_PAGE - 1) & ~(size_t)(XDL_HUGE_PAGE - 1);
+    void *ptr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (ptr == MAP_FAILED)
+        return NULL;
+    madvise(ptr, len, MADV_HUGEPAGE);
+    return (chanode_t *)ptr;
+}
+#endif
+
+static void xdl_cha_free_node(chanode_t *node)
+{
+#if defined(XDL_HUGE_PAGES)
+    if (node->huge) {
+        munmap(node, (sizeof(chanode_t) + node->nsize + XDL_HUGE_PAGE - 1) &
+                         ~(size_t)(XDL_HUGE_PAGE - 1));
+        return;
+    }
+#endif
+    xdl_free(node);
+}
+
 void xdl_cha_free(chastore_t *cha)
 {
     chanode_t *cur, *tmp;
 
     for (cur = cha->head; (tmp = cur) != NULL;) {
         cur = cur->next;
-        xdl_free(tmp);
+        xdl_cha_free_node(tmp);
     }
 }
 
+/* Empty the store but keep its nodes for the items allocated next */
+void xdl_cha_reset(chastore_t *cha)
+{
+    chanode_t *cur;
+
+    for (cur = cha->head; cur; cur = cur->next)
+        cur->icurr = 0;
+    cha->ancur = cha->head;
+}
+
 void *xdl_cha_alloc(chastore_t *cha)
 {
     chanode_t *ancur;
     void *data;
 
-    if (!(ancur = cha->ancur) || ancur->icurr == cha->nsize) {
-        if (!(ancur = (chanode_t *)xdl_malloc(sizeof(chanode_t) + cha->nsize))) {
-            return NULL;
+    if (!(ancur = cha->ancur) || ancur->icurr + cha->isize > ancur->nsize) {
+        if (ancur && ancur->next) {
+            ancur = ancur->next;
+        } else {
+            long nsize = XDL_MAX(cha->nsize, cha->isize);
+
+            ancur = NULL;
+#if defined(XDL_HUGE_PAGES)
+            /* Huge pages only come from the C library allocator's side */
+            if (nsize >= XDL_HUGE_PAGE && !xdl_cur_alloc && (ancur = xdl_cha_map(nsize)) != NULL)
+                ancur->huge = 1;
+#endif
+            if (!ancur) {
+                if (!(ancur = (chanode_t *)xdl_malloc(sizeof(chanode_t) + nsize)))
+                    return NULL;
+                ancur->huge = 0;
+            }
+            ancur->nsize = nsize;
+            ancur->next = NULL;
+            if (cha->tail)
+                cha->tail->next = ancur;
+            if (!cha->head)
+                cha->head = ancur;
+            cha->tail = ancur;
+
+            /*
+             * Callers size nodes for a quarter of the items they expect, so
+             * only a store outgrowing that estimate doubles its nodes, up to
+             * a limit.
+             */
+            if (++cha->ncount >= XDL_CHA_FIXED_NODES && cha->nsize <= XDL_CHA_MAX_NODE / 2)
+                cha->nsize *= 2;
         }
         ancur->icurr = 0;
-        ancur->next = NULL;
-        if (cha->tail)
-            cha->tail->next = ancur;
-        if (!cha->head)
-            cha->head = ancur;
-        cha->tail = ancur;
         cha->ancur = ancur;
     }
 
@@ -113,6 +226,240 @@ void *xdl_cha_alloc(chastore_t *cha)
     return data;
 }
 
+/*
+ * Length of the common prefix of two buffers. Large blocks are compared
+ * with memcmp() (which the C library vectorizes), the mismatching block
+ * is then narrowed down a machine word at a time, and the last few
+ * bytes one by one.
+ */
+long xdl_common_prefix(char const *a, char const *b, long size)
+{
+    long i = 0;
+
+    while (i + XDL_CMP_BLOCK <= size && !memcmp(a + i, b + i, XDL_CMP_BLOCK))
+        i += XDL_CMP_BLOCK;
+    for (; i + (long)sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t wa, wb;
+
+        memcpy(&wa, a + i, sizeof(wa));
+        memcpy(&wb, b + i, sizeof(wb));
+        if (wa != wb)
+            break;
+    }
+    for (; i < size && a[i] == b[i]; i++)
+        ;
+
+    return i;
+}
+
+/*
+ * Length of the common suffix of two buffers, scanning backwards from
+ * the passed end pointers. Mirror image of xdl_common_prefix().
+ */
+long xdl_common_suffix(char const *a, char const *b, long size)
+{
+    long i = 0;
+
+    while (i + XDL_CMP_BLOCK <= size &&
+           !memcmp(a - i - XDL_CMP_BLOCK, b - i - XDL_CMP_BLOCK, XDL_CMP_BLOCK))
+        i += XDL_CMP_BLOCK;
+    for (; i + (long)sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t wa, wb;
+
+        memcpy(&wa, a - i - sizeof(wa), sizeof(wa));
+        memcpy(&wb, b - i - sizeof(wb), sizeof(wb));
+        if (wa != wb)
+            break;
+    }
+    for (; i < size && a[-i - 1] == b[-i - 1]; i++)
+        ;
+
+    return i;
+}
+
+/*
+ * Control bytes that do not occur in text: those below the space
+ * except backspace, the whitespace controls and escape.
+ */
+static int xdl_is_ctrl(unsigned char c)
+{
+    return c < 0x20 && (c < 0x08 || c > 0x0d) && c != 0x1b;
+}
+
+long xdl_count_ctrl_scalar(unsigned char const *ptr, long size)
+{
+    long i, ctrl = 0;
+
+    for (i = 0; i < size; i++) {
+        if (!ptr[i])
+            return -1;
+        ctrl += xdl_is_ctrl(ptr[i]);
+    }
+    return ctrl;
+}
+
+char const *xdl_find_eol_scalar(char const *ptr, char const *top)
+{
+    for (; ptr < top && *ptr != '\n'; ptr++)
+        ;
+    return ptr;
+}
+
+char const *xdl_find_space_scalar(char const *ptr, char const *top)
+{
+    for (; ptr < top && !XDL_ISSPACE(*ptr); ptr++)
+        ;
+    return ptr;
+}
+
+#if defined(XDL_X86_KERNELS)
+/*
+ * The vector scans stop at the first block with a match and find it with
+ * the scalar code, which also handles the tail shorter than a vector.
+ */
+XDL_TARGET("sse2") long xdl_count_ctrl_sse2(unsigned char const *ptr, long size)
+{
+    /* Most text blocks have no control byte but whitespace */
+    const __m128i zero = _mm_setzero_si128(), last = _mm_set1_epi8(0x1f);
+    const __m128i ws = _mm_set1_epi8(0x08), ws_span = _mm_set1_epi8(0x0d - 0x08);
+    const __m128i esc = _mm_set1_epi8(0x1b);
+    long i = 0, ctrl = 0, rest;
+
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128((__m128i const *)(ptr + i));
+        __m128i below = _mm_cmpeq_epi8(_mm_min_epu8(v, last), v);
+        __m128i d = _mm_sub_epi8(v, ws);
+        __m128i text = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(d, ws_span), d),
+                                    _mm_cmpeq_epi8(v, esc));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_andnot_si128(text, below));
+
+        if (mask) {
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)))
+                return -1;
+            ctrl += __builtin_popcount(mask);
+        }
+    }
+    if ((rest = xdl_count_ctrl_scalar(ptr + i, size - i)) < 0)
+        return -1;
+    return ctrl + rest;
+}
+
+XDL_TARGET("avx2") long xdl_count_ctrl_avx2(unsigned char const *ptr, long size)
+{
+    const __m256i zero = _mm256_setzero_si256(), last = _mm256_set1_epi8(0x1f);
+    const __m256i ws = _mm256_set1_epi8(0x08), ws_span = _mm256_set1_epi8(0x0d - 0x08);
+    const __m256i esc = _mm256_set1_epi8(0x1b);
+    long i = 0, ctrl = 0, rest;
+
+    for (; i + 32 <= size; i += 32) {
+        __m256i v = _mm256_loadu_si256((__m256i const *)(ptr + i));
+        __m256i below = _mm256_cmpeq_epi8(_mm256_min_epu8(v, last), v);
+        __m256i d = _mm256_sub_epi8(v, ws);
+        __m256i text = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(d, ws_span), d),
+                                       _mm256_cmpeq_epi8(v, esc));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_andnot_si256(text, below));
+
+        if (mask) {
+            if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero)))
+                return -1;
+            ctrl += __builtin_popcount(mask);
+        }
+    }
+    if ((rest = xdl_count_ctrl_scalar(ptr + i, size - i)) < 0)
+        return -1;
+    return ctrl + rest;
+}
+
+XDL_TARGET("sse2") char const *xdl_find_eol_sse2(char const *ptr, char const *top)
+{
+    const __m128i nl = _mm_set1_epi8('\n');
+
+    for (; top - ptr >= 16; ptr += 16) {
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_loadu_si128((__m128i const *)ptr), nl));
+
+        if (mask)
+            return ptr + __builtin_ctz(mask);
+    }
+    return xdl_find_eol_scalar(ptr, top);
+}
+
+XDL_TARGET("avx2") char const *xdl_find_eol_avx2(char const *ptr, char const *top)
+{
+    const __m256i nl = _mm256_set1_epi8('\n');
+
+    for (; top - ptr >= 32; ptr += 32) {
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i const *)ptr), nl));
+
+        if (mask)
+            return ptr + __builtin_ctz(mask);
+    }
+    return xdl_find_eol_sse2(ptr, top);
+}
+
+XDL_TARGET("avx512f,avx512bw") char const *xdl_find_eol_avx512(char const *ptr, char const *top)
+{
+    const __m512i nl = _mm512_set1_epi8('\n');
+
+    for (; top - ptr >= 64; ptr += 64) {
+        __mmask64 mask = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512((void const *)ptr), nl);
+
+        if (mask)
+            return ptr + __builtin_ctzll(mask);
+    }
+    return xdl_find_eol_avx2(ptr, top);
+}
+
+/*
+ * Whitespace is 0x09 to 0x0d and the space in the C locale. Bytes from
+ * 0x80 up stop the scan as well, for the caller to judge in locales
+ * where some of them are whitespace.
+ */
+XDL_TARGET("sse2") char const *xdl_find_space_sse2(char const *ptr, char const *top)
+{
+    const __m128i tab = _mm_set1_epi8(0x09), span = _mm_set1_epi8(0x0d - 0x09);
+    const __m128i sp = _mm_set1_epi8(' '), high = _mm_set1_epi8((char)0x80);
+
+    for (; top - ptr >= 16; ptr += 16) {
+        __m128i v = _mm_loadu_si128((__m128i const *)ptr), d = _mm_sub_epi8(v, tab);
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(d, span), d),
+                                   _mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_and_si128(v, high)));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(hit);
+
+        if (mask)
+            return ptr + __builtin_ctz(mask);
+    }
+    return xdl_find_space_scalar(ptr, top);
+}
+
+XDL_TARGET("avx2") char const *xdl_find_space_avx2(char const *ptr, char const *top)
+{
+    const __m256i tab = _mm256_set1_epi8(0x09), span = _mm256_set1_epi8(0x0d - 0x09);
+    const __m256i sp = _mm256_set1_epi8(' '), high = _mm256_set1_epi8((char)0x80);
+
+    for (; top - ptr >= 32; ptr += 32) {
+        __m256i v = _mm256_loadu_si256((__m256i const *)ptr), d = _mm256_sub_epi8(v, tab);
+        __m256i hit =
+            _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(d, span), d),
+                            _mm256_or_si256(_mm256_cmpeq_epi8(v, sp), _mm256_and_si256(v, high)));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(hit);
+
+        if (mask)
+            return ptr + __builtin_ctz(mask);
+    }
+    return xdl_find_space_scalar(ptr, top);
+}
+#endif
+
+int xdl_mmfile_is_binary(mmfile_t *mmf, long limit)
+{
+    long size = limit > 0 ? XDL_MIN(limit, mmf->size) : mmf->size;
+    long ctrl = xdl_kernels()->count_ctrl((unsigned char const *)mmf->ptr, size);
+
+    return ctrl < 0 || ctrl > size / XDL_BINARY_CTRL_RATIO;
+}
+
 long xdl_guess_lines(mmfile_t *mf, long sample)
 {
     long nl = 0, size, tsize = 0;
@@ -247,8 +594,9 @@ int xdl_recmatch(const char *l1, long s1, const char *l2, long s2, long flags)
 static unsigned long xdl_hash_record_with_whitespace(char const **data, char const *top, long flags)
 {
     unsigned long ha = 5381;
-    char const *ptr = *data;
+    char const *ptr = *data, *end;
     int cr_at_eol_only = (flags & XDF_WHITESPACE_FLAGS) == XDF_IGNORE_CR_AT_EOL;
+    char const *(*find_space)(char const *, char const *) = xdl_kernels()->find_space;
 
     for (; ptr < top && *ptr != '\n'; ptr++) {
         if (cr_at_eol_only) {
@@ -274,6 +622,12 @@ static unsigned long xdl_hash_record_with_whitespace(char const **data, char con
                 }
             }
             continue;
+        } else {
+            /* Hash the run up to the next byte that may be whitespace */
+            for (end = find_space(ptr + 1, top); ptr + 1 < end; ptr++) {
+                ha += (ha << 5);
+                ha ^= (unsigned long)*ptr;
+            }
         }
         ha += (ha << 5);
         ha ^= (unsigned long)*ptr;
@@ -286,16 +640,16 @@ static unsigned long xdl_hash_record_with_whitespace(char const **data, char con
 unsigned long xdl_hash_record(char const **data, char const *top, long flags)
 {
     unsigned long ha = 5381;
-    char const *ptr = *data;
+    char const *ptr = *data, *eol;
 
     if (flags & XDF_WHITESPACE_FLAGS)
         return xdl_hash_record_with_whitespace(data, top, flags);
 
-    for (; ptr < top && *ptr != '\n'; ptr++) {
+    for (eol = xdl_kernels()->find_eol(ptr, top); ptr < eol; ptr++) {
         ha += (ha << 5);
         ha ^= (unsigned long)*ptr;
     }
-    *data = ptr < top ? ptr + 1 : ptr;
+    *data = eol < top ? eol + 1 : eol;
 
     return ha;
 }
@@ -404,6 +758,7 @@ int xdl_fall_back_diff(xdfenv_t *diff_env, xpparam_t const *xpp, int line1, int
      */
     mmfile_t subfile1, subfile2;
     xdfenv_t env;
+    xdlstats_t saved;
 
     subfile1.ptr = (char *)diff_env->xdf1.recs[line1 - 1]->ptr;
     subfile1.size = diff_env->xdf1.recs[line1 + count1 - 2]->ptr +
@@ -411,8 +766,23 @@ int xdl_fall_back_diff(xdfenv_t *diff_env, xpparam_t const *xpp, int line1, int
     subfile2.ptr = (char *)diff_env->xdf2.recs[line2 - 1]->ptr;
     subfile2.size = diff_env->xdf2.recs[line2 + count2 - 2]->ptr +
                     diff_env->xdf2.recs[line2 + count2 - 2]->size - subfile2.ptr;
+    /*
+     * The region was prepared and timed as part of the whole diff, so
+     * only the algorithm counters of the nested diff are kept.
+     */
+    if (xpp->stats)
+        saved = *xpp->stats;
     if (xdl_do_diff(&subfile1, &subfile2, xpp, &env) < 0)
         return -1;
+    if (xpp->stats) {
+        saved.splits = xpp->stats->splits;
+        saved.split_cost = xpp->stats->split_cost;
+        saved.heur_snakes = xpp->stats->heur_snakes;
+        saved.cost_cutoffs = xpp->stats->cost_cutoffs;
+        saved.pinned_runs = xpp->stats->pinned_runs;
+        saved.pinned = xpp->stats->pinned;
+        *xpp->stats = saved;
+    }
 
     memcpy(diff_env->xdf1.rchg + line1 - 1, env.xdf1.rchg, count1);
     memcpy(diff_env->xdf2.rchg + line2 - 1, env.xdf2.rchg, count2);
@@ -438,3 +808,59 @@ void *xdl_alloc_grow_helper(void *p, long nr, long *alloc, size_t size)
     }
     return tmp;
 }
+
+xdlalloc_t const *xdl_alloc_push(xdlalloc_t const *alloc)
+{
+    xdlalloc_t const *prev = xdl_cur_alloc;
+
+    xdl_cur_alloc = alloc;
+    return prev;
+}
+
+void xdl_alloc_pop(xdlalloc_t const *prev)
+{
+    xdl_cur_alloc = prev;
+}
+
+xdlalloc_t const *xdl_alloc_current(void)
+{
+    return xdl_cur_alloc;
+}
+
+void *xdl_alloc_malloc(size_t size)
+{
+    xdlalloc_t const *alloc = xdl_cur_alloc;
+
+    return alloc ? alloc->malloc(alloc->priv, size) : malloc(size);
+}
+
+void *xdl_alloc_calloc(size_t nmemb, size_t size)
+{
+    xdlalloc_t const *alloc = xdl_cur_alloc;
+    void *ptr;
+
+    if (!alloc)
+        return calloc(nmemb, size);
+    if (size && nmemb > SIZE_MAX / size)
+        return NULL;
+    if ((ptr = alloc->malloc(alloc->priv, nmemb * size)) != NULL)
+        memset(ptr, 0, nmemb * size);
+    return ptr;
+}
+
+void *xdl_alloc_realloc(void *ptr, size_t size)
+{
+    xdlalloc_t const *alloc = xdl_cur_alloc;
+
+    return alloc ? alloc->realloc(alloc->priv, ptr, size) : realloc(ptr, size);
+}
+
+void xdl_alloc_free(void *ptr)
+{
+    xdlalloc_t const *alloc = xdl_cur_alloc;
+
+    if (!alloc)
+        free(ptr);
+    else if (ptr)
+        alloc->free(alloc->priv, ptr);
+}
@@ -23,12 +23,17 @@
 #if !defined(XUTILS_H)
 #define XUTILS_H
 
+double xdl_clock(void);
+void xdl_stats_time(xdlstats_t *stats, int phase, double *t);
 long xdl_bogosqrt(long n);
 int xdl_emit_diffrec(char const *rec, long size, char const *pre, long psize, xdemitcb_t *ecb);
 int xdl_cha_init(chastore_t *cha, long isize, long icount);
 void xdl_cha_free(chastore_t *cha);
+void xdl_cha_reset(chastore_t *cha);
 void *xdl_cha_alloc(chastore_t *cha);
 long xdl_guess_lines(mmfile_t *mf, long sample);
+long xdl_common_prefix(char const *a, char const *b, long size);
+long xdl_common_suffix(char const *a, char const *b, long size);
 int xdl_blankline(const char *line, long size, long flags);
 int xdl_recmatch(const char *l1, long s1, const char *l2, long s2, long flags);
 unsigned long xdl_hash_record(char const **data, char const *top, long flags);
@@ -39,6 +44,41 @@ int xdl_emit_hunk_hdr(long s1, long c1, long s2, long c2, const char *func, long
 int xdl_fall_back_diff(xdfenv_t *diff_env, xpparam_t const *xpp, int line1, int count1, int line2,
                        int count2);
 
+/*
+ * Make 'alloc' the allocator of the calling thread, NULL meaning the C
+ * library, and return the previous one to pass to xdl_alloc_pop().
+ */
+xdlalloc_t const *xdl_alloc_push(xdlalloc_t const *alloc);
+void xdl_alloc_pop(xdlalloc_t const *prev);
+
+xdlalloc_t const *xdl_alloc_current(void);
+
+/*
+ * Allocator that counts what passes through it to 'inner' and refuses
+ * to go past 'limit' bytes in use. Push '&meter.alloc' for the call.
+ */
+typedef struct s_xdlmeter {
+    xdlalloc_t alloc;
+    xdlalloc_t const *inner; /* NULL for the C library */
+    long limit;              /* 0 for no limit */
+    long live;               /* Bytes in use */
+    int phase;               /* XDL_MEM_* the allocations are accounted to */
+    int exceeded;            /* An allocation failed for the limit */
+    xdlmemstats_t *stats;
+    xdlmemstats_t own;       /* Used when the caller wants no report */
+} xdlmeter_t;
+
+int xdl_meter_wanted(xpparam_t const *xpp);
+void xdl_meter_init(xdlmeter_t *meter, xpparam_t const *xpp);
+/* Both act on the meter of the calling thread and do nothing without one */
+void xdl_meter_phase(int phase);
+/*
+ * Whether an allocation failed for the limit since the last call, in
+ * which case the caller falls back to a cheaper result and the report
+ * says so.
+ */
+int xdl_meter_degrade(void);
+
 /* Do not call this function, use XDL_ALLOC_GROW instead */
 void *xdl_alloc_grow_helper(void *p, long nr, long *alloc, size_t size);
 